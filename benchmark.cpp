@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QSurfaceFormat>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QtMath>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <sys/resource.h>
+#endif
+
+#include "scene_loader.h"
+#include "scene_renderer.h"
+
+namespace {
+
+/**
+ * @brief How every scene is rendered.
+ */
+struct BenchmarkSettings {
+  QSize size;                  /**< Size of the framebuffer */
+  int warmup_frames = 0;       /**< Number of frames rendered before measuring */
+  int frames = 0;              /**< Number of measured frames */
+  float camera_zoom = 1.0f;    /**< Multiplier of the camera distance, below 1 to zoom into the scene */
+  bool frustum_culling = true; /**< Cull the instances outside the view frustum */
+  size_t point_budget = 0;     /**< Points of point clouds drawn per frame */
+};
+
+/**
+ * @brief Measurements of a single benchmarked scene.
+ */
+struct BenchmarkResult {
+  QString name;                    /**< Mesh file, or synthetic mesh description */
+  size_t vertices = 0;             /**< Number of vertices in the VBO */
+  size_t triangles = 0;            /**< Number of drawn triangles */
+  double load_ms = 0.0;            /**< Time spent loading the scene */
+  double first_frame_ms = 0.0;     /**< Time of the first frame, which uploads the buffers and textures */
+  std::vector<double> frame_times; /**< Time of every measured frame, in milliseconds */
+  std::vector<double> gpu_times;   /**< GPU time of every measured frame, in milliseconds */
+  FrameCounters counters;          /**< Work submitted by the last measured frame */
+  VertexCacheStats cache_before;   /**< Vertex cache statistics of the indices before optimization */
+  VertexCacheStats cache_after;    /**< Vertex cache statistics of the indices after optimization */
+  double peak_memory_mb = 0.0;     /**< Peak resident memory of the process once the scene was rendered */
+};
+
+/**
+ * Gets the peak resident memory of the process.
+ *
+ * @return Peak resident memory in megabytes, or zero if it is not available on this platform.
+ */
+double peakMemoryMegabytes() {
+#ifdef Q_OS_LINUX
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    return usage.ru_maxrss / 1024.0;
+  }
+#endif
+  return 0.0;
+}
+
+/**
+ * Gets a percentile of sorted frame times, using the nearest-rank method.
+ *
+ * @param sorted_times: frame times in ascending order.
+ * @param percentile: percentile, from 0 to 1.
+ *
+ * @return The frame time at the percentile, or zero if there are no frames.
+ */
+double percentile(const std::vector<double>& sorted_times, const double percentile) {
+  if (sorted_times.empty()) {
+    return 0.0;
+  }
+  size_t rank = static_cast<size_t>(qCeil(percentile * sorted_times.size()));
+  return sorted_times[qBound<size_t>(1, rank, sorted_times.size()) - 1];
+}
+
+/**
+ * Writes a UV sphere with about the requested number of triangles as an OBJ file, so synthetic meshes go through the
+ * same load path as real ones.
+ *
+ * @param filename: path to the OBJ file to be written.
+ * @param triangles: requested number of triangles.
+ *
+ * @return True if the file was written successfully.
+ */
+bool writeSphere(const QString& filename, const size_t triangles) {
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+    return false;
+  }
+  QTextStream stream(&file);
+
+  // A sphere with n stacks and 2n slices has 4n(n - 1) triangles, the first and last stacks being fans
+  const int stacks = qMax(2, qCeil((1.0 + qSqrt(1.0 + triangles)) / 2.0));
+  const int slices = 2 * stacks;
+
+  for (int i = 0; i <= stacks; i++) {
+    double theta = M_PI * i / stacks;
+    for (int j = 0; j <= slices; j++) {
+      double phi = 2.0 * M_PI * j / slices;
+      double x = qSin(theta) * qCos(phi);
+      double y = qCos(theta);
+      double z = qSin(theta) * qSin(phi);
+      stream << "v " << x << " " << y << " " << z << "\n";
+      stream << "vn " << x << " " << y << " " << z << "\n";
+    }
+  }
+
+  auto vertex = [slices](int i, int j) { return i * (slices + 1) + j + 1; };
+  for (int i = 0; i < stacks; i++) {
+    for (int j = 0; j < slices; j++) {
+      int a = vertex(i, j), b = vertex(i + 1, j), c = vertex(i + 1, j + 1), d = vertex(i, j + 1);
+      if (i != 0) {
+        stream << "f " << a << "//" << a << " " << c << "//" << c << " " << d << "//" << d << "\n";
+      }
+      if (i != stacks - 1) {
+        stream << "f " << a << "//" << a << " " << b << "//" << b << " " << c << "//" << c << "\n";
+      }
+    }
+  }
+
+  stream.flush();
+  return stream.status() == QTextStream::Ok;
+}
+
+/**
+ * Loads a scene and renders it on an orbit around the vertical axis, timing every frame. glFinish is called after each
+ * frame, so the frame times include the GPU work.
+ *
+ * @param filename: path to the mesh file to be loaded.
+ * @param name: name of the scene in the results.
+ * @param options: options used to build the geometry.
+ * @param settings: how the scene is rendered.
+ * @param result: receives the measurements.
+ *
+ * @return True if the scene was loaded successfully.
+ */
+bool benchmarkScene(const QString& filename, const QString& name, const SceneLoadOptions& options,
+                    const BenchmarkSettings& settings, BenchmarkResult* result) {
+  result->name = name;
+
+  QElapsedTimer timer;
+  timer.start();
+  std::shared_ptr<SceneData> scene = std::make_shared<SceneData>();
+  SceneLoader loader(options);
+  if (!loader.load(filename, scene.get())) {
+    return false;
+  }
+  result->load_ms = timer.nsecsElapsed() / 1e6;
+
+  result->vertices = (scene->vertex_data.size() + scene->mapped_buffers.vertex_size) / scene->vertex_layout.stride;
+  result->cache_before = scene->vertex_cache_before;
+  result->cache_after = scene->vertex_cache_after;
+  // The vertices of a point cloud are its points, it has no triangles
+  for (const MeshRange& range : scene->mesh_ranges) {
+    size_t count = (range.index_count > 0) ? range.index_count : (scene->indexed ? 0 : range.vertex_count);
+    result->triangles += scene->point_cloud ? 0 : count / 3 * range.instance_count;
+  }
+
+  QOpenGLFunctions* functions = QOpenGLContext::currentContext()->functions();
+  const QSize& size = settings.size;
+  QOpenGLFramebufferObject framebuffer(size, QOpenGLFramebufferObject::CombinedDepthStencil);
+  framebuffer.bind();
+  functions->glViewport(0, 0, size.width(), size.height());
+
+  SceneRenderer renderer;
+  renderer.initialize();
+  renderer.setFrustumCulling(settings.frustum_culling);
+  renderer.setPointBudget(settings.point_budget);
+  // Textures are loaded by the first frame, so every measured frame draws them
+  renderer.setAsyncTextures(false);
+  renderer.setScene(scene);
+
+  // Frames are published by the profiler a few frames after they are drawn, so they are selected by their index
+  quint64 first_measured_frame = 2 + settings.warmup_frames;
+  renderer.profiler().setEnabled(true);
+  renderer.profiler().setFrameCallback([result, first_measured_frame](const FrameStats& stats) {
+    if (stats.frame >= first_measured_frame) {
+      if (stats.gpu_ms >= 0) {
+        result->gpu_times.push_back(stats.gpu_ms);
+      }
+      result->counters = stats.counters;
+    }
+  });
+
+  auto renderFrame = [&](int frame, int frame_count) {
+    // The scene turns once around the vertical axis while tilting up and down, so every side is drawn
+    double t = frame / static_cast<double>(qMax(1, frame_count));
+    QMatrix4x4 rotation;
+    rotation.rotate(20.0 * qSin(2.0 * M_PI * t), 1.0, 0.0, 0.0);
+    rotation.rotate(360.0 * t, 0.0, 1.0, 0.0);
+
+    timer.restart();
+    renderer.render(size.width(), size.height(), rotation, settings.camera_zoom);
+    functions->glFinish();
+    return timer.nsecsElapsed() / 1e6;
+  };
+
+  result->first_frame_ms = renderFrame(0, settings.frames);
+  for (int i = 0; i < settings.warmup_frames; i++) {
+    renderFrame(i, settings.warmup_frames);
+  }
+  for (int i = 0; i < settings.frames; i++) {
+    result->frame_times.push_back(renderFrame(i, settings.frames));
+  }
+  renderer.profiler().finish();
+
+  result->peak_memory_mb = peakMemoryMegabytes();
+
+  renderer.destroy();
+  framebuffer.release();
+  return true;
+}
+
+/**
+ * Formats the measurements as CSV, one line per scene.
+ *
+ * @param results: measurements of each scene.
+ *
+ * @return The CSV document.
+ */
+QString toCsv(const std::vector<BenchmarkResult>& results) {
+  QString csv;
+  QTextStream stream(&csv);
+  stream << "name,vertices,triangles,load_ms,first_frame_ms,frames,min_ms,median_ms,p99_ms,mean_ms,gpu_median_ms,"
+            "gpu_p99_ms,draw_calls,state_changes,drawn_triangles,drawn_points,culled_instances,acmr_before,acmr_after,"
+            "atvr_before,atvr_after,peak_memory_mb\n";
+  for (const BenchmarkResult& result : results) {
+    std::vector<double> times = result.frame_times;
+    std::sort(times.begin(), times.end());
+    std::vector<double> gpu_times = result.gpu_times;
+    std::sort(gpu_times.begin(), gpu_times.end());
+    double mean = times.empty() ? 0.0 : std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+    stream << "\"" << QString(result.name).replace("\"", "\"\"") << "\"," << result.vertices << ","
+           << result.triangles << "," << result.load_ms << "," << result.first_frame_ms << "," << times.size() << ","
+           << percentile(times, 0.0) << "," << percentile(times, 0.5) << "," << percentile(times, 0.99) << "," << mean
+           << "," << percentile(gpu_times, 0.5) << "," << percentile(gpu_times, 0.99) << ","
+           << result.counters.draw_calls << "," << result.counters.state_changes << "," << result.counters.triangles
+           << "," << result.counters.points << "," << result.counters.culled_instances << ","
+           << result.cache_before.acmr() << "," << result.cache_after.acmr() << "," << result.cache_before.atvr() << ","
+           << result.cache_after.atvr() << "," << result.peak_memory_mb << "\n";
+  }
+  stream.flush();
+  return csv;
+}
+
+/**
+ * Formats the measurements as a JSON array, one object per scene.
+ *
+ * @param results: measurements of each scene.
+ *
+ * @return The JSON document.
+ */
+QString toJson(const std::vector<BenchmarkResult>& results) {
+  QJsonArray array;
+  for (const BenchmarkResult& result : results) {
+    std::vector<double> times = result.frame_times;
+    std::sort(times.begin(), times.end());
+    std::vector<double> gpu_times = result.gpu_times;
+    std::sort(gpu_times.begin(), gpu_times.end());
+
+    QJsonObject object;
+    object["name"] = result.name;
+    object["vertices"] = static_cast<double>(result.vertices);
+    object["triangles"] = static_cast<double>(result.triangles);
+    object["load_ms"] = result.load_ms;
+    object["first_frame_ms"] = result.first_frame_ms;
+    object["frames"] = static_cast<int>(times.size());
+    object["min_ms"] = percentile(times, 0.0);
+    object["median_ms"] = percentile(times, 0.5);
+    object["p99_ms"] = percentile(times, 0.99);
+    object["mean_ms"] = times.empty() ? 0.0 : std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+    object["gpu_median_ms"] = percentile(gpu_times, 0.5);
+    object["gpu_p99_ms"] = percentile(gpu_times, 0.99);
+    object["draw_calls"] = static_cast<double>(result.counters.draw_calls);
+    object["state_changes"] = static_cast<double>(result.counters.state_changes);
+    object["drawn_triangles"] = static_cast<double>(result.counters.triangles);
+    object["drawn_points"] = static_cast<double>(result.counters.points);
+    object["culled_instances"] = static_cast<double>(result.counters.culled_instances);
+    object["acmr_before"] = result.cache_before.acmr();
+    object["acmr_after"] = result.cache_after.acmr();
+    object["atvr_before"] = result.cache_before.atvr();
+    object["atvr_after"] = result.cache_after.atvr();
+    object["peak_memory_mb"] = result.peak_memory_mb;
+    array.append(object);
+  }
+  return QString::fromUtf8(QJsonDocument(array).toJson());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // Same context as the viewer: uniform blocks and GLSL 3.30 shaders require OpenGL 3.3
+  QSurfaceFormat format;
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CoreProfile);
+  format.setDepthBufferSize(24);
+  QSurfaceFormat::setDefaultFormat(format);
+
+  QGuiApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Renders meshes offscreen on a scripted orbit and reports load and frame times.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("files", "Mesh files to be benchmarked.", "[files...]");
+
+  QCommandLineOption synthetic_option("synthetic", "Benchmark a generated sphere with about <triangles> triangles.",
+                                      "triangles");
+  QCommandLineOption frames_option("frames", "Number of measured frames.", "frames", "300");
+  QCommandLineOption warmup_option("warmup", "Number of frames rendered before measuring.", "frames", "10");
+  QCommandLineOption size_option("size", "Size of the framebuffer.", "WxH", "1280x720");
+  QCommandLineOption format_option("format", "Output format: csv or json.", "format", "csv");
+  QCommandLineOption output_option("output", "Write the results to a file instead of the standard output.", "file");
+  QCommandLineOption de_indexed_option("de-indexed", "Draw de-indexed geometry.");
+  QCommandLineOption quantize_option("quantize", "Quantize positions to 16 bits.");
+  QCommandLineOption cache_option("use-cache", "Load meshes from the mesh cache, when available.");
+  QCommandLineOption zoom_option("zoom", "Multiplier of the camera distance, below 1 to zoom in.", "factor", "1");
+  QCommandLineOption no_culling_option("no-culling", "Draw every instance, without view frustum culling.");
+  QCommandLineOption no_lod_option("no-lod", "Draw the full meshes, without generating levels of detail.");
+  QCommandLineOption no_optimize_option("no-optimize", "Keep the triangle and vertex order of the mesh files.");
+  QCommandLineOption point_budget_option("point-budget", "Points of point clouds drawn per frame.", "points",
+                                         "5000000");
+  parser.addOptions({synthetic_option, frames_option, warmup_option, size_option, format_option, output_option,
+                     de_indexed_option, quantize_option, cache_option, zoom_option, no_culling_option, no_lod_option,
+                     no_optimize_option, point_budget_option});
+  parser.process(app);
+
+  BenchmarkSettings settings;
+  bool valid_frames = true, valid_warmup = true;
+  settings.frames = parser.value(frames_option).toInt(&valid_frames);
+  settings.warmup_frames = parser.value(warmup_option).toInt(&valid_warmup);
+  if (!valid_frames || !valid_warmup || settings.frames <= 0 || settings.warmup_frames < 0) {
+    qCritical() << "Invalid number of frames.";
+    return 1;
+  }
+
+  QStringList size_values = parser.value(size_option).toLower().split('x');
+  settings.size = size_values.size() == 2 ? QSize(size_values[0].toInt(), size_values[1].toInt()) : QSize();
+  if (settings.size.isEmpty()) {
+    qCritical() << "Invalid framebuffer size:" << parser.value(size_option);
+    return 1;
+  }
+
+  bool valid_zoom = true;
+  settings.camera_zoom = parser.value(zoom_option).toFloat(&valid_zoom);
+  if (!valid_zoom || settings.camera_zoom <= 0.0f) {
+    qCritical() << "Invalid camera zoom:" << parser.value(zoom_option);
+    return 1;
+  }
+  settings.frustum_culling = !parser.isSet(no_culling_option);
+
+  bool valid_point_budget = true;
+  settings.point_budget = parser.value(point_budget_option).toULongLong(&valid_point_budget);
+  if (!valid_point_budget || settings.point_budget == 0) {
+    qCritical() << "Invalid point budget:" << parser.value(point_budget_option);
+    return 1;
+  }
+
+  QString output_format = parser.value(format_option).toLower();
+  if (output_format != "csv" && output_format != "json") {
+    qCritical() << "Unknown output format:" << output_format;
+    return 1;
+  }
+
+  SceneLoadOptions options;
+  options.use_indexed_geometry = !parser.isSet(de_indexed_option);
+  options.quantize_positions = parser.isSet(quantize_option);
+  options.use_mesh_cache = parser.isSet(cache_option);
+  options.generate_lods = !parser.isSet(no_lod_option);
+  options.optimize_meshes = !parser.isSet(no_optimize_option);
+
+  // Inputs are pairs of mesh file and name in the results
+  std::vector<std::pair<QString, QString>> inputs;
+  for (const QString& filename : parser.positionalArguments()) {
+    inputs.emplace_back(filename, filename);
+  }
+
+  QTemporaryDir synthetic_dir;
+  for (const QString& value : parser.values(synthetic_option)) {
+    bool valid = true;
+    qulonglong triangles = value.toULongLong(&valid);
+    QString filename = synthetic_dir.filePath(QString("sphere_%1.obj").arg(value));
+    if (!valid || triangles == 0 || !synthetic_dir.isValid() || !writeSphere(filename, triangles)) {
+      qCritical() << "Could not generate a synthetic mesh with" << value << "triangles.";
+      return 1;
+    }
+    inputs.emplace_back(filename, QString("synthetic:%1").arg(value));
+  }
+
+  if (inputs.empty()) {
+    parser.showHelp(1);
+  }
+
+  QOffscreenSurface surface;
+  surface.setFormat(format);
+  surface.create();
+
+  QOpenGLContext context;
+  context.setFormat(format);
+  if (!context.create() || !context.makeCurrent(&surface)) {
+    qCritical() << "Could not create an OpenGL context.";
+    return 1;
+  }
+
+  std::vector<BenchmarkResult> results;
+  for (const std::pair<QString, QString>& input : inputs) {
+    BenchmarkResult result;
+    if (!benchmarkScene(input.first, input.second, options, settings, &result)) {
+      qCritical() << "Could not load" << input.first;
+      return 1;
+    }
+    results.push_back(result);
+  }
+
+  context.doneCurrent();
+
+  QString report = (output_format == "json") ? toJson(results) : toCsv(results);
+  QFile output(parser.value(output_option));
+  bool opened = parser.isSet(output_option) ? output.open(QIODevice::WriteOnly | QIODevice::Text)
+                                            : output.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+  if (!opened) {
+    qCritical() << "Could not write the results.";
+    return 1;
+  }
+  output.write(report.toUtf8());
+
+  return 0;
+}
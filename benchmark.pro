@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Copyright 2021 Eberty Alves
+#
+#-------------------------------------------------
+
+QT += core gui
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = qt_opengl_benchmark
+TEMPLATE = app
+
+LIBS += -lGL -lassimp
+
+SOURCES += benchmark.cpp block_compressor.cpp bvh.cpp frame_capture.cpp frame_profiler.cpp mesh_cache.cpp \
+           mesh_optimizer.cpp mesh_simplifier.cpp mesh_streamer.cpp normal_generator.cpp obj_reader.cpp \
+           point_octree.cpp scene_loader.cpp scene_renderer.cpp scene_resources.cpp texture_manager.cpp
+HEADERS += block_compressor.h bounding_box.h bvh.h frame_capture.h frame_profiler.h mesh_cache.h mesh_optimizer.h \
+           mesh_simplifier.h mesh_streamer.h normal_generator.h obj_reader.h parallel_for.h point_octree.h \
+           scene_loader.h scene_renderer.h scene_resources.h texture_manager.h vertex_format.h
+RESOURCES += resource.qrc
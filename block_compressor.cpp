@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "block_compressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace {
+
+/** Number of power iterations used to find the principal axis of the colors of a block */
+const int kPowerIterations = 8;
+
+/** Fraction of the endpoint range moved inwards, so the endpoints do not sit on outliers */
+const float kEndpointInset = 1.0f / 16.0f;
+
+/**
+ * Quantizes an RGB color to 5:6:5 bits.
+ *
+ * @param color: red, green and blue, from 0 to 255.
+ *
+ * @return The packed 16-bit color.
+ */
+uint16_t packColor(const float* color) {
+  auto channel = [](float value, int max) {
+    return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 255.0f) * max / 255.0f));
+  };
+  return static_cast<uint16_t>((channel(color[0], 31) << 11) | (channel(color[1], 63) << 5) | channel(color[2], 31));
+}
+
+/**
+ * Expands a 5:6:5 color back to 8 bits per channel, as the GPU does.
+ *
+ * @param packed: 16-bit color.
+ * @param color: receives red, green and blue, from 0 to 255.
+ */
+void unpackColor(const uint16_t packed, int* color) {
+  int r = (packed >> 11) & 31;
+  int g = (packed >> 5) & 63;
+  int b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * Encodes the colors of a 4x4 block as a BC1 block in four-color mode.
+ *
+ * @param pixels: 16 RGBA pixels of the block, in rows.
+ * @param block: receives 8 bytes.
+ */
+void encodeColorBlock(const unsigned char pixels[16][4], unsigned char* block) {
+  float mean[3] = {0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      mean[c] += pixels[i][c] / 16.0f;
+    }
+  }
+
+  float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    float d[3] = {pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2]};
+    covariance[0] += d[0] * d[0];
+    covariance[1] += d[0] * d[1];
+    covariance[2] += d[0] * d[2];
+    covariance[3] += d[1] * d[1];
+    covariance[4] += d[1] * d[2];
+    covariance[5] += d[2] * d[2];
+  }
+
+  // The iteration starts from the covariance column of the channel with the largest variance. A fixed start such as
+  // (1, 1, 1) may be mapped to zero, as for a block of red and green texels, and would never leave the grey axis.
+  const float columns[3][3] = {{covariance[0], covariance[1], covariance[2]},
+                               {covariance[1], covariance[3], covariance[4]},
+                               {covariance[2], covariance[4], covariance[5]}};
+  int largest = 0;
+  for (int c = 1; c < 3; c++) {
+    if (columns[c][c] > columns[largest][largest]) {
+      largest = c;
+    }
+  }
+  float seed[3] = {1.0f, 1.0f, 1.0f};
+  if (columns[largest][largest] > 0.0f) {
+    std::copy(columns[largest], columns[largest] + 3, seed);
+  }
+
+  float axis[3] = {seed[0], seed[1], seed[2]};
+  for (int k = 0; k < kPowerIterations; k++) {
+    float next[3] = {covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                     covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                     covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]};
+    float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+    if (length <= 0.0f) {
+      std::copy(seed, seed + 3, axis);
+      break;
+    }
+    for (int c = 0; c < 3; c++) {
+      axis[c] = next[c] / length;
+    }
+  }
+  float axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  for (int c = 0; c < 3; c++) {
+    axis[c] /= axis_length;
+  }
+
+  float t_min = 0.0f;
+  float t_max = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float t = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] +
+              (pixels[i][2] - mean[2]) * axis[2];
+    t_min = std::min(t_min, t);
+    t_max = std::max(t_max, t);
+  }
+  float inset = (t_max - t_min) * kEndpointInset;
+  t_min += inset;
+  t_max -= inset;
+
+  float endpoints[2][3];
+  for (int c = 0; c < 3; c++) {
+    endpoints[0][c] = mean[c] + axis[c] * t_max;
+    endpoints[1][c] = mean[c] + axis[c] * t_min;
+  }
+  uint16_t color0 = packColor(endpoints[0]);
+  uint16_t color1 = packColor(endpoints[1]);
+  // Four-color mode requires color0 > color1
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    int palette[4][3];
+    unpackColor(color0, palette[0]);
+    unpackColor(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      int best_distance = std::numeric_limits<int>::max();
+      for (int p = 0; p < 4; p++) {
+        int distance = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = pixels[i][c] - palette[p][c];
+          distance += d * d;
+        }
+        if (distance < best_distance) {
+          best_distance = distance;
+          best = p;
+        }
+      }
+      indices |= static_cast<uint32_t>(best) << (2 * i);
+    }
+  }
+
+  block[0] = color0 & 0xFF;
+  block[1] = color0 >> 8;
+  block[2] = color1 & 0xFF;
+  block[3] = color1 >> 8;
+  for (int k = 0; k < 4; k++) {
+    block[4 + k] = (indices >> (8 * k)) & 0xFF;
+  }
+}
+
+/**
+ * Encodes the alpha of a 4x4 block as a BC3 alpha block in eight-value mode.
+ *
+ * @param pixels: 16 RGBA pixels of the block, in rows.
+ * @param block: receives 8 bytes.
+ */
+void encodeAlphaBlock(const unsigned char pixels[16][4], unsigned char* block) {
+  int alpha0 = 0;
+  int alpha1 = 255;
+  for (int i = 0; i < 16; i++) {
+    alpha0 = std::max(alpha0, static_cast<int>(pixels[i][3]));
+    alpha1 = std::min(alpha1, static_cast<int>(pixels[i][3]));
+  }
+
+  uint64_t indices = 0;
+  if (alpha0 != alpha1) {
+    int palette[8] = {alpha0, alpha1};
+    for (int k = 1; k < 7; k++) {
+      palette[k + 1] = ((7 - k) * alpha0 + k * alpha1) / 7;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      for (int p = 1; p < 8; p++) {
+        if (std::abs(pixels[i][3] - palette[p]) < std::abs(pixels[i][3] - palette[best])) {
+          best = p;
+        }
+      }
+      indices |= static_cast<uint64_t>(best) << (3 * i);
+    }
+  }
+
+  block[0] = static_cast<unsigned char>(alpha0);
+  block[1] = static_cast<unsigned char>(alpha1);
+  for (int k = 0; k < 6; k++) {
+    block[2 + k] = (indices >> (8 * k)) & 0xFF;
+  }
+}
+
+}  // namespace
+
+size_t BlockCompressor::compressedSize(const BlockFormat format, const int width, const int height) {
+  size_t blocks = static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4);
+  return blocks * ((format == BlockFormat::kBc1) ? 8 : 16);
+}
+
+void BlockCompressor::compress(const BlockFormat format, const unsigned char* rgba, const int width,
+                               const int height, unsigned char* blocks) {
+  const int blocks_x = (width + 3) / 4;
+  const int blocks_y = (height + 3) / 4;
+  const size_t block_size = (format == BlockFormat::kBc1) ? 8 : 16;
+
+  unsigned char pixels[16][4];
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      // Partial blocks repeat the last row and column of the image
+      for (int i = 0; i < 16; i++) {
+        int x = std::min(bx * 4 + i % 4, width - 1);
+        int y = std::min(by * 4 + i / 4, height - 1);
+        std::copy_n(&rgba[(static_cast<size_t>(y) * width + x) * 4], 4, pixels[i]);
+      }
+
+      unsigned char* block = &blocks[(static_cast<size_t>(by) * blocks_x + bx) * block_size];
+      if (format == BlockFormat::kBc3) {
+        encodeAlphaBlock(pixels, block);
+        block += 8;
+      }
+      encodeColorBlock(pixels, block);
+    }
+  }
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef BLOCK_COMPRESSOR_H_
+#define BLOCK_COMPRESSOR_H_
+
+#include <cstddef>
+
+/**
+ * @brief Block compression formats of S3TC (GL_EXT_texture_compression_s3tc).
+ */
+enum class BlockFormat {
+  kBc1, /**< DXT1: 8 bytes per 4x4 block, opaque RGB */
+  kBc3  /**< DXT5: 16 bytes per 4x4 block, RGB with interpolated alpha */
+};
+
+/**
+ * @brief CPU encoder of RGBA8 images into S3TC blocks. Endpoints are fitted along the principal axis of the colors of
+ * each block, which is fast and close to the quality of exhaustive encoders on natural textures. Images are encoded on
+ * the calling thread, so several of them may be encoded in parallel.
+ */
+class BlockCompressor {
+ public:
+  /**
+   * Gets the size of a compressed image. Partial blocks at the right and bottom borders are padded.
+   *
+   * @param format: block format.
+   * @param width: width of the image, in pixels.
+   * @param height: height of the image, in pixels.
+   *
+   * @return Size of the compressed image, in bytes.
+   */
+  static size_t compressedSize(const BlockFormat format, const int width, const int height);
+
+  /**
+   * Compresses an RGBA8 image.
+   *
+   * @param format: block format.
+   * @param rgba: pixels of the image, 4 bytes each, rows packed without padding.
+   * @param width: width of the image, in pixels.
+   * @param height: height of the image, in pixels.
+   * @param blocks: receives compressedSize(format, width, height) bytes of blocks, in rows of blocks.
+   */
+  static void compress(const BlockFormat format, const unsigned char *rgba, const int width, const int height,
+                       unsigned char *blocks);
+};
+
+#endif  // BLOCK_COMPRESSOR_H_
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef BOUNDING_BOX_H_
+#define BOUNDING_BOX_H_
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BOUNDING_BOX_SSE 1
+#endif
+
+/**
+ * Extends a bounding box with packed positions (x, y, z, x, y, z, ...). Four positions are processed per step with SSE:
+ * they span three registers whose lanes hold (x y z x), (y z x y) and (z x y z), so the lanes of each register are
+ * reduced into the three axes only at the end.
+ *
+ * @param positions: packed positions.
+ * @param count: number of positions.
+ * @param min: minimum point (x, y, z) to be extended.
+ * @param max: maximum point (x, y, z) to be extended.
+ */
+inline void extendBoundingBox(const float *positions, const size_t count, float *min, float *max) {
+  size_t i = 0;
+
+#ifdef BOUNDING_BOX_SSE
+  if (count >= 4) {
+    __m128 min_a = _mm_setr_ps(min[0], min[1], min[2], min[0]);
+    __m128 min_b = _mm_setr_ps(min[1], min[2], min[0], min[1]);
+    __m128 min_c = _mm_setr_ps(min[2], min[0], min[1], min[2]);
+    __m128 max_a = _mm_setr_ps(max[0], max[1], max[2], max[0]);
+    __m128 max_b = _mm_setr_ps(max[1], max[2], max[0], max[1]);
+    __m128 max_c = _mm_setr_ps(max[2], max[0], max[1], max[2]);
+
+    for (; i + 4 <= count; i += 4) {
+      const float *p = positions + i * 3;
+      __m128 a = _mm_loadu_ps(p);
+      __m128 b = _mm_loadu_ps(p + 4);
+      __m128 c = _mm_loadu_ps(p + 8);
+      min_a = _mm_min_ps(min_a, a);
+      min_b = _mm_min_ps(min_b, b);
+      min_c = _mm_min_ps(min_c, c);
+      max_a = _mm_max_ps(max_a, a);
+      max_b = _mm_max_ps(max_b, b);
+      max_c = _mm_max_ps(max_c, c);
+    }
+
+    alignas(16) float lanes[6][4];
+    _mm_store_ps(lanes[0], min_a);
+    _mm_store_ps(lanes[1], min_b);
+    _mm_store_ps(lanes[2], min_c);
+    _mm_store_ps(lanes[3], max_a);
+    _mm_store_ps(lanes[4], max_b);
+    _mm_store_ps(lanes[5], max_c);
+
+    // Lanes of each axis: x = a0 a3 b2 c1, y = a1 b0 b3 c2, z = a2 b1 c0 c3
+    const int lane_axis[3][4][2] = {{{0, 0}, {0, 3}, {1, 2}, {2, 1}},
+                                    {{0, 1}, {1, 0}, {1, 3}, {2, 2}},
+                                    {{0, 2}, {1, 1}, {2, 0}, {2, 3}}};
+    for (int axis = 0; axis < 3; axis++) {
+      for (int k = 0; k < 4; k++) {
+        min[axis] = std::min(min[axis], lanes[lane_axis[axis][k][0]][lane_axis[axis][k][1]]);
+        max[axis] = std::max(max[axis], lanes[3 + lane_axis[axis][k][0]][lane_axis[axis][k][1]]);
+      }
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      min[axis] = std::min(min[axis], positions[i * 3 + axis]);
+      max[axis] = std::max(max[axis], positions[i * 3 + axis]);
+    }
+  }
+}
+
+#endif  // BOUNDING_BOX_H_
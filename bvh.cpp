@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+/** Number of bins of the centroids along an axis when looking for the best SAH split */
+const int kBinCount = 12;
+
+/** Cost of traversing an inner node, relative to the cost of testing a primitive */
+const float kTraversalCost = 1.0f;
+
+/** Mask with a bit set for each of the six frustum planes */
+const uint32_t kAllPlanes = 0x3F;
+
+/**
+ * Resets a bounding box so it can be extended.
+ *
+ * @param box: bounding box to be reset.
+ */
+inline void resetBox(BoundingBox* box) {
+  std::fill(box->begin(), box->begin() + 3, std::numeric_limits<float>::max());
+  std::fill(box->begin() + 3, box->end(), std::numeric_limits<float>::lowest());
+}
+
+/**
+ * Extends a bounding box with another bounding box.
+ *
+ * @param other: bounding box to be added.
+ * @param box: bounding box to be extended.
+ */
+inline void extendBox(const BoundingBox& other, BoundingBox* box) {
+  for (int k = 0; k < 3; k++) {
+    (*box)[k] = std::min((*box)[k], other[k]);
+    (*box)[3 + k] = std::max((*box)[3 + k], other[3 + k]);
+  }
+}
+
+/**
+ * Gets the surface area of a bounding box.
+ *
+ * @param box: bounding box.
+ *
+ * @return The surface area, zero for an empty box.
+ */
+inline float surfaceArea(const BoundingBox& box) {
+  float dx = box[3] - box[0];
+  float dy = box[4] - box[1];
+  float dz = box[5] - box[2];
+  return (dx < 0.0f) ? 0.0f : 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+/**
+ * Gets the centroid of a bounding box along an axis.
+ *
+ * @param box: bounding box.
+ * @param axis: 0, 1 or 2 for x, y or z.
+ *
+ * @return The centroid coordinate.
+ */
+inline float centroid(const BoundingBox& box, const int axis) { return (box[axis] + box[3 + axis]) * 0.5f; }
+
+/**
+ * Tests a bounding box against the planes of a frustum.
+ *
+ * @param box: bounding box.
+ * @param planes: planes of the frustum.
+ * @param mask: planes to be tested, the planes the box is fully inside of are removed from it.
+ *
+ * @return False if the box is fully outside of a plane.
+ */
+inline bool intersectsFrustum(const BoundingBox& box, const FrustumPlanes& planes, uint32_t* mask) {
+  for (int p = 0; p < 6; p++) {
+    if (!(*mask & (1u << p))) {
+      continue;
+    }
+
+    // Corners of the box farthest and nearest along the plane normal
+    const std::array<float, 4>& plane = planes[p];
+    float farthest = plane[3];
+    float nearest = plane[3];
+    for (int k = 0; k < 3; k++) {
+      farthest += plane[k] * ((plane[k] >= 0.0f) ? box[3 + k] : box[k]);
+      nearest += plane[k] * ((plane[k] >= 0.0f) ? box[k] : box[3 + k]);
+    }
+
+    if (farthest < 0.0f) {
+      return false;
+    } else if (nearest >= 0.0f) {
+      *mask &= ~(1u << p);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+FrustumPlanes frustumPlanes(const QMatrix4x4& MVP) {
+  // Gribb-Hartmann: each plane is the last row of the matrix plus or minus one of the other rows
+  FrustumPlanes planes;
+  for (int axis = 0; axis < 3; axis++) {
+    for (int k = 0; k < 4; k++) {
+      planes[axis * 2][k] = MVP(3, k) + MVP(axis, k);
+      planes[axis * 2 + 1][k] = MVP(3, k) - MVP(axis, k);
+    }
+  }
+  return planes;
+}
+
+void Bvh::build(const std::vector<BoundingBox>& boxes) {
+  clear();
+  if (boxes.empty()) {
+    return;
+  }
+
+  primitives_.resize(boxes.size());
+  std::iota(primitives_.begin(), primitives_.end(), 0);
+
+  // A binary tree with n leaves has 2n - 1 nodes, so the nodes are never reallocated while being split
+  nodes_.reserve(2 * boxes.size() - 1);
+  BvhNode root;
+  root.count = static_cast<uint32_t>(boxes.size());
+  nodes_.push_back(root);
+
+  std::vector<uint32_t> stack(1, 0);
+  while (!stack.empty()) {
+    BvhNode& node = nodes_[stack.back()];
+    stack.pop_back();
+
+    BoundingBox centroids;
+    resetBox(&node.bounds);
+    resetBox(&centroids);
+    for (uint32_t p = node.first; p < node.first + node.count; p++) {
+      const BoundingBox& box = boxes[primitives_[p]];
+      extendBox(box, &node.bounds);
+      for (int k = 0; k < 3; k++) {
+        centroids[k] = std::min(centroids[k], centroid(box, k));
+        centroids[3 + k] = std::max(centroids[3 + k], centroid(box, k));
+      }
+    }
+
+    if (node.count <= kMaxLeafSize) {
+      continue;
+    }
+
+    // Binned SAH: the best split plane between bins over the three axes
+    float best_cost = std::numeric_limits<float>::max();
+    int best_axis = -1;
+    int best_split = 0;
+    const float parent_area = std::max(surfaceArea(node.bounds), std::numeric_limits<float>::min());
+
+    for (int axis = 0; axis < 3; axis++) {
+      float extent = centroids[3 + axis] - centroids[axis];
+      if (extent <= 0.0f) {
+        continue;
+      }
+
+      BoundingBox bin_boxes[kBinCount];
+      uint32_t bin_counts[kBinCount] = {};
+      for (BoundingBox& box : bin_boxes) {
+        resetBox(&box);
+      }
+      for (uint32_t p = node.first; p < node.first + node.count; p++) {
+        const BoundingBox& box = boxes[primitives_[p]];
+        float offset = (centroid(box, axis) - centroids[axis]) / extent;
+        int bin = std::min(kBinCount - 1, static_cast<int>(offset * kBinCount));
+        extendBox(box, &bin_boxes[bin]);
+        bin_counts[bin]++;
+      }
+
+      // Right to left sweep gives the area and count right of each split, the left to right sweep evaluates them
+      float right_areas[kBinCount];
+      uint32_t right_counts[kBinCount];
+      BoundingBox right_box;
+      resetBox(&right_box);
+      uint32_t right_count = 0;
+      for (int bin = kBinCount - 1; bin > 0; bin--) {
+        extendBox(bin_boxes[bin], &right_box);
+        right_count += bin_counts[bin];
+        right_areas[bin] = surfaceArea(right_box);
+        right_counts[bin] = right_count;
+      }
+
+      BoundingBox left_box;
+      resetBox(&left_box);
+      uint32_t left_count = 0;
+      for (int split = 1; split < kBinCount; split++) {
+        extendBox(bin_boxes[split - 1], &left_box);
+        left_count += bin_counts[split - 1];
+        if (left_count == 0 || right_counts[split] == 0) {
+          continue;
+        }
+        float cost = kTraversalCost +
+                     (surfaceArea(left_box) * left_count + right_areas[split] * right_counts[split]) / parent_area;
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = split;
+        }
+      }
+    }
+
+    uint32_t* begin = &primitives_[node.first];
+    uint32_t* end = begin + node.count;
+    uint32_t* middle = NULL;
+
+    if (best_axis >= 0) {
+      const float extent = centroids[3 + best_axis] - centroids[best_axis];
+      middle = std::partition(begin, end, [&](uint32_t primitive) {
+        float offset = (centroid(boxes[primitive], best_axis) - centroids[best_axis]) / extent;
+        return std::min(kBinCount - 1, static_cast<int>(offset * kBinCount)) < best_split;
+      });
+    } else {
+      // All centroids are at the same point, the primitives are split by index so leaves stay small
+      middle = begin + node.count / 2;
+    }
+
+    BvhNode left;
+    left.first = node.first;
+    left.count = static_cast<uint32_t>(middle - begin);
+    BvhNode right;
+    right.first = left.first + left.count;
+    right.count = node.count - left.count;
+
+    node.first = static_cast<uint32_t>(nodes_.size());
+    node.count = 0;
+    stack.push_back(node.first);
+    stack.push_back(node.first + 1);
+    nodes_.push_back(left);
+    nodes_.push_back(right);
+  }
+
+  primitive_bounds_.resize(primitives_.size());
+  for (size_t p = 0; p < primitives_.size(); p++) {
+    primitive_bounds_[p] = boxes[primitives_[p]];
+  }
+}
+
+void Bvh::clear() {
+  nodes_.clear();
+  primitives_.clear();
+  primitive_bounds_.clear();
+}
+
+bool Bvh::empty() const { return nodes_.empty(); }
+
+const std::vector<BvhNode>& Bvh::nodes() const { return nodes_; }
+
+void Bvh::cullFrustum(const FrustumPlanes& planes, std::vector<uint32_t>* visible) const {
+  visible->clear();
+  if (nodes_.empty()) {
+    return;
+  }
+
+  // Each entry holds a node and the planes its parent was not fully inside of
+  std::vector<std::pair<uint32_t, uint32_t>> stack(1, std::make_pair(0u, kAllPlanes));
+  while (!stack.empty()) {
+    const BvhNode& node = nodes_[stack.back().first];
+    uint32_t mask = stack.back().second;
+    stack.pop_back();
+
+    if (!intersectsFrustum(node.bounds, planes, &mask)) {
+      continue;
+    }
+
+    if (node.count > 0) {
+      // The primitives of a leaf are only tested against the planes that cross the leaf
+      for (uint32_t p = node.first; p < node.first + node.count; p++) {
+        uint32_t primitive_mask = mask;
+        if (intersectsFrustum(primitive_bounds_[p], planes, &primitive_mask)) {
+          visible->push_back(primitives_[p]);
+        }
+      }
+    } else {
+      stack.push_back(std::make_pair(node.first, mask));
+      stack.push_back(std::make_pair(node.first + 1, mask));
+    }
+  }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <QMatrix4x4>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Axis-aligned bounding box: minimum point (x, y, z) followed by maximum point (x, y, z).
+ */
+using BoundingBox = std::array<float, 6>;
+
+/**
+ * @brief Planes of a view frustum (left, right, bottom, top, near and far) as (a, b, c, d), with the inside of each
+ * plane where a * x + b * y + c * z + d >= 0.
+ */
+using FrustumPlanes = std::array<std::array<float, 4>, 6>;
+
+/**
+ * Extracts the planes of the view frustum of a model/view/projection matrix, in model coordinates.
+ *
+ * @param MVP: model/view/projection matrix.
+ *
+ * @return Planes of the frustum.
+ */
+FrustumPlanes frustumPlanes(const QMatrix4x4 &MVP);
+
+/**
+ * @brief Node of a Bvh. Inner nodes have two children stored next to each other.
+ */
+struct BvhNode {
+  BoundingBox bounds; /**< Bounding box of the primitives of the node */
+  uint32_t first = 0; /**< First primitive of a leaf, or index of the left child of an inner node */
+  uint32_t count = 0; /**< Number of primitives of a leaf, zero for inner nodes */
+};
+
+/**
+ * @brief Bounding volume hierarchy over a set of bounding boxes, built with the surface area heuristic (SAH) over
+ * binned centroids. It is used to find the primitives (such as mesh instances) inside a view frustum without testing
+ * each one.
+ */
+class Bvh {
+ public:
+  /**
+   * Maximum number of primitives in a leaf.
+   */
+  static const uint32_t kMaxLeafSize = 4;
+
+  /**
+   * Builds the hierarchy, replacing the previous one.
+   *
+   * @param boxes: bounding box of each primitive, indexed by primitive.
+   */
+  void build(const std::vector<BoundingBox> &boxes);
+
+  /**
+   * Removes every node.
+   */
+  void clear();
+
+  /**
+   * Checks whether the hierarchy has no primitives.
+   *
+   * @return True if no primitive was added.
+   */
+  bool empty() const;
+
+  /**
+   * Gets the nodes of the hierarchy. The first node is the root.
+   *
+   * @return Nodes in build order.
+   */
+  const std::vector<BvhNode> &nodes() const;
+
+  /**
+   * Finds the primitives whose bounding boxes intersect a view frustum. Boxes that are near a corner of the frustum may
+   * be reported although they are outside of it. Subtrees fully inside a plane are not tested against it again.
+   *
+   * @param planes: planes of the frustum.
+   * @param visible: receives the indices of the visible primitives, in no particular order.
+   */
+  void cullFrustum(const FrustumPlanes &planes, std::vector<uint32_t> *visible) const;
+
+ private:
+  std::vector<BvhNode> nodes_;                /**< Nodes of the hierarchy, the root first */
+  std::vector<uint32_t> primitives_;          /**< Primitive indices, each leaf owns a contiguous range */
+  std::vector<BoundingBox> primitive_bounds_; /**< Bounding box of each entry of primitives_ */
+};
+
+#endif  // BVH_H_
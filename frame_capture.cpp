@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "frame_capture.h"
+
+#include <QDir>
+#include <QOpenGLContext>
+#include <QRunnable>
+#include <QThread>
+#include <cstring>
+
+namespace {
+
+/** Quality of the recorded PNG frames, which selects the fastest zlib level that still compresses */
+const int kRecordingQuality = 80;
+
+/** Time a frame in flight is waited for at once, in nanoseconds, before the wait is repeated */
+const GLuint64 kWaitTimeoutNs = 100000000;
+
+/**
+ * @brief A QRunnable that runs a function, so images are written on a QThreadPool.
+ */
+class Task : public QRunnable {
+ public:
+  /**
+   * Class constructor.
+   *
+   * @param function: function to be run.
+   */
+  explicit Task(const std::function<void()>& function) : function_(function) {}
+
+  /**
+   * Runs the function on a thread of the pool.
+   */
+  void run() override { function_(); }
+
+ private:
+  std::function<void()> function_; /**< Function to be run */
+};
+
+}  // namespace
+
+FrameCapture::FrameCapture() {
+  // PNG encoding is the slowest step of a recording, so half of the cores may encode frames while the others draw
+  writers_.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+  max_pending_writes_ = static_cast<size_t>(writers_.maxThreadCount()) * 2;
+}
+
+FrameCapture::~FrameCapture() { writers_.waitForDone(); }
+
+void FrameCapture::initialize() {
+  initializeOpenGLFunctions();
+
+  // Fence sync objects are core since OpenGL 3.2 (ARB_sync) and OpenGL ES 3.0
+  QOpenGLContext* context = QOpenGLContext::currentContext();
+  fences_ = context && (context->format().version() >= (context->isOpenGLES() ? qMakePair(3, 0) : qMakePair(3, 2)) ||
+                        context->hasExtension("GL_ARB_sync"));
+}
+
+void FrameCapture::destroy() {
+  finish();
+  for (PendingCapture& capture : captures_) {
+    if (capture.buffer) {
+      glDeleteBuffers(1, &capture.buffer);
+    }
+    capture = PendingCapture();
+  }
+  next_slot_ = 0;
+  fences_ = false;
+}
+
+void FrameCapture::setSavedCallback(const SavedCallback& callback) { callback_ = callback; }
+
+void FrameCapture::requestScreenshot(const QString& filename) { screenshot_ = filename; }
+
+bool FrameCapture::startRecording(const QString& directory) {
+  stopRecording();
+  if (!QDir().mkpath(directory)) {
+    return false;
+  }
+
+  recording_dir_ = directory;
+  recording_ = true;
+  recorded_frames_ = 0;
+  dropped_frames_ = 0;
+  return true;
+}
+
+void FrameCapture::stopRecording() { recording_ = false; }
+
+bool FrameCapture::isRecording() const { return recording_; }
+
+const QString& FrameCapture::recordingDirectory() const { return recording_dir_; }
+
+bool FrameCapture::isBusy() const { return !screenshot_.isEmpty() || recording_ || !in_flight_.empty(); }
+
+size_t FrameCapture::recordedFrames() const { return recorded_frames_; }
+
+size_t FrameCapture::droppedFrames() const { return dropped_frames_; }
+
+void FrameCapture::captureFrame(const GLuint framebuffer, const int width, const int height) {
+  // Frames whose pixels were copied are written, oldest first, without waiting for the ones still being drawn
+  while (!in_flight_.empty() && isReady(captures_[in_flight_.front()])) {
+    collect(&captures_[in_flight_.front()]);
+    in_flight_.pop_front();
+  }
+
+  if ((screenshot_.isEmpty() && !recording_) || width <= 0 || height <= 0) {
+    return;
+  }
+
+  // The ring is only full when the GPU is kRingSize frames behind, and then the oldest frame is waited for
+  if (in_flight_.size() == kRingSize) {
+    collect(&captures_[in_flight_.front()]);
+    in_flight_.pop_front();
+  }
+
+  const size_t slot = next_slot_;
+  next_slot_ = (next_slot_ + 1) % kRingSize;
+  PendingCapture& capture = captures_[slot];
+
+  if (!capture.buffer) {
+    glGenBuffers(1, &capture.buffer);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.buffer);
+
+  const GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * 4;
+  if (capture.size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    capture.size = size;
+  }
+
+  // With a pack buffer bound, glReadPixels only queues the copy into it and returns at once
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  if (fences_) {
+    capture.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  capture.width = width;
+  capture.height = height;
+  capture.screenshot = screenshot_;
+  capture.recording_dir = recording_ ? recording_dir_ : QString();
+  screenshot_.clear();
+
+  in_flight_.push_back(slot);
+}
+
+void FrameCapture::finish() {
+  while (!in_flight_.empty()) {
+    collect(&captures_[in_flight_.front()]);
+    in_flight_.pop_front();
+  }
+}
+
+bool FrameCapture::isReady(const PendingCapture& capture) {
+  // Without fences, mapping the buffer waits for the copy, as a synchronous glReadPixels would
+  if (!capture.fence) {
+    return true;
+  }
+
+  GLenum result = glClientWaitSync(capture.fence, 0, 0);
+  return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+void FrameCapture::collect(PendingCapture* capture) {
+  bool copied = true;
+  if (capture->fence) {
+    GLenum result = GL_TIMEOUT_EXPIRED;
+    while (result == GL_TIMEOUT_EXPIRED) {
+      result = glClientWaitSync(capture->fence, GL_SYNC_FLUSH_COMMANDS_BIT, kWaitTimeoutNs);
+    }
+    copied = (result != GL_WAIT_FAILED);
+    glDeleteSync(capture->fence);
+    capture->fence = NULL;
+  }
+
+  // Frames of a recording that was restarted since they were captured are discarded
+  const bool recorded = !capture->recording_dir.isEmpty() && capture->recording_dir == recording_dir_;
+  const bool dropped = recorded && pending_writes_ >= max_pending_writes_;
+  if (dropped) {
+    dropped_frames_++;
+  }
+
+  if (!capture->screenshot.isEmpty() || (recorded && !dropped)) {
+    QImage image;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->buffer);
+    const void* pixels = NULL;
+    if (copied) {
+      pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, capture->size, GL_MAP_READ_BIT);
+    }
+    if (pixels) {
+      // Rows of four bytes per pixel are already aligned as QImage requires, so the pixels are copied in one go
+      image = QImage(capture->width, capture->height, QImage::Format_RGBX8888);
+      std::memcpy(image.bits(), pixels, static_cast<size_t>(capture->size));
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!capture->screenshot.isEmpty()) {
+      write(image, capture->screenshot, false);
+    }
+    if (recorded && !dropped) {
+      QString filename = QString("frame_%1.png").arg(recorded_frames_++, 6, 10, QChar('0'));
+      write(image, QDir(capture->recording_dir).filePath(filename), true);
+    }
+  }
+
+  capture->screenshot.clear();
+  capture->recording_dir.clear();
+}
+
+void FrameCapture::write(const QImage& image, const QString& filename, const bool recorded) {
+  pending_writes_++;
+  writers_.start(new Task([this, image, filename, recorded]() {
+    // OpenGL rows start at the bottom of the framebuffer, so the image is flipped before it is encoded
+    const int quality = recorded ? kRecordingQuality : -1;
+    bool success =
+        !image.isNull() && image.mirrored().convertToFormat(QImage::Format_RGB888).save(filename, NULL, quality);
+    if (callback_) {
+      callback_(filename, recorded, success);
+    }
+    pending_writes_--;
+  }));
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef FRAME_CAPTURE_H_
+#define FRAME_CAPTURE_H_
+
+#include <QImage>
+#include <QOpenGLExtraFunctions>
+#include <QString>
+#include <QThreadPool>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+
+/**
+ * @brief Saves screenshots and frame sequences of an OpenGL framebuffer without stalling the frames. Each captured
+ * frame is read into a pixel buffer object of a ring of kRingSize buffers, followed by a fence, so glReadPixels only
+ * queues a copy on the GPU. A frame is mapped once its fence has signaled, usually while the frame two later is drawn,
+ * and its pixels are flipped, encoded and written to disk on a thread pool. Recorded frames are dropped (and counted)
+ * when the writers fall behind, so recording never slows the frames down; screenshots are never dropped. All methods
+ * that touch OpenGL require the context of the capture to be current.
+ */
+class FrameCapture : protected QOpenGLExtraFunctions {
+ public:
+  /**
+   * Number of pixel buffer objects, and of captured frames that may be in flight.
+   */
+  static const size_t kRingSize = 3;
+
+  /**
+   * Callback that receives the result of each written image.
+   */
+  using SavedCallback = std::function<void(const QString &filename, bool recorded, bool success)>;
+
+  /**
+   * Class constructor.
+   */
+  FrameCapture();
+
+  /**
+   * Destructor of the class. Waits for the images being written.
+   */
+  ~FrameCapture();
+
+  /**
+   * Initializes the OpenGL functions of the current context and checks whether it supports fences.
+   */
+  void initialize();
+
+  /**
+   * Writes the frames in flight and deletes the pixel buffer objects and fences.
+   */
+  void destroy();
+
+  /**
+   * Sets the callback that receives the result of each written image.
+   *
+   * @param callback: callback called from the threads that write the images.
+   */
+  void setSavedCallback(const SavedCallback &callback);
+
+  /**
+   * Saves the next captured frame to an image file.
+   *
+   * @param filename: path to the image file, whose format is deduced from its suffix.
+   */
+  void requestScreenshot(const QString &filename);
+
+  /**
+   * Starts saving every captured frame to a PNG file of a directory, named frame_000000.png, frame_000001.png, etc.
+   * A recording already in progress is stopped.
+   *
+   * @param directory: directory of the frames, created if needed.
+   *
+   * @return True if the directory exists or was created.
+   */
+  bool startRecording(const QString &directory);
+
+  /**
+   * Stops saving the captured frames. The frames in flight are still written.
+   */
+  void stopRecording();
+
+  /**
+   * Gets whether the captured frames are recorded.
+   *
+   * @return True while recording.
+   */
+  bool isRecording() const;
+
+  /**
+   * Gets the directory of the last recording.
+   *
+   * @return Directory of the recorded frames, empty if nothing was recorded.
+   */
+  const QString &recordingDirectory() const;
+
+  /**
+   * Gets whether captured frames are requested or still in flight, so frames must keep being drawn.
+   *
+   * @return True if captureFrame has work to do.
+   */
+  bool isBusy() const;
+
+  /**
+   * Gets the number of frames of the last recording handed to the writers.
+   *
+   * @return Number of recorded frames.
+   */
+  size_t recordedFrames() const;
+
+  /**
+   * Gets the number of frames of the last recording dropped because the writers fell behind.
+   *
+   * @return Number of dropped frames.
+   */
+  size_t droppedFrames() const;
+
+  /**
+   * Reads back the framebuffer if a screenshot was requested or a recording is in progress, and hands the previous
+   * frames whose pixels are available to the writers. Called once per frame, after it was drawn.
+   *
+   * @param framebuffer: framebuffer object to be read.
+   * @param width: width of the framebuffer, in pixels.
+   * @param height: height of the framebuffer, in pixels.
+   */
+  void captureFrame(const GLuint framebuffer, const int width, const int height);
+
+  /**
+   * Waits for all frames in flight and hands them to the writers. Stalls the CPU, so it is meant for shutdown.
+   */
+  void finish();
+
+ private:
+  /**
+   * @brief Frame read into a pixel buffer object of the ring.
+   */
+  struct PendingCapture {
+    GLuint buffer = 0;     /**< Pixel buffer object, reused by later frames */
+    GLsizeiptr size = 0;   /**< Size of the buffer storage, in bytes */
+    GLsync fence = NULL;   /**< Signaled when the pixels were copied into the buffer */
+    int width = 0;         /**< Width of the frame, in pixels */
+    int height = 0;        /**< Height of the frame, in pixels */
+    QString screenshot;    /**< Path of the screenshot saved from the frame, if any */
+    QString recording_dir; /**< Directory of the recording the frame belongs to, if any */
+  };
+
+  /**
+   * Checks whether the pixels of a frame are available, without waiting.
+   *
+   * @param capture: frame in flight.
+   *
+   * @return True if the fence of the frame has signaled.
+   */
+  bool isReady(const PendingCapture &capture);
+
+  /**
+   * Maps the buffer of a frame, copies its pixels and starts writing them.
+   *
+   * @param capture: frame in flight, whose fence is deleted.
+   */
+  void collect(PendingCapture *capture);
+
+  /**
+   * Writes an image on the thread pool.
+   *
+   * @param image: bottom-up pixels of the frame.
+   * @param filename: path to the image file.
+   * @param recorded: True for a frame of a recording, false for a screenshot.
+   */
+  void write(const QImage &image, const QString &filename, const bool recorded);
+
+  bool fences_ = false; /**< True if the context supports fence sync objects */
+
+  std::array<PendingCapture, kRingSize> captures_; /**< Ring of frames whose pixels may be in flight */
+  std::deque<size_t> in_flight_;                   /**< Slots of the ring in flight, oldest first */
+  size_t next_slot_ = 0;                           /**< Slot of the next captured frame */
+
+  QString screenshot_;         /**< Path of the requested screenshot, empty if none */
+  QString recording_dir_;      /**< Directory of the last recording, kept for its frames in flight */
+  bool recording_ = false;     /**< True while the captured frames are recorded */
+  size_t recorded_frames_ = 0; /**< Frames of the last recording handed to the writers */
+  size_t dropped_frames_ = 0;  /**< Frames of the last recording dropped */
+
+  SavedCallback callback_;                /**< Receives the result of each written image */
+  QThreadPool writers_;                   /**< Encodes and writes the images */
+  size_t max_pending_writes_ = 0;         /**< Recorded frames handed to the writers beyond which frames are dropped */
+  std::atomic<size_t> pending_writes_{0}; /**< Images handed to the writers and not written yet */
+};
+
+#endif  // FRAME_CAPTURE_H_
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "frame_profiler.h"
+
+#include <QOpenGLContext>
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+FrameProfiler::Scope::Scope(FrameProfiler* profiler, const char* name) : profiler_(profiler) {
+  profiler_->beginSection(name);
+}
+
+FrameProfiler::Scope::~Scope() { profiler_->endSection(); }
+
+void FrameProfiler::initialize() {
+  initializeOpenGLFunctions();
+
+  // GL_TIME_ELAPSED queries are core since OpenGL 3.3 (ARB_timer_query), and an extension on OpenGL ES
+  QOpenGLContext* context = QOpenGLContext::currentContext();
+  timer_queries_ = context && (context->isOpenGLES() ? context->hasExtension("GL_EXT_disjoint_timer_query")
+                                                     : (context->format().version() >= qMakePair(3, 3) ||
+                                                        context->hasExtension("GL_ARB_timer_query")));
+}
+
+void FrameProfiler::destroy() {
+  for (PendingFrame& frame : frames_) {
+    if (!frame.queries.empty()) {
+      glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+    }
+    frame.queries.clear();
+    frame.used_queries = 0;
+  }
+  in_flight_.clear();
+  timer_queries_ = false;
+}
+
+void FrameProfiler::setEnabled(const bool enabled) { enabled_ = enabled; }
+
+bool FrameProfiler::isEnabled() const { return enabled_; }
+
+void FrameProfiler::setFrameCallback(const FrameCallback& callback) { callback_ = callback; }
+
+void FrameProfiler::beginFrame() {
+  counters_ = FrameCounters();
+  frame_profiled_ = enabled_;
+  if (!frame_profiled_) {
+    return;
+  }
+
+  // The slot is reused before its queries were read only when the GPU is kFrameLatency frames behind. Its GPU times are
+  // dropped rather than waited for
+  PendingFrame& frame = frames_[frame_index_ % kFrameLatency];
+  if (!in_flight_.empty() && in_flight_.front() == frame_index_ % kFrameLatency) {
+    in_flight_.pop_front();
+    publish(&frame, false);
+  }
+
+  frame_index_++;
+  frame.stats = FrameStats();
+  frame.stats.frame = frame_index_;
+  frame.stats.interval_ms = interval_timer_.isValid() ? interval_timer_.nsecsElapsed() / 1e6 : 0.0;
+  frame.section_queries.clear();
+  frame.used_queries = 0;
+  open_sections_.clear();
+  gpu_query_open_ = false;
+
+  interval_timer_.start();
+  frame_timer_.start();
+}
+
+void FrameProfiler::endFrame() {
+  if (!frame_profiled_) {
+    return;
+  }
+  frame_profiled_ = false;
+
+  while (!open_sections_.empty()) {
+    endSection();
+  }
+
+  size_t slot = (frame_index_ - 1) % kFrameLatency;
+  PendingFrame& frame = frames_[slot];
+  frame.stats.cpu_ms = frame_timer_.nsecsElapsed() / 1e6;
+  frame.stats.counters = counters_;
+
+  in_flight_.push_back(slot);
+
+  // Queries finish in submission order, so frames are published oldest first
+  while (!in_flight_.empty() && resultsAvailable(frames_[in_flight_.front()])) {
+    PendingFrame* oldest = &frames_[in_flight_.front()];
+    in_flight_.pop_front();
+    publish(oldest, true);
+  }
+}
+
+void FrameProfiler::finish() {
+  while (!in_flight_.empty()) {
+    PendingFrame* oldest = &frames_[in_flight_.front()];
+    in_flight_.pop_front();
+    publish(oldest, true);
+  }
+}
+
+void FrameProfiler::beginSection(const char* name) {
+  if (!frame_profiled_) {
+    return;
+  }
+
+  PendingFrame& frame = frames_[(frame_index_ - 1) % kFrameLatency];
+
+  ProfileSection section;
+  section.name = name;
+  section.depth = static_cast<int>(open_sections_.size());
+  frame.stats.sections.push_back(section);
+
+  OpenSection open_section;
+  open_section.index = frame.stats.sections.size() - 1;
+  open_section.start_ns = frame_timer_.nsecsElapsed();
+  open_section.gpu_query = timer_queries_ && !gpu_query_open_;
+
+  int query = -1;
+  if (open_section.gpu_query) {
+    if (frame.used_queries == frame.queries.size()) {
+      GLuint id = 0;
+      glGenQueries(1, &id);
+      frame.queries.push_back(id);
+    }
+    query = static_cast<int>(frame.used_queries++);
+    glBeginQuery(GL_TIME_ELAPSED, frame.queries[query]);
+    gpu_query_open_ = true;
+  }
+  frame.section_queries.push_back(query);
+
+  open_sections_.push_back(open_section);
+}
+
+void FrameProfiler::endSection() {
+  if (!frame_profiled_ || open_sections_.empty()) {
+    return;
+  }
+
+  OpenSection open_section = open_sections_.back();
+  open_sections_.pop_back();
+
+  PendingFrame& frame = frames_[(frame_index_ - 1) % kFrameLatency];
+  frame.stats.sections[open_section.index].cpu_ms = (frame_timer_.nsecsElapsed() - open_section.start_ns) / 1e6;
+
+  if (open_section.gpu_query) {
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_query_open_ = false;
+  }
+}
+
+FrameCounters& FrameProfiler::counters() { return counters_; }
+
+const FrameStats& FrameProfiler::lastFrame() const { return last_frame_; }
+
+bool FrameProfiler::resultsAvailable(const PendingFrame& frame) {
+  if (frame.used_queries == 0) {
+    return true;
+  }
+
+  GLuint available = GL_FALSE;
+  glGetQueryObjectuiv(frame.queries[frame.used_queries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  return available != GL_FALSE;
+}
+
+void FrameProfiler::publish(PendingFrame* frame, const bool read_queries) {
+  if (read_queries && frame->used_queries > 0) {
+    frame->stats.gpu_ms = 0.0;
+    for (size_t i = 0; i < frame->stats.sections.size(); i++) {
+      if (frame->section_queries[i] < 0) {
+        continue;
+      }
+      GLuint nanoseconds = 0;
+      glGetQueryObjectuiv(frame->queries[frame->section_queries[i]], GL_QUERY_RESULT, &nanoseconds);
+      frame->stats.sections[i].gpu_ms = nanoseconds / 1e6;
+      frame->stats.gpu_ms += nanoseconds / 1e6;
+    }
+  }
+
+  last_frame_ = frame->stats;
+  if (callback_) {
+    callback_(last_frame_);
+  }
+}
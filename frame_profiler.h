@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef FRAME_PROFILER_H_
+#define FRAME_PROFILER_H_
+
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QOpenGLExtraFunctions>
+#include <array>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief Work submitted during a frame.
+ */
+struct FrameCounters {
+  size_t draw_calls = 0;       /**< Number of glDraw* calls */
+  size_t triangles = 0;        /**< Number of triangles submitted by the draw calls */
+  size_t points = 0;           /**< Number of points of point clouds submitted by the draw calls */
+  size_t bytes_uploaded = 0;   /**< Bytes uploaded to buffers and textures */
+  size_t state_changes = 0;    /**< Binds of programs, vertex arrays, textures and uniform buffer ranges */
+  size_t culled_instances = 0; /**< Mesh instances outside the view frustum, which were not drawn */
+};
+
+/**
+ * @brief Time spent in a named section of a frame.
+ */
+struct ProfileSection {
+  const char *name = ""; /**< Name of the section, a string literal */
+  int depth = 0;         /**< Nesting level of the section, zero for top-level sections */
+  double cpu_ms = 0.0;   /**< CPU time spent in the section */
+  double gpu_ms = -1.0;  /**< GPU time spent in the section, negative if it was not measured */
+};
+
+/**
+ * @brief Timings and counters of a profiled frame.
+ */
+struct FrameStats {
+  quint64 frame = 0;                    /**< Index of the frame, starting at 1 */
+  double cpu_ms = 0.0;                  /**< CPU time between beginFrame and endFrame */
+  double gpu_ms = -1.0;                 /**< Sum of the GPU time of the sections, negative if it was not measured */
+  double interval_ms = 0.0;             /**< Time since the previous frame began, including Qt compositing */
+  std::vector<ProfileSection> sections; /**< Sections in the order they began */
+  FrameCounters counters;               /**< Work submitted during the frame */
+};
+
+Q_DECLARE_METATYPE(FrameStats)
+
+/**
+ * @brief Measures the CPU and GPU time of the sections of each frame. GPU times are measured with GL_TIME_ELAPSED
+ * queries kept in a ring of kFrameLatency frames, so their results are read frames later, when they are already
+ * available, and the CPU never waits for the GPU. Frames are published through the frame callback once their GPU times
+ * are read (or dropped, when the ring is full). Counters are updated by the renderer even when profiling is disabled.
+ * All methods that touch OpenGL require the context of the profiler to be current.
+ */
+class FrameProfiler : protected QOpenGLExtraFunctions {
+ public:
+  /**
+   * Number of frames whose GPU queries may be in flight.
+   */
+  static const size_t kFrameLatency = 4;
+
+  /**
+   * Callback that receives the stats of a frame once they are complete.
+   */
+  using FrameCallback = std::function<void(const FrameStats &)>;
+
+  /**
+   * @brief Measures a section from its construction until its destruction.
+   */
+  class Scope {
+   public:
+    /**
+     * Begins a section.
+     *
+     * @param profiler: profiler of the frame.
+     * @param name: name of the section, a string literal.
+     */
+    Scope(FrameProfiler *profiler, const char *name);
+
+    /**
+     * Ends the section.
+     */
+    ~Scope();
+
+   private:
+    FrameProfiler *profiler_; /**< Profiler of the frame */
+  };
+
+  /**
+   * Initializes the OpenGL functions of the current context and checks whether it supports timer queries.
+   */
+  void initialize();
+
+  /**
+   * Deletes the timer queries.
+   */
+  void destroy();
+
+  /**
+   * Enables profiling. Takes effect at the next beginFrame.
+   *
+   * @param enabled: True to measure sections.
+   */
+  void setEnabled(const bool enabled);
+
+  /**
+   * Gets whether profiling is enabled.
+   *
+   * @return True if sections are measured.
+   */
+  bool isEnabled() const;
+
+  /**
+   * Sets the callback that receives the stats of each frame.
+   *
+   * @param callback: callback called from endFrame or finish, in the thread of the OpenGL context.
+   */
+  void setFrameCallback(const FrameCallback &callback);
+
+  /**
+   * Starts a frame and resets the counters.
+   */
+  void beginFrame();
+
+  /**
+   * Ends the frame and publishes the previous frames whose GPU times are available.
+   */
+  void endFrame();
+
+  /**
+   * Waits for the GPU times of all frames in flight and publishes them. Stalls the CPU, so it is meant for benchmarks
+   * and shutdown.
+   */
+  void finish();
+
+  /**
+   * Starts a section of the current frame. GL_TIME_ELAPSED queries cannot be nested, so a section started inside
+   * another section is measured on the CPU only.
+   *
+   * @param name: name of the section, a string literal.
+   */
+  void beginSection(const char *name);
+
+  /**
+   * Ends the most recently started section.
+   */
+  void endSection();
+
+  /**
+   * Gets the counters of the current frame, to be updated by the renderer.
+   *
+   * @return Counters of the current frame.
+   */
+  FrameCounters &counters();
+
+  /**
+   * Gets the stats of the last published frame.
+   *
+   * @return Stats of the last published frame.
+   */
+  const FrameStats &lastFrame() const;
+
+ private:
+  /**
+   * @brief Stats and timer queries of a frame in the ring.
+   */
+  struct PendingFrame {
+    FrameStats stats;                 /**< Stats measured on the CPU */
+    std::vector<GLuint> queries;      /**< Timer queries of the slot, reused by later frames */
+    std::vector<int> section_queries; /**< Index in queries of each section, or -1 */
+    size_t used_queries = 0;          /**< Number of queries used by the frame */
+  };
+
+  /**
+   * @brief Section that has begun but not ended.
+   */
+  struct OpenSection {
+    size_t index;    /**< Index of the section in the frame stats */
+    qint64 start_ns; /**< CPU time when the section began */
+    bool gpu_query;  /**< True if a GL_TIME_ELAPSED query was started for the section */
+  };
+
+  /**
+   * Checks whether the GPU times of a frame are available.
+   *
+   * @param frame: frame in flight.
+   *
+   * @return True if the last query of the frame has a result.
+   */
+  bool resultsAvailable(const PendingFrame &frame);
+
+  /**
+   * Reads the GPU times of a frame (if requested) and calls the frame callback.
+   *
+   * @param frame: frame in flight.
+   * @param read_queries: True to read the GPU times, false to drop them.
+   */
+  void publish(PendingFrame *frame, const bool read_queries);
+
+  bool enabled_ = false;        /**< Profiling requested */
+  bool frame_profiled_ = false; /**< True if the current frame measures sections */
+  bool timer_queries_ = false;  /**< True if the context supports GL_TIME_ELAPSED queries */
+  bool gpu_query_open_ = false; /**< True while a GL_TIME_ELAPSED query is active */
+
+  FrameCallback callback_; /**< Receives the stats of each frame */
+
+  std::array<PendingFrame, kFrameLatency> frames_; /**< Ring of frames whose queries may be in flight */
+  std::deque<size_t> in_flight_;                   /**< Slots of the ring in flight, oldest first */
+  std::vector<OpenSection> open_sections_;         /**< Stack of the sections of the current frame */
+
+  quint64 frame_index_ = 0; /**< Index of the current frame */
+  FrameCounters counters_;  /**< Counters of the current frame */
+  FrameStats last_frame_;   /**< Stats of the last published frame */
+
+  QElapsedTimer frame_timer_;    /**< Started when the current frame began */
+  QElapsedTimer interval_timer_; /**< Started when the previous frame began */
+};
+
+#endif  // FRAME_PROFILER_H_
@@ -3,15 +3,121 @@
  */
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QSurfaceFormat>
 
 #include "main_window.h"
 
 int main(int argc, char *argv[]) {
+  // Uniform blocks and GLSL 3.30 shaders require an OpenGL 3.3 context, and no fixed-function state is used
+  QSurfaceFormat format;
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CoreProfile);
+  format.setDepthBufferSize(24);
+  QSurfaceFormat::setDefaultFormat(format);
+
+  // Viewports share buffers, textures and programs, so a mesh shown in several of them is uploaded once
+  QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+
   QApplication app(argc, argv);
   app.setWindowIcon(QIcon(":qt_opengl.png"));
 
-  QString filename = (argc > 1) ? argv[1] : "bunny.obj";
-  MainWindow viewer(filename);
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Loads and presents a 3D object.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("file", "Mesh file (.obj) to be loaded, bunny.obj by default.");
+
+  QCommandLineOption profile_option("profile", "Import profile: fast, balanced, max or custom.", "profile", "max");
+  QCommandLineOption flags_option("import-flags", "aiPostProcessSteps flags of the custom profile (e.g. 0x8008).",
+                                  "flags");
+  QCommandLineOption no_upgrade_option("no-upgrade", "Do not import previews again with the max profile.");
+  QCommandLineOption compress_option("compress-textures", "Compress textures to S3TC and cache them on disk.");
+  QCommandLineOption budget_option("texture-budget", "Memory kept for decoded textures, in MB (512 by default).",
+                                   "megabytes", "512");
+  QCommandLineOption views_option("views", "Number of viewports showing the mesh side by side.", "count", "1");
+  QCommandLineOption stream_option("stream", "Stream the pages of OBJ files larger than the memory.");
+  QCommandLineOption stream_budget_option("stream-budget",
+                                          "GPU memory kept for full pages of streamed meshes, in MB (1024 by default).",
+                                          "megabytes", "1024");
+  QCommandLineOption point_budget_option("point-budget", "Points of point clouds drawn per frame (5000000 by default).",
+                                         "points", "5000000");
+  QCommandLineOption crease_option("crease-angle",
+                                   "Crease angle of the normals generated for meshes without them (60 by default).",
+                                   "degrees", "60");
+  parser.addOptions({profile_option, flags_option, no_upgrade_option, compress_option, budget_option, views_option,
+                     stream_option, stream_budget_option, point_budget_option, crease_option});
+  parser.process(app);
+
+  const QMap<QString, ImportProfile> profiles = {{"fast", ImportProfile::kFast},
+                                                 {"balanced", ImportProfile::kBalanced},
+                                                 {"max", ImportProfile::kMaxQuality},
+                                                 {"custom", ImportProfile::kCustom}};
+  QString profile_name = parser.value(profile_option).toLower();
+  if (!profiles.contains(profile_name)) {
+    qCritical() << "Unknown import profile:" << profile_name;
+    return 1;
+  }
+
+  bool valid_flags = true;
+  unsigned int custom_flags = parser.isSet(flags_option) ? parser.value(flags_option).toUInt(&valid_flags, 0) : 0;
+  if (!valid_flags) {
+    qCritical() << "Invalid import flags:" << parser.value(flags_option);
+    return 1;
+  }
+  ImportProfile profile = parser.isSet(flags_option) && !parser.isSet(profile_option) ? ImportProfile::kCustom
+                                                                                        : profiles.value(profile_name);
+
+  bool valid_budget = true;
+  size_t texture_budget = parser.value(budget_option).toULongLong(&valid_budget);
+  if (!valid_budget) {
+    qCritical() << "Invalid texture budget:" << parser.value(budget_option);
+    return 1;
+  }
+
+  bool valid_views = true;
+  int views = parser.value(views_option).toInt(&valid_views);
+  if (!valid_views || views < 1) {
+    qCritical() << "Invalid number of views:" << parser.value(views_option);
+    return 1;
+  }
+
+  bool valid_stream_budget = true;
+  size_t stream_budget = parser.value(stream_budget_option).toULongLong(&valid_stream_budget);
+  if (!valid_stream_budget || stream_budget == 0) {
+    qCritical() << "Invalid stream budget:" << parser.value(stream_budget_option);
+    return 1;
+  }
+
+  bool valid_point_budget = true;
+  size_t point_budget = parser.value(point_budget_option).toULongLong(&valid_point_budget);
+  if (!valid_point_budget || point_budget == 0) {
+    qCritical() << "Invalid point budget:" << parser.value(point_budget_option);
+    return 1;
+  }
+
+  bool valid_crease = true;
+  float crease_angle = parser.value(crease_option).toFloat(&valid_crease);
+  if (!valid_crease || crease_angle < 0.0f || crease_angle > 180.0f) {
+    qCritical() << "Invalid crease angle:" << parser.value(crease_option);
+    return 1;
+  }
+
+  QStringList arguments = parser.positionalArguments();
+  QString filename = arguments.isEmpty() ? "bunny.obj" : arguments.first();
+
+  MainWindow viewer;
+  viewer.setImportProfile(profile, custom_flags);
+  viewer.setUpgradeImport(!parser.isSet(no_upgrade_option));
+  viewer.setCompressTextures(parser.isSet(compress_option));
+  viewer.setTextureMemoryBudget(texture_budget << 20);
+  viewer.setStreamMeshes(parser.isSet(stream_option));
+  viewer.setStreamBudget(stream_budget << 20);
+  viewer.setPointBudget(point_budget);
+  viewer.setCreaseAngle(crease_angle);
+  for (int i = 1; i < views; i++) {
+    viewer.addView();
+  }
+  viewer.loadMesh(filename);
   viewer.show();
 
   return app.exec();
@@ -7,9 +7,19 @@
 MainWindow::MainWindow(const QString& filename) : ui_(new Ui::MainWindowLayout) {
   ui_->setupUi(this);
   resize(600, 500);
-  loadMesh(filename);
+
+  progress_bar_ = new QProgressBar(this);
+  progress_bar_->setRange(0, 100);
+  progress_bar_->setMaximumWidth(200);
+  progress_bar_->hide();
+  statusBar()->addPermanentWidget(progress_bar_);
 
   connect(ui_->open_button_, &QPushButton::clicked, this, &MainWindow::selectFile);
+  connect(ui_->opengl_widget_, &QtOpenGL::meshLoadProgress, progress_bar_, &QProgressBar::setValue);
+  connect(ui_->opengl_widget_, &QtOpenGL::meshLoaded, this, &MainWindow::meshLoaded);
+  connectCaptures(ui_->opengl_widget_);
+
+  loadMesh(filename);
 }
 
 MainWindow::~MainWindow() { delete ui_; }
@@ -21,9 +31,62 @@ void MainWindow::selectFile() {
 }
 
 bool MainWindow::loadMesh(const QString& filename) {
-  if (!filename.isEmpty() && ui_->opengl_widget_->loadMesh(filename)) {
-    ui_->file_line_edit_->setText(QFileInfo(filename).canonicalFilePath());
+  if (!filename.isEmpty() && ui_->opengl_widget_->loadMeshAsync(filename)) {
+    progress_bar_->setValue(0);
+    progress_bar_->show();
+    statusBar()->showMessage("Loading " + QFileInfo(filename).fileName() + "...");
     return true;
   }
   return false;
 }
+
+void MainWindow::setImportProfile(const ImportProfile profile, const unsigned int custom_flags) {
+  ui_->opengl_widget_->setImportProfile(profile, custom_flags);
+}
+
+void MainWindow::setUpgradeImport(const bool upgrade_import) { ui_->opengl_widget_->setUpgradeImport(upgrade_import); }
+
+void MainWindow::setCompressTextures(const bool compress_textures) {
+  ui_->opengl_widget_->setCompressTextures(compress_textures);
+}
+
+void MainWindow::setTextureMemoryBudget(const size_t bytes) { ui_->opengl_widget_->setTextureMemoryBudget(bytes); }
+
+void MainWindow::setStreamMeshes(const bool stream_meshes) { ui_->opengl_widget_->setStreamMeshes(stream_meshes); }
+
+void MainWindow::setStreamBudget(const size_t bytes) { ui_->opengl_widget_->setStreamBudget(bytes); }
+
+void MainWindow::setCreaseAngle(const float degrees) { ui_->opengl_widget_->setCreaseAngle(degrees); }
+
+void MainWindow::setPointBudget(const size_t point_budget) { ui_->opengl_widget_->setPointBudget(point_budget); }
+
+void MainWindow::addView() {
+  QtOpenGL* view = new QtOpenGL(ui_->view_splitter_);
+  view->setMinimumSize(ui_->opengl_widget_->minimumSize());
+  ui_->view_splitter_->addWidget(view);
+  ui_->opengl_widget_->addView(view);
+  connectCaptures(view);
+  resize(width() + ui_->opengl_widget_->width(), height());
+}
+
+void MainWindow::meshLoaded(const QString& filename, bool success) {
+  progress_bar_->hide();
+  if (success) {
+    ui_->file_line_edit_->setText(QFileInfo(filename).canonicalFilePath());
+    statusBar()->clearMessage();
+  } else {
+    statusBar()->showMessage("Failed to load " + QFileInfo(filename).fileName(), 5000);
+  }
+}
+
+void MainWindow::connectCaptures(QtOpenGL* view) {
+  connect(view, &QtOpenGL::screenshotSaved, this, [this](const QString& filename, bool success) {
+    statusBar()->showMessage((success ? "Saved " : "Failed to save ") + QFileInfo(filename).fileName(), 5000);
+  });
+  connect(view, &QtOpenGL::recordingStarted, this,
+          [this](const QString& directory) { statusBar()->showMessage("Recording frames to " + directory + "..."); });
+  connect(view, &QtOpenGL::recordingStopped, this, [this](const QString& directory, int frames, int dropped) {
+    statusBar()->showMessage(QString("Recorded %1 frames to %2 (%3 dropped)").arg(frames).arg(directory).arg(dropped),
+                             5000);
+  });
+}
@@ -29,6 +29,79 @@ class MainWindow : public QMainWindow {
    */
   ~MainWindow();
 
+  /**
+   * Starts loading a mesh file (.obj) on a worker thread, it is displayed on the screen once loaded. Calls
+   * QtOpenGL::loadMeshAsync, the previous mesh stays interactive meanwhile.
+   *
+   * @param filename: mesh file to be loaded by the qt opengl widget.
+   *
+   * @return True if the mesh load was started.
+   */
+  bool loadMesh(const QString &filename);
+
+  /**
+   * Selects the assimp post-processing steps applied to imported files. Calls QtOpenGL::setImportProfile.
+   *
+   * @param profile: import profile.
+   * @param custom_flags: aiPostProcessSteps flags, used only by ImportProfile::kCustom.
+   */
+  void setImportProfile(const ImportProfile profile, const unsigned int custom_flags = 0);
+
+  /**
+   * Enables the background max quality import of previews. Calls QtOpenGL::setUpgradeImport.
+   *
+   * @param upgrade_import: True to upgrade previews to max quality.
+   */
+  void setUpgradeImport(const bool upgrade_import);
+
+  /**
+   * Enables S3TC compression of the textures. Calls QtOpenGL::setCompressTextures.
+   *
+   * @param compress_textures: True to compress textures.
+   */
+  void setCompressTextures(const bool compress_textures);
+
+  /**
+   * Sets the size of the decoded textures kept in memory. Calls QtOpenGL::setTextureMemoryBudget.
+   *
+   * @param bytes: memory budget, in bytes.
+   */
+  void setTextureMemoryBudget(const size_t bytes);
+
+  /**
+   * Streams the pages of OBJ files larger than the memory. Calls QtOpenGL::setStreamMeshes.
+   *
+   * @param stream_meshes: True to stream OBJ files.
+   */
+  void setStreamMeshes(const bool stream_meshes);
+
+  /**
+   * Sets the memory of the resident full pages of streamed meshes. Calls QtOpenGL::setStreamBudget.
+   *
+   * @param bytes: memory budget, in bytes.
+   */
+  void setStreamBudget(const size_t bytes);
+
+  /**
+   * Sets the crease angle of the normals generated for meshes without them. Calls QtOpenGL::setCreaseAngle.
+   *
+   * @param degrees: crease angle, in degrees.
+   */
+  void setCreaseAngle(const float degrees);
+
+  /**
+   * Sets the number of points of point clouds drawn per frame. Calls QtOpenGL::setPointBudget.
+   *
+   * @param point_budget: maximum number of points drawn per frame.
+   */
+  void setPointBudget(const size_t point_budget);
+
+  /**
+   * Adds a viewport next to the others, showing the same mesh from its own camera. The mesh is loaded once and its GPU
+   * buffers and textures are shared by all viewports. Calls QtOpenGL::addView.
+   */
+  void addView();
+
  private:
   /**
    * Slot called by button click. It will open a QFileDialog allowing to select a file path and call the method to load
@@ -37,15 +110,23 @@ class MainWindow : public QMainWindow {
   void selectFile();
 
   /**
-   * Loads a mesh file (.obj) and displays it on the screen. Calls QtOpenGL::loadMesh.
+   * Slot called when the qt opengl widget finishes loading a mesh.
    *
-   * @param filename: mesh file to be loaded by the qt opengl widget.
+   * @param filename: mesh file that was loaded.
+   * @param success: True if the mesh was loaded successfully.
+   */
+  void meshLoaded(const QString &filename, bool success);
+
+  /**
+   * Reports the screenshots and recordings of a viewport in the status bar.
    *
-   * @return True if the mesh was loaded successfully.
+   * @param view: viewport whose captures are reported.
    */
-  bool loadMesh(const QString &filename);
+  void connectCaptures(QtOpenGL *view);
 
   Ui::MainWindowLayout *ui_; /**< User interface layout */
+
+  QProgressBar *progress_bar_; /**< Progress of the mesh being loaded, shown in the status bar */
 };
 
 #endif  // MAIN_WINDOW_H_
@@ -0,0 +1,563 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "mesh_cache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+namespace {
+
+/** Identifies mesh cache files */
+const char kMagic[8] = {'Q', 'T', 'G', 'L', 'M', 'E', 'S', 'H'};
+
+/** Must be incremented whenever SceneData or the layout of the cache file changes */
+const uint32_t kVersion = 9;
+
+/**
+ * @brief Fixed-size header of a cache file. It is followed by the metadata (a QDataStream with the mesh ranges, scene
+ * graph, materials, bounding box and point octree), the VBO and the IBO. The header, the metadata and the IBO are
+ * checked when the entry is loaded, since corrupt indices would make draws read outside of the VBO, and the VBO in the
+ * background while it is already in use.
+ */
+struct CacheHeader {
+  char magic[8];            /**< Must be kMagic */
+  uint32_t version;         /**< Must be kVersion */
+  uint32_t options;         /**< Options used to build the geometry */
+  uint32_t import_flags;    /**< Post-processing steps of the import profile */
+  uint32_t reserved;        /**< Zero, keeps the following fields 8-byte aligned */
+  uint64_t source_size;     /**< Size of the mesh file when the entry was written */
+  int64_t source_mtime;     /**< Modification time of the mesh file, in milliseconds since epoch */
+  uint64_t metadata_size;   /**< Size in bytes of the metadata */
+  uint64_t vertex_size;     /**< Size in bytes of the VBO */
+  uint64_t index_size;      /**< Size in bytes of the IBO */
+  uint64_t checksum;        /**< Checksum of the header fields above and of the metadata */
+  uint64_t vertex_checksum; /**< Checksum of the VBO */
+  uint64_t index_checksum;  /**< Checksum of the IBO */
+};
+
+/**
+ * @brief Memory map of a cache file, unmapped when the last scene whose buffers it holds is released.
+ */
+class MappedFile {
+ public:
+  /**
+   * Maps a file.
+   *
+   * @param filename: path to the file.
+   */
+  explicit MappedFile(const QString& filename) : file_(filename) {
+    if (file_.open(QIODevice::ReadOnly) && file_.size() > 0) {
+      data_ = file_.map(0, file_.size());
+    }
+  }
+
+  /**
+   * Unmaps the file.
+   */
+  ~MappedFile() {
+    if (data_) {
+      file_.unmap(data_);
+    }
+  }
+
+  /**
+   * Gets the mapped bytes.
+   *
+   * @return First byte of the file, or NULL if it could not be mapped.
+   */
+  const unsigned char* data() const { return data_; }
+
+  /**
+   * Gets the size of the file.
+   *
+   * @return Size in bytes of the file.
+   */
+  uint64_t size() const { return static_cast<uint64_t>(file_.size()); }
+
+ private:
+  QFile file_;         /**< Mapped file, closing it would unmap it */
+  uchar* data_ = NULL; /**< Mapped bytes */
+};
+
+/**
+ * @brief Runs a function on a QThreadPool.
+ */
+class Task : public QRunnable {
+ public:
+  /**
+   * Class constructor.
+   *
+   * @param function: function to be run.
+   */
+  explicit Task(const std::function<void()>& function) : function_(function) {}
+
+  /**
+   * Runs the function on a thread of the pool.
+   */
+  void run() override { function_(); }
+
+ private:
+  std::function<void()> function_; /**< Function to be run */
+};
+
+/**
+ * Gets the options that change the geometry of a scene as bit flags, with the crease angle in degrees above them.
+ *
+ * @param options: options used to build the geometry.
+ *
+ * @return Bit flags of the options.
+ */
+uint32_t optionFlags(const SceneLoadOptions& options) {
+  return (options.use_indexed_geometry ? 0x1 : 0) | (options.quantize_positions ? 0x2 : 0) |
+         (options.use_fast_obj_reader ? 0x4 : 0) | (options.generate_lods ? 0x8 : 0) |
+         (options.optimize_meshes ? 0x10 : 0) |
+         (static_cast<uint32_t>(std::lround(qBound(0.0f, options.crease_angle, 180.0f))) << 8);
+}
+
+/**
+ * Updates a 64-bit FNV-1a checksum, processing 8 bytes per step.
+ *
+ * @param data: bytes to be added to the checksum.
+ * @param size: number of bytes.
+ * @param hash: checksum of the previous bytes.
+ *
+ * @return The updated checksum.
+ */
+uint64_t checksum(const unsigned char* data, const size_t size, uint64_t hash = 0xCBF29CE484222325ULL) {
+  const uint64_t prime = 0x100000001B3ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ data[i]) * prime;
+  }
+  return hash;
+}
+
+/**
+ * Serializes everything but the VBO and IBO of a scene.
+ *
+ * @param scene: scene to be serialized.
+ *
+ * @return The serialized metadata.
+ */
+QByteArray writeMetadata(const SceneData& scene) {
+  QByteArray metadata;
+  QDataStream stream(&metadata, QIODevice::WriteOnly);
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  stream << scene.vertex_layout.quantized << scene.position_offset << scene.position_scale << scene.scene_min
+         << scene.scene_max << scene.indexed << scene.has_normals << scene.has_texture_coords
+         << scene.read_by_obj_reader << scene.point_cloud;
+
+  for (const VertexCacheStats& stats : {scene.vertex_cache_before, scene.vertex_cache_after}) {
+    stream << quint64(stats.triangles) << quint64(stats.vertices) << quint64(stats.misses);
+  }
+
+  stream << quint64(scene.mesh_ranges.size());
+  for (const MeshRange& range : scene.mesh_ranges) {
+    stream << quint64(range.base_vertex) << quint64(range.vertex_count) << quint64(range.index_offset)
+           << quint64(range.index_count) << quint32(range.index_type) << quint32(range.material_index)
+           << range.has_texture_coords << quint64(range.instance_offset) << quint64(range.instance_count)
+           << range.bounds_min << range.bounds_max << quint64(range.lods.size());
+    for (const MeshLod& lod : range.lods) {
+      stream << quint64(lod.index_offset) << quint64(lod.index_count) << lod.error;
+    }
+  }
+
+  stream << quint64(scene.instances.size());
+  for (const MeshInstance& instance : scene.instances) {
+    stream << instance.transform << quint64(instance.range) << quint64(instance.node);
+  }
+
+  stream << quint64(scene.nodes.size());
+  for (const SceneNode& node : scene.nodes) {
+    stream << node.name << qint32(node.parent) << node.transform << node.world_transform
+           << quint64(node.instances.size());
+    for (size_t i : node.instances) {
+      stream << quint64(i);
+    }
+  }
+
+  stream << quint64(scene.draw_order.size());
+  for (size_t i : scene.draw_order) {
+    stream << quint64(i);
+  }
+
+  stream << quint64(scene.materials.size());
+  for (const Material& material : scene.materials) {
+    stream << material.ambient << material.diffuse << material.specular << material.texture_filename;
+  }
+
+  stream << quint64(scene.point_octree.nodes().size());
+  for (const PointOctreeNode& node : scene.point_octree.nodes()) {
+    stream << node.center[0] << node.center[1] << node.center[2] << node.half_size << quint32(node.first)
+           << quint32(node.count) << quint32(node.first_child) << quint32(node.child_count) << node.spacing;
+  }
+
+  return metadata;
+}
+
+/**
+ * Deserializes the metadata of a scene and checks that its mesh ranges fit in the VBO and IBO.
+ *
+ * @param metadata: serialized metadata.
+ * @param vertex_size: size in bytes of the VBO.
+ * @param index_size: size in bytes of the IBO.
+ * @param scene: receives the metadata.
+ *
+ * @return True if the metadata is valid.
+ */
+bool readMetadata(const QByteArray& metadata, const uint64_t vertex_size, const uint64_t index_size,
+                  SceneData* scene) {
+  QDataStream stream(metadata);
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  bool quantized = false;
+  stream >> quantized >> scene->position_offset >> scene->position_scale >> scene->scene_min >> scene->scene_max >>
+      scene->indexed >> scene->has_normals >> scene->has_texture_coords >> scene->read_by_obj_reader >>
+      scene->point_cloud;
+
+  for (VertexCacheStats* stats : {&scene->vertex_cache_before, &scene->vertex_cache_after}) {
+    quint64 triangles, vertices, misses;
+    stream >> triangles >> vertices >> misses;
+    stats->triangles = triangles;
+    stats->vertices = vertices;
+    stats->misses = misses;
+  }
+  if (scene->point_cloud) {
+    scene->vertex_layout = vertexLayoutInfo<PointVertex>();
+  } else {
+    scene->vertex_layout = quantized ? vertexLayoutInfo<QuantizedVertex>() : vertexLayoutInfo<PackedVertex>();
+  }
+  const uint64_t total_vertices = vertex_size / scene->vertex_layout.stride;
+
+  quint64 count = 0;
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count > static_cast<quint64>(metadata.size())) {
+    return false;
+  }
+  scene->mesh_ranges.resize(count);
+  for (MeshRange& range : scene->mesh_ranges) {
+    quint64 base_vertex, vertex_count, index_offset, index_count, instance_offset, instance_count;
+    quint32 index_type, material_index;
+    stream >> base_vertex >> vertex_count >> index_offset >> index_count >> index_type >> material_index >>
+        range.has_texture_coords >> instance_offset >> instance_count >> range.bounds_min >> range.bounds_max;
+
+    uint64_t index_bytes = (index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    if (base_vertex + vertex_count > total_vertices || index_offset + index_count * index_bytes > index_size ||
+        (index_type != GL_UNSIGNED_SHORT && index_type != GL_UNSIGNED_INT)) {
+      return false;
+    }
+
+    range.base_vertex = base_vertex;
+    range.vertex_count = vertex_count;
+    range.index_offset = index_offset;
+    range.index_count = index_count;
+    range.index_type = index_type;
+    range.material_index = material_index;
+    range.instance_offset = instance_offset;
+    range.instance_count = instance_count;
+
+    quint64 lod_count = 0;
+    stream >> lod_count;
+    if (stream.status() != QDataStream::Ok || lod_count > static_cast<quint64>(metadata.size())) {
+      return false;
+    }
+    range.lods.resize(lod_count);
+    for (MeshLod& lod : range.lods) {
+      quint64 lod_offset, lod_index_count;
+      stream >> lod_offset >> lod_index_count >> lod.error;
+      if (lod_offset + lod_index_count * index_bytes > index_size) {
+        return false;
+      }
+      lod.index_offset = lod_offset;
+      lod.index_count = lod_index_count;
+    }
+  }
+
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count > static_cast<quint64>(metadata.size())) {
+    return false;
+  }
+  scene->instances.resize(count);
+  for (MeshInstance& instance : scene->instances) {
+    quint64 range, node;
+    stream >> instance.transform >> range >> node;
+    instance.range = range;
+    instance.node = node;
+  }
+
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count > static_cast<quint64>(metadata.size())) {
+    return false;
+  }
+  scene->nodes.resize(count);
+  for (size_t n = 0; n < scene->nodes.size(); n++) {
+    SceneNode& node = scene->nodes[n];
+    qint32 parent;
+    quint64 instance_count;
+    stream >> node.name >> parent >> node.transform >> node.world_transform >> instance_count;
+    if (stream.status() != QDataStream::Ok || parent >= static_cast<qint64>(n) || parent < -1 ||
+        instance_count > scene->instances.size()) {
+      return false;
+    }
+    node.parent = parent;
+    node.instances.resize(instance_count);
+    for (size_t& i : node.instances) {
+      quint64 index;
+      stream >> index;
+      if (index >= scene->instances.size()) {
+        return false;
+      }
+      i = index;
+    }
+  }
+
+  // Instances must be grouped by mesh range and reference existing nodes
+  for (const MeshRange& range : scene->mesh_ranges) {
+    if (range.instance_offset + range.instance_count > scene->instances.size()) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < scene->instances.size(); i++) {
+    const MeshInstance& instance = scene->instances[i];
+    if (instance.range >= scene->mesh_ranges.size() || instance.node >= scene->nodes.size()) {
+      return false;
+    }
+    const MeshRange& range = scene->mesh_ranges[instance.range];
+    if (i < range.instance_offset || i >= range.instance_offset + range.instance_count) {
+      return false;
+    }
+  }
+
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count != scene->mesh_ranges.size()) {
+    return false;
+  }
+  scene->draw_order.resize(count);
+  for (size_t& i : scene->draw_order) {
+    quint64 index;
+    stream >> index;
+    if (index >= scene->mesh_ranges.size()) {
+      return false;
+    }
+    i = index;
+  }
+
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count > static_cast<quint64>(metadata.size())) {
+    return false;
+  }
+  scene->materials.resize(count);
+  for (Material& material : scene->materials) {
+    stream >> material.ambient >> material.diffuse >> material.specular >> material.texture_filename;
+  }
+  for (const MeshRange& range : scene->mesh_ranges) {
+    if (range.material_index >= scene->materials.size()) {
+      return false;
+    }
+  }
+
+  // The points of each node must be in the VBO, and its children must follow it
+  stream >> count;
+  if (stream.status() != QDataStream::Ok || count > static_cast<quint64>(metadata.size())) {
+    return false;
+  }
+  std::vector<PointOctreeNode> nodes(count);
+  for (size_t n = 0; n < nodes.size(); n++) {
+    PointOctreeNode& node = nodes[n];
+    quint32 first, point_count, first_child, child_count;
+    stream >> node.center[0] >> node.center[1] >> node.center[2] >> node.half_size >> first >> point_count >>
+        first_child >> child_count >> node.spacing;
+    if (static_cast<uint64_t>(first) + point_count > total_vertices ||
+        (child_count > 0 && (first_child <= n || static_cast<uint64_t>(first_child) + child_count > nodes.size()))) {
+      return false;
+    }
+    node.first = first;
+    node.count = point_count;
+    node.first_child = first_child;
+    node.child_count = child_count;
+  }
+  scene->point_octree.setNodes(nodes);
+
+  return stream.status() == QDataStream::Ok && stream.atEnd();
+}
+
+/**
+ * Computes the checksum of the fields of a header before its checksums, and of the metadata that follows it.
+ *
+ * @param header: header of the entry.
+ * @param metadata: serialized metadata.
+ *
+ * @return The checksum.
+ */
+uint64_t headerChecksum(const CacheHeader& header, const unsigned char* metadata) {
+  uint64_t hash = checksum(reinterpret_cast<const unsigned char*>(&header), offsetof(CacheHeader, checksum));
+  return checksum(metadata, header.metadata_size, hash);
+}
+
+/**
+ * Validates the header, the metadata and the IBO of a mapped cache file and reads them into a scene, whose VBO and IBO
+ * point into the map. The checksum of the VBO is not checked here.
+ *
+ * @param file: mapped cache file.
+ * @param source: mesh file of the entry.
+ * @param options: options used to build the geometry.
+ * @param scene: receives the cached scene.
+ * @param header: receives the header of the entry.
+ *
+ * @return True if the entry is valid and up to date.
+ */
+bool readEntry(const std::shared_ptr<MappedFile>& file, const QFileInfo& source, const SceneLoadOptions& options,
+               SceneData* scene, CacheHeader* header) {
+  const unsigned char* data = file->data();
+  const uint64_t size = file->size();
+  if (!data || size < sizeof(*header)) {
+    return false;
+  }
+  std::memcpy(header, data, sizeof(*header));
+
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion ||
+      header->options != optionFlags(options) || header->import_flags != SceneLoader::importFlags(options) ||
+      header->source_size != static_cast<uint64_t>(source.size()) ||
+      header->source_mtime != source.lastModified().toMSecsSinceEpoch()) {
+    return false;
+  }
+
+  const unsigned char* metadata = data + sizeof(*header);
+  const unsigned char* vertices = metadata + header->metadata_size;
+  const unsigned char* indices = vertices + header->vertex_size;
+  if (header->metadata_size > size || header->vertex_size > size || header->index_size > size ||
+      sizeof(*header) + header->metadata_size + header->vertex_size + header->index_size != size ||
+      headerChecksum(*header, metadata) != header->checksum ||
+      checksum(indices, header->index_size) != header->index_checksum) {
+    return false;
+  }
+
+  *scene = SceneData();
+  QByteArray metadata_bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(metadata), header->metadata_size);
+  if (!readMetadata(metadata_bytes, header->vertex_size, header->index_size, scene)) {
+    *scene = SceneData();
+    return false;
+  }
+
+  scene->filename = source.filePath();
+  scene->mapped_buffers.mapping = file;
+  scene->mapped_buffers.vertex_data = vertices;
+  scene->mapped_buffers.vertex_size = header->vertex_size;
+  scene->mapped_buffers.index_data = indices;
+  scene->mapped_buffers.index_size = header->index_size;
+  return true;
+}
+
+/**
+ * Checks the VBO of a loaded entry on the global thread pool, while the scene is already uploaded from the same map. A
+ * corrupt entry is removed, so the next load builds the scene again.
+ *
+ * @param file: mapped cache file.
+ * @param header: header of the entry.
+ * @param cache_filename: path to the cache file.
+ */
+void checkEntryData(const std::shared_ptr<MappedFile>& file, const CacheHeader& header, const QString& cache_filename) {
+  QThreadPool::globalInstance()->start(new Task([file, header, cache_filename]() {
+    const unsigned char* vertices = file->data() + sizeof(header) + header.metadata_size;
+    if (checksum(vertices, header.vertex_size) != header.vertex_checksum) {
+      qWarning() << "Removing corrupt mesh cache" << cache_filename;
+      QFile::remove(cache_filename);
+    }
+  }));
+}
+
+}  // namespace
+
+QString MeshCache::cacheFilename(const QString& filename, const SceneLoadOptions& options) {
+  QString key = QFileInfo(filename).absoluteFilePath() + QString::number(optionFlags(options)) + "/" +
+                QString::number(SceneLoader::importFlags(options));
+  QString hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes/" + hash + ".mesh";
+}
+
+bool MeshCache::load(const QString& filename, const SceneLoadOptions& options, SceneData* scene) {
+  QFileInfo source(filename);
+  QString cache_filename = cacheFilename(filename, options);
+
+  if (!source.exists() || !QFile::exists(cache_filename)) {
+    return false;
+  }
+
+  // The VBO and IBO are not copied: the scene keeps the file mapped until they are uploaded
+  std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(cache_filename);
+  CacheHeader header;
+  if (!readEntry(file, source, options, scene, &header)) {
+    file.reset();
+    qDebug() << "Removing stale mesh cache" << cache_filename;
+    QFile::remove(cache_filename);
+    return false;
+  }
+
+  checkEntryData(file, header, cache_filename);
+  return true;
+}
+
+bool MeshCache::save(const SceneData& scene, const SceneLoadOptions& options) {
+  QFileInfo source(scene.filename);
+  QString cache_filename = cacheFilename(scene.filename, options);
+  if (!QDir().mkpath(QFileInfo(cache_filename).absolutePath())) {
+    return false;
+  }
+
+  QByteArray metadata = writeMetadata(scene);
+
+  CacheHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.options = optionFlags(options);
+  header.import_flags = SceneLoader::importFlags(options);
+  header.reserved = 0;
+  header.source_size = source.size();
+  header.source_mtime = source.lastModified().toMSecsSinceEpoch();
+  header.metadata_size = metadata.size();
+  header.vertex_size = scene.vertex_data.size();
+  header.index_size = scene.index_data.size();
+  header.checksum = headerChecksum(header, reinterpret_cast<const unsigned char*>(metadata.constData()));
+  header.vertex_checksum = checksum(scene.vertex_data.data(), scene.vertex_data.size());
+  header.index_checksum = checksum(scene.index_data.data(), scene.index_data.size());
+
+  // The entry is written to a temporary file and renamed, so readers never see a partial entry
+  QSaveFile file(cache_filename);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(metadata);
+  file.write(reinterpret_cast<const char*>(scene.vertex_data.data()), scene.vertex_data.size());
+  file.write(reinterpret_cast<const char*>(scene.index_data.data()), scene.index_data.size());
+
+  if (!file.commit()) {
+    qWarning() << "Could not write mesh cache" << cache_filename;
+    return false;
+  }
+  return true;
+}
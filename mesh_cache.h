@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include <QString>
+
+#include "scene_loader.h"
+
+/**
+ * @brief Binary cache of loaded scenes. Each entry holds the GPU-ready vertex and index buffers, mesh ranges (with
+ * their levels of detail), scene graph, materials and bounding box of a scene, so a mesh file that did not change is
+ * loaded with a memory map instead of being imported again: only the metadata is parsed, and the VBO and IBO are
+ * uploaded straight from the map. Entries are keyed by the source path and by the options that change the geometry,
+ * and are validated against the size and modification time of the source file and checksums of their header, metadata
+ * and IBO. The checksum of the VBO is checked in the background, and a corrupt entry is removed.
+ */
+class MeshCache {
+ public:
+  /**
+   * Gets the cache file of a mesh file.
+   *
+   * @param filename: path to the mesh file.
+   * @param options: options used to build the geometry.
+   *
+   * @return Path to the cache file, inside the application cache directory.
+   */
+  static QString cacheFilename(const QString &filename, const SceneLoadOptions &options);
+
+  /**
+   * Loads a scene from the cache, whose VBO and IBO stay in the map of the entry (SceneData::mapped_buffers). Stale or
+   * corrupt entries are removed.
+   *
+   * @param filename: path to the mesh file.
+   * @param options: options used to build the geometry.
+   * @param scene: receives the cached scene.
+   *
+   * @return True if a valid entry was found.
+   */
+  static bool load(const QString &filename, const SceneLoadOptions &options, SceneData *scene);
+
+  /**
+   * Writes a scene to the cache, replacing any previous entry.
+   *
+   * @param scene: scene to be cached, its filename is the key of the entry.
+   * @param options: options used to build the geometry.
+   *
+   * @return True if the entry was written.
+   */
+  static bool save(const SceneData &scene, const SceneLoadOptions &options);
+};
+
+#endif  // MESH_CACHE_H_
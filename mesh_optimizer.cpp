@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+/** Number of vertices of the LRU cache modelled by the Forsyth scores */
+const int kForsythCacheSize = 32;
+
+/** Decay of the score of a vertex with its position in the LRU cache */
+const float kCacheDecayPower = 1.5f;
+
+/** Score of the vertices of the last emitted triangle, kept low so the order does not turn into strips */
+const float kLastTriangleScore = 0.75f;
+
+/** Boost of vertices with few remaining triangles, so they are finished before they leave the cache */
+const float kValenceBoostScale = 2.0f;
+
+/** Decay of the valence boost with the number of remaining triangles */
+const float kValenceBoostPower = 0.5f;
+
+/**
+ * Computes the Forsyth score of a vertex.
+ *
+ * @param cache_position: position of the vertex in the LRU cache, -1 if it is not in the cache.
+ * @param remaining: number of triangles of the vertex not yet emitted.
+ *
+ * @return Score of the vertex, -1 if it has no remaining triangles.
+ */
+float vertexScore(const int cache_position, const uint32_t remaining) {
+  if (remaining == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cache_position >= 0 && cache_position < 3) {
+    score = kLastTriangleScore;
+  } else if (cache_position >= 3) {
+    const float scale = 1.0f / (kForsythCacheSize - 3);
+    score = std::pow(1.0f - (cache_position - 3) * scale, kCacheDecayPower);
+  }
+  return score + kValenceBoostScale * std::pow(static_cast<float>(remaining), -kValenceBoostPower);
+}
+
+/**
+ * Computes the (non-normalized) normal of a triangle, whose length is twice its area.
+ *
+ * @param a: first corner (x, y, z).
+ * @param b: second corner (x, y, z).
+ * @param c: third corner (x, y, z).
+ * @param n: receives the normal.
+ */
+inline void triangleNormal(const float* a, const float* b, const float* c, double* n) {
+  const double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  const double v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = u[1] * v[2] - u[2] * v[1];
+  n[1] = u[2] * v[0] - u[0] * v[2];
+  n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+}  // namespace
+
+float VertexCacheStats::acmr() const { return (triangles > 0) ? static_cast<float>(misses) / triangles : 0.0f; }
+
+float VertexCacheStats::atvr() const { return (vertices > 0) ? static_cast<float>(misses) / vertices : 0.0f; }
+
+void VertexCacheStats::add(const VertexCacheStats& other) {
+  triangles += other.triangles;
+  vertices += other.vertices;
+  misses += other.misses;
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t>& indices, const size_t vertex_count) {
+  VertexCacheStats stats;
+  stats.triangles = indices.size() / 3;
+
+  // A vertex is in the FIFO cache while fewer than kCacheSize misses happened since it was loaded
+  std::vector<size_t> loaded(vertex_count, 0);
+  std::vector<char> referenced(vertex_count, 0);
+  size_t timestamp = kCacheSize + 1;
+  for (uint32_t index : indices) {
+    if (timestamp - loaded[index] > kCacheSize) {
+      loaded[index] = timestamp++;
+      stats.misses++;
+    }
+    referenced[index] = 1;
+  }
+  stats.vertices = std::count(referenced.begin(), referenced.end(), 1);
+
+  return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<uint32_t>* indices, const size_t vertex_count) {
+  const size_t triangle_count = indices->size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  // Triangles of each vertex; the first remaining[v] entries are the triangles not yet emitted
+  std::vector<uint32_t> remaining(vertex_count, 0);
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    remaining[(*indices)[i]]++;
+  }
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+  std::vector<uint32_t> triangles(triangle_count * 3);
+  std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    triangles[next[(*indices)[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  std::vector<int> cache_positions(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++) {
+    vertex_scores[v] = vertexScore(-1, remaining[v]);
+  }
+
+  std::vector<float> triangle_scores(triangle_count);
+  std::vector<char> emitted(triangle_count, 0);
+  for (size_t t = 0; t < triangle_count; t++) {
+    const uint32_t* triangle = &(*indices)[t * 3];
+    triangle_scores[t] = vertex_scores[triangle[0]] + vertex_scores[triangle[1]] + vertex_scores[triangle[2]];
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(triangle_count * 3);
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> new_cache;
+  size_t best = std::max_element(triangle_scores.begin(), triangle_scores.end()) - triangle_scores.begin();
+  size_t cursor = 0;
+
+  while (result.size() < triangle_count * 3) {
+    // Dead end: no triangle of a cached vertex remains, continue with the next triangle in the input order
+    if (best == std::numeric_limits<size_t>::max()) {
+      while (emitted[cursor]) {
+        cursor++;
+      }
+      best = cursor;
+    }
+
+    const uint32_t* triangle = &(*indices)[best * 3];
+    emitted[best] = 1;
+    result.insert(result.end(), triangle, triangle + 3);
+
+    new_cache.assign(triangle, triangle + 3);
+    for (uint32_t v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        new_cache.push_back(v);
+      }
+    }
+
+    for (int k = 0; k < 3; k++) {
+      uint32_t* begin = &triangles[offsets[triangle[k]]];
+      uint32_t* end = begin + remaining[triangle[k]];
+      std::iter_swap(std::find(begin, end, static_cast<uint32_t>(best)), end - 1);
+      remaining[triangle[k]]--;
+    }
+
+    // Vertices that moved in or out of the cache change the scores of their remaining triangles
+    best = std::numeric_limits<size_t>::max();
+    float best_score = -1.0f;
+    for (size_t i = 0; i < new_cache.size(); i++) {
+      const uint32_t v = new_cache[i];
+      cache_positions[v] = (i < static_cast<size_t>(kForsythCacheSize)) ? static_cast<int>(i) : -1;
+      const float score = vertexScore(cache_positions[v], remaining[v]);
+      const float delta = score - vertex_scores[v];
+      vertex_scores[v] = score;
+
+      for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+        const uint32_t t = triangles[j];
+        triangle_scores[t] += delta;
+        if (cache_positions[v] >= 0 && triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best = t;
+        }
+      }
+    }
+
+    new_cache.resize(std::min(new_cache.size(), static_cast<size_t>(kForsythCacheSize)));
+    cache.swap(new_cache);
+  }
+
+  indices->swap(result);
+}
+
+void MeshOptimizer::optimizeOverdraw(const float* positions, const size_t vertex_count,
+                                     std::vector<uint32_t>* indices) {
+  const size_t triangle_count = indices->size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  // Clusters start at the triangles that miss all of their vertices, where the cache is refilled anyway
+  std::vector<size_t> cluster_starts;
+  std::vector<size_t> loaded(vertex_count, 0);
+  size_t timestamp = kCacheSize + 1;
+  for (size_t t = 0; t < triangle_count; t++) {
+    int misses = 0;
+    for (int k = 0; k < 3; k++) {
+      uint32_t index = (*indices)[t * 3 + k];
+      if (timestamp - loaded[index] > kCacheSize) {
+        loaded[index] = timestamp++;
+        misses++;
+      }
+    }
+    if (t == 0 || misses == 3) {
+      cluster_starts.push_back(t);
+    }
+  }
+  cluster_starts.push_back(triangle_count);
+
+  // Area-weighted centroid and normal of each cluster, and centroid of the whole mesh
+  const size_t cluster_count = cluster_starts.size() - 1;
+  std::vector<double> centroids(cluster_count * 3, 0.0);
+  std::vector<double> normals(cluster_count * 3, 0.0);
+  double mesh_centroid[3] = {0.0, 0.0, 0.0};
+  double mesh_area = 0.0;
+
+  for (size_t c = 0; c < cluster_count; c++) {
+    double area = 0.0;
+    for (size_t t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+      const float* p[3];
+      for (int k = 0; k < 3; k++) {
+        p[k] = &positions[(*indices)[t * 3 + k] * 3];
+      }
+      double n[3];
+      triangleNormal(p[0], p[1], p[2], n);
+      double triangle_area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5;
+      for (int a = 0; a < 3; a++) {
+        centroids[c * 3 + a] += (p[0][a] + p[1][a] + p[2][a]) / 3.0 * triangle_area;
+        normals[c * 3 + a] += n[a];
+      }
+      area += triangle_area;
+    }
+
+    for (int a = 0; a < 3; a++) {
+      mesh_centroid[a] += centroids[c * 3 + a];
+      centroids[c * 3 + a] /= (area > 0.0) ? area : 1.0;
+    }
+    mesh_area += area;
+  }
+  for (int a = 0; a < 3; a++) {
+    mesh_centroid[a] /= (mesh_area > 0.0) ? mesh_area : 1.0;
+  }
+
+  // Clusters that face away from the center are more likely to be in front of the others
+  std::vector<double> keys(cluster_count);
+  for (size_t c = 0; c < cluster_count; c++) {
+    const double* n = &normals[c * 3];
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    double dot = 0.0;
+    for (int a = 0; a < 3; a++) {
+      dot += (centroids[c * 3 + a] - mesh_centroid[a]) * n[a];
+    }
+    keys[c] = (length > 0.0) ? dot / length : 0.0;
+  }
+
+  std::vector<size_t> order(cluster_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+  std::vector<uint32_t> result;
+  result.reserve(triangle_count * 3);
+  for (size_t c : order) {
+    result.insert(result.end(), indices->begin() + cluster_starts[c] * 3, indices->begin() + cluster_starts[c + 1] * 3);
+  }
+  indices->swap(result);
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexFetch(std::vector<uint32_t>* indices, const size_t vertex_count) {
+  const uint32_t unused = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> remap(vertex_count, unused);
+  uint32_t next = 0;
+
+  for (uint32_t& index : *indices) {
+    if (remap[index] == unused) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+
+  for (uint32_t& vertex : remap) {
+    if (vertex == unused) {
+      vertex = next++;
+    }
+  }
+
+  return remap;
+}
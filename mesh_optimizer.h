@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef MESH_OPTIMIZER_H_
+#define MESH_OPTIMIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Post-transform vertex cache statistics of triangle indices, simulated with a FIFO cache of
+ * MeshOptimizer::kCacheSize vertices. Statistics of several meshes are added up.
+ */
+struct VertexCacheStats {
+  size_t triangles = 0; /**< Number of triangles */
+  size_t vertices = 0;  /**< Number of distinct vertices referenced by the triangles */
+  size_t misses = 0;    /**< Number of vertices transformed, that is, cache misses */
+
+  /**
+   * Gets the average cache miss ratio: transformed vertices per triangle, from 3 (no reuse) down to about 0.5.
+   *
+   * @return The ACMR, zero if there are no triangles.
+   */
+  float acmr() const;
+
+  /**
+   * Gets the average transformed vertex ratio: transformed vertices per distinct vertex, 1 at best.
+   *
+   * @return The ATVR, zero if there are no vertices.
+   */
+  float atvr() const;
+
+  /**
+   * Adds the statistics of another mesh.
+   *
+   * @param other: statistics to be added.
+   */
+  void add(const VertexCacheStats &other);
+};
+
+/**
+ * @brief Reorders the triangles and vertices of indexed meshes for the GPU: triangles are sorted for the post-transform
+ * vertex cache (Tom Forsyth's linear-speed algorithm), then clusters of them are sorted so outer triangles are drawn
+ * first and occlude the inner ones, and finally vertices are renumbered in the order they are first used, so vertex
+ * fetches walk the vertex buffer forward.
+ */
+class MeshOptimizer {
+ public:
+  /**
+   * Number of vertices of the FIFO cache used to measure the statistics and to find the clusters of optimizeOverdraw.
+   */
+  static const size_t kCacheSize = 16;
+
+  /**
+   * Simulates the post-transform vertex cache over triangle indices.
+   *
+   * @param indices: triangle indices.
+   * @param vertex_count: number of vertices.
+   *
+   * @return Statistics of the indices.
+   */
+  static VertexCacheStats analyzeVertexCache(const std::vector<uint32_t> &indices, const size_t vertex_count);
+
+  /**
+   * Reorders triangles so consecutive triangles share their vertices. The triangles keep their winding.
+   *
+   * @param indices: triangle indices, reordered in place.
+   * @param vertex_count: number of vertices.
+   */
+  static void optimizeVertexCache(std::vector<uint32_t> *indices, const size_t vertex_count);
+
+  /**
+   * Splits triangles ordered by optimizeVertexCache into clusters where the cache restarts, and sorts the clusters so
+   * the ones that face away from the center of the mesh are drawn first. The vertex cache efficiency is kept, as
+   * clusters start with a cold cache anyway.
+   *
+   * @param positions: positions (x, y, z) of the vertices.
+   * @param vertex_count: number of vertices.
+   * @param indices: triangle indices, reordered in place.
+   */
+  static void optimizeOverdraw(const float *positions, const size_t vertex_count, std::vector<uint32_t> *indices);
+
+  /**
+   * Renumbers vertices in the order they are first referenced by the indices. Unreferenced vertices are moved after
+   * the referenced ones.
+   *
+   * @param indices: triangle indices, rewritten with the new vertex numbers.
+   * @param vertex_count: number of vertices.
+   *
+   * @return New index of each vertex, indexed by its old index.
+   */
+  static std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> *indices, const size_t vertex_count);
+};
+
+#endif  // MESH_OPTIMIZER_H_
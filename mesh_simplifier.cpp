@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+/**
+ * @brief Symmetric 4x4 quadric of the squared distances to a set of planes, weighted by the area of their triangles.
+ */
+struct Quadric {
+  double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0; /**< Upper 3x3 block */
+  double b0 = 0.0, b1 = 0.0, b2 = 0.0;                                     /**< Last column */
+  double c = 0.0;                                                          /**< Constant term */
+  double weight = 0.0;                                                     /**< Sum of the weights of the planes */
+};
+
+/**
+ * @brief Candidate collapse of a vertex onto one of its neighbours.
+ */
+struct Collapse {
+  uint32_t from; /**< Vertex that is removed */
+  uint32_t to;   /**< Vertex that takes its place */
+  double cost;   /**< Mean squared distance of the merged quadric at the position of the remaining vertex */
+};
+
+/**
+ * Adds a plane to a quadric.
+ *
+ * @param n: unit normal of the plane.
+ * @param d: distance term of the plane (n . p + d = 0).
+ * @param weight: weight of the plane.
+ * @param quadric: quadric to be extended.
+ */
+inline void addPlane(const double* n, const double d, const double weight, Quadric* quadric) {
+  quadric->a00 += weight * n[0] * n[0];
+  quadric->a01 += weight * n[0] * n[1];
+  quadric->a02 += weight * n[0] * n[2];
+  quadric->a11 += weight * n[1] * n[1];
+  quadric->a12 += weight * n[1] * n[2];
+  quadric->a22 += weight * n[2] * n[2];
+  quadric->b0 += weight * n[0] * d;
+  quadric->b1 += weight * n[1] * d;
+  quadric->b2 += weight * n[2] * d;
+  quadric->c += weight * d * d;
+  quadric->weight += weight;
+}
+
+/**
+ * Adds a quadric to another.
+ *
+ * @param other: quadric to be added.
+ * @param quadric: quadric to be extended.
+ */
+inline void addQuadric(const Quadric& other, Quadric* quadric) {
+  quadric->a00 += other.a00;
+  quadric->a01 += other.a01;
+  quadric->a02 += other.a02;
+  quadric->a11 += other.a11;
+  quadric->a12 += other.a12;
+  quadric->a22 += other.a22;
+  quadric->b0 += other.b0;
+  quadric->b1 += other.b1;
+  quadric->b2 += other.b2;
+  quadric->c += other.c;
+  quadric->weight += other.weight;
+}
+
+/**
+ * Evaluates a quadric at a point.
+ *
+ * @param quadric: quadric to be evaluated.
+ * @param p: point (x, y, z).
+ *
+ * @return Mean squared distance from the point to the planes of the quadric.
+ */
+inline double quadricError(const Quadric& quadric, const float* p) {
+  const double x = p[0], y = p[1], z = p[2];
+  double error = quadric.a00 * x * x + quadric.a11 * y * y + quadric.a22 * z * z +
+                 2.0 * (quadric.a01 * x * y + quadric.a02 * x * z + quadric.a12 * y * z) +
+                 2.0 * (quadric.b0 * x + quadric.b1 * y + quadric.b2 * z) + quadric.c;
+  return (quadric.weight > 0.0) ? std::max(0.0, error / quadric.weight) : 0.0;
+}
+
+/**
+ * Computes the (non-normalized) normal of a triangle, whose length is twice its area.
+ *
+ * @param a: first corner (x, y, z).
+ * @param b: second corner (x, y, z).
+ * @param c: third corner (x, y, z).
+ * @param n: receives the normal.
+ */
+inline void triangleNormal(const float* a, const float* b, const float* c, double* n) {
+  const double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  const double v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = u[1] * v[2] - u[2] * v[1];
+  n[1] = u[2] * v[0] - u[0] * v[2];
+  n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+}  // namespace
+
+std::vector<uint32_t> MeshSimplifier::simplify(const float* positions, const size_t vertex_count,
+                                               const std::vector<uint32_t>& indices, const size_t target_index_count,
+                                               const float target_error, float* result_error) {
+  std::vector<uint32_t> result(indices.begin(), indices.end() - indices.size() % 3);
+  *result_error = 0.0f;
+  if (result.size() <= target_index_count) {
+    return result;
+  }
+
+  // A half-edge without a twin lies on an open border or on a seam, where vertices are split by their attributes
+  std::vector<uint64_t> half_edges;
+  half_edges.reserve(result.size());
+  for (size_t i = 0; i < result.size(); i += 3) {
+    for (int k = 0; k < 3; k++) {
+      half_edges.push_back(static_cast<uint64_t>(result[i + k]) << 32 | result[i + (k + 1) % 3]);
+    }
+  }
+  std::sort(half_edges.begin(), half_edges.end());
+
+  std::vector<char> locked(vertex_count, 0);
+  for (uint64_t half_edge : half_edges) {
+    uint32_t a = static_cast<uint32_t>(half_edge >> 32);
+    uint32_t b = static_cast<uint32_t>(half_edge);
+    if (!std::binary_search(half_edges.begin(), half_edges.end(), static_cast<uint64_t>(b) << 32 | a)) {
+      locked[a] = locked[b] = 1;
+    }
+  }
+
+  std::vector<Quadric> quadrics(vertex_count);
+  for (size_t i = 0; i < result.size(); i += 3) {
+    const float* p0 = &positions[result[i] * 3];
+    double n[3];
+    triangleNormal(p0, &positions[result[i + 1] * 3], &positions[result[i + 2] * 3], n);
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0) {
+      continue;
+    }
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+    double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+    for (int k = 0; k < 3; k++) {
+      addPlane(n, d, length * 0.5, &quadrics[result[i + k]]);
+    }
+  }
+
+  const double max_cost = static_cast<double>(target_error) * target_error;
+  double error = 0.0;
+  std::vector<uint32_t> remap(vertex_count);
+  std::iota(remap.begin(), remap.end(), 0);
+  std::vector<char> touched(vertex_count);
+  std::vector<uint32_t> offsets(vertex_count + 1);
+  std::vector<uint32_t> adjacency;
+
+  // Each pass collapses the cheapest edges whose neighbourhoods do not overlap, then rewrites the indices
+  while (result.size() > target_index_count) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (uint32_t index : result) {
+      offsets[index + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    adjacency.resize(result.size());
+    std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < result.size(); i++) {
+      adjacency[next[result[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // Each interior edge is seen once with its first vertex lower, and may be collapsed in both directions
+    std::vector<Collapse> collapses;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = result[i + k];
+        uint32_t b = result[i + (k + 1) % 3];
+        if (a >= b) {
+          continue;
+        }
+        for (const std::pair<uint32_t, uint32_t>& edge : {std::make_pair(a, b), std::make_pair(b, a)}) {
+          if (locked[edge.first]) {
+            continue;
+          }
+          Quadric quadric = quadrics[edge.first];
+          addQuadric(quadrics[edge.second], &quadric);
+          collapses.push_back({edge.first, edge.second, quadricError(quadric, &positions[edge.second * 3])});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+    std::fill(touched.begin(), touched.end(), 0);
+    size_t triangle_count = result.size() / 3;
+    bool collapsed = false;
+
+    for (const Collapse& collapse : collapses) {
+      if (collapse.cost > max_cost || triangle_count * 3 <= target_index_count) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to]) {
+        continue;
+      }
+
+      // Triangles that keep their area must not flip when the vertex moves
+      bool flipped = false;
+      size_t removed = 0;
+      for (uint32_t j = offsets[collapse.from]; j < offsets[collapse.from + 1] && !flipped; j++) {
+        const uint32_t* triangle = &result[adjacency[j] * 3];
+        if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+          removed++;
+          continue;
+        }
+
+        const float* before[3];
+        const float* after[3];
+        for (int k = 0; k < 3; k++) {
+          before[k] = &positions[triangle[k] * 3];
+          after[k] = &positions[(triangle[k] == collapse.from ? collapse.to : triangle[k]) * 3];
+        }
+        double n_before[3], n_after[3];
+        triangleNormal(before[0], before[1], before[2], n_before);
+        triangleNormal(after[0], after[1], after[2], n_after);
+        double before_length = n_before[0] * n_before[0] + n_before[1] * n_before[1] + n_before[2] * n_before[2];
+        flipped = before_length > 0.0 &&
+                  n_before[0] * n_after[0] + n_before[1] * n_after[1] + n_before[2] * n_after[2] <= 0.0;
+      }
+      if (flipped) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      addQuadric(quadrics[collapse.from], &quadrics[collapse.to]);
+      for (uint32_t j = offsets[collapse.from]; j < offsets[collapse.from + 1]; j++) {
+        for (int k = 0; k < 3; k++) {
+          touched[result[adjacency[j] * 3 + k]] = 1;
+        }
+      }
+
+      triangle_count -= removed;
+      error = std::max(error, collapse.cost);
+      collapsed = true;
+    }
+
+    if (!collapsed) {
+      break;
+    }
+
+    size_t output = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t a = remap[result[i]];
+      uint32_t b = remap[result[i + 1]];
+      uint32_t c = remap[result[i + 2]];
+      if (a != b && b != c && a != c) {
+        result[output++] = a;
+        result[output++] = b;
+        result[output++] = c;
+      }
+    }
+    result.resize(output);
+  }
+
+  *result_error = static_cast<float>(std::sqrt(error));
+  return result;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef MESH_SIMPLIFIER_H_
+#define MESH_SIMPLIFIER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Simplifies indexed triangle meshes by quadric-error edge collapse. Each collapse moves a vertex onto one of
+ * its neighbours, so the simplified mesh only has new indices and shares the vertices (and their attributes) of the
+ * original one. Vertices on a border of the index topology are never moved: that covers open borders and also UV and
+ * normal seams, where assimp and ObjReader split vertices that share a position.
+ */
+class MeshSimplifier {
+ public:
+  /**
+   * Simplifies a mesh until it has at most the target number of indices, or until the next collapse would exceed the
+   * target error.
+   *
+   * @param positions: positions (x, y, z) of the vertices.
+   * @param vertex_count: number of vertices.
+   * @param indices: triangle indices of the mesh.
+   * @param target_index_count: number of indices to reduce the mesh to.
+   * @param target_error: maximum error, as a distance in the units of the positions.
+   * @param result_error: receives the error of the simplified mesh, as a distance in the units of the positions.
+   *
+   * @return Triangle indices of the simplified mesh.
+   */
+  static std::vector<uint32_t> simplify(const float *positions, const size_t vertex_count,
+                                        const std::vector<uint32_t> &indices, const size_t target_index_count,
+                                        const float target_error, float *result_error);
+};
+
+#endif  // MESH_SIMPLIFIER_H_
@@ -0,0 +1,822 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "mesh_streamer.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+
+#include "bounding_box.h"
+#include "mesh_simplifier.h"
+#include "normal_generator.h"
+#include "obj_reader.h"
+#include "parallel_for.h"
+
+namespace {
+
+/** Identifies page files */
+const char kMagic[8] = {'Q', 'T', 'G', 'L', 'P', 'A', 'G', 'E'};
+
+/** Must be incremented whenever MeshPage or the layout of the page file changes */
+const uint32_t kVersion = 4;
+
+/** A coarse page is simplified to this fraction of the triangles of its full page */
+const size_t kCoarseReduction = 16;
+
+/** Number of positions spilled to the temporary file at once */
+const size_t kSpillPositions = 1 << 16;
+
+/** Number of pages read at the same time */
+const int kMaxReaders = 2;
+
+/** Number of times a page that could not be read is requested before it is left coarse */
+const int kMaxReadAttempts = 3;
+
+/** Fraction of the load progress reported while the page file is built, the rest is used to read the coarse pages */
+const float kBuildProgress = 0.9f;
+
+/** Fraction of the build progress reported while the positions are spilled */
+const float kSpillProgress = 0.25f;
+
+/** Fraction of the build progress reported while the normals are summed, the rest is used to build the pages */
+const float kNormalProgress = 0.25f;
+
+/**
+ * @brief Fixed-size header of a page file. It is followed by the pages and then by the page table, an array of
+ * page_count MeshPage.
+ */
+struct PageHeader {
+  char magic[8];         /**< Must be kMagic */
+  uint32_t version;      /**< Must be kVersion */
+  uint32_t quantized;    /**< 1 if the vertices are QuantizedVertex, 0 for PackedVertex */
+  uint64_t source_size;  /**< Size of the mesh file when the page file was written */
+  int64_t source_mtime;  /**< Modification time of the mesh file, in milliseconds since epoch */
+  uint64_t page_count;   /**< Number of pages */
+  uint64_t table_offset; /**< Offset in bytes of the page table */
+  float half_extent[3];  /**< Half extent of the bounding box of the mesh, which is centered on the origin */
+  uint32_t reserved;     /**< Zero, keeps the size of the header a multiple of 8 bytes */
+};
+
+/**
+ * @brief Runs a function on a QThreadPool.
+ */
+class Task : public QRunnable {
+ public:
+  /**
+   * Class constructor.
+   *
+   * @param function: function to be run.
+   */
+  explicit Task(const std::function<void()>& function) : function_(function) {}
+
+  /**
+   * Runs the function on a thread of the pool.
+   */
+  void run() override { function_(); }
+
+ private:
+  std::function<void()> function_; /**< Function to be run */
+};
+
+/**
+ * @brief Page built from the faces of the file, before it is written to the page file.
+ */
+struct BuiltPage {
+  MeshPage page;                                 /**< Sizes, bounding box and coarse error of the page */
+  std::vector<unsigned char> vertex_data;        /**< Full vertices, packed */
+  std::vector<uint32_t> indices;                 /**< Full indices */
+  std::vector<unsigned char> coarse_vertex_data; /**< Coarse vertices, packed */
+  std::vector<uint32_t> coarse_indices;          /**< Coarse indices */
+};
+
+/**
+ * Calls a function with the keyword and the rest of every line of an OBJ file, in file order.
+ *
+ * @param data: OBJ file contents.
+ * @param size: size in bytes of the contents.
+ * @param function: called with the keyword, its length, the first byte after it and the end of the line. Returning
+ * false stops the scan.
+ * @param progress: callback that receives the fraction of the contents scanned. Returning false stops the scan.
+ *
+ * @return False if the scan was stopped.
+ */
+template <typename Function>
+bool forEachLine(const char* data, const size_t size, Function function, const std::function<bool(float)>& progress) {
+  const char* p = data;
+  const char* end = data + size;
+  size_t lines = 0;
+
+  while (p < end) {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    const char* line_end = eol ? eol : end;
+
+    const char* keyword = p;
+    while (keyword < line_end && (*keyword == ' ' || *keyword == '\t')) {
+      keyword++;
+    }
+    const char* rest = keyword;
+    while (rest < line_end && *rest != ' ' && *rest != '\t' && *rest != '\r') {
+      rest++;
+    }
+    if (!function(keyword, static_cast<size_t>(rest - keyword), rest, line_end)) {
+      return false;
+    }
+    p = eol ? eol + 1 : end;
+
+    if ((++lines & 0xFFFF) == 0 && !progress(static_cast<float>(p - data) / size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Packs a vertex of a page, without texture coordinates.
+ *
+ * @param position: position (x, y, z) centered on the page.
+ * @param normal: unit normal (x, y, z).
+ * @param quantize: True for a QuantizedVertex, false for a PackedVertex.
+ * @param scale: half extent of the bounding box of the mesh, to quantize the positions.
+ * @param data: receives the packed vertex.
+ */
+void packVertex(const float* position, const float* normal, const bool quantize, const float* scale,
+                unsigned char* data) {
+  if (quantize) {
+    QuantizedVertex vertex;
+    for (int k = 0; k < 3; k++) {
+      vertex.position[k] = quantizeCoordinate(position[k], 0.0f, scale[k]);
+    }
+    vertex.position[3] = std::numeric_limits<int16_t>::max();
+    vertex.normal = packNormal(normal[0], normal[1], normal[2]);
+    vertex.texture_coords[0] = vertex.texture_coords[1] = 0;
+    std::memcpy(data, &vertex, sizeof(vertex));
+  } else {
+    PackedVertex vertex;
+    std::copy_n(position, 3, vertex.position);
+    vertex.normal = packNormal(normal[0], normal[1], normal[2]);
+    vertex.texture_coords[0] = vertex.texture_coords[1] = 0;
+    std::memcpy(data, &vertex, sizeof(vertex));
+  }
+}
+
+/**
+ * Builds a page from consecutive triangles of the file: the vertices it references are gathered with their normals and
+ * centered on the bounding box of the page, and a coarse page is simplified from it.
+ *
+ * @param triangles: position indices of the triangles, into the positions of the file.
+ * @param positions: positions (x, y, z) of the file.
+ * @param normal_sums: unnormalized smooth normals (x, y, z) of the positions of the file, summed over the whole mesh.
+ * @param center: center of the bounding box of the mesh.
+ * @param quantize: True to pack QuantizedVertex, false for PackedVertex.
+ * @param scale: half extent of the bounding box of the mesh.
+ *
+ * @return The page, with its geometry.
+ */
+BuiltPage buildPage(const std::vector<uint32_t>& triangles, const float* positions, const float* normal_sums,
+                    const float* center, const bool quantize, const float* scale) {
+  BuiltPage built;
+
+  // Normals were summed over the faces of every page, so vertices on the border of two pages get the same normal in
+  // both and the shading has no seams between pages
+  std::unordered_map<uint32_t, uint32_t> local_vertices;
+  local_vertices.reserve(triangles.size());
+  std::vector<float> vertices, normals;
+  built.indices.resize(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    auto inserted = local_vertices.emplace(triangles[i], static_cast<uint32_t>(local_vertices.size()));
+    if (inserted.second) {
+      const float* position = &positions[static_cast<size_t>(triangles[i]) * 3];
+      const float* sum = &normal_sums[static_cast<size_t>(triangles[i]) * 3];
+      const float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+      for (int k = 0; k < 3; k++) {
+        vertices.push_back(position[k] - center[k]);
+        normals.push_back((length > 0.0f) ? sum[k] / length : 0.0f);
+      }
+    }
+    built.indices[i] = inserted.first->second;
+  }
+  const size_t vertex_count = vertices.size() / 3;
+
+  // Each page is centered on its own bounding box, like the mesh ranges of a loaded scene, so its center is the
+  // translation of its instance. The page stays inside the box of the mesh, so it is quantized with the same scale
+  MeshPage& page = built.page;
+  const float lowest = std::numeric_limits<float>::lowest();
+  std::fill_n(page.bounds_min, 3, std::numeric_limits<float>::max());
+  std::fill_n(page.bounds_max, 3, lowest);
+  extendBoundingBox(vertices.data(), vertex_count, page.bounds_min, page.bounds_max);
+  for (size_t i = 0; i < vertices.size(); i++) {
+    vertices[i] -= (page.bounds_min[i % 3] + page.bounds_max[i % 3]) / 2.0f;
+  }
+
+  // The coarse page keeps the vertices on the border of the page, so neighbouring coarse and full pages stay closed.
+  // Pages too small to be simplified are their own coarse page
+  float error = 0.0f;
+  const size_t target_index_count = built.indices.size() / kCoarseReduction / 3 * 3;
+  if (target_index_count == 0) {
+    built.coarse_indices = built.indices;
+  } else {
+    built.coarse_indices = MeshSimplifier::simplify(vertices.data(), vertex_count, built.indices, target_index_count,
+                                                    std::numeric_limits<float>::max(), &error);
+  }
+  if (built.coarse_indices.empty()) {
+    float diagonal[3] = {page.bounds_max[0] - page.bounds_min[0], page.bounds_max[1] - page.bounds_min[1],
+                         page.bounds_max[2] - page.bounds_min[2]};
+    error = std::sqrt(diagonal[0] * diagonal[0] + diagonal[1] * diagonal[1] + diagonal[2] * diagonal[2]);
+  }
+  page.coarse_error = error;
+
+  // Coarse vertices are compacted, so the coarse pages of the whole mesh fit in memory
+  const size_t stride = quantize ? sizeof(QuantizedVertex) : sizeof(PackedVertex);
+  std::vector<uint32_t> coarse_remap(vertex_count, std::numeric_limits<uint32_t>::max());
+  uint32_t coarse_count = 0;
+  for (uint32_t& index : built.coarse_indices) {
+    if (coarse_remap[index] == std::numeric_limits<uint32_t>::max()) {
+      coarse_remap[index] = coarse_count++;
+      built.coarse_vertex_data.resize(coarse_count * stride);
+      packVertex(&vertices[index * 3], &normals[index * 3], quantize, scale,
+                 &built.coarse_vertex_data[(coarse_count - 1) * stride]);
+    }
+    index = coarse_remap[index];
+  }
+
+  built.vertex_data.resize(vertex_count * stride);
+  for (size_t i = 0; i < vertex_count; i++) {
+    packVertex(&vertices[i * 3], &normals[i * 3], quantize, scale, &built.vertex_data[i * stride]);
+  }
+
+  page.vertex_count = static_cast<uint32_t>(vertex_count);
+  page.index_count = static_cast<uint32_t>(built.indices.size());
+  page.coarse_vertices = coarse_count;
+  page.coarse_indices = static_cast<uint32_t>(built.coarse_indices.size());
+  return built;
+}
+
+/**
+ * Checks that triangle indices reference existing vertices.
+ *
+ * @param indices: triangle indices.
+ * @param count: number of indices.
+ * @param vertex_count: number of vertices.
+ *
+ * @return True if every index is below the number of vertices.
+ */
+bool validIndices(const uint32_t* indices, const size_t count, const size_t vertex_count) {
+  return std::all_of(indices, indices + count, [vertex_count](uint32_t index) { return index < vertex_count; });
+}
+
+}  // namespace
+
+const size_t MeshStreamer::kPageTriangles;
+
+bool MeshStreamer::load(const QString& filename, const SceneLoadOptions& options, SceneData* scene,
+                        const ProgressCallback& progress) {
+  auto report = [&progress](float value) { return !progress || progress(value); };
+
+  std::vector<MeshPage> pages;
+  *scene = SceneData();
+  if (!readPageTable(filename, options, &pages, scene)) {
+    auto build_progress = [&report](float value) { return report(value * kBuildProgress); };
+    if (!build(filename, options, build_progress) || !readPageTable(filename, options, &pages, scene)) {
+      *scene = SceneData();
+      return false;
+    }
+  }
+
+  const QString page_filename = pageFilename(filename, options);
+  QFile file(page_filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    *scene = SceneData();
+    return false;
+  }
+
+  // Only the coarse pages are read, each one becomes a mesh range with a single instance
+  const size_t stride = scene->vertex_layout.stride;
+  size_t vertex_count = 0;
+  size_t index_size = 0;
+  for (const MeshPage& page : pages) {
+    vertex_count += page.coarse_vertices;
+    index_size += page.coarse_indices * sizeof(GLuint);
+  }
+  scene->vertex_data.resize(vertex_count * stride);
+  scene->index_data.reserve(index_size);
+  scene->mesh_ranges.resize(pages.size());
+  scene->instances.resize(pages.size());
+
+  SceneNode root;
+  root.name = QFileInfo(filename).baseName();
+  size_t base_vertex = 0;
+  std::vector<uint32_t> indices;
+  for (size_t i = 0; i < pages.size(); i++) {
+    const MeshPage& page = pages[i];
+    const uint64_t coarse_offset = page.offset + page.vertex_count * stride + page.index_count * sizeof(uint32_t);
+    indices.resize(page.coarse_indices);
+
+    const qint64 vertex_bytes = static_cast<qint64>(page.coarse_vertices * stride);
+    const qint64 index_bytes = static_cast<qint64>(indices.size() * sizeof(uint32_t));
+    if (!file.seek(coarse_offset) ||
+        file.read(reinterpret_cast<char*>(&scene->vertex_data[base_vertex * stride]), vertex_bytes) != vertex_bytes ||
+        file.read(reinterpret_cast<char*>(indices.data()), index_bytes) != index_bytes ||
+        !validIndices(indices.data(), indices.size(), page.coarse_vertices)) {
+      qWarning() << "Corrupt page file" << page_filename;
+      QFile::remove(page_filename);
+      *scene = SceneData();
+      return false;
+    }
+
+    // Coarse pages are small enough for 16-bit indices, unless the simplification kept most of the page
+    MeshRange& range = scene->mesh_ranges[i];
+    range.base_vertex = base_vertex;
+    range.vertex_count = page.coarse_vertices;
+    range.index_offset = (scene->index_data.size() + 3) & ~static_cast<size_t>(3);
+    range.index_count = indices.size();
+    range.index_type = (page.coarse_vertices <= 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    range.instance_offset = i;
+    range.instance_count = 1;
+    const QVector3D bounds_min(page.bounds_min[0], page.bounds_min[1], page.bounds_min[2]);
+    const QVector3D bounds_max(page.bounds_max[0], page.bounds_max[1], page.bounds_max[2]);
+    const QVector3D center = (bounds_min + bounds_max) / 2.0;
+    range.bounds_min = bounds_min - center;
+    range.bounds_max = bounds_max - center;
+
+    scene->index_data.resize(range.index_offset);
+    if (range.index_type == GL_UNSIGNED_SHORT) {
+      for (uint32_t index : indices) {
+        GLushort value = static_cast<GLushort>(index);
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        scene->index_data.insert(scene->index_data.end(), bytes, bytes + sizeof(value));
+      }
+    } else {
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(indices.data());
+      scene->index_data.insert(scene->index_data.end(), bytes, bytes + index_bytes);
+    }
+
+    MeshLod coarse;
+    coarse.index_offset = range.index_offset;
+    coarse.index_count = range.index_count;
+    coarse.error = page.coarse_error;
+    range.lods.push_back(coarse);
+
+    // The vertices of a page are centered on it, and its instance moves them back into the mesh
+    MeshInstance& instance = scene->instances[i];
+    instance.range = i;
+    instance.node = 0;
+    instance.transform.translate(center);
+    root.instances.push_back(i);
+
+    base_vertex += page.coarse_vertices;
+    if ((i & 0xFF) == 0 && !report(kBuildProgress + (1.0f - kBuildProgress) * i / pages.size())) {
+      *scene = SceneData();
+      return false;
+    }
+  }
+
+  scene->filename = filename;
+  scene->nodes.push_back(root);
+  scene->materials.push_back(Material());
+  scene->draw_order.resize(pages.size());
+  std::iota(scene->draw_order.begin(), scene->draw_order.end(), 0);
+  scene->indexed = true;
+  scene->has_normals = !pages.empty();
+  scene->read_by_obj_reader = true;
+  scene->streamer.reset(new MeshStreamer(page_filename, stride, pages, options.stream_budget));
+
+  return report(1.0f);
+}
+
+QString MeshStreamer::pageFilename(const QString& filename, const SceneLoadOptions& options) {
+  QString key = QFileInfo(filename).absoluteFilePath() + (options.quantize_positions ? "/quantized" : "/packed");
+  QString hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/pages/" + hash + ".pages";
+}
+
+MeshStreamer::MeshStreamer(const QString& filename, const size_t stride, const std::vector<MeshPage>& pages,
+                           const size_t memory_budget)
+    : filename_(filename), stride_(stride), pages_(pages), memory_budget_(memory_budget), read_failures_(pages.size()) {
+  thread_pool_.setMaxThreadCount(kMaxReaders);
+}
+
+MeshStreamer::~MeshStreamer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.clear();
+  }
+  thread_pool_.waitForDone();
+}
+
+size_t MeshStreamer::pageCount() const { return pages_.size(); }
+
+const MeshPage& MeshStreamer::page(const size_t page) const { return pages_[page]; }
+
+void MeshStreamer::maxPageSize(size_t* vertex_bytes, size_t* index_bytes) const {
+  *vertex_bytes = 0;
+  *index_bytes = 0;
+  for (const MeshPage& page : pages_) {
+    *vertex_bytes = std::max(*vertex_bytes, page.vertex_count * stride_);
+    *index_bytes = std::max(*index_bytes, page.index_count * sizeof(uint32_t));
+  }
+}
+
+size_t MeshStreamer::memoryBudget() const { return memory_budget_; }
+
+void MeshStreamer::setReadyCallback(const ReadyCallback& callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ready_callback_ = callback;
+}
+
+void MeshStreamer::request(const std::vector<size_t>& pages) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::set<size_t> ready;
+  for (const PageData& data : ready_) {
+    ready.insert(data.page);
+  }
+
+  // Pages that are no longer needed are dropped before they are read
+  pending_.clear();
+  for (size_t page : pages) {
+    if (page < pages_.size() && reading_.count(page) == 0 && ready.count(page) == 0 &&
+        read_failures_[page] < kMaxReadAttempts) {
+      pending_.push_back(page);
+    }
+  }
+
+  while (readers_ < kMaxReaders && static_cast<size_t>(readers_) < pending_.size()) {
+    readers_++;
+    thread_pool_.start(new Task([this]() { readPages(); }));
+  }
+}
+
+std::vector<PageData> MeshStreamer::takeReady(const size_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  size_t bytes = 0;
+  size_t count = 0;
+  while (count < ready_.size() && (count == 0 || bytes < max_bytes)) {
+    bytes += ready_[count].vertex_data.size() + ready_[count].index_data.size();
+    count++;
+  }
+
+  std::vector<PageData> result(std::make_move_iterator(ready_.begin()),
+                               std::make_move_iterator(ready_.begin() + count));
+  ready_.erase(ready_.begin(), ready_.begin() + count);
+  return result;
+}
+
+bool MeshStreamer::hasReady() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !ready_.empty();
+}
+
+bool MeshStreamer::isIdle() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.empty() && reading_.empty() && ready_.empty();
+}
+
+bool MeshStreamer::isReadable(const size_t page) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return page < pages_.size() && read_failures_[page] < kMaxReadAttempts;
+}
+
+bool MeshStreamer::build(const QString& filename, const SceneLoadOptions& options, const ProgressCallback& progress) {
+  QFileInfo source(filename);
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+    return false;
+  }
+
+  // The file is memory mapped, so the system pages it in and out as it is scanned
+  uchar* mapped = file.map(0, file.size());
+  if (!mapped) {
+    qWarning() << "Could not map" << filename << "for streaming.";
+    return false;
+  }
+  const char* data = reinterpret_cast<const char*>(mapped);
+  const size_t size = static_cast<size_t>(file.size());
+
+  const QString page_filename = pageFilename(filename, options);
+  if (!QDir().mkpath(QFileInfo(page_filename).absolutePath())) {
+    return false;
+  }
+  auto report = [&progress](float value) { return !progress || progress(value); };
+
+  // First pass: the positions are spilled to a temporary file, which is then memory mapped
+  QTemporaryFile positions_file(QFileInfo(page_filename).absolutePath() + "/positions-XXXXXX");
+  if (!positions_file.open()) {
+    return false;
+  }
+
+  std::vector<float> spill;
+  spill.reserve(kSpillPositions * 3);
+  float min[3], max[3];
+  std::fill_n(min, 3, std::numeric_limits<float>::max());
+  std::fill_n(max, 3, std::numeric_limits<float>::lowest());
+  size_t vertex_count = 0;
+  bool spilled = true;
+
+  auto flush_positions = [&]() {
+    extendBoundingBox(spill.data(), spill.size() / 3, min, max);
+    const qint64 bytes = static_cast<qint64>(spill.size() * sizeof(float));
+    spilled &= (positions_file.write(reinterpret_cast<const char*>(spill.data()), bytes) == bytes);
+    spill.clear();
+  };
+
+  bool success = forEachLine(
+      data, size,
+      [&](const char* keyword, size_t length, const char* rest, const char* end) {
+        if (length != 1 || keyword[0] != 'v') {
+          return true;
+        }
+        float position[3];
+        if (!ObjReader::parsePosition(rest, end, position)) {
+          return false;
+        }
+        spill.insert(spill.end(), position, position + 3);
+        vertex_count++;
+        if (spill.size() == kSpillPositions * 3) {
+          flush_positions();
+        }
+        return spilled;
+      },
+      [&report](float value) { return report(value * kSpillProgress); });
+  flush_positions();
+
+  if (!success || !spilled || vertex_count == 0 || vertex_count > std::numeric_limits<uint32_t>::max() ||
+      !positions_file.flush()) {
+    file.unmap(mapped);
+    return false;
+  }
+
+  uchar* positions_mapped = positions_file.map(0, vertex_count * 3 * sizeof(float));
+  if (!positions_mapped) {
+    file.unmap(mapped);
+    return false;
+  }
+  const float* positions = reinterpret_cast<const float*>(positions_mapped);
+  const size_t batch_size = std::max(1u, std::thread::hardware_concurrency());
+
+  // Second pass: the weighted normals of the faces are summed into another memory mapped temporary file, a batch of
+  // faces at a time, so the pages get the smooth normals of the whole mesh instead of the normals of their own faces
+  QTemporaryFile normals_file(QFileInfo(page_filename).absolutePath() + "/normals-XXXXXX");
+  const qint64 normal_bytes = static_cast<qint64>(vertex_count * 3 * sizeof(float));
+  uchar* normals_mapped = NULL;
+  if (normals_file.open() && normals_file.resize(normal_bytes)) {
+    normals_mapped = normals_file.map(0, normal_bytes);
+  }
+  if (!normals_mapped) {
+    positions_file.unmap(positions_mapped);
+    file.unmap(mapped);
+    return false;
+  }
+  float* normal_sums = reinterpret_cast<float*>(normals_mapped);
+
+  std::vector<uint32_t> faces;
+  std::vector<uint32_t> face;
+  size_t face_vertices = 0;
+  success = forEachLine(
+      data, size,
+      [&](const char* keyword, size_t length, const char* rest, const char* end) {
+        if (length == 1 && keyword[0] == 'v') {
+          face_vertices++;
+        } else if (length == 1 && keyword[0] == 'f') {
+          face.clear();
+          if (ObjReader::parseFacePositions(rest, end, face_vertices, &face) < 0) {
+            return false;
+          }
+          faces.insert(faces.end(), face.begin(), face.end());
+          if (faces.size() >= kPageTriangles * 3 * batch_size) {
+            NormalGenerator::accumulate(positions, faces.data(), faces.size(), normal_sums);
+            faces.clear();
+          }
+        }
+        return true;
+      },
+      [&report](float value) { return report(kSpillProgress + kNormalProgress * value); });
+  NormalGenerator::accumulate(positions, faces.data(), faces.size(), normal_sums);
+  std::vector<uint32_t>().swap(faces);
+
+  if (!success) {
+    normals_file.unmap(normals_mapped);
+    positions_file.unmap(positions_mapped);
+    file.unmap(mapped);
+    return false;
+  }
+
+  const float center[3] = {(min[0] + max[0]) / 2.0f, (min[1] + max[1]) / 2.0f, (min[2] + max[2]) / 2.0f};
+  const float half_extent[3] = {(max[0] - min[0]) / 2.0f, (max[1] - min[1]) / 2.0f, (max[2] - min[2]) / 2.0f};
+  const bool quantize = options.quantize_positions;
+
+  PageHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.quantized = quantize ? 1 : 0;
+  header.source_size = source.size();
+  header.source_mtime = source.lastModified().toMSecsSinceEpoch();
+  std::copy_n(half_extent, 3, header.half_extent);
+
+  // The page file is written to a temporary file and renamed, so readers never see a partial page file
+  QSaveFile page_file(page_filename);
+  if (!page_file.open(QIODevice::WriteOnly)) {
+    normals_file.unmap(normals_mapped);
+    positions_file.unmap(positions_mapped);
+    file.unmap(mapped);
+    return false;
+  }
+  page_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // Third pass: faces are grouped into pages in file order, and a batch of pages is built in parallel while the
+  // scan is stopped, so only a batch of pages is held in memory
+  std::vector<MeshPage> pages;
+  std::vector<std::vector<uint32_t>> batch(1);
+
+  auto write_batch = [&]() {
+    std::vector<BuiltPage> built(batch.size());
+    parallelFor(batch.size(), [&](size_t i) {
+      built[i] = buildPage(batch[i], positions, normal_sums, center, quantize, half_extent);
+    });
+    for (BuiltPage& page : built) {
+      page.page.offset = static_cast<uint64_t>(page_file.pos());
+      page_file.write(reinterpret_cast<const char*>(page.vertex_data.data()), page.vertex_data.size());
+      page_file.write(reinterpret_cast<const char*>(page.indices.data()), page.indices.size() * sizeof(uint32_t));
+      page_file.write(reinterpret_cast<const char*>(page.coarse_vertex_data.data()), page.coarse_vertex_data.size());
+      page_file.write(reinterpret_cast<const char*>(page.coarse_indices.data()),
+                      page.coarse_indices.size() * sizeof(uint32_t));
+      pages.push_back(page.page);
+    }
+    batch.assign(1, std::vector<uint32_t>());
+  };
+
+  // Polygons are never split across pages, a page is closed before a face that would not fit in it
+  face_vertices = 0;
+  success = forEachLine(
+      data, size,
+      [&](const char* keyword, size_t length, const char* rest, const char* end) {
+        if (length == 1 && keyword[0] == 'v') {
+          face_vertices++;
+        } else if (length == 1 && keyword[0] == 'f') {
+          face.clear();
+          if (ObjReader::parseFacePositions(rest, end, face_vertices, &face) < 0 || face.size() > kPageTriangles * 3) {
+            return false;
+          }
+          if (batch.back().size() + face.size() > kPageTriangles * 3) {
+            batch.emplace_back();
+            if (batch.size() > batch_size) {
+              batch.pop_back();
+              write_batch();
+            }
+          }
+          batch.back().insert(batch.back().end(), face.begin(), face.end());
+        }
+        return true;
+      },
+      [&report](float value) {
+        return report(kSpillProgress + kNormalProgress + (1.0f - kSpillProgress - kNormalProgress) * value);
+      });
+
+  if (success) {
+    if (batch.back().empty()) {
+      batch.pop_back();
+    }
+    if (!batch.empty()) {
+      write_batch();
+    }
+  }
+
+  normals_file.unmap(normals_mapped);
+  positions_file.unmap(positions_mapped);
+  file.unmap(mapped);
+  if (!success || pages.empty()) {
+    page_file.cancelWriting();
+    return false;
+  }
+
+  header.page_count = pages.size();
+  header.table_offset = static_cast<uint64_t>(page_file.pos());
+  page_file.write(reinterpret_cast<const char*>(pages.data()), pages.size() * sizeof(MeshPage));
+  page_file.seek(0);
+  page_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  if (!page_file.commit()) {
+    qWarning() << "Could not write page file" << page_filename;
+    return false;
+  }
+  return true;
+}
+
+bool MeshStreamer::readPageTable(const QString& filename, const SceneLoadOptions& options,
+                                 std::vector<MeshPage>* pages, SceneData* scene) {
+  QFileInfo source(filename);
+  QFile file(pageFilename(filename, options));
+  if (!source.exists() || !file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  PageHeader header;
+  const uint64_t size = static_cast<uint64_t>(file.size());
+  if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+      header.quantized != (options.quantize_positions ? 1u : 0u) ||
+      header.source_size != static_cast<uint64_t>(source.size()) ||
+      header.source_mtime != source.lastModified().toMSecsSinceEpoch() || header.table_offset > size ||
+      header.page_count > size / sizeof(MeshPage) ||
+      header.table_offset + header.page_count * sizeof(MeshPage) != size) {
+    return false;
+  }
+
+  pages->resize(header.page_count);
+  const qint64 table_bytes = static_cast<qint64>(pages->size() * sizeof(MeshPage));
+  if (!file.seek(header.table_offset) ||
+      file.read(reinterpret_cast<char*>(pages->data()), table_bytes) != table_bytes) {
+    return false;
+  }
+
+  scene->vertex_layout =
+      options.quantize_positions ? vertexLayoutInfo<QuantizedVertex>() : vertexLayoutInfo<PackedVertex>();
+  const uint64_t stride = scene->vertex_layout.stride;
+  for (const MeshPage& page : *pages) {
+    uint64_t page_size = (static_cast<uint64_t>(page.vertex_count) + page.coarse_vertices) * stride +
+                         (static_cast<uint64_t>(page.index_count) + page.coarse_indices) * sizeof(uint32_t);
+    if (page.offset < sizeof(header) || page.offset + page_size > header.table_offset ||
+        page.index_count > kPageTriangles * 3 || page.coarse_vertices > page.vertex_count) {
+      return false;
+    }
+  }
+
+  const QVector3D half_extent(header.half_extent[0], header.half_extent[1], header.half_extent[2]);
+  scene->scene_min = -half_extent;
+  scene->scene_max = half_extent;
+  scene->position_offset = QVector3D(0, 0, 0);
+  scene->position_scale = options.quantize_positions ? half_extent : QVector3D(1, 1, 1);
+  return true;
+}
+
+void MeshStreamer::readPages() {
+  while (true) {
+    size_t page = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (pending_.empty()) {
+        readers_--;
+        return;
+      }
+      page = pending_.front();
+      pending_.pop_front();
+      reading_.insert(page);
+    }
+
+    PageData data;
+    bool success = readPage(page, &data);
+    if (!success) {
+      qWarning() << "Could not read page" << page << "of" << filename_;
+    }
+
+    // A failed page is also reported, so a frame requests it again once the streamer is idle
+    ReadyCallback callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      reading_.erase(page);
+      if (success) {
+        ready_.push_back(std::move(data));
+      } else {
+        read_failures_[page]++;
+      }
+      callback = ready_callback_;
+    }
+    if (callback) {
+      callback();
+    }
+  }
+}
+
+bool MeshStreamer::readPage(const size_t page, PageData* data) const {
+  const MeshPage& info = pages_[page];
+  QFile file(filename_);
+  if (!file.open(QIODevice::ReadOnly) || !file.seek(info.offset)) {
+    return false;
+  }
+
+  data->page = page;
+  data->vertex_data.resize(info.vertex_count * stride_);
+  data->index_data.resize(info.index_count * sizeof(uint32_t));
+  const qint64 vertex_bytes = static_cast<qint64>(data->vertex_data.size());
+  const qint64 index_bytes = static_cast<qint64>(data->index_data.size());
+  return file.read(reinterpret_cast<char*>(data->vertex_data.data()), vertex_bytes) == vertex_bytes &&
+         file.read(reinterpret_cast<char*>(data->index_data.data()), index_bytes) == index_bytes &&
+         validIndices(reinterpret_cast<const uint32_t*>(data->index_data.data()), info.index_count, info.vertex_count);
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef MESH_STREAMER_H_
+#define MESH_STREAMER_H_
+
+#include <QString>
+#include <QThreadPool>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "scene_loader.h"
+
+/**
+ * @brief Location of a page in the page file. The full geometry of a page (vertices, then 32-bit indices) is stored
+ * at its offset, followed by its coarse geometry.
+ */
+struct MeshPage {
+  uint64_t offset = 0;          /**< Offset in bytes of the full vertices of the page in the page file */
+  uint32_t vertex_count = 0;    /**< Number of vertices of the full page */
+  uint32_t index_count = 0;     /**< Number of indices of the full page */
+  uint32_t coarse_vertices = 0; /**< Number of vertices of the coarse page */
+  uint32_t coarse_indices = 0;  /**< Number of indices of the coarse page */
+  float bounds_min[3];          /**< Minimum point of the bounding box of the page, in the centered mesh */
+  float bounds_max[3];          /**< Maximum point of the bounding box of the page, in the centered mesh */
+  float coarse_error = 0.0f;    /**< Geometric error of the coarse page, in the units of the packed vertices */
+};
+
+/**
+ * @brief Full geometry of a page read from the page file, ready to be uploaded.
+ */
+struct PageData {
+  size_t page = 0;                        /**< Index of the page, which is also its mesh range */
+  std::vector<unsigned char> vertex_data; /**< Interleaved vertices, in the vertex layout of the scene */
+  std::vector<unsigned char> index_data;  /**< 32-bit triangle indices, relative to the first vertex of the page */
+};
+
+/**
+ * @brief Out-of-core loader of meshes larger than the memory. An OBJ file is converted once, in file order and without
+ * holding its geometry in memory, into a page file in the application cache: each page is a cluster of up to
+ * kPageTriangles consecutive triangles with its own vertices, stored at full resolution and as a coarse simplified
+ * version. Loading a streamed scene only reads the coarse pages, one mesh range per page, so the mesh is shown at once;
+ * the full pages the camera needs are then read on a thread pool, in priority order, and uploaded by SceneResources
+ * into a pool of GPU slots that holds at most the memory budget. The positions of the file, and the smooth normals
+ * summed over all of its faces, are spilled to memory mapped temporary files while it is converted, so only the pages
+ * being built are held in memory. Only positions and faces are read: normals are generated, and materials and texture
+ * coordinates are ignored. All methods but load are thread safe.
+ */
+class MeshStreamer {
+ public:
+  /**
+   * Callback called from a reading thread when a requested page is ready or failed to be read.
+   */
+  using ReadyCallback = std::function<void()>;
+
+  /**
+   * Callback that receives the load progress in [0, 1]. Returning false cancels the load.
+   */
+  using ProgressCallback = std::function<bool(float)>;
+
+  /** Maximum number of triangles of a page */
+  static const size_t kPageTriangles = 1 << 15;
+
+  /**
+   * Loads the coarse pages of a mesh file into a scene, converting the file into a page file first when it has no
+   * valid one. Each page becomes a mesh range with a single instance, whose indices are the coarse page and whose
+   * only level of detail is the coarse page with its error, so the renderer selects the full page (level 0) wherever
+   * the coarse one is not precise enough. The vertices of a page are centered on its bounding box and its instance is
+   * translated to the center of the page. The streamer of the pages is set to the scene.
+   *
+   * @param filename: path to the OBJ file.
+   * @param options: options used to build the geometry, stream_budget included.
+   * @param scene: receives the coarse scene.
+   * @param progress: optional callback to report progress and to cancel the load.
+   *
+   * @return True if the pages were loaded successfully (and were not cancelled).
+   */
+  static bool load(const QString &filename, const SceneLoadOptions &options, SceneData *scene,
+                   const ProgressCallback &progress = ProgressCallback());
+
+  /**
+   * Gets the page file of a mesh file.
+   *
+   * @param filename: path to the mesh file.
+   * @param options: options used to build the geometry.
+   *
+   * @return Path to the page file, inside the application cache directory.
+   */
+  static QString pageFilename(const QString &filename, const SceneLoadOptions &options);
+
+  /**
+   * Destructor of the class. Waits for the pages being read.
+   */
+  ~MeshStreamer();
+
+  /**
+   * Gets the number of pages.
+   *
+   * @return Number of pages, which is also the number of mesh ranges of the scene.
+   */
+  size_t pageCount() const;
+
+  /**
+   * Gets a page.
+   *
+   * @param page: index of the page.
+   *
+   * @return Location and size of the page.
+   */
+  const MeshPage &page(const size_t page) const;
+
+  /**
+   * Gets the size of the largest page, the size of a slot of the page pool.
+   *
+   * @param vertex_bytes: receives the size in bytes of the largest full vertices.
+   * @param index_bytes: receives the size in bytes of the largest full indices.
+   */
+  void maxPageSize(size_t *vertex_bytes, size_t *index_bytes) const;
+
+  /**
+   * Gets the memory budget of the resident full pages.
+   *
+   * @return Memory budget, in bytes.
+   */
+  size_t memoryBudget() const;
+
+  /**
+   * Sets the callback called when a requested page is ready.
+   *
+   * @param callback: function called from the reading thread.
+   */
+  void setReadyCallback(const ReadyCallback &callback);
+
+  /**
+   * Replaces the pages to be read. Pages already being read are kept, the others are read in the given order.
+   *
+   * @param pages: indices of the pages, from the highest priority to the lowest.
+   */
+  void request(const std::vector<size_t> &pages);
+
+  /**
+   * Takes the requested pages that are ready, in the order they became ready.
+   *
+   * @param max_bytes: size in bytes after which no more pages are taken. At least one page is taken.
+   *
+   * @return The ready pages.
+   */
+  std::vector<PageData> takeReady(const size_t max_bytes);
+
+  /**
+   * Gets whether requested pages are ready to be taken.
+   *
+   * @return True if takeReady would return pages.
+   */
+  bool hasReady() const;
+
+  /**
+   * Gets whether no page is waiting to be read, being read or ready to be taken.
+   *
+   * @return True if the streamer has no work left.
+   */
+  bool isIdle() const;
+
+  /**
+   * Gets whether a page may still be requested. Pages that failed to be read several times are not read again.
+   *
+   * @param page: index of the page.
+   *
+   * @return True if the page may be read.
+   */
+  bool isReadable(const size_t page) const;
+
+ private:
+  /**
+   * Class constructor, called by load once the page file is valid.
+   *
+   * @param filename: path to the page file.
+   * @param stride: size in bytes of a vertex of the pages.
+   * @param pages: pages of the page file.
+   * @param memory_budget: memory budget of the resident full pages, in bytes.
+   */
+  MeshStreamer(const QString &filename, const size_t stride, const std::vector<MeshPage> &pages,
+               const size_t memory_budget);
+
+  /**
+   * Converts an OBJ file into a page file, in three passes over the memory mapped file: the first one spills the
+   * positions to a temporary file, the second one sums the normals of the faces into another one, and the third one
+   * groups the faces into pages in file order and builds batches of pages in parallel.
+   *
+   * @param filename: path to the OBJ file.
+   * @param options: options used to build the geometry.
+   * @param progress: optional callback to report progress and to cancel the conversion.
+   *
+   * @return True if the page file was written.
+   */
+  static bool build(const QString &filename, const SceneLoadOptions &options, const ProgressCallback &progress);
+
+  /**
+   * Reads the pages of a page file and checks that it is valid and up to date.
+   *
+   * @param filename: path to the OBJ file.
+   * @param options: options used to build the geometry.
+   * @param pages: receives the pages.
+   * @param scene: receives the bounding box and the dequantization of the positions.
+   *
+   * @return True if the page file is valid.
+   */
+  static bool readPageTable(const QString &filename, const SceneLoadOptions &options, std::vector<MeshPage> *pages,
+                            SceneData *scene);
+
+  /**
+   * Reads pages requested and not read yet until there are none left. Runs on the thread pool.
+   */
+  void readPages();
+
+  /**
+   * Reads the full geometry of a page from the page file.
+   *
+   * @param page: index of the page.
+   * @param data: receives the geometry.
+   *
+   * @return True if the page was read.
+   */
+  bool readPage(const size_t page, PageData *data) const;
+
+  QString filename_;            /**< Path to the page file */
+  size_t stride_ = 0;           /**< Size in bytes of a vertex of the pages */
+  std::vector<MeshPage> pages_; /**< Pages of the page file */
+  size_t memory_budget_ = 0;    /**< Size in bytes of the full pages that may be resident */
+
+  mutable std::mutex mutex_; /**< Guards every member below */
+
+  std::deque<size_t> pending_;     /**< Requested pages not being read yet, by priority */
+  std::set<size_t> reading_;       /**< Pages being read */
+  std::vector<PageData> ready_;    /**< Requested pages ready to be taken */
+  std::vector<int> read_failures_; /**< Number of failed reads of each page */
+  int readers_ = 0;                /**< Number of tasks reading pages on the thread pool */
+  ReadyCallback ready_callback_;   /**< Called when a requested page is ready or failed to be read */
+
+  QThreadPool thread_pool_; /**< Reads the requested pages */
+};
+
+#endif  // MESH_STREAMER_H_
@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "normal_generator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+
+#include "bounding_box.h"
+#include "parallel_for.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define NORMAL_GENERATOR_SSE 1
+#endif
+
+namespace {
+
+/** Faces (with their corners) or vertices handled by each task */
+const size_t kTaskSize = 1 << 16;
+
+/** Vertices with more faces are not split at creases, since every pair of their faces would be compared */
+const size_t kMaxCreaseFaces = 1024;
+
+const float kPi = 3.14159265f;
+
+/** Bits per axis of the grid over the bounding box on which vertices at the same position are welded */
+const int kWeldBits = 20;
+
+/**
+ * Sets the angles of the corners of a triangle. The angles of a triangle add up to pi, so the third one is not
+ * computed.
+ *
+ * @param length: length of the cross product of two edges of the triangle.
+ * @param dot_a: dot product of the two edges that leave the first corner.
+ * @param dot_b: dot product of the two edges that leave the second corner.
+ * @param angles: receives the angles of the three corners, in radians.
+ */
+inline void setCornerAngles(const float length, const float dot_a, const float dot_b, float* angles) {
+  angles[0] = std::atan2(length, dot_a);
+  angles[1] = std::atan2(length, dot_b);
+  angles[2] = std::max(0.0f, kPi - angles[0] - angles[1]);
+}
+
+#ifdef NORMAL_GENERATOR_SSE
+/**
+ * Computes atan2(y, x) of four lanes for y >= 0, with an error below 1e-5 radians: the arctangent of the ratio of the
+ * smaller to the larger of |x| and y is approximated by a polynomial, then mirrored into [0, pi].
+ *
+ * @param y: non-negative sines, or any multiple of them.
+ * @param x: cosines, with the same scale as the sines.
+ *
+ * @return Angles in [0, pi].
+ */
+inline __m128 atan2Positive(const __m128 y, const __m128 x) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 abs_x = _mm_andnot_ps(sign, x);
+  const __m128 larger = _mm_max_ps(_mm_max_ps(abs_x, y), _mm_set1_ps(std::numeric_limits<float>::min()));
+  const __m128 a = _mm_div_ps(_mm_min_ps(abs_x, y), larger);
+  const __m128 s = _mm_mul_ps(a, a);
+
+  __m128 r = _mm_set1_ps(-0.01172120f);
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.05265332f));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.11643287f));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.19354346f));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.33262347f));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.99997726f));
+  r = _mm_mul_ps(r, a);
+
+  // Angles above pi / 4 mirror around it, and negative cosines around pi / 2
+  const __m128 steep = _mm_cmpgt_ps(y, abs_x);
+  r = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps(kPi / 2.0f), r)), _mm_andnot_ps(steep, r));
+  const __m128 obtuse = _mm_cmplt_ps(x, _mm_setzero_ps());
+  return _mm_or_ps(_mm_and_ps(obtuse, _mm_sub_ps(_mm_set1_ps(kPi), r)), _mm_andnot_ps(obtuse, r));
+}
+#endif
+
+/**
+ * Computes the normals of a range of faces, as the cross product of two of their edges (whose length is twice the
+ * area of the face), and the angles of their corners. Four faces are processed per step with SSE, with one register
+ * per coordinate so each lane holds a face.
+ *
+ * @param positions: positions (x, y, z) of the vertices.
+ * @param indices: triangle indices of the mesh.
+ * @param begin: first face of the range.
+ * @param end: face after the last one of the range.
+ * @param face_normals: receives the unscaled normal (x, y, z) of each face.
+ * @param corner_angles: receives the angle of each corner.
+ */
+void computeFaces(const float* positions, const uint32_t* indices, const size_t begin, const size_t end,
+                  float* face_normals, float* corner_angles) {
+  size_t f = begin;
+
+#ifdef NORMAL_GENERATOR_SSE
+  for (; f + 4 <= end; f += 4) {
+    alignas(16) float corners[9][4];
+    for (int lane = 0; lane < 4; lane++) {
+      for (int k = 0; k < 3; k++) {
+        const float* position = positions + static_cast<size_t>(indices[(f + lane) * 3 + k]) * 3;
+        corners[k * 3][lane] = position[0];
+        corners[k * 3 + 1][lane] = position[1];
+        corners[k * 3 + 2][lane] = position[2];
+      }
+    }
+
+    // Edges a -> b (u), a -> c (v) and b -> c (w)
+    const __m128 ax = _mm_load_ps(corners[0]), ay = _mm_load_ps(corners[1]), az = _mm_load_ps(corners[2]);
+    const __m128 bx = _mm_load_ps(corners[3]), by = _mm_load_ps(corners[4]), bz = _mm_load_ps(corners[5]);
+    const __m128 cx = _mm_load_ps(corners[6]), cy = _mm_load_ps(corners[7]), cz = _mm_load_ps(corners[8]);
+    const __m128 ux = _mm_sub_ps(bx, ax), uy = _mm_sub_ps(by, ay), uz = _mm_sub_ps(bz, az);
+    const __m128 vx = _mm_sub_ps(cx, ax), vy = _mm_sub_ps(cy, ay), vz = _mm_sub_ps(cz, az);
+    const __m128 wx = _mm_sub_ps(cx, bx), wy = _mm_sub_ps(cy, by), wz = _mm_sub_ps(cz, bz);
+
+    const __m128 nx = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+    const __m128 ny = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+    const __m128 nz = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+    const __m128 length =
+        _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+    const __m128 uv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, vx), _mm_mul_ps(uy, vy)), _mm_mul_ps(uz, vz));
+    const __m128 uw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, wx), _mm_mul_ps(uy, wy)), _mm_mul_ps(uz, wz));
+    const __m128 angle_a = atan2Positive(length, uv);
+    const __m128 angle_b = atan2Positive(length, _mm_sub_ps(_mm_setzero_ps(), uw));
+    const __m128 angle_c = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(kPi), angle_a), angle_b));
+
+    alignas(16) float lanes[6][4];
+    _mm_store_ps(lanes[0], nx);
+    _mm_store_ps(lanes[1], ny);
+    _mm_store_ps(lanes[2], nz);
+    _mm_store_ps(lanes[3], angle_a);
+    _mm_store_ps(lanes[4], angle_b);
+    _mm_store_ps(lanes[5], angle_c);
+    for (int lane = 0; lane < 4; lane++) {
+      float* normal = face_normals + (f + lane) * 3;
+      normal[0] = lanes[0][lane];
+      normal[1] = lanes[1][lane];
+      normal[2] = lanes[2][lane];
+      corner_angles[(f + lane) * 3] = lanes[3][lane];
+      corner_angles[(f + lane) * 3 + 1] = lanes[4][lane];
+      corner_angles[(f + lane) * 3 + 2] = lanes[5][lane];
+    }
+  }
+#endif
+
+  for (; f < end; f++) {
+    const float* a = positions + static_cast<size_t>(indices[f * 3]) * 3;
+    const float* b = positions + static_cast<size_t>(indices[f * 3 + 1]) * 3;
+    const float* c = positions + static_cast<size_t>(indices[f * 3 + 2]) * 3;
+    float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float w[3] = {c[0] - b[0], c[1] - b[1], c[2] - b[2]};
+
+    float* normal = face_normals + f * 3;
+    normal[0] = u[1] * v[2] - u[2] * v[1];
+    normal[1] = u[2] * v[0] - u[0] * v[2];
+    normal[2] = u[0] * v[1] - u[1] * v[0];
+    float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    setCornerAngles(length, u[0] * v[0] + u[1] * v[1] + u[2] * v[2], -(u[0] * w[0] + u[1] * w[1] + u[2] * w[2]),
+                    corner_angles + f * 3);
+  }
+}
+
+/**
+ * Scales a vector to unit length.
+ *
+ * @param vector: vector (x, y, z) to be normalized.
+ *
+ * @return False if the vector is zero, and was left unchanged.
+ */
+inline bool normalize(float* vector) {
+  float length = std::sqrt(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+  if (length <= 0.0f) {
+    return false;
+  }
+  vector[0] /= length;
+  vector[1] /= length;
+  vector[2] /= length;
+  return true;
+}
+
+/**
+ * Adds the normal of the face of a corner, weighted by its area and by the angle of the corner, to a sum.
+ *
+ * @param face_normals: unscaled normals of the faces.
+ * @param corner_angles: angles of the corners.
+ * @param corner: index of the corner.
+ * @param sum: normal (x, y, z) to be extended.
+ */
+inline void addCorner(const float* face_normals, const float* corner_angles, const uint32_t corner, float* sum) {
+  const float* normal = face_normals + static_cast<size_t>(corner / 3) * 3;
+  const float angle = corner_angles[corner];
+  sum[0] += normal[0] * angle;
+  sum[1] += normal[1] * angle;
+  sum[2] += normal[2] * angle;
+}
+
+/**
+ * Welds vertices at the same position, so the corners of vertices split at texture or material seams are gathered
+ * together. Positions are snapped to a grid of 2^kWeldBits cells per axis over the bounding box of the mesh.
+ *
+ * @param positions: positions (x, y, z) of the vertices.
+ * @param vertex_count: number of vertices.
+ * @param welded: receives, for each vertex, the first vertex at its position.
+ */
+void weldPositions(const float* positions, const size_t vertex_count, uint32_t* welded) {
+  float min[3], max[3];
+  std::fill_n(min, 3, std::numeric_limits<float>::max());
+  std::fill_n(max, 3, std::numeric_limits<float>::lowest());
+  extendBoundingBox(positions, vertex_count, min, max);
+  const float extent = std::max({max[0] - min[0], max[1] - min[1], max[2] - min[2], 0.0f});
+  const float scale = (extent > 0.0f) ? static_cast<float>(1 << kWeldBits) / extent : 0.0f;
+
+  std::unordered_map<uint64_t, uint32_t> first_vertices;
+  first_vertices.reserve(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++) {
+    uint64_t key = 0;
+    for (int k = 0; k < 3; k++) {
+      const uint64_t cell = static_cast<uint64_t>(std::lround((positions[v * 3 + k] - min[k]) * scale));
+      key = (key << (kWeldBits + 1)) | cell;
+    }
+    welded[v] = first_vertices.emplace(key, static_cast<uint32_t>(v)).first->second;
+  }
+}
+
+/**
+ * Groups the corners of a vertex by the side of its creases they are on. The normal of a corner sums the faces of the
+ * vertex whose normals are within the crease angle of its own face, and the corners whose normals are equal share a
+ * side. Without creases, all corners are on the first side and get the smooth normal of the vertex.
+ *
+ * @param corners: corners of the vertex, in ascending order, so the sums do not depend on the order of the faces.
+ * @param count: number of corners.
+ * @param face_normals: unscaled normals of the faces.
+ * @param corner_angles: angles of the corners.
+ * @param split: True to split the vertex at creases.
+ * @param crease_cosine: cosine of the crease angle.
+ * @param half_crease_cosine: cosine of half of the crease angle.
+ * @param unit_normals: scratch buffer for the unit normals of the faces of the vertex.
+ * @param sides: receives the side of each corner.
+ * @param side_normals: receives the unit normal (x, y, z) of each side.
+ */
+void groupCorners(const uint32_t* corners, const size_t count, const float* face_normals, const float* corner_angles,
+                  const bool split, const float crease_cosine, const float half_crease_cosine,
+                  std::vector<float>* unit_normals, std::vector<uint32_t>* sides, std::vector<float>* side_normals) {
+  float smooth[3] = {0.0f, 0.0f, 0.0f};
+  for (size_t i = 0; i < count; i++) {
+    addCorner(face_normals, corner_angles, corners[i], smooth);
+  }
+  normalize(smooth);
+
+  sides->assign(count, 0);
+  side_normals->assign(smooth, smooth + 3);
+  if (!split || count < 2 || count > kMaxCreaseFaces) {
+    return;
+  }
+
+  // Faces without area keep a zero normal. When every face is within half of the crease angle of the smooth normal,
+  // any two faces are within the crease angle of each other and the vertex has a single side
+  unit_normals->resize(count * 3);
+  bool smooth_only = true;
+  for (size_t i = 0; i < count; i++) {
+    float* normal = &(*unit_normals)[i * 3];
+    std::copy_n(face_normals + static_cast<size_t>(corners[i] / 3) * 3, 3, normal);
+    if (normalize(normal)) {
+      smooth_only &= (normal[0] * smooth[0] + normal[1] * smooth[1] + normal[2] * smooth[2] >= half_crease_cosine);
+    }
+  }
+  if (smooth_only) {
+    return;
+  }
+
+  side_normals->clear();
+  for (size_t i = 0; i < count; i++) {
+    // Corners of faces without area have no direction to compare, they take the smooth normal
+    float sum[3] = {0.0f, 0.0f, 0.0f};
+    const float* normal = &(*unit_normals)[i * 3];
+    if (normal[0] != 0.0f || normal[1] != 0.0f || normal[2] != 0.0f) {
+      for (size_t j = 0; j < count; j++) {
+        const float* other = &(*unit_normals)[j * 3];
+        if (normal[0] * other[0] + normal[1] * other[1] + normal[2] * other[2] >= crease_cosine) {
+          addCorner(face_normals, corner_angles, corners[j], sum);
+        }
+      }
+    }
+    if (!normalize(sum)) {
+      std::copy_n(smooth, 3, sum);
+    }
+
+    size_t side = 0;
+    while (side < side_normals->size() / 3 && !std::equal(sum, sum + 3, &(*side_normals)[side * 3])) {
+      side++;
+    }
+    if (side == side_normals->size() / 3) {
+      side_normals->insert(side_normals->end(), sum, sum + 3);
+    }
+    (*sides)[i] = static_cast<uint32_t>(side);
+  }
+}
+
+}  // namespace
+
+void NormalGenerator::generate(const float* positions, const size_t vertex_count, const uint32_t* indices,
+                               const size_t index_count, const float crease_angle, GeneratedNormals* result) {
+  const size_t face_count = index_count / 3;
+  const size_t corner_count = face_count * 3;
+  const size_t face_tasks = (face_count + kTaskSize - 1) / kTaskSize;
+  const size_t vertex_tasks = (vertex_count + kTaskSize - 1) / kTaskSize;
+
+  std::vector<float> face_normals(face_count * 3);
+  std::vector<float> corner_angles(corner_count);
+  parallelFor(face_tasks, [&](const size_t t) {
+    computeFaces(positions, indices, t * kTaskSize, std::min(face_count, (t + 1) * kTaskSize), face_normals.data(),
+                 corner_angles.data());
+  });
+
+  // Corners are gathered by the position of their vertex rather than by its index, so vertices split at texture or
+  // material seams still get the same smooth normal
+  std::vector<uint32_t> welded(vertex_count);
+  weldPositions(positions, vertex_count, welded.data());
+
+  // Corners of each welded vertex, in rows of a compressed table. The rows are sized and filled in parallel with atomic
+  // counters, and each row is sorted before it is used so the result does not depend on the order of the tasks
+  std::unique_ptr<std::atomic<uint32_t>[]> cursors(new std::atomic<uint32_t>[vertex_count]());
+  parallelFor(face_tasks, [&](const size_t t) {
+    for (size_t c = t * kTaskSize * 3; c < std::min(corner_count, (t + 1) * kTaskSize * 3); c++) {
+      cursors[welded[indices[c]]].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  std::vector<uint32_t> row_offsets(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++) {
+    row_offsets[v + 1] = row_offsets[v] + cursors[v].load(std::memory_order_relaxed);
+    cursors[v].store(row_offsets[v], std::memory_order_relaxed);
+  }
+
+  std::vector<uint32_t> rows(corner_count);
+  parallelFor(face_tasks, [&](const size_t t) {
+    for (size_t c = t * kTaskSize * 3; c < std::min(corner_count, (t + 1) * kTaskSize * 3); c++) {
+      rows[cursors[welded[indices[c]]].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(c);
+    }
+  });
+  cursors.reset();
+  parallelFor(vertex_tasks, [&](const size_t t) {
+    for (size_t v = t * kTaskSize; v < std::min(vertex_count, (t + 1) * kTaskSize); v++) {
+      std::sort(&rows[row_offsets[v]], &rows[row_offsets[v + 1]]);
+    }
+  });
+
+  // Gather: each vertex sums the normals of the faces at its position, so the normals are written without atomics.
+  // The sides of the creases are found over all the corners at the position, and a vertex keeps the sides of its own
+  // corners: the first one for itself, the others for its split copies
+  const bool split = crease_angle < kSmoothAngle;
+  const float crease_cosine = std::cos(std::max(crease_angle, 0.0f) * kPi / 180.0f);
+  const float half_crease_cosine = std::cos(std::max(crease_angle, 0.0f) * kPi / 360.0f);
+  auto own_sides = [&](const size_t v, const uint32_t* row, const size_t count, const std::vector<uint32_t>& sides,
+                       std::vector<uint32_t>* result) {
+    result->clear();
+    for (size_t i = 0; i < count; i++) {
+      if (indices[row[i]] == v && std::find(result->begin(), result->end(), sides[i]) == result->end()) {
+        result->push_back(sides[i]);
+      }
+    }
+  };
+
+  std::vector<uint32_t> split_offsets(split ? vertex_count + 1 : 0, 0);
+  result->normals.resize(vertex_count * 3);
+  parallelFor(vertex_tasks, [&](const size_t t) {
+    std::vector<float> unit_normals, side_normals;
+    std::vector<uint32_t> sides, vertex_sides;
+    for (size_t v = t * kTaskSize; v < std::min(vertex_count, (t + 1) * kTaskSize); v++) {
+      const uint32_t* row = &rows[row_offsets[welded[v]]];
+      const size_t count = row_offsets[welded[v] + 1] - row_offsets[welded[v]];
+      groupCorners(row, count, face_normals.data(), corner_angles.data(), split, crease_cosine, half_crease_cosine,
+                   &unit_normals, &sides, &side_normals);
+      own_sides(v, row, count, sides, &vertex_sides);
+      const uint32_t first_side = vertex_sides.empty() ? 0 : vertex_sides.front();
+      std::copy_n(&side_normals[first_side * 3], 3, &result->normals[v * 3]);
+      if (split) {
+        split_offsets[v + 1] = static_cast<uint32_t>(vertex_sides.empty() ? 0 : vertex_sides.size() - 1);
+      }
+    }
+  });
+
+  result->indices.assign(indices, indices + corner_count);
+  result->split_sources.clear();
+  if (!split) {
+    return;
+  }
+
+  // Each extra side of a vertex gets a copy of it after the input vertices, and the corners on that side use the copy
+  for (size_t v = 0; v < vertex_count; v++) {
+    split_offsets[v + 1] += split_offsets[v];
+  }
+  const size_t split_count = split_offsets[vertex_count];
+  if (split_count == 0) {
+    return;
+  }
+  result->normals.resize((vertex_count + split_count) * 3);
+  result->split_sources.resize(split_count);
+
+  parallelFor(vertex_tasks, [&](const size_t t) {
+    std::vector<float> unit_normals, side_normals;
+    std::vector<uint32_t> sides, vertex_sides;
+    for (size_t v = t * kTaskSize; v < std::min(vertex_count, (t + 1) * kTaskSize); v++) {
+      if (split_offsets[v + 1] == split_offsets[v]) {
+        continue;
+      }
+      const uint32_t* row = &rows[row_offsets[welded[v]]];
+      const size_t count = row_offsets[welded[v] + 1] - row_offsets[welded[v]];
+      groupCorners(row, count, face_normals.data(), corner_angles.data(), split, crease_cosine, half_crease_cosine,
+                   &unit_normals, &sides, &side_normals);
+      own_sides(v, row, count, sides, &vertex_sides);
+
+      const size_t first_copy = vertex_count + split_offsets[v];
+      for (size_t side = 1; side < vertex_sides.size(); side++) {
+        std::copy_n(&side_normals[vertex_sides[side] * 3], 3, &result->normals[(first_copy + side - 1) * 3]);
+        result->split_sources[split_offsets[v] + side - 1] = static_cast<uint32_t>(v);
+      }
+      for (size_t i = 0; i < count; i++) {
+        if (indices[row[i]] != v) {
+          continue;
+        }
+        const size_t side = std::find(vertex_sides.begin(), vertex_sides.end(), sides[i]) - vertex_sides.begin();
+        if (side > 0) {
+          result->indices[row[i]] = static_cast<uint32_t>(first_copy + side - 1);
+        }
+      }
+    }
+  });
+}
+
+void NormalGenerator::accumulate(const float* positions, const uint32_t* indices, const size_t index_count,
+                                 float* sums) {
+  const size_t face_count = index_count / 3;
+  const size_t face_tasks = (face_count + kTaskSize - 1) / kTaskSize;
+
+  std::vector<float> face_normals(face_count * 3);
+  std::vector<float> corner_angles(face_count * 3);
+  parallelFor(face_tasks, [&](const size_t t) {
+    computeFaces(positions, indices, t * kTaskSize, std::min(face_count, (t + 1) * kTaskSize), face_normals.data(),
+                 corner_angles.data());
+  });
+
+  for (size_t c = 0; c < face_count * 3; c++) {
+    float* sum = sums + static_cast<size_t>(indices[c]) * 3;
+    addCorner(face_normals.data(), corner_angles.data(), static_cast<uint32_t>(c), sum);
+  }
+}
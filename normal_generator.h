@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef NORMAL_GENERATOR_H_
+#define NORMAL_GENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Normals generated by NormalGenerator. Vertices shared by faces that meet at a crease are split: the output has
+ * the input vertices first, in the same order, followed by one copy of a vertex for each extra side of its creases.
+ */
+struct GeneratedNormals {
+  std::vector<float> normals;          /**< Unit normals (x, y, z) of the input vertices, then of the split vertices */
+  std::vector<uint32_t> indices;       /**< Triangle indices, whose corners across a crease use the split vertices */
+  std::vector<uint32_t> split_sources; /**< Input vertex copied by each split vertex */
+};
+
+/**
+ * @brief Generates smooth vertex normals for indexed triangle meshes that have none. Each face adds its normal to its
+ * corners weighted by its area and by the angle of the corner, so the result does not depend on how a surface is
+ * triangulated. Corners are gathered by the position of their vertex, so vertices duplicated at texture or material
+ * seams get the same normal. Faces whose normals differ by more than a crease angle do not share their normals, so hard
+ * edges stay sharp.
+ *
+ * The work is spread over all cores without locks on the normals: face normals are computed in parallel over ranges
+ * of faces, four faces at a time with SSE, and each vertex then gathers the normals of the faces at its position, so no
+ * two threads ever add to the same normal.
+ */
+class NormalGenerator {
+ public:
+  /** Crease angle, in degrees, from which faces always share their normals and vertices are never split */
+  static constexpr float kSmoothAngle = 180.0f;
+
+  /**
+   * Generates the normals of a mesh.
+   *
+   * @param positions: positions (x, y, z) of the vertices.
+   * @param vertex_count: number of vertices.
+   * @param indices: triangle indices of the mesh, below the number of vertices.
+   * @param index_count: number of indices, a multiple of three.
+   * @param crease_angle: largest angle between two faces that share their normals, in degrees.
+   * @param result: receives the normals, the indices and the split vertices.
+   */
+  static void generate(const float *positions, const size_t vertex_count, const uint32_t *indices,
+                       const size_t index_count, const float crease_angle, GeneratedNormals *result);
+
+  /**
+   * Adds the normals of faces, weighted as by generate, to the unnormalized smooth normals of their vertices. A mesh
+   * too large to be held in memory is accumulated in batches of faces, and its sums are normalized once every face
+   * was added. The face normals are computed in parallel and added by the calling thread.
+   *
+   * @param positions: positions (x, y, z) of the vertices.
+   * @param indices: triangle indices of the batch of faces.
+   * @param index_count: number of indices, a multiple of three.
+   * @param sums: sums (x, y, z) of each vertex, to which the weighted normals are added.
+   */
+  static void accumulate(const float *positions, const uint32_t *indices, const size_t index_count, float *sums);
+};
+
+#endif  // NORMAL_GENERATOR_H_
@@ -0,0 +1,667 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "obj_reader.h"
+
+#include <QFile>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+/** Marks a missing texture coordinates or normal index in a face corner */
+const int32_t kNoIndex = std::numeric_limits<int32_t>::min();
+
+/** Files are split in chunks of at least this size, so small files are parsed by a single thread */
+const size_t kMinChunkSize = 1 << 20;
+
+/** Marks a missing color component of a vertex, replaced by kDefaultColor once the chunks are merged */
+const float kNoColor = -1.0f;
+
+/** Color of the vertices of a point cloud without color */
+const float kDefaultColor = 0.8f;
+
+/** Fraction of the progress reported while the chunks are parsed, the rest is used to merge them */
+const float kParseProgress = 0.7f;
+
+/** Exact powers of 10 representable as double */
+const double kPowersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                              1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/**
+ * @brief Records of a line-aligned part of the file. Face corners hold (v, vt, vn) indices, 0-based. Relative
+ * (negative) OBJ indices are resolved against the records of the chunk, so they must be offset by the number of
+ * records of the previous chunks when merging.
+ */
+struct ObjChunk {
+  const char* begin = NULL; /**< First byte of the chunk */
+  const char* end = NULL;   /**< Byte after the last one of the chunk */
+
+  std::vector<float> vertices;          /**< v records */
+  std::vector<float> normals;           /**< vn records */
+  std::vector<float> texture_coords;    /**< vt records */
+  std::vector<float> colors;            /**< Colors of the v records, empty until a v record has a color */
+  std::vector<int32_t> corners;         /**< v, vt and vn indices of each triangle corner */
+  std::vector<size_t> relative_corners; /**< Positions in corners holding indices relative to the chunk */
+  bool has_points = false;              /**< True if the chunk has p records */
+
+  ObjReader::Status status = ObjReader::kSuccess; /**< Parse status of the chunk */
+};
+
+inline bool isSpace(const char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline bool isDigit(const char c) { return c >= '0' && c <= '9'; }
+
+inline const char* skipSpaces(const char* p, const char* end) {
+  while (p < end && isSpace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+/**
+ * Parses a decimal float, with optional sign, fraction and exponent.
+ *
+ * @return Pointer after the number, or NULL if it is malformed.
+ */
+const char* parseFloat(const char* p, const char* end, float* value) {
+  p = skipSpaces(p, end);
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  bool has_digits = false;
+
+  for (; p < end && isDigit(*p); p++) {
+    has_digits = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += (mantissa != 0);
+    } else {
+      exponent++;
+    }
+  }
+
+  if (p < end && *p == '.') {
+    for (p++; p < end && isDigit(*p); p++) {
+      has_digits = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += (mantissa != 0);
+        exponent--;
+      }
+    }
+  }
+
+  if (!has_digits) {
+    return NULL;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negative_exponent = false;
+    if (q < end && (*q == '-' || *q == '+')) {
+      negative_exponent = (*q == '-');
+      q++;
+    }
+    if (q < end && isDigit(*q)) {
+      int e = 0;
+      for (; q < end && isDigit(*q); q++) {
+        e = (e < 10000) ? e * 10 + (*q - '0') : e;
+      }
+      exponent += negative_exponent ? -e : e;
+      p = q;
+    }
+  }
+
+  if (p < end && !isSpace(*p)) {
+    return NULL;
+  }
+
+  double result = static_cast<double>(mantissa);
+  if (mantissa != 0 && exponent != 0) {
+    if (exponent < 0 && exponent >= -22) {
+      result /= kPowersOf10[-exponent];
+    } else if (exponent > 0 && exponent <= 22) {
+      result *= kPowersOf10[exponent];
+    } else {
+      result *= std::pow(10.0, exponent);
+    }
+  }
+
+  *value = static_cast<float>(negative ? -result : result);
+  return p;
+}
+
+/**
+ * Parses a face index and converts it to a 0-based index. Negative indices are relative to the records already read,
+ * here resolved against the records of the chunk.
+ *
+ * @return Pointer after the index, or NULL if it is malformed.
+ */
+const char* parseIndex(const char* p, const char* end, const size_t chunk_count, int32_t* index, bool* relative) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+  if (p >= end || !isDigit(*p)) {
+    return NULL;
+  }
+
+  int64_t value = 0;
+  for (; p < end && isDigit(*p); p++) {
+    value = value * 10 + (*p - '0');
+    if (value > std::numeric_limits<int32_t>::max()) {
+      return NULL;
+    }
+  }
+
+  if (value == 0) {
+    return NULL;
+  }
+
+  *relative = negative;
+  *index = static_cast<int32_t>(negative ? static_cast<int64_t>(chunk_count) - value : value - 1);
+  return p;
+}
+
+/**
+ * Parses the vertices of a face record and appends it to the chunk as a triangle fan.
+ *
+ * @return Number of vertices of the face, or -1 if it is malformed.
+ */
+int parseFace(const char* p, const char* end, ObjChunk* chunk) {
+  const size_t counts[3] = {chunk->vertices.size() / 3, chunk->texture_coords.size() / 2, chunk->normals.size() / 3};
+
+  std::array<int32_t, 3> first, previous;
+  std::array<bool, 3> first_relative, previous_relative;
+  int count = 0;
+
+  auto append_corner = [chunk](const std::array<int32_t, 3>& corner, const std::array<bool, 3>& relative) {
+    for (int k = 0; k < 3; k++) {
+      if (relative[k]) {
+        chunk->relative_corners.push_back(chunk->corners.size());
+      }
+      chunk->corners.push_back(corner[k]);
+    }
+  };
+
+  while (true) {
+    p = skipSpaces(p, end);
+    if (p >= end || *p == '#') {
+      break;
+    }
+
+    std::array<int32_t, 3> corner = {kNoIndex, kNoIndex, kNoIndex};
+    std::array<bool, 3> relative = {false, false, false};
+
+    p = parseIndex(p, end, counts[0], &corner[0], &relative[0]);
+    if (p && p < end && *p == '/') {
+      p++;
+      if (p < end && *p != '/') {
+        p = parseIndex(p, end, counts[1], &corner[1], &relative[1]);
+      }
+      if (p && p < end && *p == '/') {
+        p = parseIndex(p + 1, end, counts[2], &corner[2], &relative[2]);
+      }
+    }
+
+    if (!p || (p < end && !isSpace(*p))) {
+      return -1;
+    }
+
+    if (count >= 2) {
+      append_corner(first, first_relative);
+      append_corner(previous, previous_relative);
+      append_corner(corner, relative);
+    }
+    if (count == 0) {
+      first = corner;
+      first_relative = relative;
+    }
+    previous = corner;
+    previous_relative = relative;
+    count++;
+  }
+
+  return count;
+}
+
+/**
+ * Parses a single line (without the line break) of the file.
+ */
+void parseLine(const char* p, const char* end, ObjChunk* chunk) {
+  p = skipSpaces(p, end);
+  if (p >= end || *p == '#') {
+    return;
+  }
+
+  const char* keyword = p;
+  while (p < end && !isSpace(*p)) {
+    p++;
+  }
+  size_t length = p - keyword;
+
+  if (length == 1 && keyword[0] == 'v') {
+    float xyz[3];
+    for (int k = 0; k < 3 && p; k++) {
+      p = parseFloat(p, end, &xyz[k]);
+    }
+
+    // Optional w, and vertex colors (r, g, b) as written by point cloud tools: v x y z r g b or v x y z w r g b
+    float extra[4];
+    int extra_count = 0;
+    while (p && extra_count < 4 && skipSpaces(p, end) < end && *skipSpaces(p, end) != '#') {
+      p = parseFloat(p, end, &extra[extra_count++]);
+    }
+    if (!p) {
+      chunk->status = ObjReader::kFailed;
+      return;
+    }
+
+    const bool has_color = (extra_count == 3 || extra_count == 4);
+    const float* color = (extra_count == 4) ? extra + 1 : extra;
+    if (has_color && chunk->colors.empty()) {
+      chunk->colors.assign(chunk->vertices.size(), kNoColor);
+    }
+    chunk->vertices.insert(chunk->vertices.end(), xyz, xyz + 3);
+    if (has_color || !chunk->colors.empty()) {
+      if (has_color) {
+        chunk->colors.insert(chunk->colors.end(), color, color + 3);
+      } else {
+        chunk->colors.insert(chunk->colors.end(), 3, kNoColor);
+      }
+    }
+  } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+    float xyz[3];
+    for (int k = 0; k < 3 && p; k++) {
+      p = parseFloat(p, end, &xyz[k]);
+    }
+    if (!p) {
+      chunk->status = ObjReader::kFailed;
+      return;
+    }
+    chunk->normals.insert(chunk->normals.end(), xyz, xyz + 3);
+  } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+    float uv[2] = {0.0f, 0.0f};
+    p = parseFloat(p, end, &uv[0]);
+    if (p && skipSpaces(p, end) < end) {
+      p = parseFloat(p, end, &uv[1]);
+    }
+    if (!p) {
+      chunk->status = ObjReader::kFailed;
+      return;
+    }
+    chunk->texture_coords.insert(chunk->texture_coords.end(), uv, uv + 2);
+  } else if (length == 1 && keyword[0] == 'f') {
+    int count = parseFace(p, end, chunk);
+    if (count < 0) {
+      chunk->status = ObjReader::kFailed;
+    } else if (count < 3) {
+      chunk->status = ObjReader::kUnsupported;
+    }
+  } else if (length == 1 && keyword[0] == 'p') {
+    // Point clouds draw every vertex, so the referenced vertices are not needed
+    chunk->has_points = true;
+  } else if ((length == 1 && (keyword[0] == 'o' || keyword[0] == 'g' || keyword[0] == 's'))) {
+    return;
+  } else {
+    // Materials (mtllib, usemtl), lines and free-form geometry are left to assimp
+    chunk->status = ObjReader::kUnsupported;
+  }
+}
+
+/**
+ * Parses all lines of a chunk, until the end of the chunk or until another chunk fails.
+ */
+void parseChunk(ObjChunk* chunk, const std::atomic_bool& stop) {
+  const char* p = chunk->begin;
+  const char* end = chunk->end;
+  size_t lines = 0;
+
+  while (p < end && chunk->status == ObjReader::kSuccess) {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    const char* line_end = eol ? eol : end;
+
+    // Line continuations are rare and would cross chunk boundaries
+    const char* last = line_end;
+    while (last > p && last[-1] == '\r') {
+      last--;
+    }
+    if (last > p && last[-1] == '\\') {
+      chunk->status = ObjReader::kUnsupported;
+      break;
+    }
+
+    parseLine(p, line_end, chunk);
+    p = eol ? eol + 1 : end;
+
+    if ((++lines & 0xFFFF) == 0 && stop) {
+      break;
+    }
+  }
+}
+
+/**
+ * Hash of the (v, vt, vn) indices of a face corner.
+ */
+struct CornerHash {
+  size_t operator()(const std::array<int32_t, 3>& corner) const {
+    uint64_t hash = static_cast<uint32_t>(corner[0]);
+    hash = hash * 0x9E3779B97F4A7C15ULL + static_cast<uint32_t>(corner[1]);
+    hash = hash * 0x9E3779B97F4A7C15ULL + static_cast<uint32_t>(corner[2]);
+    return static_cast<size_t>(hash ^ (hash >> 29));
+  }
+};
+
+}  // namespace
+
+ObjReader::Status ObjReader::read(const QString& filename, ObjMesh* mesh, const ProgressCallback& progress) {
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+    return kFailed;
+  }
+
+  uchar* data = file.map(0, file.size());
+  if (!data) {
+    QByteArray bytes = file.readAll();
+    return parse(bytes.constData(), bytes.size(), mesh, progress);
+  }
+
+  Status status = parse(reinterpret_cast<const char*>(data), file.size(), mesh, progress);
+  file.unmap(data);
+  return status;
+}
+
+ObjReader::Status ObjReader::parse(const char* data, const size_t size, ObjMesh* mesh,
+                                   const ProgressCallback& progress) {
+  size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+  size_t chunk_count = std::max<size_t>(1, std::min(thread_count * 4, size / kMinChunkSize));
+
+  // Splits the file in chunks that start right after a line break
+  std::vector<ObjChunk> chunks(chunk_count);
+  const char* end = data + size;
+  const char* begin = data;
+  for (size_t i = 0; i < chunk_count; i++) {
+    const char* chunk_end = (i + 1 == chunk_count) ? end : data + size * (i + 1) / chunk_count;
+    chunk_end = std::max(chunk_end, begin);
+    const char* eol = static_cast<const char*>(std::memchr(chunk_end, '\n', end - chunk_end));
+    chunk_end = eol ? eol + 1 : end;
+
+    chunks[i].begin = begin;
+    chunks[i].end = chunk_end;
+    begin = chunk_end;
+  }
+
+  std::atomic_bool stop(false);
+  std::atomic<size_t> next_chunk(0);
+  std::atomic<size_t> parsed_chunks(0);
+
+  auto worker = [&]() {
+    for (size_t i = next_chunk++; i < chunk_count && !stop; i = next_chunk++) {
+      parseChunk(&chunks[i], stop);
+      if (chunks[i].status != kSuccess) {
+        stop = true;
+      }
+      parsed_chunks++;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(thread_count, chunk_count); i++) {
+    threads.emplace_back(worker);
+  }
+
+  // The calling thread also parses chunks, and is the only one that reports progress
+  bool cancelled = false;
+  for (size_t i = next_chunk++; i < chunk_count && !stop; i = next_chunk++) {
+    parseChunk(&chunks[i], stop);
+    if (chunks[i].status != kSuccess) {
+      stop = true;
+    }
+    parsed_chunks++;
+
+    if (progress && !progress(kParseProgress * parsed_chunks / chunk_count)) {
+      cancelled = true;
+      stop = true;
+    }
+  }
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  if (cancelled) {
+    return kCancelled;
+  }
+
+  Status status = kSuccess;
+  for (const ObjChunk& chunk : chunks) {
+    if (chunk.status == kUnsupported || (chunk.status == kFailed && status == kSuccess)) {
+      status = chunk.status;
+    }
+  }
+  if (status != kSuccess) {
+    return status;
+  }
+
+  // Merges the records of the chunks, offsetting relative indices by the records of the previous chunks
+  std::vector<float> vertices, normals, texture_coords, colors;
+  std::vector<int32_t> corners;
+  size_t total_corners = 0;
+  bool has_points = false;
+  bool has_colors = false;
+  for (const ObjChunk& chunk : chunks) {
+    total_corners += chunk.corners.size();
+    has_points |= chunk.has_points;
+    has_colors |= !chunk.colors.empty();
+  }
+  corners.reserve(total_corners);
+
+  // Points mixed with faces would need a separate mesh, which assimp builds
+  if (has_points && total_corners > 0) {
+    return kUnsupported;
+  }
+
+  for (ObjChunk& chunk : chunks) {
+    const int64_t bases[3] = {static_cast<int64_t>(vertices.size() / 3),
+                              static_cast<int64_t>(texture_coords.size() / 2),
+                              static_cast<int64_t>(normals.size() / 3)};
+    size_t corner_offset = corners.size();
+
+    vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+    normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+    texture_coords.insert(texture_coords.end(), chunk.texture_coords.begin(), chunk.texture_coords.end());
+    if (has_colors && chunk.colors.empty()) {
+      colors.insert(colors.end(), chunk.vertices.size(), kNoColor);
+    } else {
+      colors.insert(colors.end(), chunk.colors.begin(), chunk.colors.end());
+    }
+    corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+
+    for (size_t position : chunk.relative_corners) {
+      corners[corner_offset + position] += static_cast<int32_t>(bases[position % 3]);
+    }
+
+    chunk = ObjChunk();
+  }
+
+  if (progress && !progress(kParseProgress + (1.0f - kParseProgress) * 0.3f)) {
+    return kCancelled;
+  }
+
+  const int64_t counts[3] = {static_cast<int64_t>(vertices.size() / 3),
+                             static_cast<int64_t>(texture_coords.size() / 2),
+                             static_cast<int64_t>(normals.size() / 3)};
+  bool identity = true;
+  bool uses_texture_coords = false;
+  bool uses_normals = false;
+
+  for (size_t i = 0; i < corners.size(); i += 3) {
+    if (corners[i] < 0 || corners[i] >= counts[0]) {
+      return kFailed;
+    }
+    for (int k = 1; k < 3; k++) {
+      if (corners[i + k] != kNoIndex) {
+        if (corners[i + k] < 0 || corners[i + k] >= counts[k]) {
+          return kFailed;
+        }
+        identity &= (corners[i + k] == corners[i]);
+      }
+    }
+    uses_texture_coords |= (corners[i + 1] != kNoIndex);
+    uses_normals |= (corners[i + 2] != kNoIndex);
+  }
+
+  *mesh = ObjMesh();
+  mesh->has_texture_coords = uses_texture_coords;
+  mesh->has_normals = uses_normals;
+
+  // Faces without normals in a file with normals are marked, so their normals are generated instead of left at zero
+  bool missing_normals = false;
+  for (size_t i = 2; uses_normals && !missing_normals && i < corners.size(); i += 3) {
+    missing_normals = (corners[i] == kNoIndex);
+  }
+
+  if (corners.empty()) {
+    // A point cloud keeps the positions of the file, with colors in [0, 1] (some tools write them in [0, 255])
+    mesh->vertices = std::move(vertices);
+    if (has_colors) {
+      float max_color = 0.0f;
+      for (float color : colors) {
+        max_color = std::max(max_color, color);
+      }
+      float scale = (max_color > 1.0f) ? 1.0f / 255.0f : 1.0f;
+      for (float& color : colors) {
+        color = (color == kNoColor) ? kDefaultColor : std::max(0.0f, std::min(1.0f, color * scale));
+      }
+      mesh->colors = std::move(colors);
+      mesh->has_colors = true;
+    }
+  } else if (identity) {
+    // Every corner references the same v, vt and vn index (or no vt/vn), so the file is already indexed
+    mesh->vertices = std::move(vertices);
+    mesh->texture_coords.assign(counts[0] * 2, 0.0f);
+    std::copy_n(texture_coords.begin(), std::min(texture_coords.size(), mesh->texture_coords.size()),
+                mesh->texture_coords.begin());
+    mesh->normals.assign(counts[0] * 3, 0.0f);
+    std::copy_n(normals.begin(), std::min(normals.size(), mesh->normals.size()), mesh->normals.begin());
+
+    mesh->indices.resize(corners.size() / 3);
+    for (size_t i = 0; i < mesh->indices.size(); i++) {
+      mesh->indices[i] = static_cast<uint32_t>(corners[i * 3]);
+    }
+
+    // A vertex has a normal if any of its corners references one, which is then its own vn record
+    if (missing_normals) {
+      mesh->missing_normals.assign(counts[0], 1);
+      for (size_t i = 0; i < mesh->indices.size(); i++) {
+        if (corners[i * 3 + 2] != kNoIndex) {
+          mesh->missing_normals[mesh->indices[i]] = 0;
+        }
+      }
+      for (size_t i = 0; i < mesh->missing_normals.size(); i++) {
+        if (mesh->missing_normals[i]) {
+          std::fill_n(&mesh->normals[i * 3], 3, 0.0f);
+        }
+      }
+    }
+  } else {
+    std::unordered_map<std::array<int32_t, 3>, uint32_t, CornerHash> unique_vertices;
+    unique_vertices.reserve(counts[0]);
+    mesh->indices.resize(corners.size() / 3);
+
+    for (size_t i = 0; i < mesh->indices.size(); i++) {
+      std::array<int32_t, 3> corner = {corners[i * 3], corners[i * 3 + 1], corners[i * 3 + 2]};
+      auto inserted = unique_vertices.emplace(corner, static_cast<uint32_t>(unique_vertices.size()));
+      if (inserted.second) {
+        const float* vertex = &vertices[corner[0] * 3];
+        mesh->vertices.insert(mesh->vertices.end(), vertex, vertex + 3);
+
+        if (corner[1] != kNoIndex) {
+          const float* uv = &texture_coords[corner[1] * 2];
+          mesh->texture_coords.insert(mesh->texture_coords.end(), uv, uv + 2);
+        } else {
+          mesh->texture_coords.insert(mesh->texture_coords.end(), 2, 0.0f);
+        }
+
+        if (corner[2] != kNoIndex) {
+          const float* normal = &normals[corner[2] * 3];
+          mesh->normals.insert(mesh->normals.end(), normal, normal + 3);
+        } else {
+          mesh->normals.insert(mesh->normals.end(), 3, 0.0f);
+        }
+
+        if (missing_normals) {
+          mesh->missing_normals.push_back(corner[2] == kNoIndex);
+        }
+      }
+      mesh->indices[i] = inserted.first->second;
+    }
+  }
+
+  if (progress && !progress(1.0f)) {
+    return kCancelled;
+  }
+
+  return kSuccess;
+}
+
+bool ObjReader::parsePosition(const char* line, const char* end, float* position) {
+  const char* p = line;
+  for (int k = 0; k < 3 && p; k++) {
+    p = parseFloat(p, end, &position[k]);
+  }
+  return p != NULL;
+}
+
+int ObjReader::parseFacePositions(const char* line, const char* end, const size_t vertex_count,
+                                  std::vector<uint32_t>* indices) {
+  uint32_t first = 0, previous = 0;
+  int count = 0;
+
+  while (true) {
+    const char* p = skipSpaces(line, end);
+    if (p >= end || *p == '#') {
+      break;
+    }
+
+    int32_t index = 0;
+    bool relative = false;
+    p = parseIndex(p, end, vertex_count, &index, &relative);
+    if (!p || index < 0 || static_cast<size_t>(index) >= vertex_count) {
+      return -1;
+    }
+
+    // Texture coordinates and normal indices of the corner are skipped
+    while (p < end && !isSpace(*p)) {
+      p++;
+    }
+    line = p;
+
+    if (count >= 2) {
+      indices->insert(indices->end(), {first, previous, static_cast<uint32_t>(index)});
+    }
+    if (count == 0) {
+      first = static_cast<uint32_t>(index);
+    }
+    previous = static_cast<uint32_t>(index);
+    count++;
+  }
+
+  return count;
+}
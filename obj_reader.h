@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef OBJ_READER_H_
+#define OBJ_READER_H_
+
+#include <QString>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief Indexed triangle mesh read from an OBJ file. Vertices are unique combinations of position, texture coordinates
+ * and normal indices of the file. A file without faces is a point cloud: it has no indices, normals or texture
+ * coordinates, only the positions of the file and their colors. When only some faces have normals, the vertices of the
+ * others are marked in missing_normals, so their normals can be generated.
+ */
+struct ObjMesh {
+  std::vector<float> vertices;          /**< Positions (x, y, z) */
+  std::vector<float> normals;           /**< Normals (x, y, z), zero when the file has none */
+  std::vector<float> texture_coords;    /**< Texture coordinates (u, v), zero when the file has none */
+  std::vector<uint32_t> indices;        /**< Triangle indices */
+  std::vector<float> colors;            /**< Colors (r, g, b) in [0, 1] of point clouds, empty when there are none */
+  std::vector<uint8_t> missing_normals; /**< Non-zero for vertices of faces without normals in a file with normals */
+
+  bool has_normals = false;        /**< True if the file has normals */
+  bool has_texture_coords = false; /**< True if the file has texture coordinates */
+  bool has_colors = false;         /**< True if the file has vertex colors (v x y z r g b or v x y z w r g b) */
+};
+
+/**
+ * @brief Fast reader for plain OBJ geometry. The file is memory mapped and split into line-aligned chunks that are
+ * parsed in parallel, then the v/vt/vn/f records are merged into an indexed mesh. Files with only v records (and p
+ * records referencing them) are read as point clouds. Only geometry is supported: files with materials, free-form
+ * geometry, lines, or both points and faces are reported as unsupported, so the caller can fall back to assimp.
+ */
+class ObjReader {
+ public:
+  /**
+   * Result of a read.
+   */
+  enum Status {
+    kSuccess,     /**< The mesh was read */
+    kUnsupported, /**< The file uses OBJ features not handled by the reader */
+    kFailed,      /**< The file could not be opened or is malformed */
+    kCancelled    /**< The progress callback cancelled the read */
+  };
+
+  /**
+   * Callback that receives the read progress in [0, 1]. Returning false cancels the read.
+   */
+  using ProgressCallback = std::function<bool(float)>;
+
+  /**
+   * Reads an OBJ file.
+   *
+   * @param filename: path to the OBJ file.
+   * @param mesh: receives the mesh.
+   * @param progress: optional callback to report progress and to cancel the read.
+   *
+   * @return Status of the read.
+   */
+  static Status read(const QString &filename, ObjMesh *mesh, const ProgressCallback &progress = ProgressCallback());
+
+  /**
+   * Parses OBJ data already in memory.
+   *
+   * @param data: OBJ file contents.
+   * @param size: size in bytes of the contents.
+   * @param mesh: receives the mesh.
+   * @param progress: optional callback to report progress and to cancel the parse.
+   *
+   * @return Status of the parse.
+   */
+  static Status parse(const char *data, const size_t size, ObjMesh *mesh,
+                      const ProgressCallback &progress = ProgressCallback());
+
+  /**
+   * Parses the position of a v record, for readers that stream the records of a file instead of reading it at once.
+   *
+   * @param line: first byte after the v keyword.
+   * @param end: end of the line, without the line break.
+   * @param position: receives the position (x, y, z).
+   *
+   * @return True if the record is valid.
+   */
+  static bool parsePosition(const char *line, const char *end, float *position);
+
+  /**
+   * Parses the position indices of an f record as a triangle fan, for readers that stream the records of a file
+   * instead of reading it at once. Texture coordinates and normal indices are skipped.
+   *
+   * @param line: first byte after the f keyword.
+   * @param end: end of the line, without the line break.
+   * @param vertex_count: number of v records before the face, which relative indices refer to.
+   * @param indices: receives the 0-based position indices of the triangles.
+   *
+   * @return Number of vertices of the face, or -1 if it is malformed or references a missing position.
+   */
+  static int parseFacePositions(const char *line, const char *end, const size_t vertex_count,
+                                std::vector<uint32_t> *indices);
+};
+
+#endif  // OBJ_READER_H_
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef PARALLEL_FOR_H_
+#define PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/**
+ * Gets the maximum number of threads of the parallelFor calls made by the current thread.
+ *
+ * @return Reference to the limit of the current thread, zero for all cores.
+ */
+inline size_t &parallelForThreadLimit() {
+  static thread_local size_t limit = 0;
+  return limit;
+}
+
+/**
+ * @brief Limits the threads of the parallelFor calls made by the current thread while it exists, so work that already
+ * runs on several threads (such as loads on a thread pool) does not spawn a full set of threads from each of them.
+ */
+class ParallelForLimit {
+ public:
+  /**
+   * Class constructor.
+   *
+   * @param max_threads: maximum number of threads of each parallelFor call, the calling one included. Zero for all
+   * cores.
+   */
+  explicit ParallelForLimit(const size_t max_threads) : previous_(parallelForThreadLimit()) {
+    parallelForThreadLimit() = max_threads;
+  }
+
+  /**
+   * Destructor of the class. Restores the previous limit.
+   */
+  ~ParallelForLimit() { parallelForThreadLimit() = previous_; }
+
+ private:
+  size_t previous_; /**< Limit of the current thread before this one */
+};
+
+/**
+ * Runs a function for every task index in [0, count) on all cores, or on at most parallelForThreadLimit threads. Tasks
+ * are taken in order from a shared counter, so they may have different costs. The calling thread also runs tasks and
+ * is the only one that calls the progress callback, so the callback does not need to be thread safe.
+ *
+ * @param count: number of tasks.
+ * @param function: function called with the index of each task, from any thread.
+ * @param progress: optional callback called by the calling thread with the number of finished tasks. Returning false
+ * stops the tasks not yet started.
+ *
+ * @return False if the progress callback stopped the tasks.
+ */
+template <typename Function>
+bool parallelFor(const size_t count, Function function,
+                 const std::function<bool(size_t)> &progress = std::function<bool(size_t)>()) {
+  std::atomic<size_t> next_task(0);
+  std::atomic<size_t> finished_tasks(0);
+  std::atomic_bool stop(false);
+
+  // Workers keep the limit of the calling thread for the parallelFor calls of the tasks
+  const size_t limit = parallelForThreadLimit();
+  auto worker = [&]() {
+    ParallelForLimit worker_limit(limit);
+    for (size_t i = next_task++; i < count && !stop; i = next_task++) {
+      function(i);
+      finished_tasks++;
+    }
+  };
+
+  size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+  if (limit > 0) {
+    thread_count = std::min(thread_count, limit);
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(worker);
+  }
+
+  bool completed = true;
+  for (size_t i = next_task++; i < count && !stop; i = next_task++) {
+    function(i);
+    finished_tasks++;
+    if (progress && !progress(finished_tasks)) {
+      completed = false;
+      stop = true;
+    }
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  return completed;
+}
+
+#endif  // PARALLEL_FOR_H_
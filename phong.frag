@@ -1,22 +1,45 @@
-#version 130
-
-uniform vec3 uLPos;
-uniform vec3 uCamPos;
-
-uniform vec4 matAmb;
-uniform vec4 matDif;
-uniform vec4 matSpec;
-
-uniform sampler2D uTextureID;
-uniform int uTexLoad;
-uniform int uMaterial;
+#version 330
+
+struct Material {
+  vec4 ambient;
+  vec4 diffuse;
+  vec4 specular;
+};
+
+// Size must match SceneResources::kMaxBlockMaterials in scene_resources.h
+layout(std140) uniform Materials {
+  Material uMaterials[256];
+};
+
+// Per-frame uniforms, updated in a single call. Layout must match FrameBlock in scene_renderer.cpp
+layout(std140) uniform Frame {
+  mat4 uMVP;
+  mat4 uM;
+  mat4 uN;
+  vec3 uLPos;
+  vec3 uCamPos;
+  vec3 uPosOffset;
+  vec3 uPosScale;
+  int uMaterial;
+};
+
+uniform int uMaterialIndex;
+
+uniform sampler2DArray uTextureID;
+uniform int uTextureLayer;
 
 in vec3 vNormal;
 in vec3 vPosW;
 in vec2 vCoords;
 
+out vec4 fragColor;
+
 void main(void) {
-  vec4 vColor = (uTexLoad > 0) ? texture(uTextureID, vCoords) : matDif;
+  vec4 matAmb = uMaterials[uMaterialIndex].ambient;
+  vec4 matDif = uMaterials[uMaterialIndex].diffuse;
+  vec4 matSpec = uMaterials[uMaterialIndex].specular;
+
+  vec4 vColor = (uTextureLayer >= 0) ? texture(uTextureID, vec3(vCoords, uTextureLayer)) : matDif;
 
   vec4 ambient = vec4(vColor.rgb * matAmb.rgb, matAmb.a);
   vec3 vL = normalize(uLPos - vPosW);
@@ -28,5 +51,5 @@ void main(void) {
   float cOmega = max(dot(vV, vR), 0.0);
   vec4 specular = vec4(vColor.rgb * matSpec.rgb * pow(cOmega, 20.0), matSpec.a);
 
-  gl_FragColor = (uMaterial > 0) ? clamp(ambient + diffuse + specular, 0.0, 1.0) : vColor;
+  fragColor = (uMaterial > 0) ? clamp(ambient + diffuse + specular, 0.0, 1.0) : vColor;
 }
@@ -1,22 +1,38 @@
-#version 130
+#version 330
 
 in vec3 aPosition;
-in vec4 aColor;
 in vec3 aNormal;
 in vec2 aCoords;
+in mat4 aInstance;
 
-uniform mat4 uM;
-uniform mat4 uN;
-uniform mat4 uMVP;
+// Per-frame uniforms, updated in a single call. Layout must match FrameBlock in scene_renderer.cpp
+layout(std140) uniform Frame {
+  mat4 uMVP;
+  mat4 uM;
+  mat4 uN;
+  vec3 uLPos;
+  vec3 uCamPos;
+  vec3 uPosOffset;
+  vec3 uPosScale;
+  int uMaterial;
+};
 
 out vec3 vNormal;
 out vec3 vPosW;
 out vec2 vCoords;
 
 void main(void) {
-  vPosW = (uM * vec4(aPosition, 1.0)).xyz;
-  vNormal = normalize((uN * vec4(aNormal, 1.0)).xyz);
+  vec4 position = aInstance * vec4(uPosOffset + aPosition * uPosScale, 1.0);
 
-  gl_Position = uMVP * vec4(aPosition, 1.0);
-  vCoords = aCoords;
+  // Cofactor matrix of the instance transform: transforms normals like the inverse transpose, up to scale
+  mat3 m = mat3(aInstance);
+  mat3 cofactor = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1])) * sign(determinant(m));
+  vec3 normal = cofactor * aNormal;
+
+  vPosW = (uM * position).xyz;
+  vNormal = normalize((uN * vec4(normal, 1.0)).xyz);
+
+  gl_Position = uMVP * position;
+  // Images are uploaded top row first, so the v axis is flipped here instead of flipping every image
+  vCoords = vec2(aCoords.x, 1.0 - aCoords.y);
 }
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "point_octree.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <utility>
+
+#include "parallel_for.h"
+
+namespace {
+
+/** Nodes whose points are less than this many pixels apart are not refined */
+const float kMinPixelSpacing = 1.0f;
+
+/** Ratio between the radius of the bounding sphere of a cube and half of its edge */
+const float kSqrt3 = 1.7320508f;
+
+/**
+ * Selection state of a node, used to find the selected nodes whose visible children are all selected.
+ */
+enum NodeState : uint8_t { kUntested, kCulled, kQueued, kSelected };
+
+/**
+ * Checks whether the cube of a node intersects a view frustum. Cubes near a corner of the frustum may be reported as
+ * intersecting it although they are outside of it.
+ */
+bool intersectsFrustum(const PointOctreeNode& node, const FrustumPlanes& planes) {
+  for (const std::array<float, 4>& plane : planes) {
+    float distance = plane[0] * node.center[0] + plane[1] * node.center[1] + plane[2] * node.center[2] + plane[3];
+    float extent = node.half_size * (std::abs(plane[0]) + std::abs(plane[1]) + std::abs(plane[2]));
+    if (distance + extent < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Splits the points of a node: a random sample of kNodePoints points stays in the node, at the start of its range of
+ * the order, and the others are sorted by octant after it. Nodes with few points, or at the deepest level, keep all of
+ * them.
+ *
+ * @param index: index of the node, which seeds the random sample so builds are reproducible.
+ * @param depth: level of the node.
+ * @param positions: positions of the points.
+ * @param node: node whose count is the number of points of its cube on input, and of its own points on output.
+ * @param order: point order, whose range of the node is reordered.
+ * @param scratch: buffer of the size of the order, whose range of the node is overwritten.
+ * @param octant_counts: receives the number of points of each octant.
+ */
+void splitNode(const size_t index, const int depth, const std::vector<float>& positions, PointOctreeNode* node,
+               std::vector<uint32_t>* order, std::vector<uint32_t>* scratch, std::array<uint32_t, 8>* octant_counts) {
+  octant_counts->fill(0);
+  const uint32_t total = node->count;
+
+  if (total > 2 * PointOctree::kNodePoints && depth < PointOctree::kMaxDepth) {
+    // Partial Fisher-Yates shuffle: the first kNodePoints points of the range are a uniform sample of it
+    uint32_t* points = order->data() + node->first;
+    std::minstd_rand random(static_cast<uint32_t>(index) + 1);
+    for (uint32_t i = 0; i < PointOctree::kNodePoints; i++) {
+      std::swap(points[i], points[i + random() % (total - i)]);
+    }
+    node->count = PointOctree::kNodePoints;
+
+    // Counting sort of the remaining points by octant, through the scratch buffer
+    uint32_t* remaining = points + PointOctree::kNodePoints;
+    uint32_t* sorted = scratch->data() + node->first + PointOctree::kNodePoints;
+    const uint32_t remaining_count = total - PointOctree::kNodePoints;
+    auto octant = [&](const uint32_t point) {
+      const float* position = &positions[static_cast<size_t>(point) * 3];
+      return (position[0] >= node->center[0] ? 1 : 0) | (position[1] >= node->center[1] ? 2 : 0) |
+             (position[2] >= node->center[2] ? 4 : 0);
+    };
+
+    for (uint32_t i = 0; i < remaining_count; i++) {
+      (*octant_counts)[octant(remaining[i])]++;
+    }
+    std::array<uint32_t, 8> offsets;
+    std::exclusive_scan(octant_counts->begin(), octant_counts->end(), offsets.begin(), 0u);
+    for (uint32_t i = 0; i < remaining_count; i++) {
+      sorted[offsets[octant(remaining[i])]++] = remaining[i];
+    }
+    std::copy_n(sorted, remaining_count, remaining);
+  }
+
+  node->spacing = 2.0f * node->half_size / std::sqrt(static_cast<float>(std::max(node->count, 1u)));
+}
+
+}  // namespace
+
+void PointOctree::build(const std::vector<float>& positions, const BoundingBox& bounds,
+                        std::vector<uint32_t>* order) {
+  clear();
+  const size_t point_count = positions.size() / 3;
+  order->resize(point_count);
+  std::iota(order->begin(), order->end(), 0);
+  if (point_count == 0) {
+    return;
+  }
+
+  // The cube of the root is slightly larger than the bounding box, so the points on its faces are inside of it
+  PointOctreeNode root;
+  float edge = 0.0f;
+  for (int k = 0; k < 3; k++) {
+    root.center[k] = (bounds[k] + bounds[k + 3]) / 2.0f;
+    edge = std::max(edge, bounds[k + 3] - bounds[k]);
+  }
+  root.half_size = std::max(edge / 2.0f * 1.0001f, std::numeric_limits<float>::min());
+  root.count = static_cast<uint32_t>(point_count);
+  nodes_.push_back(root);
+
+  // Nodes are split one level at a time, so the children of each node are appended next to each other
+  std::vector<uint32_t> scratch(point_count);
+  size_t level_begin = 0;
+  for (int depth = 0; level_begin < nodes_.size(); depth++) {
+    const size_t level_end = nodes_.size();
+    std::vector<std::array<uint32_t, 8>> octant_counts(level_end - level_begin);
+    parallelFor(level_end - level_begin, [&](const size_t i) {
+      splitNode(level_begin + i, depth, positions, &nodes_[level_begin + i], order, &scratch, &octant_counts[i]);
+    });
+
+    for (size_t i = level_begin; i < level_end; i++) {
+      const PointOctreeNode parent = nodes_[i];
+      uint32_t first = parent.first + parent.count;
+      nodes_[i].first_child = static_cast<uint32_t>(nodes_.size());
+
+      for (int octant = 0; octant < 8; octant++) {
+        const uint32_t count = octant_counts[i - level_begin][octant];
+        if (count == 0) {
+          continue;
+        }
+
+        PointOctreeNode child;
+        child.half_size = parent.half_size / 2.0f;
+        for (int k = 0; k < 3; k++) {
+          child.center[k] = parent.center[k] + ((octant & (1 << k)) ? child.half_size : -child.half_size);
+        }
+        child.first = first;
+        child.count = count;
+        first += count;
+        nodes_.push_back(child);
+        nodes_[i].child_count++;
+      }
+
+      if (nodes_[i].child_count == 0) {
+        nodes_[i].first_child = 0;
+      }
+    }
+    level_begin = level_end;
+  }
+}
+
+void PointOctree::setNodes(const std::vector<PointOctreeNode>& nodes) { nodes_ = nodes; }
+
+void PointOctree::clear() { nodes_.clear(); }
+
+bool PointOctree::empty() const { return nodes_.empty(); }
+
+const std::vector<PointOctreeNode>& PointOctree::nodes() const { return nodes_; }
+
+size_t PointOctree::select(const FrustumPlanes& planes, const QVector3D& camera, const float pixels_per_unit,
+                           const size_t point_budget, std::vector<SelectedPointNode>* selected) const {
+  selected->clear();
+  if (nodes_.empty() || !intersectsFrustum(nodes_.front(), planes)) {
+    return 0;
+  }
+
+  // Spacing of the points of a node on the screen, in pixels, at the nearest point of its bounding sphere
+  auto pixel_spacing = [&](const PointOctreeNode& node) {
+    float distance = camera.distanceToPoint(QVector3D(node.center[0], node.center[1], node.center[2])) -
+                     node.half_size * kSqrt3;
+    return (distance > 0.0f) ? node.spacing * pixels_per_unit / distance : std::numeric_limits<float>::max();
+  };
+
+  std::vector<uint8_t> states(nodes_.size(), kUntested);
+  std::priority_queue<std::pair<float, uint32_t>> queue;
+  queue.push(std::make_pair(pixel_spacing(nodes_.front()), 0u));
+  states.front() = kQueued;
+
+  size_t point_count = 0;
+  while (!queue.empty()) {
+    const uint32_t index = queue.top().second;
+    const float spacing = queue.top().first;
+    const PointOctreeNode& node = nodes_[index];
+    if (!selected->empty() && point_count + node.count > point_budget) {
+      break;
+    }
+    queue.pop();
+
+    SelectedPointNode entry;
+    entry.node = index;
+    entry.spacing = node.spacing;
+    selected->push_back(entry);
+    states[index] = kSelected;
+    point_count += node.count;
+
+    if (spacing < kMinPixelSpacing) {
+      continue;
+    }
+    for (uint32_t child = node.first_child; child < node.first_child + node.child_count; child++) {
+      if (intersectsFrustum(nodes_[child], planes)) {
+        queue.push(std::make_pair(pixel_spacing(nodes_[child]), child));
+        states[child] = kQueued;
+      } else {
+        states[child] = kCulled;
+      }
+    }
+  }
+
+  // The points of a node are interleaved with those of its children, so when all of its visible children are drawn its
+  // points are as close as theirs. Children are selected after their parents, so they are visited first in reverse
+  std::vector<float> spacings(nodes_.size(), 0.0f);
+  for (auto entry = selected->rbegin(); entry != selected->rend(); ++entry) {
+    const PointOctreeNode& node = nodes_[entry->node];
+    float children_spacing = 0.0f;
+    bool children_drawn = true;
+    for (uint32_t child = node.first_child; child < node.first_child + node.child_count; child++) {
+      if (states[child] == kSelected) {
+        children_spacing = std::max(children_spacing, spacings[child]);
+      } else if (states[child] != kCulled) {
+        children_drawn = false;
+      }
+    }
+    if (children_drawn && children_spacing > 0.0f) {
+      entry->spacing = std::min(node.spacing, children_spacing);
+    }
+    spacings[entry->node] = entry->spacing;
+  }
+
+  return point_count;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef POINT_OCTREE_H_
+#define POINT_OCTREE_H_
+
+#include <QVector3D>
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+
+/**
+ * @brief Node of a PointOctree. Each node holds a random sample of the points inside its cube that were not taken by
+ * its ancestors, so drawing a node and its ancestors shows the points of its cube at the density of the node. The
+ * children of a node are stored next to each other.
+ */
+struct PointOctreeNode {
+  float center[3] = {0.0f, 0.0f, 0.0f}; /**< Center of the cube of the node */
+  float half_size = 0.0f;               /**< Half of the edge of the cube of the node */
+  uint32_t first = 0;                   /**< First point of the node, in the order of the octree */
+  uint32_t count = 0;                   /**< Number of points of the node */
+  uint32_t first_child = 0;             /**< Index of the first child, zero for leaves */
+  uint32_t child_count = 0;             /**< Number of children, empty octants have none */
+  float spacing = 0.0f;                 /**< Average distance between the points of the node */
+};
+
+/**
+ * @brief Node selected by PointOctree::select.
+ */
+struct SelectedPointNode {
+  uint32_t node = 0;    /**< Index of the node */
+  float spacing = 0.0f; /**< Distance between the drawn points around the points of the node */
+};
+
+/**
+ * @brief Level of detail hierarchy of a point cloud, in the spirit of Potree: each node of the octree keeps up to
+ * kNodePoints points sampled at random from its cube, and the remaining points go to its children. The coarse levels
+ * are then a uniform subsample of the cloud, and each frame draws the nodes that cover the most pixels until a point
+ * budget is reached, so the cost of a frame does not depend on the size of the cloud.
+ */
+class PointOctree {
+ public:
+  /** Number of points sampled by each inner node */
+  static const uint32_t kNodePoints = 16384;
+
+  /** Deepest level of the octree, whose nodes keep all their points */
+  static const int kMaxDepth = 20;
+
+  /**
+   * Builds the octree over a point cloud, replacing the previous one. The nodes of each level are split in parallel.
+   *
+   * @param positions: positions (x, y, z) of the points.
+   * @param bounds: bounding box of the points.
+   * @param order: receives the index of each point of the octree, so the points of each node are contiguous.
+   */
+  void build(const std::vector<float> &positions, const BoundingBox &bounds, std::vector<uint32_t> *order);
+
+  /**
+   * Replaces the nodes of the octree, such as nodes read from the mesh cache.
+   *
+   * @param nodes: nodes of the octree, the root first.
+   */
+  void setNodes(const std::vector<PointOctreeNode> &nodes);
+
+  /**
+   * Removes every node.
+   */
+  void clear();
+
+  /**
+   * Checks whether the octree has no points.
+   *
+   * @return True if the octree has no nodes.
+   */
+  bool empty() const;
+
+  /**
+   * Gets the nodes of the octree. The first node is the root.
+   *
+   * @return Nodes in breadth-first order.
+   */
+  const std::vector<PointOctreeNode> &nodes() const;
+
+  /**
+   * Selects the nodes to be drawn, those with the largest projected spacing first, until the point budget is reached
+   * (the visible root is always selected). Nodes outside the view frustum are skipped, and nodes whose points are less
+   * than a pixel apart are not refined. Each selected node gets the spacing of the points drawn around its own points:
+   * the spacing of its children when they are all drawn, and its own spacing otherwise.
+   *
+   * @param planes: planes of the view frustum, in the coordinates of the points. Zero planes disable culling.
+   * @param camera: position of the camera, in the coordinates of the points.
+   * @param pixels_per_unit: pixels covered by a unit of distance at unit depth.
+   * @param point_budget: maximum number of points of the selected nodes.
+   * @param selected: receives the selected nodes, parents before their children.
+   *
+   * @return Number of points of the selected nodes.
+   */
+  size_t select(const FrustumPlanes &planes, const QVector3D &camera, const float pixels_per_unit,
+                const size_t point_budget, std::vector<SelectedPointNode> *selected) const;
+
+ private:
+  std::vector<PointOctreeNode> nodes_; /**< Nodes of the octree, the root first */
+};
+
+#endif  // POINT_OCTREE_H_
@@ -0,0 +1,30 @@
+#version 330
+
+// Per-frame uniforms, updated in a single call. Layout must match FrameBlock in scene_renderer.cpp
+layout(std140) uniform Frame {
+  mat4 uMVP;
+  mat4 uM;
+  mat4 uN;
+  vec3 uLPos;
+  vec3 uCamPos;
+  vec3 uPosOffset;
+  vec3 uPosScale;
+  int uMaterial;
+};
+
+in vec3 vColor;
+
+out vec4 fragColor;
+
+void main(void) {
+  // Round splats: the corners of the point square are discarded
+  vec2 coord = gl_PointCoord * 2.0 - 1.0;
+  float radius2 = dot(coord, coord);
+  if (radius2 > 1.0) {
+    discard;
+  }
+
+  // With shading, splats are lit like spheres facing the camera, so the shape of the cloud is visible
+  float shade = (uMaterial > 0) ? 0.5 + 0.5 * sqrt(1.0 - radius2) : 1.0;
+  fragColor = vec4(vColor * shade, 1.0);
+}
@@ -0,0 +1,35 @@
+#version 330
+
+in vec4 aPosition;
+in vec4 aColor;
+
+// Per-frame uniforms, updated in a single call. Layout must match FrameBlock in scene_renderer.cpp
+layout(std140) uniform Frame {
+  mat4 uMVP;
+  mat4 uM;
+  mat4 uN;
+  vec3 uLPos;
+  vec3 uCamPos;
+  vec3 uPosOffset;
+  vec3 uPosScale;
+  int uMaterial;
+};
+
+// Cube of the drawn octree node, against which its positions are quantized
+uniform vec3 uNodeCenter;
+uniform float uNodeHalfSize;
+
+// Distance between the drawn points around the node, and pixels covered by a unit of distance at unit depth
+uniform float uPointSpacing;
+uniform float uPixelsPerUnit;
+uniform float uMaxPointSize;
+
+out vec3 vColor;
+
+void main(void) {
+  gl_Position = uMVP * vec4(uNodeCenter + aPosition.xyz * uNodeHalfSize, 1.0);
+
+  // Each splat covers the spacing of the points projected at its depth, so the surface is drawn without holes
+  gl_PointSize = clamp(uPointSpacing * uPixelsPerUnit / gl_Position.w, 1.0, uMaxPointSize);
+  vColor = aColor.rgb;
+}
@@ -4,142 +4,392 @@
 
 #include "qt_opengl.h"
 
-#include <assimp/postprocess.h>
+#include <QtConcurrent>
 
-#include <assimp/Importer.hpp>
-#include <limits>
+#include "mesh_streamer.h"
 
-QtOpenGL::QtOpenGL(QWidget* parent) : QOpenGLWidget(parent) {
+namespace {
+
+/**
+ * Gets the folder of the screenshots and recordings started from the keyboard or the context menu.
+ *
+ * @return The pictures folder of the user, or the current directory if there is none.
+ */
+QString captureFolder() {
+  QString folder = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
+  return folder.isEmpty() ? QDir::currentPath() : folder;
+}
+
+/**
+ * Gets a name for a screenshot or a recording from the current time, so captures never overwrite each other.
+ *
+ * @return Name without suffix.
+ */
+QString captureName() { return "qt_opengl_" + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss_zzz"); }
+
+}  // namespace
+
+QtOpenGL::QtOpenGL(QWidget* parent)
+    : QOpenGLWidget(parent), views_(std::make_shared<QList<QPointer<QtOpenGL>>>()) {
   setFocusPolicy(Qt::WheelFocus);
   createCustomContextMenu();
+  views_->append(this);
+
+  renderer_.profiler().setFrameCallback([this](const FrameStats& stats) { emit frameProfiled(stats); });
+
+  // Captured images are written on worker threads, and the results are reported on the thread of the viewer
+  QPointer<QtOpenGL> viewer(this);
+  capture_.setSavedCallback([viewer](const QString& filename, const bool recorded, const bool success) {
+    QMetaObject::invokeMethod(
+        qApp,
+        [viewer, filename, recorded, success]() {
+          if (!recorded && viewer) {
+            emit viewer->screenshotSaved(filename, success);
+          } else if (recorded && !success) {
+            qWarning() << "Failed to write" << filename;
+          }
+        },
+        Qt::QueuedConnection);
+  });
 
-  connect(
-      this, &QtOpenGL::loadTextureSignal, this,
-      [this]() {
-        is_texture_loaded_ = loadTexture(texture_filename_);
-      },
-      Qt::QueuedConnection);
+  // Textures are decoded on worker threads, and each one that becomes ready requests a frame to upload it
+  renderer_.textureManager().setReadyCallback(readyCallback());
 }
 
 QtOpenGL::~QtOpenGL() {
-  makeCurrent();
-  if (texture_) {
-    delete texture_;
+  views_->removeAll(this);
+
+  cancelMeshLoading();
+  for (QFuture<std::shared_ptr<SceneData>>& future : pending_loads_) {
+    future.waitForFinished();
   }
+
+  makeCurrent();
+  capture_.destroy();
+  renderer_.destroy();
   doneCurrent();
 }
 
 void QtOpenGL::setClearColor(const QColor& color) {
   if (color.isValid()) {
-    clear_color_ = color;
-    update();
+    renderer_.setClearColor(color);
+    scheduleFrame();
   }
 }
 
-void QtOpenGL::setUseMaterial(const bool use_material) { use_material_ = use_material; }
+void QtOpenGL::setUseMaterial(const bool use_material) {
+  renderer_.setUseMaterial(use_material);
+  scheduleFrame();
+}
 
-bool QtOpenGL::loadMesh(const QString& filename) {
-  QFileInfo file(filename);
-  if (!file.exists(filename) || !file.completeSuffix().endsWith("obj")) {
-    qWarning() << filename << "is not a valid mesh file.";
-    return false;
+void QtOpenGL::setFrustumCulling(const bool frustum_culling) {
+  renderer_.setFrustumCulling(frustum_culling);
+  scheduleFrame();
+}
+
+void QtOpenGL::setUseLods(const bool use_lods) {
+  renderer_.setUseLods(use_lods);
+  scheduleFrame();
+}
+
+void QtOpenGL::setCompressTextures(const bool compress_textures) {
+  // The views share their texture manager, so they must agree on the compression
+  for (const QPointer<QtOpenGL>& view : *views_) {
+    if (view) {
+      view->renderer_.setCompressTextures(compress_textures);
+    }
   }
+  scheduleViewFrames();
+}
 
-  Assimp::Importer importer;
-  const aiScene* scene = importer.ReadFile(filename.toStdString(), aiProcessPreset_TargetRealtime_MaxQuality);
+void QtOpenGL::setTextureMemoryBudget(const size_t bytes) { renderer_.textureManager().setMemoryBudget(bytes); }
 
-  if (!scene) {
-    qWarning() << "Scene import failed.";
-    return false;
+void QtOpenGL::setStreamMeshes(const bool stream_meshes) {
+  if (stream_meshes_ != stream_meshes) {
+    stream_meshes_ = stream_meshes;
+    reloadMesh();
   }
+}
+
+void QtOpenGL::setStreamBudget(const size_t bytes) { stream_budget_ = bytes; }
+
+void QtOpenGL::setCreaseAngle(const float degrees) { crease_angle_ = degrees; }
+
+void QtOpenGL::setPointBudget(const size_t point_budget) {
+  for (const QPointer<QtOpenGL>& view : *views_) {
+    if (view) {
+      view->renderer_.setPointBudget(point_budget);
+    }
+  }
+  scheduleViewFrames();
+}
+
+void QtOpenGL::setReleaseCpuGeometry(const bool release_cpu_geometry) {
+  renderer_.setReleaseCpuGeometry(release_cpu_geometry);
+}
 
-  resetView();
-  clearAllVBOs();
+void QtOpenGL::setQuantizePositions(const bool quantize_positions) {
+  if (quantize_positions_ != quantize_positions) {
+    quantize_positions_ = quantize_positions;
+    reloadMesh();
+  }
+}
 
-  float max = std::numeric_limits<float>::max();
-  float min = std::numeric_limits<float>::min();
+void QtOpenGL::setUseFastObjReader(const bool use_fast_obj_reader) {
+  if (use_fast_obj_reader_ != use_fast_obj_reader) {
+    use_fast_obj_reader_ = use_fast_obj_reader;
+    reloadMesh();
+  }
+}
 
-  scene_min_ = QVector3D(max, max, max);
-  scene_max_ = QVector3D(min, min, min);
+void QtOpenGL::setImportProfile(const ImportProfile profile, const unsigned int custom_flags) {
+  if (import_profile_ != profile || custom_import_flags_ != custom_flags) {
+    import_profile_ = profile;
+    custom_import_flags_ = custom_flags;
+    reloadMesh();
+  }
+}
 
-  traverseScene(scene, scene->mRootNode);
-  moveObjectToOrigin();
+void QtOpenGL::setUpgradeImport(const bool upgrade_import) { upgrade_import_ = upgrade_import; }
 
-  max = qMax(scene_max_.x(), qMax(scene_max_.y(), scene_max_.z()));
-  light_pos_ = QVector3D(max, max, max) * 3.0;
+void QtOpenGL::setUseIndexedGeometry(const bool use_indexed_geometry) {
+  if (use_indexed_geometry_ != use_indexed_geometry) {
+    use_indexed_geometry_ = use_indexed_geometry;
+    reloadMesh();
+  }
+}
 
-  mesh_filename_ = filename;
-  emit loadTextureSignal();
+bool QtOpenGL::loadMesh(const QString& filename) {
+  std::shared_ptr<SceneData> scene = std::make_shared<SceneData>();
+  SceneLoader loader(loadOptions());
+  if (!loader.load(filename, scene.get())) {
+    return false;
+  }
 
+  cancelMeshLoading();
+  setScene(scene);
   return true;
 }
 
-bool QtOpenGL::loadTexture(const QString& filename) {
-  if (filename.isEmpty()) {
-    texture_ = NULL;
+bool QtOpenGL::loadMeshAsync(const QString& filename) {
+  if (!SceneLoader::isValidMeshFile(filename)) {
+    qWarning() << filename << "is not a valid mesh file.";
     return false;
   }
 
-  makeCurrent();
-  QString texture_filepath = QFileInfo(mesh_filename_).absolutePath() + QString(QDir::separator()) + filename;
+  startMeshLoad(filename, loadOptions(), false);
+  return true;
+}
+
+void QtOpenGL::startMeshLoad(const QString& filename, const SceneLoadOptions& options, const bool upgrade) {
+  cancelMeshLoading();
+
+  std::shared_ptr<std::atomic_bool> cancelled = std::make_shared<std::atomic_bool>(false);
+  load_cancelled_ = cancelled;
+
+  QFuture<std::shared_ptr<SceneData>> future = QtConcurrent::run([this, filename, options, upgrade, cancelled]() {
+    int last_percentage = -1;
+    SceneLoader::ProgressCallback progress = [this, upgrade, cancelled, &last_percentage](float value) {
+      if (*cancelled) {
+        return false;
+      }
+      int percentage = qRound(value * 100);
+      if (!upgrade && percentage != last_percentage) {
+        last_percentage = percentage;
+        emit meshLoadProgress(percentage);
+      }
+      return true;
+    };
+
+    std::shared_ptr<SceneData> scene = std::make_shared<SceneData>();
+    SceneLoader loader(options);
+    return loader.load(filename, scene.get(), progress) ? scene : std::shared_ptr<SceneData>();
+  });
+
+  auto watcher = new QFutureWatcher<std::shared_ptr<SceneData>>(this);
+  connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, filename, options, upgrade, cancelled]() {
+    std::shared_ptr<SceneData> scene = watcher->result();
+    watcher->deleteLater();
+
+    if (*cancelled) {
+      return;
+    }
+    load_cancelled_.reset();
+
+    if (upgrade) {
+      // A failed upgrade keeps the preview
+      if (scene) {
+        setScene(scene, false);
+      }
+      return;
+    }
+
+    if (scene) {
+      setScene(scene);
+    }
+    emit meshLoaded(filename, scene != nullptr);
+
+    // Profiles only apply to files imported with assimp
+    if (scene && upgrade_import_ && options.import_profile != ImportProfile::kMaxQuality &&
+        !scene->read_by_obj_reader) {
+      SceneLoadOptions upgrade_options = options;
+      upgrade_options.import_profile = ImportProfile::kMaxQuality;
+      startMeshLoad(filename, upgrade_options, true);
+    }
+  });
+  watcher->setFuture(future);
 
-  if (texture_) {
-    delete texture_;
+  for (int i = pending_loads_.size() - 1; i >= 0; i--) {
+    if (pending_loads_[i].isFinished()) {
+      pending_loads_.removeAt(i);
+    }
+  }
+  pending_loads_.append(future);
+}
+
+void QtOpenGL::cancelMeshLoading() {
+  if (load_cancelled_) {
+    *load_cancelled_ = true;
+    load_cancelled_.reset();
   }
+}
 
-  QImage image = QImage(texture_filepath);
-  texture_ = new QOpenGLTexture(image.mirrored());
-  texture_->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
-  texture_->setMagnificationFilter(QOpenGLTexture::Linear);
-  texture_->setWrapMode(QOpenGLTexture::ClampToEdge);
+void QtOpenGL::setProfilingEnabled(const bool profiling_enabled) {
+  profiling_enabled_ = profiling_enabled;
+  renderer_.profiler().setEnabled(profiling_enabled_ || show_profiler_overlay_);
+}
 
-  if (texture_->textureId() == 0) {
-    texture_ = NULL;
-    qWarning() << "Texture import failed.";
+void QtOpenGL::setShowProfilerOverlay(const bool show_profiler_overlay) {
+  show_profiler_overlay_ = show_profiler_overlay;
+  renderer_.profiler().setEnabled(profiling_enabled_ || show_profiler_overlay_);
+  scheduleFrame();
+}
+
+void QtOpenGL::saveScreenshot(const QString& filename) {
+  capture_.requestScreenshot(filename);
+  scheduleFrame();
+}
+
+bool QtOpenGL::startRecording(const QString& directory) {
+  stopRecording();
+  if (!capture_.startRecording(directory)) {
     return false;
   }
 
-  texture_->bind();
+  emit recordingStarted(directory);
+  scheduleFrame();
   return true;
 }
 
+void QtOpenGL::stopRecording() {
+  if (!capture_.isRecording()) {
+    return;
+  }
+  capture_.stopRecording();
+
+  // The last frames are still in flight, and are waited for once so the counts are final
+  makeCurrent();
+  capture_.finish();
+  doneCurrent();
+
+  emit recordingStopped(capture_.recordingDirectory(), static_cast<int>(capture_.recordedFrames()),
+                        static_cast<int>(capture_.droppedFrames()));
+}
+
+bool QtOpenGL::isRecording() const { return capture_.isRecording(); }
+
+bool QtOpenGL::loadTexture(const QString& filename) {
+  makeCurrent();
+  bool success = renderer_.loadTexture(filename);
+  doneCurrent();
+
+  scheduleViewFrames();
+  return success;
+}
+
+void QtOpenGL::addView(QtOpenGL* view) {
+  view->renderer_.shareTextureManager(renderer_);
+  view->renderer_.setCompressTextures(renderer_.compressTextures());
+  view->renderer_.setPointBudget(renderer_.pointBudget());
+
+  view->views_ = views_;
+  views_->append(view);
+
+  if (renderer_.scene()) {
+    view->showScene(renderer_.scene(), true);
+  }
+}
+
 void QtOpenGL::paintGL(void) {
-  glClearColor(clear_color_.redF(), clear_color_.greenF(), clear_color_.blueF(), clear_color_.alphaF());
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  frame_scheduled_ = false;
+  applyPendingInput();
+
+  renderer_.render(width(), height(), rotation_matrix_, camera_pos_z_mult_);
 
-  QMatrix4x4 projection;
-  float camera_near = scene_max_.distanceToPoint(scene_min_) / 500.0;
-  projection.perspective(45.0f, (width() / static_cast<float>(height() ? height() : 1)), camera_near, 100000.0);
-  camera_pos_ = QVector3D(0, 0, (scene_max_.z() * 5.0 * camera_pos_z_mult_));
+  // The scene is read back before the overlay is painted, so captures do not include it. Captured frames are mapped a
+  // few frames later and recordings save every frame, so frames keep being drawn while there is something to capture
+  if (capture_.isBusy()) {
+    QSize size = (QSizeF(this->size()) * devicePixelRatioF()).toSize();
+    capture_.captureFrame(defaultFramebufferObject(), size.width(), size.height());
+    scheduleFrame();
+  }
+
+  // Ready textures and pages over the upload limit of a frame are uploaded by the next ones, drawn by every view
+  const std::shared_ptr<SceneData>& scene = renderer_.scene();
+  if (renderer_.textureManager().hasReady() || (scene && scene->streamer && scene->streamer->hasReady())) {
+    scheduleViewFrames();
+  }
 
-  QMatrix4x4 view;
-  view.lookAt(camera_pos_, QVector3D(0, 0, 0), QVector3D(0, 1, 0));
+  if (show_profiler_overlay_) {
+    drawProfilerOverlay();
+    // The GPU times of a frame are read a few frames later, so the overlay keeps drawing frames while it is shown
+    scheduleFrame();
+  }
+}
 
-  shader_program_.bind();
+void QtOpenGL::scheduleFrame() {
+  if (!frame_scheduled_) {
+    frame_scheduled_ = true;
+    update();
+  }
+}
 
-  QMatrix4x4 MVP = projection * view * rotation_matrix_;
-  setUniformValues(MVP);
+void QtOpenGL::scheduleViewFrames() {
+  for (const QPointer<QtOpenGL>& view : *views_) {
+    if (view) {
+      view->scheduleFrame();
+    }
+  }
+}
 
-  if (texture_) {
-    glBindTexture(GL_TEXTURE_2D, texture_->textureId());
+void QtOpenGL::applyPendingInput() {
+  if (!rotation_pending_) {
+    return;
   }
+  rotation_pending_ = false;
 
-  drawMesh();
+  QVector3D v = getArcBallVector(last_pos_.x(), last_pos_.y());
+  QVector3D u = getArcBallVector(pending_pos_.x(), pending_pos_.y());
+  last_pos_ = pending_pos_;
+
+  float angle = qAcos(qMin(1.0f, QVector3D::dotProduct(u, v)));
+  QVector3D rot_axis = QVector3D::crossProduct(v, u);
+  if (rot_axis.isNull()) {
+    return;
+  }
 
-  shader_program_.release();
+  // The arcball axis is in view space, so the rotation is applied after the current one
+  QMatrix4x4 rotation;
+  rotation.rotate(qRadiansToDegrees(angle), rot_axis);
+  rotation_matrix_ = rotation * rotation_matrix_;
 }
 
 void QtOpenGL::resizeGL(int width, int height) { glViewport(0, 0, width, height); }
 
 void QtOpenGL::initializeGL() {
   initializeOpenGLFunctions();
-
-  initShaders();
-  enableGlCapabilities();
-
-  shader_program_.link();
-
-  getAttributeLocations();
+  renderer_.initialize();
+  capture_.initialize();
 }
 
 void QtOpenGL::keyPressEvent(QKeyEvent* event) {
@@ -149,18 +399,28 @@ void QtOpenGL::keyPressEvent(QKeyEvent* event) {
       break;
     case Qt::Key_Space:
       resetView();
+      scheduleFrame();
       break;
     case Qt::Key_Period:
-      makeCurrent();
-      glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+      renderer_.setPolygonMode(GL_POINT);
+      scheduleFrame();
       break;
     case Qt::Key_Minus:
-      makeCurrent();
-      glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+      renderer_.setPolygonMode(GL_LINE);
+      scheduleFrame();
       break;
     case Qt::Key_F:
-      makeCurrent();
-      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+      renderer_.setPolygonMode(GL_FILL);
+      scheduleFrame();
+      break;
+    case Qt::Key_P:
+      setShowProfilerOverlay(!show_profiler_overlay_);
+      break;
+    case Qt::Key_S:
+      saveScreenshot(QDir(captureFolder()).filePath(captureName() + ".png"));
+      break;
+    case Qt::Key_R:
+      toggleRecording();
       break;
     default:
       break;
@@ -168,42 +428,24 @@ void QtOpenGL::keyPressEvent(QKeyEvent* event) {
 }
 
 void QtOpenGL::mouseMoveEvent(QMouseEvent* event) {
+  // Mouse moves between two frames are coalesced into a single rotation, applied by the next paintGL
   if (event->buttons() & Qt::LeftButton) {
-    QVector3D v = getArcBallVector(last_pos_.x(), last_pos_.y());
-    QVector3D u = getArcBallVector(event->x(), event->y());
-
-    float angle = qAcos(qMin(1.0f, QVector3D::dotProduct(u, v)));
-
-    QVector3D rot_axis = QVector3D::crossProduct(v, u);
-    QVector3D rot_vector = rotation_matrix_.inverted() * rot_axis;
-
-    last_pos_ = event->pos();
-
-    rotation_matrix_.rotate(qRadiansToDegrees(angle), rot_vector);
+    pending_pos_ = event->pos();
+    rotation_pending_ = true;
+    scheduleFrame();
   }
 }
 
-void QtOpenGL::mousePressEvent(QMouseEvent* event) { last_pos_ = event->pos(); }
+void QtOpenGL::mousePressEvent(QMouseEvent* event) {
+  last_pos_ = event->pos();
+  pending_pos_ = last_pos_;
+  rotation_pending_ = false;
+}
 
 void QtOpenGL::wheelEvent(QWheelEvent* event) {
   camera_pos_z_mult_ *=
       (event->delta() > 0) ? (camera_pos_z_mult_ < 10 ? 1.25 : 1.0) : (camera_pos_z_mult_ > 0.1 ? 0.8 : 1.0);
-}
-
-bool QtOpenGL::event(QEvent* event) {
-  bool handled = QOpenGLWidget::event(event);
-  switch (event->type()) {
-    case QEvent::Show:
-    case QEvent::KeyPress:
-    case QEvent::MouseButtonPress:
-    case QEvent::MouseMove:
-    case QEvent::Wheel:
-      this->update();
-      break;
-    default:
-      break;
-  }
-  return handled;
+  scheduleFrame();
 }
 
 void QtOpenGL::createCustomContextMenu() {
@@ -213,15 +455,115 @@ void QtOpenGL::createCustomContextMenu() {
 
   QAction* shading_action = new QAction("Enable shading", this);
   shading_action->setCheckable(true);
-  shading_action->setChecked(use_material_);
+  shading_action->setChecked(renderer_.useMaterial());
   connect(shading_action, &QAction::toggled, this, &QtOpenGL::setUseMaterial);
   menu->addAction(shading_action);
 
+  QAction* culling_action = new QAction("Frustum culling", this);
+  culling_action->setCheckable(true);
+  culling_action->setChecked(renderer_.frustumCulling());
+  connect(culling_action, &QAction::toggled, this, &QtOpenGL::setFrustumCulling);
+  menu->addAction(culling_action);
+
+  QAction* lod_action = new QAction("Levels of detail", this);
+  lod_action->setCheckable(true);
+  lod_action->setChecked(renderer_.useLods());
+  connect(lod_action, &QAction::toggled, this, &QtOpenGL::setUseLods);
+  menu->addAction(lod_action);
+
+  QAction* indexed_action = new QAction("Indexed geometry", this);
+  indexed_action->setCheckable(true);
+  indexed_action->setChecked(use_indexed_geometry_);
+  connect(indexed_action, &QAction::toggled, this, &QtOpenGL::setUseIndexedGeometry);
+  menu->addAction(indexed_action);
+
+  QAction* quantize_action = new QAction("Quantized positions", this);
+  quantize_action->setCheckable(true);
+  quantize_action->setChecked(quantize_positions_);
+  connect(quantize_action, &QAction::toggled, this, &QtOpenGL::setQuantizePositions);
+  menu->addAction(quantize_action);
+
+  QAction* compress_action = new QAction("Compressed textures", this);
+  compress_action->setCheckable(true);
+  compress_action->setChecked(renderer_.compressTextures());
+  connect(compress_action, &QAction::toggled, this, &QtOpenGL::setCompressTextures);
+  menu->addAction(compress_action);
+
+  QAction* stream_action = new QAction("Stream OBJ pages", this);
+  stream_action->setCheckable(true);
+  connect(stream_action, &QAction::toggled, this, &QtOpenGL::setStreamMeshes);
+  menu->addAction(stream_action);
+
+  QAction* obj_reader_action = new QAction("Fast OBJ reader", this);
+  obj_reader_action->setCheckable(true);
+  obj_reader_action->setChecked(use_fast_obj_reader_);
+  connect(obj_reader_action, &QAction::toggled, this, &QtOpenGL::setUseFastObjReader);
+  menu->addAction(obj_reader_action);
+
+  QMenu* profile_menu = menu->addMenu("Import profile");
+  QActionGroup* profile_group = new QActionGroup(this);
+  const std::vector<std::pair<QString, ImportProfile>> profiles = {{"Fast", ImportProfile::kFast},
+                                                                   {"Balanced", ImportProfile::kBalanced},
+                                                                   {"Max quality", ImportProfile::kMaxQuality},
+                                                                   {"Custom", ImportProfile::kCustom}};
+  for (const std::pair<QString, ImportProfile>& profile : profiles) {
+    QAction* profile_action = profile_group->addAction(profile.first);
+    profile_action->setCheckable(true);
+    profile_action->setData(static_cast<int>(profile.second));
+    connect(profile_action, &QAction::triggered, this,
+            [this, profile]() { setImportProfile(profile.second, custom_import_flags_); });
+    profile_menu->addAction(profile_action);
+  }
+
+  profile_menu->addSeparator();
+
+  QAction* upgrade_action = new QAction("Upgrade to max quality in background", this);
+  upgrade_action->setCheckable(true);
+  connect(upgrade_action, &QAction::toggled, this, &QtOpenGL::setUpgradeImport);
+  profile_menu->addAction(upgrade_action);
+
   menu->addSeparator();
 
+  QAction* overlay_action = new QAction("Show profiler overlay", this);
+  overlay_action->setCheckable(true);
+  connect(overlay_action, &QAction::toggled, this, &QtOpenGL::setShowProfilerOverlay);
+  menu->addAction(overlay_action);
+
+  // The import profile, the overlay, the texture compression and the streaming may also be set from the command line or
+  // the keyboard, so the checked actions are refreshed on every popup
+  connect(menu, &QMenu::aboutToShow, this,
+          [this, profile_group, upgrade_action, overlay_action, compress_action, stream_action]() {
+    for (QAction* action : profile_group->actions()) {
+      action->setChecked(action->data().toInt() == static_cast<int>(import_profile_));
+    }
+    upgrade_action->setChecked(upgrade_import_);
+    overlay_action->setChecked(show_profiler_overlay_);
+    compress_action->setChecked(renderer_.compressTextures());
+    stream_action->setChecked(stream_meshes_);
+  });
+
+  menu->addSeparator();
+
+  QAction* screenshot_action = new QAction("Save screenshot...", this);
+  connect(screenshot_action, &QAction::triggered, this, [this]() {
+    QString filename = QFileDialog::getSaveFileName(this, "Save screenshot",
+                                                    QDir(captureFolder()).filePath(captureName() + ".png"),
+                                                    "Images (*.png *.jpg *.bmp)");
+    if (!filename.isEmpty()) {
+      saveScreenshot(filename);
+    }
+  });
+  menu->addAction(screenshot_action);
+
+  QAction* record_action = new QAction("Record frames", this);
+  record_action->setCheckable(true);
+  connect(record_action, &QAction::triggered, this, &QtOpenGL::toggleRecording);
+  menu->addAction(record_action);
+  connect(menu, &QMenu::aboutToShow, this, [this, record_action]() { record_action->setChecked(isRecording()); });
+
   QAction* color_action = new QAction("Change background color", this);
   connect(color_action, &QAction::triggered, this, [this]() {
-    QColor color = QColorDialog::getColor(clear_color_, this);
+    QColor color = QColorDialog::getColor(renderer_.clearColor(), this);
     setClearColor(color);
   });
   menu->addAction(color_action);
@@ -229,187 +571,122 @@ void QtOpenGL::createCustomContextMenu() {
   connect(this, &QLabel::customContextMenuRequested, [this, menu](QPoint pos) { menu->popup(this->mapToGlobal(pos)); });
 }
 
-bool QtOpenGL::initShaders() {
-  bool success = true;
-  success &= shader_program_.addShaderFromSourceFile(QOpenGLShader::Vertex, ":phong.vert");
-  success &= shader_program_.addShaderFromSourceFile(QOpenGLShader::Fragment, ":phong.frag");
-
-  if (!success) {
-    qWarning() << "Shader import failed.";
-  }
-
-  return success;
-}
-
-void QtOpenGL::enableGlCapabilities() {
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_NORMALIZE);
-  glEnable(GL_TEXTURE_2D);
-
-  glDepthFunc(GL_LESS);
-}
-
-void QtOpenGL::getAttributeLocations() {
-  vertex_location_ = shader_program_.attributeLocation("aPosition");
-  vertex_color_location_ = shader_program_.attributeLocation("aColor");
-  vertex_normal_location_ = shader_program_.attributeLocation("aNormal");
-  vertex_uv_coords_location_ = shader_program_.attributeLocation("aCoords");
-}
-
 void QtOpenGL::resetView() {
-  makeCurrent();
-
-  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  renderer_.setPolygonMode(GL_FILL);
+  renderer_.setUseMaterial(true);
 
-  use_material_ = true;
   camera_pos_z_mult_ = 1.0;
 
   rotation_matrix_.setToIdentity();
+  rotation_pending_ = false;
 }
 
-void QtOpenGL::clearAllVBOs() {
-  vbo_vertices_.clear();
-  vbo_colors_.clear();
-  vbo_normals_.clear();
-  vbo_texture_coords_.clear();
+SceneLoadOptions QtOpenGL::loadOptions() const {
+  SceneLoadOptions options;
+  options.use_indexed_geometry = use_indexed_geometry_;
+  options.quantize_positions = quantize_positions_;
+  options.use_fast_obj_reader = use_fast_obj_reader_;
+  options.import_profile = import_profile_;
+  options.custom_import_flags = custom_import_flags_;
+  options.stream = stream_meshes_;
+  options.stream_budget = stream_budget_;
+  options.crease_angle = crease_angle_;
+  return options;
 }
 
-int QtOpenGL::traverseScene(const aiScene* sc, const aiNode* nd) {
-  int tot_vertices = 0;
-  for (unsigned int n = 0; n < nd->mNumMeshes; n++) {
-    const aiMesh* mesh = sc->mMeshes[nd->mMeshes[n]];
-    updateMaterial(sc->mMaterials[mesh->mMaterialIndex], n);
-
-    for (unsigned int t = 0; t < mesh->mNumFaces; t++) {
-      const aiFace* face = &mesh->mFaces[t];
-      for (unsigned int i = 0; i < face->mNumIndices; i++) {
-        int index = face->mIndices[i];
-
-        vbo_colors_.push_back(ambient_material_.x());
-        vbo_colors_.push_back(ambient_material_.y());
-        vbo_colors_.push_back(ambient_material_.z());
-        vbo_colors_.push_back(ambient_material_.w());
-
-        if (mesh->HasTextureCoords(0)) {
-          vbo_texture_coords_.push_back(mesh->mTextureCoords[0][index].x);
-          vbo_texture_coords_.push_back(mesh->mTextureCoords[0][index].y);
-        }
-
-        if (mesh->mNormals != NULL) {
-          vbo_normals_.push_back(mesh->mNormals[index].x);
-          vbo_normals_.push_back(mesh->mNormals[index].y);
-          vbo_normals_.push_back(mesh->mNormals[index].z);
-        }
-
-        aiVector3D vertex = mesh->mVertices[index];
-        vbo_vertices_.push_back(vertex.x);
-        vbo_vertices_.push_back(vertex.y);
-        vbo_vertices_.push_back(vertex.z);
-        updateSceneBoundingBox(vertex);
-
-        tot_vertices++;
-      }
-    }
-  }
-
-  for (unsigned int n = 0; n < nd->mNumChildren; n++) {
-    tot_vertices += traverseScene(sc, nd->mChildren[n]);
+void QtOpenGL::reloadMesh() {
+  if (!mesh_filename_.isEmpty()) {
+    loadMeshAsync(mesh_filename_);
   }
-
-  return tot_vertices;
-}
-
-void QtOpenGL::updateSceneBoundingBox(const aiVector3D& vertex) {
-  scene_min_.setX(qMin(scene_min_.x(), vertex.x));
-  scene_min_.setY(qMin(scene_min_.y(), vertex.y));
-  scene_min_.setZ(qMin(scene_min_.z(), vertex.z));
-
-  scene_max_.setX(qMax(scene_max_.x(), vertex.x));
-  scene_max_.setY(qMax(scene_max_.y(), vertex.y));
-  scene_max_.setZ(qMax(scene_max_.z(), vertex.z));
 }
 
-void QtOpenGL::moveObjectToOrigin() {
-  QVector3D scene_center = QVector3D(scene_min_ + scene_max_) / 2.0;
-  for (size_t i = 0; i < vbo_vertices_.size(); i += 3) {
-    vbo_vertices_[i] -= scene_center.x();
-    vbo_vertices_[i + 1] -= scene_center.y();
-    vbo_vertices_[i + 2] -= scene_center.z();
-  }
-
-  scene_min_ -= scene_center;
-  scene_max_ -= scene_center;
+std::function<void()> QtOpenGL::readyCallback() const {
+  std::shared_ptr<QList<QPointer<QtOpenGL>>> views = views_;
+  return [views]() {
+    QMetaObject::invokeMethod(
+        qApp,
+        [views]() {
+          for (const QPointer<QtOpenGL>& view : *views) {
+            if (view) {
+              view->scheduleFrame();
+            }
+          }
+        },
+        Qt::QueuedConnection);
+  };
 }
 
-void QtOpenGL::updateMaterial(const aiMaterial* const material, const int mesh_index) {
-  aiColor4D c;
-  aiString s;
-
-  if (AI_SUCCESS == material->Get(AI_MATKEY_COLOR_AMBIENT, c)) {
-    ambient_material_ = QVector4D(c.r, c.g, c.b, c.a);
-  }
-  if (AI_SUCCESS == material->Get(AI_MATKEY_COLOR_DIFFUSE, c)) {
-    diffuse_material_ = QVector4D(c.r, c.g, c.b, c.a);
-  }
-  if (AI_SUCCESS == material->Get(AI_MATKEY_COLOR_SPECULAR, c)) {
-    specular_material_ = QVector4D(c.r, c.g, c.b, c.a);
+void QtOpenGL::setScene(const std::shared_ptr<SceneData>& scene, const bool reset_view) {
+  // Full pages are read on worker threads, and each one that becomes ready requests a frame to upload it
+  if (scene->streamer) {
+    scene->streamer->setReadyCallback(readyCallback());
   }
 
-  if (AI_SUCCESS == material->Get(AI_MATKEY_TEXTURE_DIFFUSE(mesh_index), s)) {
-    texture_filename_ = s.C_Str();
-  } else {
-    texture_filename_.clear();
+  for (const QPointer<QtOpenGL>& view : *views_) {
+    if (view) {
+      view->showScene(scene, reset_view);
+    }
   }
 }
 
-bool QtOpenGL::isValidTexture() {
-  return (is_texture_loaded_ && !vbo_texture_coords_.empty() && !texture_filename_.isEmpty());
-}
-
-void QtOpenGL::setUniformValues(const QMatrix4x4& MVP) {
-  QMatrix4x4 normal_matrix = rotation_matrix_.inverted().transposed();
-
-  shader_program_.setUniformValue("uLPos", light_pos_);
-  shader_program_.setUniformValue("uCamPos", camera_pos_);
-
-  shader_program_.setUniformValue("matAmb", ambient_material_);
-  shader_program_.setUniformValue("matDif", diffuse_material_);
-  shader_program_.setUniformValue("matSpec", specular_material_);
+void QtOpenGL::showScene(const std::shared_ptr<SceneData>& scene, const bool reset_view) {
+  if (reset_view) {
+    resetView();
+  }
 
-  shader_program_.setUniformValue("uMVP", MVP);
-  shader_program_.setUniformValue("uN", normal_matrix);
-  shader_program_.setUniformValue("uM", rotation_matrix_);
+  renderer_.setScene(scene);
+  mesh_filename_ = scene->filename;
 
-  shader_program_.setUniformValue("uTexLoad", isValidTexture());
-  shader_program_.setUniformValue("uMaterial", use_material_);
+  scheduleFrame();
 }
 
-void QtOpenGL::drawMesh() {
-  if (vbo_vertices_.empty() || vbo_colors_.empty() || vbo_normals_.empty()) {
-    return;
+void QtOpenGL::drawProfilerOverlay() {
+  const FrameStats& stats = renderer_.profiler().lastFrame();
+  auto milliseconds = [](double value) { return value < 0 ? QString("n/a") : QString::number(value, 'f', 2); };
+
+  QStringList lines;
+  lines << QString("Frame %1  CPU %2 ms  GPU %3 ms  Interval %4 ms")
+               .arg(stats.frame)
+               .arg(milliseconds(stats.cpu_ms))
+               .arg(milliseconds(stats.gpu_ms))
+               .arg(milliseconds(stats.interval_ms));
+  for (const ProfileSection& section : stats.sections) {
+    lines << QString("%1%2 CPU %3 ms  GPU %4 ms")
+                 .arg(QString(2 * (section.depth + 1), ' '))
+                 .arg(QString(section.name), -10)
+                 .arg(milliseconds(section.cpu_ms))
+                 .arg(milliseconds(section.gpu_ms));
   }
-
-  shader_program_.setAttributeArray(vertex_location_, &vbo_vertices_[0], 3);
-  shader_program_.enableAttributeArray(vertex_location_);
-
-  shader_program_.setAttributeArray(vertex_color_location_, &vbo_colors_[0], 4);
-  shader_program_.enableAttributeArray(vertex_color_location_);
-
-  shader_program_.setAttributeArray(vertex_normal_location_, &vbo_normals_[0], 3);
-  shader_program_.enableAttributeArray(vertex_normal_location_);
-
-  if (isValidTexture()) {
-    shader_program_.setAttributeArray(vertex_uv_coords_location_, &vbo_texture_coords_[0], 2);
-    shader_program_.enableAttributeArray(vertex_uv_coords_location_);
+  lines << QString("Draws %1  Triangles %2  Points %3  Uploaded %4 KB  State changes %5  Culled %6")
+               .arg(stats.counters.draw_calls)
+               .arg(stats.counters.triangles)
+               .arg(stats.counters.points)
+               .arg(stats.counters.bytes_uploaded / 1024)
+               .arg(stats.counters.state_changes)
+               .arg(stats.counters.culled_instances);
+
+  QPainter painter(this);
+  painter.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  QFontMetrics metrics(painter.font());
+
+  int text_width = 0;
+  for (const QString& line : lines) {
+    text_width = qMax(text_width, metrics.boundingRect(line).width());
   }
 
-  glDrawArrays(GL_TRIANGLES, 0, (vbo_vertices_.size() / 3));
+  QRect background(8, 8, text_width + 16, lines.size() * metrics.height() + 8);
+  painter.fillRect(background, QColor(0, 0, 0, 160));
+  painter.setPen(Qt::white);
+  for (int i = 0; i < lines.size(); i++) {
+    painter.drawText(background.left() + 8, background.top() + 4 + metrics.ascent() + i * metrics.height(), lines[i]);
+  }
+}
 
-  shader_program_.disableAttributeArray(vertex_location_);
-  shader_program_.disableAttributeArray(vertex_color_location_);
-  shader_program_.disableAttributeArray(vertex_normal_location_);
-  if (isValidTexture()) {
-    shader_program_.disableAttributeArray(vertex_uv_coords_location_);
+void QtOpenGL::toggleRecording() {
+  if (isRecording()) {
+    stopRecording();
+  } else if (!startRecording(QDir(captureFolder()).filePath(captureName()))) {
+    qWarning() << "Failed to create the recording directory in" << captureFolder();
   }
 }
 
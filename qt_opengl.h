@@ -5,19 +5,22 @@
 #ifndef QT_OPENGL_H_
 #define QT_OPENGL_H_
 
-#include <assimp/scene.h>
-
-#include <QOpenGLFunctions>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLTexture>
+#include <QFuture>
+#include <QOpenGLExtraFunctions>
+#include <QPointer>
 #include <QtWidgets>
-#include <vector>
+#include <atomic>
+#include <memory>
+
+#include "frame_capture.h"
+#include "scene_loader.h"
+#include "scene_renderer.h"
 
 /**
  * @brief A QOpenGLWidget based class that allows loading and displaying OpenGL scenes in qt applications. For this
- * widget, we use the Phong's realistic rendering technique
+ * widget, we use the Phong's realistic rendering technique, drawn by a SceneRenderer
  */
-class QtOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
+class QtOpenGL : public QOpenGLWidget, protected QOpenGLExtraFunctions {
   Q_OBJECT
 
  public:
@@ -48,7 +51,115 @@ class QtOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
   void setUseMaterial(const bool use_material);
 
   /**
-   * Loads the mesh and updating the viewer.
+   * Enables view frustum culling of the mesh instances.
+   *
+   * @param frustum_culling: True to draw only the instances inside the view frustum.
+   */
+  void setFrustumCulling(const bool frustum_culling);
+
+  /**
+   * Enables the selection of a level of detail per mesh, from its size on the screen.
+   *
+   * @param use_lods: True to draw distant meshes with their simplified levels of detail.
+   */
+  void setUseLods(const bool use_lods);
+
+  /**
+   * Selects between indexed geometry (unique vertices drawn with glDrawElements) and the de-indexed path, where every
+   * face corner is expanded into the VBOs and drawn with glDrawArrays. The current mesh is reloaded if needed.
+   *
+   * @param use_indexed_geometry: True to draw indexed geometry.
+   */
+  void setUseIndexedGeometry(const bool use_indexed_geometry);
+
+  /**
+   * Enables S3TC compression of the textures, which are then mipmapped and compressed on the CPU and kept in a disk
+   * cache for the next loads. The textures of the current mesh are loaded again.
+   *
+   * @param compress_textures: True to compress textures.
+   */
+  void setCompressTextures(const bool compress_textures);
+
+  /**
+   * Sets the size of the decoded textures kept in memory, so meshes loaded again reuse them.
+   *
+   * @param bytes: memory budget, in bytes.
+   */
+  void setTextureMemoryBudget(const size_t bytes);
+
+  /**
+   * Streams OBJ files larger than the memory: only coarse pages are loaded, and the full pages the camera needs are
+   * read in the background with the MeshStreamer. The current mesh is reloaded if needed.
+   *
+   * @param stream_meshes: True to stream OBJ files.
+   */
+  void setStreamMeshes(const bool stream_meshes);
+
+  /**
+   * Sets the memory of the full pages of a streamed mesh that may be resident on the GPU. Applies to the next loads.
+   *
+   * @param bytes: memory budget, in bytes.
+   */
+  void setStreamBudget(const size_t bytes);
+
+  /**
+   * Sets the crease angle of the normals generated for meshes without them: faces at a larger angle do not share their
+   * normals. Applies to the next loads.
+   *
+   * @param degrees: crease angle, in degrees. 180 generates smooth normals only.
+   */
+  void setCreaseAngle(const float degrees);
+
+  /**
+   * Sets the number of points of point clouds drawn per frame by every view, from the octree nodes that cover the most
+   * pixels.
+   *
+   * @param point_budget: maximum number of points drawn per frame.
+   */
+  void setPointBudget(const size_t point_budget);
+
+  /**
+   * When enabled, the CPU-side VBO and IBO of the scene are freed as soon as the geometry is uploaded to the GPU
+   * buffers.
+   *
+   * @param release_cpu_geometry: True to free the CPU copy of the geometry after upload.
+   */
+  void setReleaseCpuGeometry(const bool release_cpu_geometry);
+
+  /**
+   * Selects the interleaved vertex format: float positions (20 bytes per vertex) or 16-bit positions quantized against
+   * the scene bounding box (16 bytes per vertex). The current mesh is reloaded if needed.
+   *
+   * @param quantize_positions: True to quantize positions.
+   */
+  void setQuantizePositions(const bool quantize_positions);
+
+  /**
+   * Selects the reader of OBJ files: the multithreaded ObjReader (plain geometry only, falling back to assimp) or
+   * always assimp. The current mesh is reloaded if needed.
+   *
+   * @param use_fast_obj_reader: True to read plain OBJ geometry with ObjReader.
+   */
+  void setUseFastObjReader(const bool use_fast_obj_reader);
+
+  /**
+   * Selects the assimp post-processing steps applied to imported files. The current mesh is reloaded if needed.
+   *
+   * @param profile: import profile.
+   * @param custom_flags: aiPostProcessSteps flags, used only by ImportProfile::kCustom.
+   */
+  void setImportProfile(const ImportProfile profile, const unsigned int custom_flags = 0);
+
+  /**
+   * When enabled, a mesh imported with a profile other than ImportProfile::kMaxQuality is displayed as a preview and
+   * imported again with the max quality profile in the background, replacing the preview once ready.
+   *
+   * @param upgrade_import: True to upgrade previews to max quality.
+   */
+  void setUpgradeImport(const bool upgrade_import);
+
+  /**
+   * Loads the mesh and updating the viewer. The GUI thread is blocked until the mesh is loaded.
    *
    * @param filename: path to the mesh file to be loaded.
    *
@@ -57,20 +168,131 @@ class QtOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
   bool loadMesh(const QString &filename);
 
   /**
-   * Create a new QOpenGLTexture from an image.
+   * Starts loading the mesh on a worker thread. The current mesh keeps being displayed until the new one is ready, and
+   * a load already in progress is cancelled. meshLoadProgress and meshLoaded report the state of the load.
    *
-   * @param filename: path to the texture file to be loaded.
+   * @param filename: path to the mesh file to be loaded.
+   *
+   * @return True if the load was started (the file is a valid mesh file).
+   */
+  bool loadMeshAsync(const QString &filename);
+
+  /**
+   * Cancels the asynchronous mesh load in progress, if any. meshLoaded is not emitted for a cancelled load.
+   */
+  void cancelMeshLoading();
+
+  /**
+   * Enables the frame profiler, so every frame measures the CPU and GPU time of its sections and frameProfiled is
+   * emitted. The profiler is also enabled while the overlay is shown.
+   *
+   * @param profiling_enabled: True to profile frames.
+   */
+  void setProfilingEnabled(const bool profiling_enabled);
+
+  /**
+   * Shows the frame times, section times and counters of the last profiled frame over the scene.
+   *
+   * @param show_profiler_overlay: True to show the overlay.
+   */
+  void setShowProfilerOverlay(const bool show_profiler_overlay);
+
+  /**
+   * Saves the next frame to an image file. The frame is read back without stalling the frames and the file is written
+   * on a worker thread, then screenshotSaved is emitted.
+   *
+   * @param filename: path to the image file, whose format is deduced from its suffix.
+   */
+  void saveScreenshot(const QString &filename);
+
+  /**
+   * Starts saving every frame to the PNG files of a directory (frame_000000.png, frame_000001.png, etc.). Frames are
+   * drawn continuously while recording, read back a few frames later through a ring of pixel buffer objects and written
+   * on worker threads, and frames are dropped rather than slowing the viewer down when the disk falls behind.
+   *
+   * @param directory: directory of the frames, created if needed.
+   *
+   * @return True if the recording started.
+   */
+  bool startRecording(const QString &directory);
+
+  /**
+   * Stops the recording in progress, if any, and emits recordingStopped.
+   */
+  void stopRecording();
+
+  /**
+   * Gets whether the frames are being recorded.
+   *
+   * @return True while recording.
+   */
+  bool isRecording() const;
+
+  /**
+   * Create a new QOpenGLTexture from an image and store it for the materials that reference it.
+   *
+   * @param filename: path to the texture file to be loaded, relative to the mesh file.
    *
    * @return True if the texture was loaded successfully.
    */
   bool loadTexture(const QString &filename);
 
+  /**
+   * Adds a viewer to the views of this one: every mesh loaded by any of the views is loaded once and shown by all of
+   * them, each with its own camera. Their contexts must share objects (Qt::AA_ShareOpenGLContexts), so the views draw
+   * the GPU buffers and textures of the scene uploaded by the first of them, and decode textures with the same texture
+   * manager.
+   *
+   * @param view: viewer without a context yet, which must not have views of its own.
+   */
+  void addView(QtOpenGL *view);
+
  Q_SIGNALS:  // NOLINT
   /**
-   * To allow texture loading outside the main thread, this signal is emitted, so texture loading can be done at runtime
-   * even if the context is not the current.
+   * Emitted while a mesh is loaded asynchronously. May be emitted from the worker thread.
+   *
+   * @param percentage: load progress, from 0 to 100.
+   */
+  void meshLoadProgress(int percentage);
+
+  /**
+   * Emitted when an asynchronous mesh load finishes without being cancelled.
+   *
+   * @param filename: path to the mesh file.
+   * @param success: True if the mesh was loaded and is now displayed.
    */
-  void loadTextureSignal();
+  void meshLoaded(const QString &filename, bool success);
+
+  /**
+   * Emitted once the GPU times of a profiled frame are available, a few frames after it was drawn.
+   *
+   * @param stats: timings and counters of the frame.
+   */
+  void frameProfiled(const FrameStats &stats);
+
+  /**
+   * Emitted once a screenshot was written.
+   *
+   * @param filename: path to the image file.
+   * @param success: True if the file was written.
+   */
+  void screenshotSaved(const QString &filename, bool success);
+
+  /**
+   * Emitted when a recording starts.
+   *
+   * @param directory: directory of the frames.
+   */
+  void recordingStarted(const QString &directory);
+
+  /**
+   * Emitted when a recording stops.
+   *
+   * @param directory: directory of the frames.
+   * @param frames: number of frames recorded into the directory.
+   * @param dropped: number of frames dropped because the disk fell behind.
+   */
+  void recordingStopped(const QString &directory, int frames, int dropped);
 
  protected:
   /**
@@ -99,7 +321,6 @@ class QtOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
   void mouseMoveEvent(QMouseEvent *event) override;
   void mousePressEvent(QMouseEvent *event) override;
   void wheelEvent(QWheelEvent *event) override;
-  bool event(QEvent *event) override;
 
  private:
   /**
@@ -108,80 +329,82 @@ class QtOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
   void createCustomContextMenu();
 
   /**
-   * Add veetex and fragment shaders to the shader_program_ using source files.
-   *
-   * @return True if shaders were loaded successfully.
+   * Resets all viewer properties.
    */
-  bool initShaders();
+  void resetView();
 
   /**
-   * Enable GL_DEPTH_TEST, GL_NORMALIZE and GL_TEXTURE_2D. Also set glDepthFunc to GL_LESS.
+   * Gets the options used to build the geometry of a loaded scene.
+   *
+   * @return Scene load options from the viewer properties.
    */
-  void enableGlCapabilities();
+  SceneLoadOptions loadOptions() const;
 
   /**
-   * Get location for vertex positions, colors, normals and UV coordinates from the shader program.
+   * Reloads the current mesh asynchronously, so the new viewer properties are used to build its geometry.
    */
-  void getAttributeLocations();
+  void reloadMesh();
 
   /**
-   * Resets all viewer properties.
+   * Gets the callback of the textures and pages read on worker threads, which requests a frame in every view. The
+   * texture manager and the streamer may be shared with other views and outlive this one, so the callback only holds
+   * the list of views.
+   *
+   * @return Callback to be called from any thread.
    */
-  void resetView();
+  std::function<void()> readyCallback() const;
 
   /**
-   * Clear all VBOs vectors.
+   * Starts loading a mesh on a worker thread, cancelling a load already in progress.
+   *
+   * @param filename: path to the mesh file to be loaded.
+   * @param options: options used to build the geometry.
+   * @param upgrade: True for the background max quality import of a preview, which keeps the current view and does
+   * not report progress.
    */
-  void clearAllVBOs();
+  void startMeshLoad(const QString &filename, const SceneLoadOptions &options, const bool upgrade);
 
   /**
-   * Recursive function to traverse the entire scene and update the VBOs (vertex buffer object).
+   * Replaces the scene displayed by every view by a loaded one.
    *
-   * @param sc: assimp scene to be traversed.
-   *
-   * @return Number of traversed vertices.
+   * @param scene: loaded scene.
+   * @param reset_view: True to reset the camera and rotation.
    */
-  int traverseScene(const aiScene *sc, const aiNode *nd);
+  void setScene(const std::shared_ptr<SceneData> &scene, const bool reset_view = true);
 
   /**
-   * Given a new vertex, updates the scene bounding box (scene min and max).
+   * Replaces the scene displayed by this viewer. The GPU buffers and textures are acquired on the next paintGL.
    *
-   * @param vertex: vertex to check if it is a delimiter of the scene.
+   * @param scene: loaded scene.
+   * @param reset_view: True to reset the camera and rotation.
    */
-  void updateSceneBoundingBox(const aiVector3D &vertex);
+  void showScene(const std::shared_ptr<SceneData> &scene, const bool reset_view);
 
   /**
-   * Move object to the origin.
+   * Requests a new frame. Requests made before the frame is painted are merged into it, and Qt paints at most one frame
+   * per vsync, so no frame is drawn while nothing changes.
    */
-  void moveObjectToOrigin();
+  void scheduleFrame();
 
   /**
-   * Given a aiMaterial from a mesh gets its diffuse, specular, ambient materials. Get also the texture if exists.
-   *
-   * @param material: assimp loaded material.
-   * @param mesh_index: mesh index of a scene.
+   * Requests a new frame in every view, after a change of the resources they share.
    */
-  void updateMaterial(const aiMaterial *const material, const int mesh_index);
+  void scheduleViewFrames();
 
   /**
-   * Validates the texture: texture file must be valid (and correctly loaded) and object must contain texture
-   * coordinates..
-   *
-   * @return True if the loaded mesh has a is valid texture.
+   * Applies the mouse moves received since the previous frame as a single arcball rotation.
    */
-  bool isValidTexture();
+  void applyPendingInput();
 
   /**
-   * Sets the uniform variables in the shader program..
-   *
-   * @param MVP: model/view/projection matrix.
+   * Paints the stats of the last profiled frame over the scene with QPainter.
    */
-  void setUniformValues(const QMatrix4x4 &MVP);
+  void drawProfilerOverlay();
 
   /**
-   * Set attribute arrays and call glDrawArrays GL_TRIANGLES..
+   * Toggles the recording of the frames into a new directory of the pictures folder.
    */
-  void drawMesh();
+  void toggleRecording();
 
   /**
    * A method to helps manipulating and rotating a scene with the mouse.
@@ -195,42 +418,38 @@ class QtOpenGL : public QOpenGLWidget, protected QOpenGLFunctions {
    */
   QVector3D getArcBallVector(int x, int y);
 
-  QColor clear_color_ = Qt::white; /**< Background color of the viewer */
-
-  QOpenGLShaderProgram shader_program_; /**< Allows OpenGL shader programs to be linked and used */
-  QOpenGLTexture *texture_ = NULL;      /**< Encapsulates an OpenGL texture object */
-
-  QString mesh_filename_;    /**< Path to the loaded mesh */
-  QString texture_filename_; /**< Path to the loaded texture */
+  SceneRenderer renderer_; /**< Draws the displayed scene */
+  FrameCapture capture_;   /**< Reads back the frames of screenshots and recordings */
 
-  bool is_texture_loaded_ = false; /**< True if the texture was loaded successfully */
-  bool use_material_ = true;       /**< Enable shading method (Phong) */
+  std::shared_ptr<QList<QPointer<QtOpenGL>>> views_; /**< Viewers showing the same scenes, this one included */
 
-  float camera_pos_z_mult_ = 1.0; /**< Responsible for zoom in and zoom out */
+  QString mesh_filename_; /**< Path to the loaded mesh */
 
-  int vertex_location_;           /**< Location of aPosition attribute in shader */
-  int vertex_color_location_;     /**< Location of aColor attribute in shader */
-  int vertex_normal_location_;    /**< Location of aNormal attribute in shader */
-  int vertex_uv_coords_location_; /**< Location of aCoords attribute in shader */
+  std::shared_ptr<std::atomic_bool> load_cancelled_;         /**< Cancellation flag of the asynchronous load */
+  QList<QFuture<std::shared_ptr<SceneData>>> pending_loads_; /**< Asynchronous loads that may still be running */
 
-  std::vector<float> vbo_vertices_;       /**< VBO: vertexcies */
-  std::vector<float> vbo_normals_;        /**< VBO: normals */
-  std::vector<float> vbo_colors_;         /**< VBO: colors */
-  std::vector<float> vbo_texture_coords_; /**< VBO: texture coordinates*/
+  bool use_indexed_geometry_ = true;   /**< Draw unique vertices with an index buffer */
+  bool quantize_positions_ = false;    /**< Use 16-bit positions quantized against the scene bounding box */
+  bool use_fast_obj_reader_ = true;    /**< Read plain OBJ geometry with ObjReader instead of assimp */
+  bool stream_meshes_ = false;         /**< Stream the pages of OBJ files with the MeshStreamer */
+  bool upgrade_import_ = true;         /**< Import previews again with the max quality profile */
+  bool profiling_enabled_ = false;     /**< Profile frames and emit frameProfiled */
+  bool show_profiler_overlay_ = false; /**< Show the stats of the last profiled frame over the scene */
 
-  QPoint last_pos_; /**< Last known mouse position during its manipulation */
+  ImportProfile import_profile_ = ImportProfile::kMaxQuality; /**< Post-processing steps applied by assimp */
+  unsigned int custom_import_flags_ = 0;                      /**< aiPostProcessSteps flags of kCustom */
+  size_t stream_budget_ = size_t(1024) << 20;                 /**< Memory of the resident full pages, in bytes */
+  float crease_angle_ = 60.0f;                                /**< Crease angle of generated normals, in degrees */
 
-  QMatrix4x4 rotation_matrix_; /**< Rotation matrix for the shading technique and visualization */
+  float camera_pos_z_mult_ = 1.0; /**< Responsible for zoom in and zoom out */
 
-  QVector3D light_pos_;  /**< Light position */
-  QVector3D camera_pos_; /**< Camera position */
+  QPoint last_pos_;    /**< Last known mouse position during its manipulation */
+  QPoint pending_pos_; /**< Mouse position not yet applied to the rotation */
 
-  QVector3D scene_min_;    /**< Minimum point of the bound box of the scene */
-  QVector3D scene_max_;    /**< Maximum point of the bound box of the scene */
+  bool frame_scheduled_ = false;  /**< True if a frame was requested and not painted yet */
+  bool rotation_pending_ = false; /**< True if the mouse moved since the rotation was last updated */
 
-  QVector4D ambient_material_ = QVector4D(0.6, 0.6, 0.6, 1.0);  /**< Ambient material for shading */
-  QVector4D diffuse_material_ = QVector4D(0.5, 0.0, 0.0, 1.0);  /**< Diffuse material for shading */
-  QVector4D specular_material_ = QVector4D(1.0, 1.0, 1.0, 1.0); /**< Specular material for shading */
+  QMatrix4x4 rotation_matrix_; /**< Rotation matrix for the shading technique and visualization */
 };
 
 #endif  // QT_OPENGL_H_
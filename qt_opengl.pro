@@ -4,14 +4,20 @@
 #
 #-------------------------------------------------
 
-QT += core gui widgets opengl
+QT += core gui widgets opengl concurrent
+CONFIG += c++17
 
 TARGET = qt_opengl
 TEMPLATE = app
 
 LIBS += -lGL -lassimp
 
-SOURCES += main.cpp main_window.cpp qt_opengl.cpp
-HEADERS += main_window.h qt_opengl.h
+SOURCES += block_compressor.cpp bvh.cpp frame_capture.cpp frame_profiler.cpp main.cpp main_window.cpp mesh_cache.cpp \
+           mesh_optimizer.cpp mesh_simplifier.cpp mesh_streamer.cpp normal_generator.cpp obj_reader.cpp \
+           point_octree.cpp qt_opengl.cpp scene_loader.cpp scene_renderer.cpp scene_resources.cpp texture_manager.cpp
+HEADERS += block_compressor.h bounding_box.h bvh.h frame_capture.h frame_profiler.h main_window.h mesh_cache.h \
+           mesh_optimizer.h mesh_simplifier.h mesh_streamer.h normal_generator.h obj_reader.h parallel_for.h \
+           point_octree.h qt_opengl.h scene_loader.h scene_renderer.h scene_resources.h texture_manager.h \
+           vertex_format.h
 RESOURCES += resource.qrc
 FORMS += main_window.ui
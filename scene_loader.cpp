@@ -0,0 +1,1300 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "scene_loader.h"
+
+#include <assimp/postprocess.h>
+
+#include <QDebug>
+#include <QFileInfo>
+#include <algorithm>
+#include <array>
+#include <assimp/Importer.hpp>
+#include <assimp/ProgressHandler.hpp>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "bounding_box.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "mesh_streamer.h"
+#include "normal_generator.h"
+#include "parallel_for.h"
+#include "point_octree.h"
+
+namespace {
+
+/** Fraction of the progress reported while the file is imported, the rest is used to build the geometry */
+const float kImportProgress = 0.8f;
+
+/** Fraction of the import progress reported while assimp reads the file, the rest is used by post-processing */
+const float kReadProgress = 0.5f;
+
+/**
+ * @brief Assimp post-processing step, in the order the assimp pipeline runs them.
+ */
+struct PostProcessStep {
+  unsigned int flag; /**< aiPostProcessSteps flag of the step */
+  const char* name;  /**< Name of the step */
+};
+
+const PostProcessStep kPostProcessSteps[] = {
+    {aiProcess_ValidateDataStructure, "ValidateDataStructure"},
+    {aiProcess_RemoveComponent, "RemoveComponent"},
+    {aiProcess_RemoveRedundantMaterials, "RemoveRedundantMaterials"},
+    {aiProcess_FindInstances, "FindInstances"},
+    {aiProcess_OptimizeGraph, "OptimizeGraph"},
+    {aiProcess_GenUVCoords, "GenUVCoords"},
+    {aiProcess_TransformUVCoords, "TransformUVCoords"},
+    {aiProcess_PreTransformVertices, "PreTransformVertices"},
+    {aiProcess_Triangulate, "Triangulate"},
+    {aiProcess_FindDegenerates, "FindDegenerates"},
+    {aiProcess_SortByPType, "SortByPType"},
+    {aiProcess_FindInvalidData, "FindInvalidData"},
+    {aiProcess_OptimizeMeshes, "OptimizeMeshes"},
+    {aiProcess_FixInfacingNormals, "FixInfacingNormals"},
+    {aiProcess_SplitLargeMeshes, "SplitLargeMeshes"},
+    {aiProcess_GenNormals, "GenNormals"},
+    {aiProcess_GenSmoothNormals, "GenSmoothNormals"},
+    {aiProcess_CalcTangentSpace, "CalcTangentSpace"},
+    {aiProcess_JoinIdenticalVertices, "JoinIdenticalVertices"},
+    {aiProcess_LimitBoneWeights, "LimitBoneWeights"},
+    {aiProcess_ImproveCacheLocality, "ImproveCacheLocality"},
+};
+
+/** Maximum number of faces, vertices or indices handled by a single task of the parallel passes */
+const size_t kTaskSize = 1 << 16;
+
+/** Vertices whose positions are transformed at once when packed, small enough for the stack */
+const size_t kPackBatchSize = 1024;
+
+/** Minimum number of triangles of a mesh range to build its levels of detail */
+const size_t kLodMinTriangles = 1024;
+
+/** Gray level of the points of clouds without colors */
+const uint8_t kPointGray = 204;
+
+/** Maximum number of levels of detail of a mesh range */
+const int kMaxLodCount = 4;
+
+/** Maximum error of a level of detail, relative to the diagonal of the bounding box of its mesh range */
+const float kLodMaxError = 0.05f;
+
+/** A level of detail must have at most this fraction of the indices of the previous level to be kept */
+const float kLodMinReduction = 0.8f;
+
+/**
+ * @brief Part of an assimp mesh flattened by a single task: a range of its vertices and a range of its faces.
+ */
+struct FlattenTask {
+  const aiMesh* mesh = NULL;     /**< Mesh of the task */
+  size_t range = 0;              /**< Index of the mesh range of the mesh */
+  unsigned int vertex_begin = 0; /**< First vertex copied by the task, for indexed geometry */
+  unsigned int vertex_end = 0;   /**< Vertex after the last one copied by the task */
+  unsigned int face_begin = 0;   /**< First face of the task */
+  unsigned int face_end = 0;     /**< Face after the last one of the task */
+  size_t triangle_count = 0;     /**< Number of triangles in the faces of the task */
+  size_t first_triangle = 0;     /**< Number of triangles of the mesh before the faces of the task */
+  float min[3];                  /**< Minimum point of the vertices written by the task */
+  float max[3];                  /**< Maximum point of the vertices written by the task */
+};
+
+/**
+ * Copies a vertex of an assimp mesh to the staging VBOs. Missing normals or texture coordinates are left as zeros.
+ *
+ * @param mesh: assimp mesh that holds the vertex.
+ * @param index: index of the vertex in the mesh.
+ * @param output: index of the vertex in the staging VBOs.
+ * @param vertices: staging VBO of positions.
+ * @param normals: staging VBO of normals.
+ * @param texture_coords: staging VBO of texture coordinates.
+ */
+inline void copyVertex(const aiMesh* mesh, const unsigned int index, const size_t output, float* vertices,
+                       float* normals, float* texture_coords) {
+  const aiVector3D& vertex = mesh->mVertices[index];
+  vertices[output * 3] = vertex.x;
+  vertices[output * 3 + 1] = vertex.y;
+  vertices[output * 3 + 2] = vertex.z;
+
+  if (mesh->mNormals) {
+    const aiVector3D& normal = mesh->mNormals[index];
+    normals[output * 3] = normal.x;
+    normals[output * 3 + 1] = normal.y;
+    normals[output * 3 + 2] = normal.z;
+  }
+
+  if (mesh->mTextureCoords[0]) {
+    const aiVector3D& uv = mesh->mTextureCoords[0][index];
+    texture_coords[output * 2] = uv.x;
+    texture_coords[output * 2 + 1] = uv.y;
+  }
+}
+
+/**
+ * Resets a bounding box so it can be extended.
+ *
+ * @param min: minimum point (x, y, z).
+ * @param max: maximum point (x, y, z).
+ */
+inline void resetBoundingBox(float* min, float* max) {
+  std::fill(min, min + 3, std::numeric_limits<float>::max());
+  std::fill(max, max + 3, std::numeric_limits<float>::lowest());
+}
+
+/**
+ * Computes the bounding box of packed positions, reduced per task in parallel and then merged.
+ *
+ * @param positions: packed positions (x, y, z, x, y, z, ...).
+ * @param count: number of positions.
+ * @param min: receives the minimum point (x, y, z).
+ * @param max: receives the maximum point (x, y, z).
+ */
+void reduceBoundingBox(const float* positions, const size_t count, float* min, float* max) {
+  std::vector<BoundingBox> boxes((count + kTaskSize - 1) / kTaskSize);
+  parallelFor(boxes.size(), [&](size_t t) {
+    float* task_min = boxes[t].data();
+    float* task_max = boxes[t].data() + 3;
+    resetBoundingBox(task_min, task_max);
+    size_t begin = t * kTaskSize;
+    extendBoundingBox(&positions[begin * 3], std::min(count, begin + kTaskSize) - begin, task_min, task_max);
+  });
+
+  resetBoundingBox(min, max);
+  for (const BoundingBox& box : boxes) {
+    extendBoundingBox(box.data(), 1, min, max);
+    extendBoundingBox(box.data() + 3, 1, min, max);
+  }
+}
+
+/**
+ * Sets the bounding box of a mesh range. An empty box (with no vertices) becomes a box at the origin.
+ *
+ * @param min: minimum point (x, y, z) of the vertices of the range.
+ * @param max: maximum point (x, y, z) of the vertices of the range.
+ * @param range: mesh range that receives the bounding box.
+ */
+inline void setRangeBounds(const float* min, const float* max, MeshRange* range) {
+  if (min[0] > max[0]) {
+    range->bounds_min = QVector3D(0, 0, 0);
+    range->bounds_max = QVector3D(0, 0, 0);
+  } else {
+    range->bounds_min = QVector3D(min[0], min[1], min[2]);
+    range->bounds_max = QVector3D(max[0], max[1], max[2]);
+  }
+}
+
+/**
+ * Gets the bounding box of an instance: the transformed corners of the bounding box of its mesh range.
+ *
+ * @param instance: instance of the mesh range.
+ * @param range: mesh range of the instance.
+ *
+ * @return Bounding box of the instance, in scene coordinates.
+ */
+BoundingBox instanceBounds(const MeshInstance& instance, const MeshRange& range) {
+  BoundingBox box;
+  resetBoundingBox(box.data(), box.data() + 3);
+  for (int corner = 0; corner < 8; corner++) {
+    QVector3D point((corner & 1) ? range.bounds_max.x() : range.bounds_min.x(),
+                    (corner & 2) ? range.bounds_max.y() : range.bounds_min.y(),
+                    (corner & 4) ? range.bounds_max.z() : range.bounds_min.z());
+    point = instance.transform.map(point);
+    const float coordinates[3] = {point.x(), point.y(), point.z()};
+    extendBoundingBox(coordinates, 1, box.data(), box.data() + 3);
+  }
+  return box;
+}
+
+/**
+ * @brief Forwards the assimp import progress to a SceneLoader::ProgressCallback, mapped to the range of the current
+ * import step. Returning false from Update aborts the import.
+ */
+class ImportProgressHandler : public Assimp::ProgressHandler {
+ public:
+  ImportProgressHandler(const SceneLoader::ProgressCallback &progress, bool *cancelled)
+      : progress_(progress), cancelled_(cancelled) {}
+
+  bool Update(float percentage) override {
+    float value = begin_ + qBound(0.0f, percentage, 1.0f) * (end_ - begin_);
+    if (progress_ && !progress_(value)) {
+      *cancelled_ = true;
+    }
+    return !*cancelled_;
+  }
+
+  void setRange(const float begin, const float end) {
+    begin_ = begin;
+    end_ = end;
+  }
+
+ private:
+  SceneLoader::ProgressCallback progress_; /**< Callback that receives the progress */
+  bool* cancelled_;                        /**< Set when the callback cancels the import */
+  float begin_ = 0.0f;                     /**< Progress at the start of the current step */
+  float end_ = kImportProgress;            /**< Progress at the end of the current step */
+};
+
+/**
+ * Reads indices of the IBO as 32-bit indices.
+ *
+ * @param index_data: IBO.
+ * @param offset: offset in bytes of the first index.
+ * @param count: number of indices.
+ * @param index_type: GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+ *
+ * @return The indices.
+ */
+std::vector<uint32_t> readIndices(const std::vector<unsigned char>& index_data, const size_t offset,
+                                  const size_t count, const GLenum index_type) {
+  std::vector<uint32_t> indices(count);
+  if (index_type == GL_UNSIGNED_SHORT) {
+    std::copy_n(reinterpret_cast<const GLushort*>(index_data.data() + offset), count, indices.begin());
+  } else {
+    std::memcpy(indices.data(), index_data.data() + offset, count * sizeof(GLuint));
+  }
+  return indices;
+}
+
+/**
+ * Writes 32-bit indices into the IBO, converting them to its index type.
+ *
+ * @param indices: indices to be written.
+ * @param offset: offset in bytes of the first index.
+ * @param index_type: GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+ * @param index_data: IBO, large enough to hold the indices.
+ */
+void writeIndices(const std::vector<uint32_t>& indices, const size_t offset, const GLenum index_type,
+                  std::vector<unsigned char>* index_data) {
+  if (index_type == GL_UNSIGNED_SHORT) {
+    std::copy(indices.begin(), indices.end(), reinterpret_cast<GLushort*>(index_data->data() + offset));
+  } else {
+    std::memcpy(index_data->data() + offset, indices.data(), indices.size() * sizeof(GLuint));
+  }
+}
+
+/**
+ * Moves the vertices of a mesh range to their new positions in a staging VBO.
+ *
+ * @param remap: new index of each vertex of the mesh range, relative to its first vertex.
+ * @param base_vertex: first vertex of the mesh range.
+ * @param components: number of floats per vertex.
+ * @param data: staging VBO.
+ */
+void remapVertices(const std::vector<uint32_t>& remap, const size_t base_vertex, const size_t components,
+                   std::vector<float>* data) {
+  const std::vector<float> source(data->begin() + base_vertex * components,
+                                  data->begin() + (base_vertex + remap.size()) * components);
+  for (size_t v = 0; v < remap.size(); v++) {
+    std::copy_n(&source[v * components], components, &(*data)[(base_vertex + remap[v]) * components]);
+  }
+}
+
+}  // namespace
+
+SceneLoader::SceneLoader(const SceneLoadOptions& options) : options_(options) {}
+
+bool SceneLoader::isValidMeshFile(const QString& filename) {
+  QFileInfo file(filename);
+  return file.exists() && file.completeSuffix().endsWith("obj");
+}
+
+unsigned int SceneLoader::importFlags(const SceneLoadOptions& options) {
+  switch (options.import_profile) {
+    case ImportProfile::kFast:
+      return aiProcess_Triangulate | aiProcess_JoinIdenticalVertices;
+    case ImportProfile::kBalanced:
+      return aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals |
+             aiProcess_SortByPType | aiProcess_ImproveCacheLocality;
+    case ImportProfile::kCustom:
+      return options.custom_import_flags;
+    case ImportProfile::kMaxQuality:
+    default:
+      return aiProcessPreset_TargetRealtime_MaxQuality;
+  }
+}
+
+bool SceneLoader::load(const QString& filename, SceneData* scene, const ProgressCallback& progress) {
+  if (!isValidMeshFile(filename)) {
+    qWarning() << filename << "is not a valid mesh file.";
+    return false;
+  }
+
+  progress_ = progress;
+  import_times_.clear();
+  step_timer_.start();
+  ParallelForLimit thread_limit(options_.max_threads);
+
+  // Streamed scenes only hold their coarse pages, the page file of the MeshStreamer replaces the mesh cache. Other
+  // formats than OBJ are loaded in memory
+  if (options_.stream && QFileInfo(filename).suffix().toLower() == "obj") {
+    if (!MeshStreamer::load(filename, options_, scene, progress_)) {
+      return false;
+    }
+    recordImportTime("MeshStreamer");
+    buildBvh(scene);
+    recordImportTime("BVH");
+    scene->import_times = import_times_;
+    return true;
+  }
+
+  if (options_.use_mesh_cache && MeshCache::load(filename, options_, scene)) {
+    recordImportTime("Mesh cache");
+    buildBvh(scene);
+    recordImportTime("BVH");
+    scene->import_times = import_times_;
+    return reportProgress(1.0f);
+  }
+
+  bool success = false;
+  bool imported = false;
+
+  if (options_.use_fast_obj_reader) {
+    ObjMesh mesh;
+    ObjReader::Status status = ObjReader::read(filename, &mesh, [this](float value) {
+      return reportProgress(value * kImportProgress);
+    });
+
+    recordImportTime("ObjReader");
+
+    if (status == ObjReader::kSuccess && mesh.indices.empty()) {
+      beginScene(filename, scene);
+      scene_->read_by_obj_reader = true;
+      success = buildPointCloud(&mesh);
+      imported = true;
+    } else if (status == ObjReader::kSuccess) {
+      beginScene(filename, scene);
+      scene_->read_by_obj_reader = true;
+      if (!mesh.has_normals || !mesh.missing_normals.empty()) {
+        generateObjNormals(&mesh);
+        recordImportTime("Normals");
+      }
+      appendObjMesh(&mesh);
+      recordImportTime("Flatten");
+      success = finishScene();
+      imported = true;
+    } else if (status == ObjReader::kCancelled) {
+      return false;
+    } else {
+      qDebug() << filename << "is not plain OBJ geometry, importing it with assimp.";
+    }
+  }
+
+  if (!imported) {
+    beginScene(filename, scene);
+    success = importScene(filename) && finishScene();
+  }
+
+  if (success) {
+    if (options_.use_mesh_cache) {
+      MeshCache::save(*scene, options_);
+      recordImportTime("Mesh cache write");
+    }
+    scene->import_times = import_times_;
+
+    double total = 0.0;
+    for (const ImportStepTime& step : import_times_) {
+      total += step.milliseconds;
+    }
+    qDebug().noquote() << QFileInfo(filename).fileName() << QString("loaded in %1 ms").arg(total, 0, 'f', 2);
+    for (const ImportStepTime& step : import_times_) {
+      qDebug().noquote() << QString("  %1: %2 ms").arg(step.name).arg(step.milliseconds, 0, 'f', 2);
+    }
+    const VertexCacheStats& before = scene->vertex_cache_before;
+    const VertexCacheStats& after = scene->vertex_cache_after;
+    if (after.triangles > 0) {
+      qDebug().noquote() << QString("  ACMR %1 -> %2, ATVR %3 -> %4")
+                                .arg(before.acmr(), 0, 'f', 3)
+                                .arg(after.acmr(), 0, 'f', 3)
+                                .arg(before.atvr(), 0, 'f', 3)
+                                .arg(after.atvr(), 0, 'f', 3);
+    }
+  }
+
+  std::vector<float>().swap(vbo_vertices_);
+  std::vector<float>().swap(vbo_normals_);
+  std::vector<float>().swap(vbo_texture_coords_);
+  range_centers_.clear();
+  scene_ = NULL;
+
+  return success;
+}
+
+void SceneLoader::beginScene(const QString& filename, SceneData* scene) {
+  *scene = SceneData();
+  scene_ = scene;
+  scene_->filename = filename;
+  scene_->indexed = options_.use_indexed_geometry;
+
+  float max = std::numeric_limits<float>::max();
+  float min = std::numeric_limits<float>::lowest();
+
+  scene_->scene_min = QVector3D(max, max, max);
+  scene_->scene_max = QVector3D(min, min, min);
+}
+
+bool SceneLoader::finishScene() {
+  if (!optimizeMeshes()) {
+    return false;
+  }
+  recordImportTime("Optimize");
+  if (!generateLods()) {
+    return false;
+  }
+  recordImportTime("LOD");
+  moveObjectToOrigin();
+  packVertices();
+  buildDrawList();
+  recordImportTime("Pack");
+  buildBvh(scene_);
+  recordImportTime("BVH");
+  return reportProgress(1.0f);
+}
+
+void SceneLoader::recordImportTime(const QString& name) {
+  ImportStepTime step;
+  step.name = name;
+  step.milliseconds = step_timer_.nsecsElapsed() / 1e6;
+  import_times_.push_back(step);
+  step_timer_.restart();
+}
+
+bool SceneLoader::importScene(const QString& filename) {
+  bool cancelled = false;
+
+  // The importer takes ownership of the progress handler
+  Assimp::Importer importer;
+  ImportProgressHandler* handler = new ImportProgressHandler(progress_, &cancelled);
+  importer.SetProgressHandler(handler);
+
+  handler->setRange(0.0f, kImportProgress * kReadProgress);
+  const aiScene* sc = importer.ReadFile(filename.toStdString(), 0);
+  recordImportTime("assimp ReadFile");
+
+  // Post-processing steps are applied one at a time, in pipeline order, so the time of each one can be reported.
+  // Smooth normals of the profiles are generated in parallel by flattenScene instead of assimp, unless assimp's step
+  // was explicitly requested with custom flags
+  unsigned int flags = importFlags(options_);
+  if (options_.import_profile != ImportProfile::kCustom) {
+    flags &= ~aiProcess_GenSmoothNormals;
+  }
+  unsigned int remaining_flags = flags;
+  int total_steps = 0;
+  for (const PostProcessStep& step : kPostProcessSteps) {
+    total_steps += (flags & step.flag) ? 1 : 0;
+  }
+
+  int current_step = 0;
+  for (const PostProcessStep& step : kPostProcessSteps) {
+    if (!sc || !(flags & step.flag)) {
+      continue;
+    }
+    float begin = kImportProgress * (kReadProgress + (1.0f - kReadProgress) * current_step / total_steps);
+    float end = kImportProgress * (kReadProgress + (1.0f - kReadProgress) * (current_step + 1) / total_steps);
+    handler->setRange(begin, end);
+
+    sc = importer.ApplyPostProcessing(step.flag);
+    recordImportTime(step.name);
+    remaining_flags &= ~step.flag;
+    current_step++;
+  }
+
+  if (sc && remaining_flags) {
+    sc = importer.ApplyPostProcessing(remaining_flags);
+    recordImportTime("Other post-processing steps");
+  }
+
+  if (!sc) {
+    if (!cancelled) {
+      qWarning() << "Scene import failed:" << importer.GetErrorString();
+    }
+    return false;
+  }
+
+  if (!reportProgress(kImportProgress)) {
+    return false;
+  }
+
+  for (unsigned int i = 0; i < sc->mNumMaterials; i++) {
+    scene_->materials.push_back(readMaterial(sc->mMaterials[i]));
+  }
+
+  bool success = flattenScene(sc);
+  recordImportTime("Flatten");
+  return success;
+}
+
+void SceneLoader::generateObjNormals(ObjMesh* mesh) {
+  GeneratedNormals generated;
+  const size_t vertex_count = mesh->vertices.size() / 3;
+  NormalGenerator::generate(mesh->vertices.data(), vertex_count, mesh->indices.data(), mesh->indices.size(),
+                            options_.crease_angle, &generated);
+
+  // Only the vertices without normals take the generated ones. Splits of vertices with normals from the file are not
+  // needed, so their corners keep the original vertex
+  const std::vector<uint8_t>& missing = mesh->missing_normals;
+  std::vector<uint32_t> split_vertices(generated.split_sources.size());
+  size_t new_count = vertex_count;
+  for (size_t i = 0; i < generated.split_sources.size(); i++) {
+    const bool used = missing.empty() || missing[generated.split_sources[i]];
+    split_vertices[i] = used ? static_cast<uint32_t>(new_count++) : std::numeric_limits<uint32_t>::max();
+  }
+
+  mesh->vertices.resize(new_count * 3);
+  mesh->texture_coords.resize(new_count * 2);
+  mesh->normals.resize(new_count * 3);
+  for (size_t i = 0; i < vertex_count; i++) {
+    if (missing.empty() || missing[i]) {
+      std::copy_n(&generated.normals[i * 3], 3, &mesh->normals[i * 3]);
+    }
+  }
+  for (size_t i = 0; i < generated.split_sources.size(); i++) {
+    const uint32_t vertex = split_vertices[i];
+    if (vertex != std::numeric_limits<uint32_t>::max()) {
+      const size_t source = generated.split_sources[i];
+      std::copy_n(&mesh->vertices[source * 3], 3, &mesh->vertices[vertex * 3]);
+      std::copy_n(&mesh->texture_coords[source * 2], 2, &mesh->texture_coords[vertex * 2]);
+      std::copy_n(&generated.normals[(vertex_count + i) * 3], 3, &mesh->normals[vertex * 3]);
+    }
+  }
+
+  for (size_t i = 0; i < mesh->indices.size(); i++) {
+    const uint32_t index = generated.indices[i];
+    if (index >= vertex_count && split_vertices[index - vertex_count] != std::numeric_limits<uint32_t>::max()) {
+      mesh->indices[i] = split_vertices[index - vertex_count];
+    }
+  }
+
+  mesh->missing_normals.clear();
+  mesh->has_normals = true;
+}
+
+void SceneLoader::appendObjMesh(ObjMesh* mesh) {
+  scene_->has_normals = mesh->has_normals;
+  scene_->has_texture_coords = mesh->has_texture_coords;
+  scene_->materials.push_back(Material());
+
+  MeshRange range;
+  range.has_texture_coords = mesh->has_texture_coords;
+
+  const std::vector<uint32_t>& indices = mesh->indices;
+  const size_t task_count = (indices.size() + kTaskSize - 1) / kTaskSize;
+
+  if (options_.use_indexed_geometry) {
+    vbo_vertices_ = std::move(mesh->vertices);
+    vbo_normals_ = std::move(mesh->normals);
+    vbo_texture_coords_ = std::move(mesh->texture_coords);
+
+    range.vertex_count = vbo_vertices_.size() / 3;
+    range.index_type = (range.vertex_count <= 0x10000) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    range.index_count = indices.size();
+
+    std::vector<unsigned char>& index_data = scene_->index_data;
+    index_data.resize(indices.size() * ((range.index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint)));
+    parallelFor(task_count, [&](size_t t) {
+      size_t end = std::min(indices.size(), (t + 1) * kTaskSize);
+      if (range.index_type == GL_UNSIGNED_SHORT) {
+        GLushort* output = reinterpret_cast<GLushort*>(index_data.data());
+        std::copy(indices.begin() + t * kTaskSize, indices.begin() + end, output + t * kTaskSize);
+      } else {
+        std::memcpy(index_data.data() + t * kTaskSize * sizeof(GLuint), &indices[t * kTaskSize],
+                    (end - t * kTaskSize) * sizeof(GLuint));
+      }
+    });
+  } else {
+    vbo_vertices_.resize(indices.size() * 3);
+    vbo_normals_.resize(indices.size() * 3);
+    vbo_texture_coords_.resize(indices.size() * 2);
+    parallelFor(task_count, [&](size_t t) {
+      for (size_t i = t * kTaskSize; i < std::min(indices.size(), (t + 1) * kTaskSize); i++) {
+        size_t index = indices[i];
+        std::copy_n(&mesh->vertices[index * 3], 3, &vbo_vertices_[i * 3]);
+        std::copy_n(&mesh->normals[index * 3], 3, &vbo_normals_[i * 3]);
+        std::copy_n(&mesh->texture_coords[index * 2], 2, &vbo_texture_coords_[i * 2]);
+      }
+    });
+    range.vertex_count = indices.size();
+  }
+
+  float min[3], max[3];
+  reduceBoundingBox(vbo_vertices_.data(), vbo_vertices_.size() / 3, min, max);
+  setRangeBounds(min, max, &range);
+  scene_->mesh_ranges.push_back(range);
+
+  // OBJ files have no node tree, the mesh is placed once by a root node
+  SceneNode node;
+  node.name = QFileInfo(scene_->filename).fileName();
+  scene_->nodes.push_back(node);
+
+  MeshInstance instance;
+  scene_->instances.push_back(instance);
+}
+
+bool SceneLoader::buildPointCloud(ObjMesh* mesh) {
+  std::vector<float>& positions = mesh->vertices;
+  const size_t point_count = positions.size() / 3;
+  if (point_count > static_cast<size_t>(std::numeric_limits<int>::max()) / sizeof(PointVertex)) {
+    qWarning() << scene_->filename << "has too many points for a vertex buffer:" << point_count;
+    return false;
+  }
+
+  scene_->point_cloud = true;
+  scene_->indexed = false;
+  scene_->materials.push_back(Material());
+  scene_->vertex_layout = vertexLayoutInfo<PointVertex>();
+
+  // The cloud is moved to the origin in place, before its points are sorted into the octree
+  float min[3], max[3];
+  reduceBoundingBox(positions.data(), point_count, min, max);
+  MeshRange range;
+  setRangeBounds(min, max, &range);
+  const QVector3D center = (range.bounds_min + range.bounds_max) / 2.0;
+  range.bounds_min -= center;
+  range.bounds_max -= center;
+
+  const float offset[3] = {center.x(), center.y(), center.z()};
+  parallelFor((point_count + kTaskSize - 1) / kTaskSize, [&](size_t t) {
+    for (size_t i = t * kTaskSize * 3; i < std::min(point_count, (t + 1) * kTaskSize) * 3; i++) {
+      positions[i] -= offset[i % 3];
+    }
+  });
+  recordImportTime("Flatten");
+  if (!reportProgress(kImportProgress + (1.0f - kImportProgress) * 0.2f)) {
+    return false;
+  }
+
+  const BoundingBox bounds = {range.bounds_min.x(), range.bounds_min.y(), range.bounds_min.z(),
+                              range.bounds_max.x(), range.bounds_max.y(), range.bounds_max.z()};
+  std::vector<uint32_t> order;
+  scene_->point_octree.build(positions, bounds, &order);
+  recordImportTime("Octree");
+  if (!reportProgress(kImportProgress + (1.0f - kImportProgress) * 0.7f)) {
+    return false;
+  }
+
+  // Each node is packed by a single task, its points quantized against its own cube so they keep their precision at
+  // any depth
+  const std::vector<PointOctreeNode>& nodes = scene_->point_octree.nodes();
+  const std::vector<float>& colors = mesh->colors;
+  scene_->vertex_data.resize(point_count * sizeof(PointVertex));
+  parallelFor(nodes.size(), [&](size_t n) {
+    const PointOctreeNode& node = nodes[n];
+    for (uint32_t i = node.first; i < node.first + node.count; i++) {
+      const size_t point = order[i];
+      PointVertex vertex;
+      for (int k = 0; k < 3; k++) {
+        vertex.position[k] = quantizeCoordinate(positions[point * 3 + k], node.center[k], node.half_size);
+        vertex.color[k] =
+            mesh->has_colors ? static_cast<uint8_t>(std::lround(colors[point * 3 + k] * 255.0f)) : kPointGray;
+      }
+      vertex.position[3] = std::numeric_limits<int16_t>::max();
+      vertex.color[3] = 255;
+      std::memcpy(&scene_->vertex_data[i * sizeof(PointVertex)], &vertex, sizeof(vertex));
+    }
+  });
+
+  range.vertex_count = point_count;
+  range.instance_count = 1;
+  scene_->mesh_ranges.push_back(range);
+  scene_->draw_order.push_back(0);
+  scene_->scene_min = range.bounds_min;
+  scene_->scene_max = range.bounds_max;
+
+  SceneNode node;
+  node.name = QFileInfo(scene_->filename).fileName();
+  node.instances.push_back(0);
+  scene_->nodes.push_back(node);
+  scene_->instances.push_back(MeshInstance());
+  recordImportTime("Pack");
+
+  buildBvh(scene_);
+  recordImportTime("BVH");
+  return reportProgress(1.0f);
+}
+
+void SceneLoader::buildSceneGraph(const aiScene* sc, const aiNode* nd, const int parent, std::vector<int>* mesh_ranges,
+                                  std::vector<const aiMesh*>* meshes) {
+  const aiMatrix4x4& m = nd->mTransformation;
+
+  SceneNode node;
+  node.name = nd->mName.C_Str();
+  node.parent = parent;
+  node.transform = QMatrix4x4(m.a1, m.a2, m.a3, m.a4, m.b1, m.b2, m.b3, m.b4, m.c1, m.c2, m.c3, m.c4, m.d1, m.d2, m.d3,
+                              m.d4);
+  node.world_transform = (parent < 0) ? node.transform : scene_->nodes[parent].world_transform * node.transform;
+
+  const int index = static_cast<int>(scene_->nodes.size());
+  scene_->nodes.push_back(node);
+
+  for (unsigned int n = 0; n < nd->mNumMeshes; n++) {
+    int& range = (*mesh_ranges)[nd->mMeshes[n]];
+    if (range < 0) {
+      range = static_cast<int>(meshes->size());
+      meshes->push_back(sc->mMeshes[nd->mMeshes[n]]);
+    }
+
+    MeshInstance instance;
+    instance.transform = node.world_transform;
+    instance.range = range;
+    instance.node = index;
+    scene_->instances.push_back(instance);
+  }
+
+  for (unsigned int n = 0; n < nd->mNumChildren; n++) {
+    buildSceneGraph(sc, nd->mChildren[n], index, mesh_ranges, meshes);
+  }
+}
+
+bool SceneLoader::flattenScene(const aiScene* sc) {
+  std::vector<int> mesh_ranges(sc->mNumMeshes, -1);
+  std::vector<const aiMesh*> meshes;
+  buildSceneGraph(sc, sc->mRootNode, -1, &mesh_ranges, &meshes);
+
+  // Large meshes are split so their vertices and faces are spread over several tasks
+  std::vector<FlattenTask> tasks;
+  std::vector<size_t> range_pieces(meshes.size());
+  for (size_t m = 0; m < meshes.size(); m++) {
+    const aiMesh* mesh = meshes[m];
+    size_t pieces = std::max<size_t>(1, (std::max(mesh->mNumVertices, mesh->mNumFaces) + kTaskSize - 1) / kTaskSize);
+    range_pieces[m] = pieces;
+    for (size_t p = 0; p < pieces; p++) {
+      FlattenTask task;
+      task.mesh = mesh;
+      task.range = m;
+      task.face_begin = static_cast<unsigned int>(mesh->mNumFaces * p / pieces);
+      task.face_end = static_cast<unsigned int>(mesh->mNumFaces * (p + 1) / pieces);
+      tasks.push_back(task);
+    }
+  }
+
+  // Counting pass: number of triangles of each task, faces that are not triangles are skipped
+  parallelFor(tasks.size(), [&tasks](size_t i) {
+    FlattenTask& task = tasks[i];
+    for (unsigned int f = task.face_begin; f < task.face_end; f++) {
+      task.triangle_count += (task.mesh->mFaces[f].mNumIndices == 3) ? 1 : 0;
+    }
+  });
+
+  std::vector<size_t> range_triangles(meshes.size(), 0);
+  for (FlattenTask& task : tasks) {
+    task.first_triangle = range_triangles[task.range];
+    range_triangles[task.range] += task.triangle_count;
+  }
+
+  // Meshes without normals get them from the NormalGenerator, which needs their triangles as plain indices. Vertices
+  // split at creases follow the vertices of their mesh
+  std::vector<std::vector<uint32_t>> triangle_indices(meshes.size());
+  for (size_t m = 0; m < meshes.size(); m++) {
+    if (!meshes[m]->HasNormals() && range_triangles[m] > 0) {
+      triangle_indices[m].resize(range_triangles[m] * 3);
+    }
+  }
+  parallelFor(tasks.size(), [&](size_t i) {
+    const FlattenTask& task = tasks[i];
+    std::vector<uint32_t>& indices = triangle_indices[task.range];
+    size_t index = task.first_triangle * 3;
+    for (unsigned int f = task.face_begin; f < task.face_end && !indices.empty(); f++) {
+      const aiFace& face = task.mesh->mFaces[f];
+      if (face.mNumIndices == 3) {
+        std::copy_n(face.mIndices, 3, &indices[index]);
+        index += 3;
+      }
+    }
+  });
+
+  static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "assimp positions must be packed floats");
+  std::vector<GeneratedNormals> generated(meshes.size());
+  bool generated_normals = false;
+  for (size_t m = 0; m < meshes.size(); m++) {
+    if (!triangle_indices[m].empty()) {
+      NormalGenerator::generate(&meshes[m]->mVertices[0].x, meshes[m]->mNumVertices, triangle_indices[m].data(),
+                                triangle_indices[m].size(), options_.crease_angle, &generated[m]);
+      std::vector<uint32_t>().swap(triangle_indices[m]);
+      generated_normals = true;
+    }
+  }
+  if (generated_normals) {
+    recordImportTime("Normals");
+  }
+
+  std::vector<size_t> next_piece(meshes.size(), 0);
+  for (FlattenTask& task : tasks) {
+    const size_t vertex_count = task.mesh->mNumVertices + generated[task.range].split_sources.size();
+    const size_t piece = next_piece[task.range]++;
+    task.vertex_begin = static_cast<unsigned int>(vertex_count * piece / range_pieces[task.range]);
+    task.vertex_end = static_cast<unsigned int>(vertex_count * (piece + 1) / range_pieces[task.range]);
+  }
+
+  // Output offsets of each mesh range in the VBOs and the IBO
+  const bool indexed = options_.use_indexed_geometry;
+  std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+  ranges.resize(meshes.size());
+  size_t total_vertices = 0;
+  size_t index_size = 0;
+
+  for (size_t m = 0; m < meshes.size(); m++) {
+    const aiMesh* mesh = meshes[m];
+    MeshRange& range = ranges[m];
+
+    scene_->has_normals |= mesh->HasNormals() || !generated[m].normals.empty();
+    scene_->has_texture_coords |= mesh->HasTextureCoords(0);
+
+    range.base_vertex = total_vertices;
+    range.material_index = mesh->mMaterialIndex;
+    range.has_texture_coords = mesh->HasTextureCoords(0);
+
+    if (indexed) {
+      // Assimp meshes already share their vertices between faces, so they are copied once and referenced by index
+      range.vertex_count = mesh->mNumVertices + generated[m].split_sources.size();
+      range.index_type = (range.vertex_count <= 0x10000) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+      range.index_count = range_triangles[m] * 3;
+
+      // Keep 32-bit indices aligned after a mesh with an odd number of 16-bit indices
+      range.index_offset = (index_size + 3) & ~static_cast<size_t>(3);
+      index_size = range.index_offset +
+                   range.index_count * ((range.index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint));
+    } else {
+      range.vertex_count = range_triangles[m] * 3;
+    }
+
+    total_vertices += range.vertex_count;
+  }
+
+  vbo_vertices_.assign(total_vertices * 3, 0.0f);
+  vbo_normals_.assign(total_vertices * 3, 0.0f);
+  vbo_texture_coords_.assign(total_vertices * 2, 0.0f);
+  scene_->index_data.assign(index_size, 0);
+
+  // Fill pass: each task writes its own part of the preallocated buffers and the bounding box of its vertices
+  float* vertices = vbo_vertices_.data();
+  float* normals = vbo_normals_.data();
+  float* texture_coords = vbo_texture_coords_.data();
+  unsigned char* index_data = scene_->index_data.data();
+
+  auto fill = [&](size_t i) {
+    FlattenTask& task = tasks[i];
+    const aiMesh* mesh = task.mesh;
+    const MeshRange& range = ranges[task.range];
+    const GeneratedNormals& mesh_normals = generated[task.range];
+
+    size_t first_output = range.base_vertex + (indexed ? task.vertex_begin : task.first_triangle * 3);
+    size_t output = first_output;
+
+    // Copies a vertex of the mesh, or of the generated normals, whose split vertices copy a vertex of the mesh
+    auto copy = [&](const unsigned int v) {
+      if (mesh_normals.normals.empty()) {
+        copyVertex(mesh, v, output++, vertices, normals, texture_coords);
+        return;
+      }
+      unsigned int source = (v < mesh->mNumVertices) ? v : mesh_normals.split_sources[v - mesh->mNumVertices];
+      copyVertex(mesh, source, output, vertices, normals, texture_coords);
+      std::copy_n(&mesh_normals.normals[static_cast<size_t>(v) * 3], 3, normals + output * 3);
+      output++;
+    };
+
+    if (indexed) {
+      for (unsigned int v = task.vertex_begin; v < task.vertex_end; v++) {
+        copy(v);
+      }
+
+      GLushort* short_indices = reinterpret_cast<GLushort*>(index_data + range.index_offset);
+      GLuint* int_indices = reinterpret_cast<GLuint*>(index_data + range.index_offset);
+      size_t index = task.first_triangle * 3;
+      auto write_index = [&](const unsigned int value) {
+        if (range.index_type == GL_UNSIGNED_SHORT) {
+          short_indices[index++] = static_cast<GLushort>(value);
+        } else {
+          int_indices[index++] = value;
+        }
+      };
+
+      if (!mesh_normals.normals.empty()) {
+        const size_t end = (task.first_triangle + task.triangle_count) * 3;
+        while (index < end) {
+          write_index(mesh_normals.indices[index]);
+        }
+      } else {
+        for (unsigned int f = task.face_begin; f < task.face_end; f++) {
+          const aiFace& face = mesh->mFaces[f];
+          if (face.mNumIndices == 3) {
+            for (unsigned int k = 0; k < 3; k++) {
+              write_index(face.mIndices[k]);
+            }
+          }
+        }
+      }
+    } else if (!mesh_normals.normals.empty()) {
+      for (size_t index = task.first_triangle * 3; index < (task.first_triangle + task.triangle_count) * 3; index++) {
+        copy(mesh_normals.indices[index]);
+      }
+    } else {
+      for (unsigned int f = task.face_begin; f < task.face_end; f++) {
+        const aiFace& face = mesh->mFaces[f];
+        if (face.mNumIndices == 3) {
+          for (unsigned int k = 0; k < 3; k++) {
+            copy(face.mIndices[k]);
+          }
+        }
+      }
+    }
+
+    resetBoundingBox(task.min, task.max);
+    extendBoundingBox(vertices + first_output * 3, output - first_output, task.min, task.max);
+  };
+
+  bool completed = parallelFor(tasks.size(), fill, [this, &tasks](size_t finished) {
+    return reportProgress(kImportProgress + (1.0f - kImportProgress) * 0.9f * finished / tasks.size());
+  });
+  if (!completed) {
+    return false;
+  }
+
+  std::vector<std::array<float, 6>> range_boxes(ranges.size());
+  for (std::array<float, 6>& box : range_boxes) {
+    resetBoundingBox(box.data(), box.data() + 3);
+  }
+  for (const FlattenTask& task : tasks) {
+    std::array<float, 6>& box = range_boxes[task.range];
+    if (task.min[0] <= task.max[0]) {
+      extendBoundingBox(task.min, 1, box.data(), box.data() + 3);
+      extendBoundingBox(task.max, 1, box.data(), box.data() + 3);
+    }
+  }
+  for (size_t m = 0; m < ranges.size(); m++) {
+    setRangeBounds(range_boxes[m].data(), range_boxes[m].data() + 3, &ranges[m]);
+  }
+
+  return true;
+}
+
+void SceneLoader::updateSceneBoundingBox(const float* min, const float* max) {
+  QVector3D& scene_min = scene_->scene_min;
+  QVector3D& scene_max = scene_->scene_max;
+
+  scene_min.setX(qMin(scene_min.x(), min[0]));
+  scene_min.setY(qMin(scene_min.y(), min[1]));
+  scene_min.setZ(qMin(scene_min.z(), min[2]));
+
+  scene_max.setX(qMax(scene_max.x(), max[0]));
+  scene_max.setY(qMax(scene_max.y(), max[1]));
+  scene_max.setZ(qMax(scene_max.z(), max[2]));
+}
+
+void SceneLoader::moveObjectToOrigin() {
+  std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+  std::vector<MeshInstance>& instances = scene_->instances;
+
+  // Instances of the same mesh range are contiguous, so each range draws all of them with a single instanced draw call
+  std::stable_sort(instances.begin(), instances.end(),
+                   [](const MeshInstance& a, const MeshInstance& b) { return a.range < b.range; });
+  for (SceneNode& node : scene_->nodes) {
+    node.instances.clear();
+  }
+  for (size_t i = 0; i < instances.size(); i++) {
+    MeshRange& range = ranges[instances[i].range];
+    if (range.instance_count == 0) {
+      range.instance_offset = i;
+    }
+    range.instance_count++;
+    scene_->nodes[instances[i].node].instances.push_back(i);
+  }
+
+  // The vertices are moved by packVertices, in the same pass that packs them
+  range_centers_.resize(ranges.size());
+  for (size_t m = 0; m < ranges.size(); m++) {
+    range_centers_[m] = (ranges[m].bounds_min + ranges[m].bounds_max) / 2.0;
+    ranges[m].bounds_min -= range_centers_[m];
+    ranges[m].bounds_max -= range_centers_[m];
+  }
+
+  for (MeshInstance& instance : instances) {
+    instance.transform.translate(range_centers_[instance.range]);
+    BoundingBox box = instanceBounds(instance, ranges[instance.range]);
+    updateSceneBoundingBox(box.data(), box.data() + 3);
+  }
+
+  if (instances.empty()) {
+    scene_->scene_min = QVector3D(0, 0, 0);
+    scene_->scene_max = QVector3D(0, 0, 0);
+    return;
+  }
+
+  const QVector3D scene_center = (scene_->scene_min + scene_->scene_max) / 2.0;
+  scene_->scene_min -= scene_center;
+  scene_->scene_max -= scene_center;
+
+  QMatrix4x4 to_origin;
+  to_origin.translate(-scene_center);
+  for (MeshInstance& instance : instances) {
+    instance.transform = to_origin * instance.transform;
+  }
+  for (SceneNode& node : scene_->nodes) {
+    node.world_transform = to_origin * node.world_transform;
+  }
+}
+
+bool SceneLoader::optimizeMeshes() {
+  std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+  if (!options_.optimize_meshes || !scene_->indexed) {
+    return true;
+  }
+
+  // Each task optimizes a single mesh range: its indices and its own part of the staging VBOs
+  std::vector<VertexCacheStats> before(ranges.size());
+  std::vector<VertexCacheStats> after(ranges.size());
+  auto optimize = [&](size_t m) {
+    const MeshRange& range = ranges[m];
+    if (range.index_count == 0) {
+      return;
+    }
+
+    std::vector<uint32_t> indices =
+        readIndices(scene_->index_data, range.index_offset, range.index_count, range.index_type);
+    before[m] = MeshOptimizer::analyzeVertexCache(indices, range.vertex_count);
+
+    MeshOptimizer::optimizeVertexCache(&indices, range.vertex_count);
+    MeshOptimizer::optimizeOverdraw(&vbo_vertices_[range.base_vertex * 3], range.vertex_count, &indices);
+    std::vector<uint32_t> remap = MeshOptimizer::optimizeVertexFetch(&indices, range.vertex_count);
+
+    after[m] = MeshOptimizer::analyzeVertexCache(indices, range.vertex_count);
+    writeIndices(indices, range.index_offset, range.index_type, &scene_->index_data);
+    remapVertices(remap, range.base_vertex, 3, &vbo_vertices_);
+    remapVertices(remap, range.base_vertex, 3, &vbo_normals_);
+    remapVertices(remap, range.base_vertex, 2, &vbo_texture_coords_);
+  };
+
+  bool completed = parallelFor(ranges.size(), optimize, [this, &ranges](size_t finished) {
+    return reportProgress(kImportProgress + (1.0f - kImportProgress) * (0.9f + 0.05f * finished / ranges.size()));
+  });
+  if (!completed) {
+    return false;
+  }
+
+  for (size_t m = 0; m < ranges.size(); m++) {
+    scene_->vertex_cache_before.add(before[m]);
+    scene_->vertex_cache_after.add(after[m]);
+  }
+  return true;
+}
+
+bool SceneLoader::generateLods() {
+  std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+  if (!options_.generate_lods || !scene_->indexed) {
+    return true;
+  }
+
+  std::vector<size_t> candidates;
+  for (size_t m = 0; m < ranges.size(); m++) {
+    if (ranges[m].index_count / 3 >= kLodMinTriangles) {
+      candidates.push_back(m);
+    }
+  }
+
+  // Each task simplifies the levels of a single mesh range, the indices are appended to the IBO once all are done
+  std::vector<std::vector<std::vector<uint32_t>>> lod_indices(ranges.size());
+  auto simplify = [&](size_t c) {
+    MeshRange& range = ranges[candidates[c]];
+    std::vector<uint32_t> indices =
+        readIndices(scene_->index_data, range.index_offset, range.index_count, range.index_type);
+
+    const float max_error = (range.bounds_max - range.bounds_min).length() * kLodMaxError;
+    const float* positions = &vbo_vertices_[range.base_vertex * 3];
+    float error = 0.0f;
+
+    for (int level = 0; level < kMaxLodCount; level++) {
+      // Each level is simplified from the previous one, so its error is bounded by the sum of the errors of both
+      float level_error = 0.0f;
+      std::vector<uint32_t> simplified = MeshSimplifier::simplify(positions, range.vertex_count, indices,
+                                                                  indices.size() / 6 * 3, max_error, &level_error);
+      if (simplified.empty() || simplified.size() > indices.size() * kLodMinReduction) {
+        break;
+      }
+      if (options_.optimize_meshes) {
+        MeshOptimizer::optimizeVertexCache(&simplified, range.vertex_count);
+      }
+
+      error += level_error;
+      MeshLod lod;
+      lod.index_count = simplified.size();
+      lod.error = error;
+      range.lods.push_back(lod);
+      lod_indices[candidates[c]].push_back(simplified);
+      indices.swap(simplified);
+    }
+  };
+
+  bool completed = parallelFor(candidates.size(), simplify, [this, &candidates](size_t finished) {
+    return reportProgress(kImportProgress + (1.0f - kImportProgress) * (0.95f + 0.05f * finished / candidates.size()));
+  });
+  if (!completed) {
+    return false;
+  }
+
+  std::vector<unsigned char>& index_data = scene_->index_data;
+  size_t index_size = index_data.size();
+  for (MeshRange& range : ranges) {
+    for (MeshLod& lod : range.lods) {
+      lod.index_offset = (index_size + 3) & ~static_cast<size_t>(3);
+      index_size = lod.index_offset +
+                   lod.index_count * ((range.index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint));
+    }
+  }
+  index_data.resize(index_size, 0);
+
+  for (size_t m = 0; m < ranges.size(); m++) {
+    for (size_t l = 0; l < ranges[m].lods.size(); l++) {
+      writeIndices(lod_indices[m][l], ranges[m].lods[l].index_offset, ranges[m].index_type, &index_data);
+    }
+  }
+
+  return true;
+}
+
+void SceneLoader::buildBvh(SceneData* scene) {
+  std::vector<BoundingBox> boxes(scene->instances.size());
+  parallelFor((boxes.size() + kTaskSize - 1) / kTaskSize, [&](size_t t) {
+    for (size_t i = t * kTaskSize; i < std::min(boxes.size(), (t + 1) * kTaskSize); i++) {
+      boxes[i] = instanceBounds(scene->instances[i], scene->mesh_ranges[scene->instances[i].range]);
+    }
+  });
+  scene->bvh.build(boxes);
+}
+
+void SceneLoader::packVertices() {
+  const bool quantize = options_.quantize_positions;
+  const std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+
+  // Positions are quantized against the bounding box of the centered mesh ranges
+  float min[3], max[3];
+  resetBoundingBox(min, max);
+  for (const MeshRange& range : ranges) {
+    const float range_min[3] = {range.bounds_min.x(), range.bounds_min.y(), range.bounds_min.z()};
+    const float range_max[3] = {range.bounds_max.x(), range.bounds_max.y(), range.bounds_max.z()};
+    extendBoundingBox(range_min, 1, min, max);
+    extendBoundingBox(range_max, 1, min, max);
+  }
+  const QVector3D bounds_min = ranges.empty() ? QVector3D(0, 0, 0) : QVector3D(min[0], min[1], min[2]);
+  const QVector3D bounds_max = ranges.empty() ? QVector3D(0, 0, 0) : QVector3D(max[0], max[1], max[2]);
+
+  scene_->vertex_layout = quantize ? vertexLayoutInfo<QuantizedVertex>() : vertexLayoutInfo<PackedVertex>();
+  scene_->position_offset = quantize ? (bounds_min + bounds_max) / 2.0 : QVector3D(0, 0, 0);
+  scene_->position_scale = quantize ? (bounds_max - bounds_min) / 2.0 : QVector3D(1, 1, 1);
+
+  const size_t stride = scene_->vertex_layout.stride;
+  const float offset[3] = {scene_->position_offset.x(), scene_->position_offset.y(), scene_->position_offset.z()};
+  const float scale[3] = {scene_->position_scale.x(), scene_->position_scale.y(), scene_->position_scale.z()};
+
+  size_t vertex_count = vbo_vertices_.size() / 3;
+  scene_->vertex_data.resize(vertex_count * stride);
+
+  // Each task packs part of a single mesh range, so all its vertices are moved by the same center
+  std::vector<std::pair<size_t, size_t>> tasks;
+  for (size_t m = 0; m < ranges.size(); m++) {
+    for (size_t begin = 0; begin < ranges[m].vertex_count; begin += kTaskSize) {
+      tasks.push_back(std::make_pair(m, ranges[m].base_vertex + begin));
+    }
+  }
+
+  parallelFor(tasks.size(), [&](size_t t) {
+    const MeshRange& range = ranges[tasks[t].first];
+    const QVector3D& range_center = range_centers_[tasks[t].first];
+    const size_t end = std::min(range.base_vertex + range.vertex_count, tasks[t].second + kTaskSize);
+
+    // Positions are moved (and normalized to [-32767, 32767] when quantized) with SSE, a batch at a time
+    float add[3], mul[3];
+    for (int k = 0; k < 3; k++) {
+      add[k] = -range_center[k] - offset[k];
+      mul[k] = !quantize ? 1.0f : (scale[k] > 0.0f) ? 32767.0f / scale[k] : 0.0f;
+    }
+    const float low = quantize ? -32767.0f : -std::numeric_limits<float>::max();
+    const float high = quantize ? 32767.0f : std::numeric_limits<float>::max();
+
+    float positions[kPackBatchSize * 3];
+    for (size_t batch = tasks[t].second; batch < end; batch += kPackBatchSize) {
+      const size_t batch_end = std::min(end, batch + kPackBatchSize);
+      transformPositions(&vbo_vertices_[batch * 3], batch_end - batch, add, mul, low, high, positions);
+
+      for (size_t i = batch; i < batch_end; i++) {
+        const float* position = &positions[(i - batch) * 3];
+        const float* normal = &vbo_normals_[i * 3];
+        const float* uv = &vbo_texture_coords_[i * 2];
+        unsigned char* data = &scene_->vertex_data[i * stride];
+
+        if (quantize) {
+          QuantizedVertex vertex;
+          for (int k = 0; k < 3; k++) {
+            vertex.position[k] = static_cast<int16_t>(std::lround(position[k]));
+          }
+          vertex.position[3] = std::numeric_limits<int16_t>::max();
+          vertex.normal = packNormal(normal[0], normal[1], normal[2]);
+          vertex.texture_coords[0] = toHalfFloat(uv[0]);
+          vertex.texture_coords[1] = toHalfFloat(uv[1]);
+          std::memcpy(data, &vertex, sizeof(vertex));
+        } else {
+          PackedVertex vertex;
+          std::memcpy(vertex.position, position, sizeof(vertex.position));
+          vertex.normal = packNormal(normal[0], normal[1], normal[2]);
+          vertex.texture_coords[0] = toHalfFloat(uv[0]);
+          vertex.texture_coords[1] = toHalfFloat(uv[1]);
+          std::memcpy(data, &vertex, sizeof(vertex));
+        }
+      }
+    }
+  });
+
+  std::vector<float>().swap(vbo_vertices_);
+  std::vector<float>().swap(vbo_normals_);
+  std::vector<float>().swap(vbo_texture_coords_);
+}
+
+Material SceneLoader::readMaterial(const aiMaterial* const material) {
+  Material result;
+  aiColor4D c;
+  aiString s;
+
+  if (AI_SUCCESS == material->Get(AI_MATKEY_COLOR_AMBIENT, c)) {
+    result.ambient = QVector4D(c.r, c.g, c.b, c.a);
+  }
+  if (AI_SUCCESS == material->Get(AI_MATKEY_COLOR_DIFFUSE, c)) {
+    result.diffuse = QVector4D(c.r, c.g, c.b, c.a);
+  }
+  if (AI_SUCCESS == material->Get(AI_MATKEY_COLOR_SPECULAR, c)) {
+    result.specular = QVector4D(c.r, c.g, c.b, c.a);
+  }
+
+  if (AI_SUCCESS == material->Get(AI_MATKEY_TEXTURE_DIFFUSE(0), s)) {
+    result.texture_filename = s.C_Str();
+  }
+
+  return result;
+}
+
+void SceneLoader::buildDrawList() {
+  const std::vector<MeshRange>& mesh_ranges = scene_->mesh_ranges;
+  const std::vector<Material>& materials = scene_->materials;
+
+  std::vector<size_t>& draw_order = scene_->draw_order;
+  draw_order.resize(mesh_ranges.size());
+  for (size_t i = 0; i < draw_order.size(); i++) {
+    draw_order[i] = i;
+  }
+
+  // Textures are the most expensive state to change, followed by the window of the materials uniform buffer
+  auto texture_filename = [&materials](const MeshRange& range) {
+    return (range.material_index < materials.size()) ? materials[range.material_index].texture_filename : QString();
+  };
+  std::stable_sort(draw_order.begin(), draw_order.end(), [&](size_t a, size_t b) {
+    const MeshRange& range_a = mesh_ranges[a];
+    const MeshRange& range_b = mesh_ranges[b];
+    QString texture_a = texture_filename(range_a);
+    QString texture_b = texture_filename(range_b);
+    if (texture_a != texture_b) {
+      return texture_a < texture_b;
+    }
+    return range_a.material_index < range_b.material_index;
+  });
+}
+
+bool SceneLoader::reportProgress(const float value) { return !progress_ || progress_(value); }
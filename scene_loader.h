@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef SCENE_LOADER_H_
+#define SCENE_LOADER_H_
+
+#include <assimp/scene.h>
+
+#include <QElapsedTimer>
+#include <QMatrix4x4>
+#include <QString>
+#include <QVector3D>
+#include <QVector4D>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+#include "mesh_optimizer.h"
+#include "obj_reader.h"
+#include "point_octree.h"
+#include "vertex_format.h"
+
+class MeshStreamer;
+
+/**
+ * @brief Simplified level of detail of a mesh range. It shares the vertices of its mesh range and only has its own
+ * indices, of the same type, stored after the indices of the original meshes.
+ */
+struct MeshLod {
+  size_t index_offset = 0; /**< Offset in bytes of the first index in the IBO */
+  size_t index_count = 0;  /**< Number of indices */
+  float error = 0.0f;      /**< Geometric error of the level, as a distance in the units of the packed vertices */
+};
+
+/**
+ * @brief Portion of the VBOs and IBO that belongs to a single assimp mesh. Indices are relative to the first vertex of
+ * the mesh, so meshes with up to 65536 vertices can use 16-bit indices. As assimp meshes have a single material, each
+ * mesh range is also a draw range. A mesh referenced by several nodes is stored once and drawn with one instanced draw
+ * call over its instances.
+ */
+struct MeshRange {
+  size_t base_vertex = 0;                /**< First vertex of the mesh in the VBOs */
+  size_t vertex_count = 0;               /**< Number of vertices of the mesh */
+  size_t index_offset = 0;               /**< Offset in bytes of the first index in the IBO */
+  size_t index_count = 0;                /**< Number of indices, zero for de-indexed geometry */
+  GLenum index_type = GL_UNSIGNED_SHORT; /**< GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+  unsigned int material_index = 0;       /**< Index of the mesh material in the scene materials */
+  bool has_texture_coords = false;       /**< True if the mesh has texture coordinates */
+  size_t instance_offset = 0;            /**< First instance of the mesh in the scene instances */
+  size_t instance_count = 0;             /**< Number of instances of the mesh */
+  QVector3D bounds_min;                  /**< Minimum point of the bounding box of the packed vertices */
+  QVector3D bounds_max;                  /**< Maximum point of the bounding box of the packed vertices */
+  std::vector<MeshLod> lods;             /**< Simplified levels of detail, from the finest to the coarsest */
+};
+
+/**
+ * @brief Placement of a mesh range in the scene. The instances of a mesh range are contiguous, and their transforms
+ * form the per-instance matrix buffer.
+ */
+struct MeshInstance {
+  QMatrix4x4 transform; /**< Transform from the packed vertices of the mesh range to the scene */
+  size_t range = 0;     /**< Index of the mesh range of the instance */
+  size_t node = 0;      /**< Index of the node that references the mesh */
+};
+
+/**
+ * @brief Node of the scene graph, as read from the assimp node tree. Nodes are stored in depth-first order, so a parent
+ * always precedes its children.
+ */
+struct SceneNode {
+  QString name;                  /**< Name of the node */
+  int parent = -1;               /**< Index of the parent node, -1 for the root */
+  QMatrix4x4 transform;          /**< Transform relative to the parent node (aiNode::mTransformation) */
+  QMatrix4x4 world_transform;    /**< Accumulated transform from the node to the scene */
+  std::vector<size_t> instances; /**< Indices of the mesh instances of the node */
+};
+
+/**
+ * @brief Phong material of a mesh, as read from the assimp scene.
+ */
+struct Material {
+  QVector4D ambient = QVector4D(0.6, 0.6, 0.6, 1.0);  /**< Ambient material for shading */
+  QVector4D diffuse = QVector4D(0.5, 0.0, 0.0, 1.0);  /**< Diffuse material for shading */
+  QVector4D specular = QVector4D(1.0, 1.0, 1.0, 1.0); /**< Specular material for shading */
+  QString texture_filename;                           /**< Path to the diffuse texture, relative to the mesh */
+};
+
+/**
+ * @brief Time spent in a single step of a scene load.
+ */
+struct ImportStepTime {
+  QString name;              /**< Name of the step (reader, assimp post-process step, etc.) */
+  double milliseconds = 0.0; /**< Time spent in the step */
+};
+
+/**
+ * @brief VBO and IBO of a scene that stay in the memory map of a MeshCache entry, so they are uploaded straight from
+ * the file instead of being copied. The file stays mapped until the last holder of the mapping releases it.
+ */
+struct MappedBuffers {
+  std::shared_ptr<const void> mapping;     /**< Keeps the file mapped, NULL if nothing is mapped */
+  const unsigned char *vertex_data = NULL; /**< VBO: interleaved vertices */
+  size_t vertex_size = 0;                  /**< Size in bytes of the VBO */
+  const unsigned char *index_data = NULL;  /**< IBO: 16-bit or 32-bit indices, according to each mesh range */
+  size_t index_size = 0;                   /**< Size in bytes of the IBO */
+};
+
+/**
+ * @brief GPU-ready geometry of a loaded scene: interleaved vertices, index buffer, mesh ranges and materials. It is
+ * built without an OpenGL context, so it can be produced on a worker thread.
+ */
+struct SceneData {
+  QString filename; /**< Path to the mesh file */
+
+  VertexLayoutInfo vertex_layout = vertexLayoutInfo<PackedVertex>(); /**< Layout of the interleaved vertices */
+  std::vector<unsigned char> vertex_data;                            /**< VBO: interleaved vertices */
+  std::vector<unsigned char> index_data; /**< IBO: 16-bit or 32-bit indices, according to each mesh range */
+  MappedBuffers mapped_buffers;          /**< VBO and IBO of a scene read from the MeshCache, instead of the above */
+
+  std::vector<MeshRange> mesh_ranges;  /**< Ranges of the VBO and IBO of each unique mesh */
+  std::vector<MeshInstance> instances; /**< Instances of the mesh ranges, grouped by mesh range */
+  std::vector<SceneNode> nodes;        /**< Scene graph, in depth-first order */
+  std::vector<size_t> draw_order;      /**< Indices of mesh_ranges sorted by texture and material */
+  std::vector<Material> materials;     /**< Materials of the scene, indexed by assimp material index */
+
+  QVector3D position_offset = QVector3D(0, 0, 0); /**< Dequantization offset of positions (bounding box center) */
+  QVector3D position_scale = QVector3D(1, 1, 1);  /**< Dequantization scale of positions (bounding box half extent) */
+
+  QVector3D scene_min; /**< Minimum point of the bound box of the scene */
+  QVector3D scene_max; /**< Maximum point of the bound box of the scene */
+  Bvh bvh;             /**< Hierarchy over the bounding boxes of the instances, for frustum culling */
+
+  PointOctree point_octree; /**< Levels of detail of a point cloud, whose points are stored node by node */
+
+  bool indexed = true;             /**< True if the mesh ranges are drawn with an index buffer */
+  bool has_normals = false;        /**< True if the scene has normals */
+  bool has_texture_coords = false; /**< True if the scene has texture coordinates */
+  bool read_by_obj_reader = false; /**< True if the file was read by ObjReader, so no import profile was applied */
+  bool point_cloud = false;        /**< True if the scene is a point cloud (PointVertex), drawn from its octree */
+
+  VertexCacheStats vertex_cache_before; /**< Vertex cache statistics of the mesh ranges before optimization */
+  VertexCacheStats vertex_cache_after;  /**< Vertex cache statistics of the mesh ranges after optimization */
+
+  std::vector<ImportStepTime> import_times; /**< Time spent in each step of the load */
+
+  std::shared_ptr<MeshStreamer> streamer; /**< Reads the full pages of a streamed scene, NULL for scenes in memory */
+};
+
+/**
+ * @brief Sets of assimp post-processing steps applied to imported files.
+ */
+enum class ImportProfile {
+  kFast,       /**< Triangulation and joining of identical vertices only, for a quick preview */
+  kBalanced,   /**< Fast steps plus smooth normals, primitive sorting and vertex cache locality */
+  kMaxQuality, /**< aiProcessPreset_TargetRealtime_MaxQuality */
+  kCustom      /**< Steps given by SceneLoadOptions::custom_import_flags */
+};
+
+/**
+ * @brief Options that change how the geometry of a scene is built.
+ */
+struct SceneLoadOptions {
+  bool use_indexed_geometry = true; /**< Draw unique vertices with an index buffer */
+  bool quantize_positions = false;  /**< Use 16-bit positions quantized against the scene bounding box */
+  bool use_fast_obj_reader = true;  /**< Read plain OBJ geometry with ObjReader, falling back to assimp */
+  bool use_mesh_cache = true;       /**< Load and store the built scene in the MeshCache */
+  bool generate_lods = true;        /**< Build simplified levels of detail of large indexed meshes */
+  bool optimize_meshes = true;      /**< Reorder triangles and vertices of indexed meshes with the MeshOptimizer */
+  bool stream = false;              /**< Stream the pages of OBJ files larger than the memory with the MeshStreamer */
+
+  size_t stream_budget = size_t(1024) << 20; /**< Memory of the resident full pages of a streamed scene, in bytes */
+  float crease_angle = 60.0f;                /**< Faces at a larger angle (degrees) do not share generated normals */
+  size_t max_threads = 0;                    /**< Threads of each parallel step of a load, zero for all cores */
+
+  ImportProfile import_profile = ImportProfile::kMaxQuality; /**< Post-processing steps applied by assimp */
+  unsigned int custom_import_flags = 0;                      /**< aiPostProcessSteps flags of kCustom */
+};
+
+/**
+ * @brief Imports a mesh file and flattens it into a SceneData. Plain OBJ geometry is read with ObjReader, other files
+ * are imported with assimp. The loader does not touch any OpenGL state, so it may run on a worker thread.
+ */
+class SceneLoader {
+ public:
+  /**
+   * Callback that receives the load progress in [0, 1]. Returning false cancels the load.
+   */
+  using ProgressCallback = std::function<bool(float)>;
+
+  /**
+   * Class constructor.
+   *
+   * @param options: options used to build the geometry.
+   */
+  explicit SceneLoader(const SceneLoadOptions &options = SceneLoadOptions());
+
+  /**
+   * Checks if a file can be loaded by the loader.
+   *
+   * @param filename: path to the mesh file.
+   *
+   * @return True if the file exists and is an OBJ file.
+   */
+  static bool isValidMeshFile(const QString &filename);
+
+  /**
+   * Gets the assimp post-processing steps of the import profile of the options.
+   *
+   * @param options: options used to build the geometry.
+   *
+   * @return aiPostProcessSteps flags.
+   */
+  static unsigned int importFlags(const SceneLoadOptions &options);
+
+  /**
+   * Imports a mesh file and builds its geometry, or loads it from the mesh cache when the file did not change.
+   *
+   * @param filename: path to the mesh file to be loaded.
+   * @param scene: receives the loaded scene.
+   * @param progress: optional callback to report progress and to cancel the load.
+   *
+   * @return True if the mesh was loaded successfully (and was not cancelled).
+   */
+  bool load(const QString &filename, SceneData *scene, const ProgressCallback &progress = ProgressCallback());
+
+ private:
+  /**
+   * Resets the scene being built.
+   *
+   * @param filename: path to the mesh file.
+   * @param scene: scene to be built.
+   */
+  void beginScene(const QString &filename, SceneData *scene);
+
+  /**
+   * Optimizes the meshes of the scene, builds their levels of detail, moves the scene to the origin, packs its
+   * vertices, sorts its draw list and builds its bounding volume hierarchy.
+   *
+   * @return False if the load was cancelled.
+   */
+  bool finishScene();
+
+  /**
+   * Records the time elapsed since the previous step of the load.
+   *
+   * @param name: name of the step.
+   */
+  void recordImportTime(const QString &name);
+
+  /**
+   * Imports the mesh file with assimp, applying the post-processing steps of the import profile one at a time so each
+   * one is timed, and flattens its node tree.
+   *
+   * @param filename: path to the mesh file.
+   *
+   * @return False if the import failed or was cancelled.
+   */
+  bool importScene(const QString &filename);
+
+  /**
+   * Generates the normals of a mesh read by ObjReader from a file without normals, or of its vertices marked in
+   * missing_normals when only some faces have normals. Vertices are split at the creases of the options, the copies are
+   * appended to the vertices and texture coordinates of the mesh.
+   *
+   * @param mesh: mesh read by ObjReader, whose has_normals is false or whose missing_normals is not empty.
+   */
+  void generateObjNormals(ObjMesh *mesh);
+
+  /**
+   * Fills the staging VBOs and the IBO with a mesh read by ObjReader, as a single mesh range with the default material.
+   * The staging VBOs take over the arrays of the mesh.
+   *
+   * @param mesh: mesh read by ObjReader.
+   */
+  void appendObjMesh(ObjMesh *mesh);
+
+  /**
+   * Builds a point cloud scene from an OBJ file without faces: the points are moved to the origin, sorted into a
+   * PointOctree and packed node by node, each point quantized against the cube of its node. The scene has a single mesh
+   * range without indices and a single instance, so it is culled and cached like any other scene.
+   *
+   * @param mesh: point cloud read by ObjReader.
+   *
+   * @return False if the cloud is too large for a vertex buffer or the load was cancelled.
+   */
+  bool buildPointCloud(ObjMesh *mesh);
+
+  /**
+   * Appends a node of the assimp node tree, and its children, to the scene graph in depth-first order, accumulating
+   * their world transforms. Each mesh reference of a node becomes an instance; a mesh gets a mesh range when it is
+   * first referenced, so meshes referenced by several nodes are flattened once.
+   *
+   * @param sc: assimp scene to be traversed.
+   * @param nd: node to be traversed.
+   * @param parent: index of the parent node in the scene graph, -1 for the root.
+   * @param mesh_ranges: index of the mesh range of each assimp mesh, -1 while it was not referenced.
+   * @param meshes: receives the referenced meshes, in the order of their mesh ranges.
+   */
+  void buildSceneGraph(const aiScene *sc, const aiNode *nd, const int parent, std::vector<int> *mesh_ranges,
+                       std::vector<const aiMesh *> *meshes);
+
+  /**
+   * Flattens the unique meshes of the scene into the staging VBOs (vertex buffer object) and the IBO in two passes: a
+   * parallel counting pass gives the offset of every mesh (and of every part of large meshes) in the output, then a
+   * parallel fill pass writes each part into the preallocated buffers and reduces its bounding box.
+   *
+   * @param sc: assimp scene to be flattened.
+   *
+   * @return False if the load was cancelled.
+   */
+  bool flattenScene(const aiScene *sc);
+
+  /**
+   * Extends the scene bounding box (scene min and max) with another bounding box.
+   *
+   * @param min: minimum point (x, y, z) of the box.
+   * @param max: maximum point (x, y, z) of the box.
+   */
+  void updateSceneBoundingBox(const float *min, const float *max);
+
+  /**
+   * Groups the instances by mesh range, centers each mesh range on its own bounding box and moves the bounding box of
+   * all instances to the origin. The instance transforms take both offsets, so the packed vertices stay close to zero
+   * (keeping their precision) wherever the instances are. The vertices are moved by packVertices, in the same pass that
+   * packs them.
+   */
+  void moveObjectToOrigin();
+
+  /**
+   * Reorders the triangles of each indexed mesh range for the vertex cache and for overdraw, then renumbers its
+   * vertices in the order they are first used, in parallel. The vertex cache statistics before and after are recorded
+   * in the scene. Must be called while the staging VBOs still hold float positions.
+   *
+   * @return False if the load was cancelled.
+   */
+  bool optimizeMeshes();
+
+  /**
+   * Builds a chain of simplified levels of detail for each large indexed mesh range, in parallel, and appends their
+   * indices to the IBO. Each level is simplified from the previous one to about half of its triangles, until the error
+   * gets too large or the savings too small. Must be called while the staging VBOs still hold float positions.
+   *
+   * @return False if the load was cancelled.
+   */
+  bool generateLods();
+
+  /**
+   * Builds the hierarchy over the bounding boxes of the instances of a scene. It is not stored in the mesh cache, as it
+   * is cheap to rebuild from the instances.
+   *
+   * @param scene: scene whose mesh ranges and instances are final.
+   */
+  void buildBvh(SceneData *scene);
+
+  /**
+   * Packs the staging VBOs (float positions, normals and UV coordinates) into the interleaved vertex format, in
+   * parallel, and frees them. Must be called after the mesh ranges were centered.
+   */
+  void packVertices();
+
+  /**
+   * Given a aiMaterial from a mesh gets its diffuse, specular, ambient materials. Get also the texture if exists.
+   *
+   * @param material: assimp loaded material.
+   *
+   * @return The material used for shading.
+   */
+  Material readMaterial(const aiMaterial *const material);
+
+  /**
+   * Sorts the mesh ranges by texture and material, so consecutive draws share as much state as possible.
+   */
+  void buildDrawList();
+
+  /**
+   * Reports progress to the callback, if any.
+   *
+   * @param value: progress in [0, 1].
+   *
+   * @return False if the load must be cancelled.
+   */
+  bool reportProgress(const float value);
+
+  SceneLoadOptions options_;             /**< Options used to build the geometry */
+  SceneData *scene_ = NULL;              /**< Scene being built */
+  ProgressCallback progress_;            /**< Progress callback of the current load */
+  std::vector<QVector3D> range_centers_; /**< Center of each mesh range, subtracted from its vertices when packing */
+
+  QElapsedTimer step_timer_;                 /**< Measures the current step of the load */
+  std::vector<ImportStepTime> import_times_; /**< Time spent in each step of the current load */
+
+  std::vector<float> vbo_vertices_;       /**< Staging VBO: vertexcies */
+  std::vector<float> vbo_normals_;        /**< Staging VBO: normals */
+  std::vector<float> vbo_texture_coords_; /**< Staging VBO: texture coordinates*/
+};
+
+#endif  // SCENE_LOADER_H_
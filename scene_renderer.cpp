@@ -0,0 +1,773 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "scene_renderer.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+#include "mesh_streamer.h"
+
+namespace {
+
+/** Uniform buffer binding point of the Frame block, after the Materials block of the SceneResources */
+const GLuint kFrameBinding = SceneResources::kMaterialsBinding + 1;
+
+/**
+ * @brief Contents of the Frame uniform block of the Phong and point shaders, in the std140 layout: vec3 members are
+ * aligned to 16 bytes and the int that follows the last one fills its padding.
+ */
+struct FrameBlock {
+  float mvp[16];            /**< uMVP */
+  float model[16];          /**< uM */
+  float normal[16];         /**< uN */
+  float light_pos[4];       /**< uLPos, and padding */
+  float camera_pos[4];      /**< uCamPos, and padding */
+  float position_offset[4]; /**< uPosOffset, and padding */
+  float position_scale[3];  /**< uPosScale */
+  int32_t use_material;     /**< uMaterial */
+};
+static_assert(sizeof(FrameBlock) == 256, "FrameBlock must match the std140 layout of the Frame block");
+
+/** Size in bytes of an instance in the instance buffer: a column-major mat4 */
+const GLsizei kInstanceSize = 16 * sizeof(float);
+
+/** Largest geometric error of a level of detail, in pixels, that may be drawn */
+const float kLodPixelError = 1.0f;
+
+/** A mesh range moves to a coarser level of detail only when its error is below this fraction of kLodPixelError */
+const float kLodHysteresis = 0.75f;
+
+/** Pixels per unit of the packed vertices when the camera is inside the bounding sphere of an instance */
+const float kLodMaxPixelScale = std::numeric_limits<float>::max();
+
+/** Largest diameter of a point splat, in pixels */
+const float kMaxPointSize = 64.0f;
+
+}  // namespace
+
+bool SceneRenderer::initialize() {
+  initializeOpenGLFunctions();
+  profiler_.initialize();
+
+  bool success = initShaders();
+  enableGlCapabilities();
+
+  // Programs of cacheable shaders are loaded from the program binary cache of Qt when they were linked before by the
+  // same driver, and only compiled and linked (then stored in the cache) otherwise
+  success &= shader_program_.link();
+  success &= point_program_.link();
+
+  getAttributeLocations(&shader_program_);
+  uniforms_dirty_ = true;
+
+  compression_supported_ = QOpenGLContext::currentContext()->hasExtension("GL_EXT_texture_compression_s3tc");
+  updateTextureCompression();
+
+  material_index_location_ = shader_program_.uniformLocation("uMaterialIndex");
+  texture_unit_location_ = shader_program_.uniformLocation("uTextureID");
+  texture_layer_location_ = shader_program_.uniformLocation("uTextureLayer");
+
+  node_center_location_ = point_program_.uniformLocation("uNodeCenter");
+  node_half_size_location_ = point_program_.uniformLocation("uNodeHalfSize");
+  point_spacing_location_ = point_program_.uniformLocation("uPointSpacing");
+  pixels_per_unit_location_ = point_program_.uniformLocation("uPixelsPerUnit");
+  max_point_size_location_ = point_program_.uniformLocation("uMaxPointSize");
+
+  glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &texture_units_);
+
+  GLuint materials_block = glGetUniformBlockIndex(shader_program_.programId(), "Materials");
+  if (materials_block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(shader_program_.programId(), materials_block, SceneResources::kMaterialsBinding);
+  }
+  for (QOpenGLShaderProgram* program : {&shader_program_, &point_program_}) {
+    GLuint frame_block = glGetUniformBlockIndex(program->programId(), "Frame");
+    if (frame_block != GL_INVALID_INDEX) {
+      glUniformBlockBinding(program->programId(), frame_block, kFrameBinding);
+    }
+  }
+
+  glGenBuffers(1, &frame_buffer_);
+  glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer_);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  return success;
+}
+
+void SceneRenderer::destroy() {
+  destroyBuffers();
+  resources_.reset();
+  if (frame_buffer_) {
+    glDeleteBuffers(1, &frame_buffer_);
+    frame_buffer_ = 0;
+  }
+  profiler_.destroy();
+}
+
+void SceneRenderer::setScene(const std::shared_ptr<SceneData>& scene) {
+  scene_ = scene;
+
+  float max = qMax(scene->scene_max.x(), qMax(scene->scene_max.y(), scene->scene_max.z()));
+  light_pos_ = QVector3D(max, max, max) * 3.0;
+
+  buffers_dirty_ = true;
+  view_dirty_ = true;
+  uniforms_dirty_ = true;
+}
+
+const std::shared_ptr<SceneData>& SceneRenderer::scene() const { return scene_; }
+
+void SceneRenderer::setClearColor(const QColor& color) { clear_color_ = color; }
+
+QColor SceneRenderer::clearColor() const { return clear_color_; }
+
+void SceneRenderer::setUseMaterial(const bool use_material) {
+  uniforms_dirty_ |= (use_material_ != use_material);
+  use_material_ = use_material;
+}
+
+bool SceneRenderer::useMaterial() const { return use_material_; }
+
+void SceneRenderer::setFrustumCulling(const bool frustum_culling) {
+  view_dirty_ |= (frustum_culling_ != frustum_culling);
+  frustum_culling_ = frustum_culling;
+}
+
+bool SceneRenderer::frustumCulling() const { return frustum_culling_; }
+
+void SceneRenderer::setUseLods(const bool use_lods) {
+  view_dirty_ |= (use_lods_ != use_lods);
+  use_lods_ = use_lods;
+}
+
+bool SceneRenderer::useLods() const { return use_lods_; }
+
+void SceneRenderer::setPointBudget(const size_t point_budget) {
+  view_dirty_ |= (point_budget_ != point_budget);
+  point_budget_ = point_budget;
+}
+
+size_t SceneRenderer::pointBudget() const { return point_budget_; }
+
+void SceneRenderer::setReleaseCpuGeometry(const bool release_cpu_geometry) {
+  release_cpu_geometry_ = release_cpu_geometry;
+}
+
+void SceneRenderer::setPolygonMode(const GLenum polygon_mode) { polygon_mode_ = polygon_mode; }
+
+void SceneRenderer::setAsyncTextures(const bool async_textures) { async_textures_ = async_textures; }
+
+void SceneRenderer::setCompressTextures(const bool compress_textures) {
+  compress_textures_ = compress_textures;
+  updateTextureCompression();
+}
+
+bool SceneRenderer::compressTextures() const { return compress_textures_; }
+
+bool SceneRenderer::loadTexture(const QString& filename) {
+  acquireResources();
+  if (!resources_) {
+    return false;
+  }
+
+  bool success = resources_->loadTexture(filename);
+  profiler_.counters().bytes_uploaded += resources_->takeUploadedBytes();
+  return success;
+}
+
+TextureManager& SceneRenderer::textureManager() { return *texture_manager_; }
+
+void SceneRenderer::shareTextureManager(const SceneRenderer& renderer) { texture_manager_ = renderer.texture_manager_; }
+
+FrameProfiler& SceneRenderer::profiler() { return profiler_; }
+
+void SceneRenderer::render(const int width, const int height, const QMatrix4x4& rotation, const float camera_zoom) {
+  profiler_.beginFrame();
+
+  {
+    FrameProfiler::Scope scope(&profiler_, "clear");
+    enableGlCapabilities();
+    glPolygonMode(GL_FRONT_AND_BACK, polygon_mode_);
+    glClearColor(clear_color_.redF(), clear_color_.greenF(), clear_color_.blueF(), clear_color_.alphaF());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  }
+
+  // The camera matrices, the visible instances and the uniforms are only computed again when their inputs change
+  if (width != view_width_ || height != view_height_ || camera_zoom != view_zoom_ || rotation != view_rotation_) {
+    view_width_ = width;
+    view_height_ = height;
+    view_zoom_ = camera_zoom;
+    view_rotation_ = rotation;
+    view_dirty_ = true;
+  }
+
+  if (view_dirty_) {
+    QVector3D scene_min = scene_ ? scene_->scene_min : QVector3D();
+    QVector3D scene_max = scene_ ? scene_->scene_max : QVector3D();
+
+    QMatrix4x4 projection;
+    float camera_near = scene_max.distanceToPoint(scene_min) / 500.0;
+    projection.perspective(45.0f, (width / static_cast<float>(height ? height : 1)), camera_near, 100000.0);
+    camera_pos_ = QVector3D(0, 0, (scene_max.z() * 5.0 * camera_zoom));
+
+    QMatrix4x4 view;
+    view.lookAt(camera_pos_, QVector3D(0, 0, 0), QVector3D(0, 1, 0));
+    mvp_ = projection * view * rotation;
+    uniforms_dirty_ = true;
+  }
+
+  acquireResources();
+  if (buffers_dirty_ || (resources_ && resources_->needsUpdate())) {
+    FrameProfiler::Scope scope(&profiler_, "upload");
+    // Resources shared with other renderers are only uploaded by the first one that renders them
+    if (resources_) {
+      resources_->update(async_textures_, release_cpu_geometry_);
+      profiler_.counters().bytes_uploaded += resources_->takeUploadedBytes();
+    }
+    if (buffers_dirty_) {
+      uploadBuffers();
+    }
+  }
+
+  if (view_dirty_ && scene_ && instance_buffer_.isCreated()) {
+    FrameProfiler::Scope scope(&profiler_, "cull");
+    cullInstances(mvp_);
+    selectLods(rotation, height);
+    if (scene_->point_cloud) {
+      selectPoints(rotation, height);
+    }
+  }
+
+  // Pages are requested again while some of the last request are missing, without waiting for the view to change
+  if (scene_ && scene_->streamer && instance_buffer_.isCreated() && (view_dirty_ || resources_->pagesMissing())) {
+    requestPages();
+  }
+  view_dirty_ = false;
+  profiler_.counters().culled_instances += culled_instances_;
+
+  {
+    FrameProfiler::Scope scope(&profiler_, "uniforms");
+    shader_program_.bind();
+    glBindBufferBase(GL_UNIFORM_BUFFER, kFrameBinding, frame_buffer_);
+    profiler_.counters().state_changes++;
+
+    // The Frame block keeps its contents between frames, so it is only updated when the view or a setting changed
+    if (uniforms_dirty_) {
+      setUniformValues(mvp_, rotation);
+      uniforms_dirty_ = false;
+    }
+  }
+
+  {
+    FrameProfiler::Scope scope(&profiler_, "draw");
+    drawMesh();
+    shader_program_.release();
+    if (scene_ && scene_->point_cloud) {
+      drawPoints();
+    }
+  }
+
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  profiler_.endFrame();
+}
+
+bool SceneRenderer::initShaders() {
+  bool success = true;
+  success &= shader_program_.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":phong.vert");
+  success &= shader_program_.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":phong.frag");
+  success &= point_program_.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":points.vert");
+  success &= point_program_.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":points.frag");
+
+  if (!success) {
+    qWarning() << "Shader import failed.";
+  }
+
+  return success;
+}
+
+void SceneRenderer::enableGlCapabilities() {
+  glEnable(GL_DEPTH_TEST);
+
+  glDepthFunc(GL_LESS);
+}
+
+void SceneRenderer::getAttributeLocations(QOpenGLShaderProgram* program) {
+  attribute_locations_.clear();
+  for (size_t i = 0; i < vertex_layout_.attribute_count; i++) {
+    attribute_locations_.push_back(program->attributeLocation(vertex_layout_.attributes[i].name));
+  }
+  instance_location_ = program->attributeLocation("aInstance");
+}
+
+void SceneRenderer::acquireResources() {
+  if (resources_ && resources_->scene() == scene_) {
+    return;
+  }
+
+  // The resources of the previous scene are destroyed before the new ones are uploaded, unless another renderer still
+  // draws them
+  destroyBuffers();
+  resources_.reset();
+  if (scene_) {
+    resources_ = SceneResources::acquire(scene_, texture_manager_);
+  }
+}
+
+void SceneRenderer::uploadBuffers() {
+  destroyBuffers();
+  buffers_dirty_ = false;
+
+  if (!resources_ || !resources_->vertexBuffer().isCreated()) {
+    return;
+  }
+
+  vertex_layout_ = scene_->vertex_layout;
+
+  // One column-major matrix per instance, grouped by mesh range. All of them are visible until the first culling
+  instance_data_.resize(scene_->instances.size() * 16);
+  for (size_t i = 0; i < scene_->instances.size(); i++) {
+    std::copy_n(scene_->instances[i].transform.constData(), 16, &instance_data_[i * 16]);
+  }
+  visible_instances_.resize(scene_->instances.size());
+  std::iota(visible_instances_.begin(), visible_instances_.end(), 0);
+  visible_counts_.clear();
+  for (const MeshRange& range : scene_->mesh_ranges) {
+    visible_counts_.push_back(range.instance_count);
+  }
+  range_lods_.assign(scene_->mesh_ranges.size(), 0);
+  culled_instances_ = 0;
+  view_dirty_ = true;
+  if (!instance_data_.empty()) {
+    instance_buffer_.create();
+    instance_buffer_.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    instance_buffer_.bind();
+    instance_buffer_.allocate(instance_data_.data(), static_cast<int>(instance_data_.size() * sizeof(float)));
+    instance_buffer_.release();
+    profiler_.counters().bytes_uploaded += instance_data_.size() * sizeof(float);
+  }
+
+  // Vertex array objects are not shared between contexts, so every renderer records its own over the shared buffers
+  if (scene_->point_cloud) {
+    point_program_.bind();
+    getAttributeLocations(&point_program_);
+    point_vao_.reset(new QOpenGLVertexArrayObject);
+    if (point_vao_->create()) {
+      point_vao_->bind();
+      bindPointAttributes();
+      point_vao_->release();
+    }
+    point_program_.release();
+    resources_->vertexBuffer().release();
+    return;
+  }
+
+  shader_program_.bind();
+  getAttributeLocations(&shader_program_);
+  for (const MeshRange& range : scene_->mesh_ranges) {
+    std::unique_ptr<QOpenGLVertexArrayObject> vao(new QOpenGLVertexArrayObject);
+    if (vao->create()) {
+      vao->bind();
+      bindMeshAttributes(range);
+      vao->release();
+    }
+    mesh_vaos_.push_back(std::move(vao));
+  }
+  for (size_t slot = 0; slot < resources_->pageSlotCount(); slot++) {
+    std::unique_ptr<QOpenGLVertexArrayObject> vao(new QOpenGLVertexArrayObject);
+    if (vao->create()) {
+      vao->bind();
+      bindPageAttributes(slot);
+      vao->release();
+    }
+    page_vaos_.push_back(std::move(vao));
+  }
+  shader_program_.release();
+
+  // Leaves the buffers unbound, so they are not modified by a later client side attribute setup
+  resources_->vertexBuffer().release();
+  resources_->indexBuffer().release();
+  resources_->pageVertexBuffer().release();
+  resources_->pageIndexBuffer().release();
+  instance_buffer_.release();
+}
+
+void SceneRenderer::destroyBuffers() {
+  mesh_vaos_.clear();
+  page_vaos_.clear();
+  point_vao_.reset();
+  instance_buffer_.destroy();
+
+  visible_instances_.clear();
+  visible_counts_.clear();
+  instance_data_.clear();
+  range_lods_.clear();
+  pixel_scales_.clear();
+  selected_points_.clear();
+  culled_instances_ = 0;
+}
+
+void SceneRenderer::bindMeshAttributes(const MeshRange& range) {
+  resources_->vertexBuffer().bind();
+  setVertexAttributes(range.base_vertex * vertex_layout_.stride);
+
+  // A mat4 attribute takes four consecutive locations, one per column, advanced once per instance
+  if (instance_location_ >= 0 && instance_buffer_.isCreated()) {
+    instance_buffer_.bind();
+    size_t instance_offset = range.instance_offset * kInstanceSize;
+    for (int column = 0; column < 4; column++) {
+      glVertexAttribPointer(instance_location_ + column, 4, GL_FLOAT, GL_FALSE, kInstanceSize,
+                            reinterpret_cast<const void*>(instance_offset + column * 4 * sizeof(float)));
+      glEnableVertexAttribArray(instance_location_ + column);
+      glVertexAttribDivisor(instance_location_ + column, 1);
+    }
+  }
+
+  if (resources_->indexBuffer().isCreated()) {
+    resources_->indexBuffer().bind();
+  }
+}
+
+void SceneRenderer::bindPageAttributes(const size_t slot) {
+  resources_->pageVertexBuffer().bind();
+  setVertexAttributes(resources_->pageVertexOffset(slot));
+
+  for (int column = 0; instance_location_ >= 0 && column < 4; column++) {
+    glVertexAttribDivisor(instance_location_ + column, 0);
+    glDisableVertexAttribArray(instance_location_ + column);
+  }
+
+  resources_->pageIndexBuffer().bind();
+}
+
+void SceneRenderer::bindPointAttributes() {
+  resources_->vertexBuffer().bind();
+  setVertexAttributes(0);
+}
+
+void SceneRenderer::setVertexAttributes(const size_t offset) {
+  // Texture coordinates are always uploaded (zero filled when missing), the shader decides whether to sample them
+  for (size_t i = 0; i < vertex_layout_.attribute_count && i < attribute_locations_.size(); i++) {
+    const VertexAttribute& attribute = vertex_layout_.attributes[i];
+    if (attribute_locations_[i] < 0) {
+      continue;
+    }
+
+    glVertexAttribPointer(attribute_locations_[i], attribute.size, attribute.type, attribute.normalized,
+                          vertex_layout_.stride, reinterpret_cast<const void*>(offset + attribute.offset));
+    glEnableVertexAttribArray(attribute_locations_[i]);
+  }
+}
+
+void SceneRenderer::cullInstances(const QMatrix4x4& MVP) {
+  const std::vector<MeshInstance>& instances = scene_->instances;
+  const std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+
+  std::vector<uint32_t> visible;
+  if (frustum_culling_ && !scene_->bvh.empty()) {
+    scene_->bvh.cullFrustum(frustumPlanes(MVP), &visible);
+    std::sort(visible.begin(), visible.end());
+  } else {
+    visible.resize(instances.size());
+    std::iota(visible.begin(), visible.end(), 0);
+  }
+  culled_instances_ = instances.size() - visible.size();
+
+  if (visible == visible_instances_) {
+    return;
+  }
+  visible_instances_.swap(visible);
+
+  std::fill(visible_counts_.begin(), visible_counts_.end(), 0);
+  for (uint32_t i : visible_instances_) {
+    const MeshInstance& instance = instances[i];
+    size_t slot = ranges[instance.range].instance_offset + visible_counts_[instance.range]++;
+    std::copy_n(instance.transform.constData(), 16, &instance_data_[slot * 16]);
+  }
+
+  instance_buffer_.bind();
+  instance_buffer_.write(0, instance_data_.data(), static_cast<int>(instance_data_.size() * sizeof(float)));
+  instance_buffer_.release();
+  profiler_.counters().bytes_uploaded += instance_data_.size() * sizeof(float);
+}
+
+void SceneRenderer::selectLods(const QMatrix4x4& rotation, const int height) {
+  const std::vector<MeshInstance>& instances = scene_->instances;
+  const std::vector<MeshRange>& ranges = scene_->mesh_ranges;
+
+  // Pixels per unit of distance at unit depth, for the 45 degrees vertical field of view of the projection
+  const float pixels_per_unit = qMax(height, 1) / (2.0f * std::tan(qDegreesToRadians(22.5f)));
+
+  // Pixels covered by a unit of the packed vertices at the nearest visible instance of each mesh range, which also
+  // orders the requests of full pages
+  pixel_scales_.assign(ranges.size(), 0.0f);
+  for (uint32_t i : visible_instances_) {
+    const MeshInstance& instance = instances[i];
+    const MeshRange& range = ranges[instance.range];
+    if (range.lods.empty()) {
+      continue;
+    }
+
+    const QMatrix4x4& transform = instance.transform;
+    float scale = 0.0f;
+    for (int column = 0; column < 3; column++) {
+      scale = qMax(scale, QVector3D(transform(0, column), transform(1, column), transform(2, column)).length());
+    }
+    const float radius = (range.bounds_max - range.bounds_min).length() / 2.0f * scale;
+    const QVector3D center = rotation.map(QVector3D(transform(0, 3), transform(1, 3), transform(2, 3)));
+    const float distance = camera_pos_.distanceToPoint(center) - radius;
+
+    // The camera is inside the bounding sphere, the full mesh is drawn
+    const float pixel_scale = (distance > 0.0f) ? scale * pixels_per_unit / distance : kLodMaxPixelScale;
+    pixel_scales_[instance.range] = qMax(pixel_scales_[instance.range], qMin(pixel_scale, kLodMaxPixelScale));
+  }
+
+  if (!use_lods_) {
+    std::fill(range_lods_.begin(), range_lods_.end(), 0);
+    return;
+  }
+
+  auto level_error = [](const MeshRange& range, const size_t level) {
+    return (level > 0) ? range.lods[level - 1].error : 0.0f;
+  };
+  for (size_t m = 0; m < ranges.size(); m++) {
+    const MeshRange& range = ranges[m];
+    size_t& level = range_lods_[m];
+    level = qMin(level, range.lods.size());
+    if (pixel_scales_[m] == 0.0f) {
+      continue;
+    }
+
+    while (level > 0 && level_error(range, level) * pixel_scales_[m] > kLodPixelError) {
+      level--;
+    }
+    while (level < range.lods.size() &&
+           level_error(range, level + 1) * pixel_scales_[m] <= kLodPixelError * kLodHysteresis) {
+      level++;
+    }
+  }
+}
+
+void SceneRenderer::selectPoints(const QMatrix4x4& rotation, const int height) {
+  pixels_per_unit_ = qMax(height, 1) / (2.0f * std::tan(qDegreesToRadians(22.5f)));
+
+  // The octree is in model coordinates, where the camera is moved by the inverse rotation. Zero planes cull nothing
+  const FrustumPlanes planes = frustum_culling_ ? frustumPlanes(mvp_) : FrustumPlanes();
+  const QVector3D camera = rotation.inverted().map(camera_pos_);
+  scene_->point_octree.select(planes, camera, pixels_per_unit_, point_budget_, &selected_points_);
+}
+
+void SceneRenderer::requestPages() {
+  std::vector<size_t> pages;
+  for (size_t m = 0; m < range_lods_.size(); m++) {
+    if (visible_counts_[m] > 0 && range_lods_[m] == 0) {
+      pages.push_back(m);
+    }
+  }
+
+  std::stable_sort(pages.begin(), pages.end(),
+                   [this](size_t a, size_t b) { return pixel_scales_[a] > pixel_scales_[b]; });
+  resources_->requestPages(pages);
+}
+
+void SceneRenderer::updateTextureCompression() {
+  bool compression = compress_textures_ && compression_supported_;
+  // The resources of the scene load their textures again once the compression of the texture manager changed
+  texture_manager_->setCompression(compression);
+}
+
+void SceneRenderer::setUniformValues(const QMatrix4x4& MVP, const QMatrix4x4& rotation) {
+  QMatrix4x4 normal_matrix = rotation.inverted().transposed();
+  QVector3D position_offset = scene_ ? scene_->position_offset : QVector3D(0, 0, 0);
+  QVector3D position_scale = scene_ ? scene_->position_scale : QVector3D(1, 1, 1);
+
+  FrameBlock block = {};
+  std::copy_n(MVP.constData(), 16, block.mvp);
+  std::copy_n(rotation.constData(), 16, block.model);
+  std::copy_n(normal_matrix.constData(), 16, block.normal);
+  for (int k = 0; k < 3; k++) {
+    block.light_pos[k] = light_pos_[k];
+    block.camera_pos[k] = camera_pos_[k];
+    block.position_offset[k] = position_offset[k];
+    block.position_scale[k] = position_scale[k];
+  }
+  block.use_material = use_material_;
+
+  glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer_);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void SceneRenderer::drawMesh() {
+  if (!scene_ || !resources_ || mesh_vaos_.size() != scene_->mesh_ranges.size() ||
+      visible_counts_.size() != mesh_vaos_.size() || range_lods_.size() != mesh_vaos_.size() || !scene_->has_normals) {
+    return;
+  }
+
+  FrameCounters& counters = profiler_.counters();
+  size_t bound_window = std::numeric_limits<size_t>::max();
+  GLint material_slot = -1;
+  int bound_array = -1;
+  int bound_layer = std::numeric_limits<int>::min();
+  GLint bound_unit = -1;
+
+  // Each texture array keeps its texture unit for the whole frame, so arrays are only bound again when there are more
+  // arrays than units
+  std::vector<int> unit_arrays(std::max(1, texture_units_), -1);
+
+  for (size_t i : scene_->draw_order) {
+    const MeshRange& range = scene_->mesh_ranges[i];
+    size_t instance_count = visible_counts_[i];
+    if (range.vertex_count == 0 || instance_count == 0) {
+      continue;
+    }
+
+    size_t window = range.material_index / SceneResources::kMaxBlockMaterials;
+    if (window != bound_window) {
+      resources_->bindMaterialWindow(window);
+      bound_window = window;
+      counters.state_changes++;
+    }
+    GLint slot = static_cast<GLint>(range.material_index % SceneResources::kMaxBlockMaterials);
+    if (slot != material_slot) {
+      shader_program_.setUniformValue(material_index_location_, slot);
+      material_slot = slot;
+    }
+
+    SceneResources::TextureLayer texture = resources_->meshTexture(range);
+    if (texture.array >= 0 && texture.array != bound_array) {
+      GLint unit = texture.array % static_cast<GLint>(unit_arrays.size());
+      if (unit_arrays[unit] != texture.array) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, resources_->textureArray(texture.array));
+        unit_arrays[unit] = texture.array;
+        counters.state_changes++;
+      }
+      if (unit != bound_unit) {
+        shader_program_.setUniformValue(texture_unit_location_, unit);
+        bound_unit = unit;
+      }
+      bound_array = texture.array;
+    }
+    if (texture.layer != bound_layer) {
+      shader_program_.setUniformValue(texture_layer_location_, texture.layer);
+      bound_layer = texture.layer;
+    }
+
+    // The full page of a streamed mesh range is drawn from its slot of the page pool once it is resident, and its
+    // coarse page meanwhile
+    int page_slot = (scene_->streamer && range_lods_[i] == 0) ? resources_->pageSlot(i) : -1;
+    if (page_slot >= static_cast<int>(page_vaos_.size())) {
+      page_slot = -1;
+    }
+
+    QOpenGLVertexArrayObject* vao = (page_slot >= 0) ? page_vaos_[page_slot].get() : mesh_vaos_[i].get();
+    if (vao->isCreated()) {
+      vao->bind();
+    } else if (page_slot >= 0) {
+      bindPageAttributes(page_slot);
+    } else {
+      bindMeshAttributes(range);
+    }
+    counters.state_changes++;
+
+    // All the visible instances of a mesh range are drawn by a single draw call, at the same level of detail
+    if (page_slot >= 0) {
+      const float* transform = scene_->instances[range.instance_offset].transform.constData();
+      for (int column = 0; instance_location_ >= 0 && column < 4; column++) {
+        glVertexAttrib4fv(instance_location_ + column, transform + column * 4);
+      }
+      const size_t index_count = scene_->streamer->page(i).index_count;
+      glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT,
+                     reinterpret_cast<const void*>(resources_->pageIndexOffset(page_slot)));
+      counters.draw_calls++;
+      counters.triangles += index_count / 3;
+    } else if (range.index_count > 0) {
+      const size_t level = range_lods_[i];
+      const size_t index_offset = (level > 0) ? range.lods[level - 1].index_offset : range.index_offset;
+      const size_t index_count = (level > 0) ? range.lods[level - 1].index_count : range.index_count;
+      glDrawElementsInstanced(GL_TRIANGLES, index_count, range.index_type, reinterpret_cast<const void*>(index_offset),
+                              instance_count);
+      counters.draw_calls++;
+      counters.triangles += index_count / 3 * instance_count;
+    } else if (!scene_->indexed) {
+      glDrawArraysInstanced(GL_TRIANGLES, 0, range.vertex_count, instance_count);
+      counters.draw_calls++;
+      counters.triangles += range.vertex_count / 3 * instance_count;
+    }
+
+    if (vao->isCreated()) {
+      vao->release();
+    }
+  }
+
+  if (!mesh_vaos_.empty() && !mesh_vaos_.front()->isCreated()) {
+    for (int location : attribute_locations_) {
+      if (location >= 0) {
+        glDisableVertexAttribArray(location);
+      }
+    }
+    for (int column = 0; instance_location_ >= 0 && column < 4; column++) {
+      glVertexAttribDivisor(instance_location_ + column, 0);
+      glDisableVertexAttribArray(instance_location_ + column);
+    }
+    resources_->vertexBuffer().release();
+    resources_->indexBuffer().release();
+    resources_->pageVertexBuffer().release();
+    resources_->pageIndexBuffer().release();
+    instance_buffer_.release();
+  }
+}
+
+void SceneRenderer::drawPoints() {
+  if (!resources_ || !point_vao_ || selected_points_.empty()) {
+    return;
+  }
+
+  FrameCounters& counters = profiler_.counters();
+  // The Frame block is already bound to its binding point, which both programs read
+  point_program_.bind();
+  point_program_.setUniformValue(pixels_per_unit_location_, pixels_per_unit_);
+  point_program_.setUniformValue(max_point_size_location_, kMaxPointSize);
+  glEnable(GL_PROGRAM_POINT_SIZE);
+
+  if (point_vao_->isCreated()) {
+    point_vao_->bind();
+  } else {
+    bindPointAttributes();
+  }
+  counters.state_changes += 2;
+
+  // The points of each node are contiguous, so each node is a single draw call with its own cube and splat size
+  const std::vector<PointOctreeNode>& nodes = scene_->point_octree.nodes();
+  for (const SelectedPointNode& selected : selected_points_) {
+    const PointOctreeNode& node = nodes[selected.node];
+    point_program_.setUniformValue(node_center_location_, QVector3D(node.center[0], node.center[1], node.center[2]));
+    point_program_.setUniformValue(node_half_size_location_, node.half_size);
+    point_program_.setUniformValue(point_spacing_location_, selected.spacing);
+    glDrawArrays(GL_POINTS, static_cast<GLint>(node.first), static_cast<GLsizei>(node.count));
+    counters.draw_calls++;
+    counters.points += node.count;
+  }
+
+  if (point_vao_->isCreated()) {
+    point_vao_->release();
+  } else {
+    for (int location : attribute_locations_) {
+      if (location >= 0) {
+        glDisableVertexAttribArray(location);
+      }
+    }
+    resources_->vertexBuffer().release();
+  }
+
+  glDisable(GL_PROGRAM_POINT_SIZE);
+  point_program_.release();
+}
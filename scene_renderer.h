@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef SCENE_RENDERER_H_
+#define SCENE_RENDERER_H_
+
+#include <QColor>
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <memory>
+#include <vector>
+
+#include "frame_profiler.h"
+#include "point_octree.h"
+#include "scene_loader.h"
+#include "scene_resources.h"
+#include "texture_manager.h"
+
+/**
+ * @brief Draws a SceneData with the Phong shaders into the current OpenGL context. It owns the OpenGL resources of the
+ * view (shader program, instance buffer and vertex array objects) but no surface, so the same renderer is used by the
+ * QtOpenGL widget and by headless tools rendering into a framebuffer object. The vertex, index and material buffers and
+ * the textures of the scene are SceneResources, shared by the renderers of the same scene whose contexts share objects.
+ * For streamed scenes, the renderer requests the full pages of the visible mesh ranges whose coarse page is not
+ * precise enough, and draws them from the page pool once they are resident. Point clouds are drawn with their own
+ * shaders as round splats, from the nodes of their octree selected under a point budget. All methods that touch OpenGL
+ * require the context of the renderer to be current.
+ */
+class SceneRenderer : protected QOpenGLExtraFunctions {
+ public:
+  /**
+   * Initializes the OpenGL functions, shaders and state of the current context.
+   *
+   * @return True if the shaders were loaded successfully.
+   */
+  bool initialize();
+
+  /**
+   * Destroys the OpenGL resources of the renderer.
+   */
+  void destroy();
+
+  /**
+   * Replaces the rendered scene. The GPU buffers and textures are acquired on the next render, and only uploaded if no
+   * other renderer of the share group renders the same scene.
+   *
+   * @param scene: loaded scene.
+   */
+  void setScene(const std::shared_ptr<SceneData> &scene);
+
+  /**
+   * Gets the rendered scene.
+   *
+   * @return The rendered scene, or NULL if no scene was set.
+   */
+  const std::shared_ptr<SceneData> &scene() const;
+
+  /**
+   * Updates the background color.
+   *
+   * @param color: new background color.
+   */
+  void setClearColor(const QColor &color);
+
+  /**
+   * Gets the background color.
+   *
+   * @return The background color.
+   */
+  QColor clearColor() const;
+
+  /**
+   * Enable shading method (Phong).
+   *
+   * @param use_material: True to enable shading.
+   */
+  void setUseMaterial(const bool use_material);
+
+  /**
+   * Gets whether the shading method (Phong) is enabled.
+   *
+   * @return True if shading is enabled.
+   */
+  bool useMaterial() const;
+
+  /**
+   * Enables view frustum culling: only the instances whose bounding boxes intersect the view frustum are drawn.
+   *
+   * @param frustum_culling: True to cull instances outside the view frustum.
+   */
+  void setFrustumCulling(const bool frustum_culling);
+
+  /**
+   * Gets whether view frustum culling is enabled.
+   *
+   * @return True if instances outside the view frustum are culled.
+   */
+  bool frustumCulling() const;
+
+  /**
+   * Enables levels of detail: each mesh range is drawn with the coarsest of its levels whose error, projected on the
+   * screen at its nearest visible instance, stays below a pixel.
+   *
+   * @param use_lods: True to select a level of detail per mesh range.
+   */
+  void setUseLods(const bool use_lods);
+
+  /**
+   * Gets whether levels of detail are enabled.
+   *
+   * @return True if a level of detail is selected per mesh range.
+   */
+  bool useLods() const;
+
+  /**
+   * Sets the point budget of point clouds: the nodes of the octree that cover the most pixels are drawn until their
+   * points reach the budget.
+   *
+   * @param point_budget: maximum number of points drawn per frame.
+   */
+  void setPointBudget(const size_t point_budget);
+
+  /**
+   * Gets the point budget of point clouds.
+   *
+   * @return Maximum number of points drawn per frame.
+   */
+  size_t pointBudget() const;
+
+  /**
+   * When enabled, the CPU-side VBO and IBO of the scene are freed as soon as the geometry is uploaded to the GPU
+   * buffers.
+   *
+   * @param release_cpu_geometry: True to free the CPU copy of the geometry after upload.
+   */
+  void setReleaseCpuGeometry(const bool release_cpu_geometry);
+
+  /**
+   * Selects how polygons are rasterized.
+   *
+   * @param polygon_mode: GL_POINT, GL_LINE or GL_FILL.
+   */
+  void setPolygonMode(const GLenum polygon_mode);
+
+  /**
+   * Selects how the textures of a scene are loaded: decoded by the texture manager on its thread pool and uploaded once
+   * ready, meshes being drawn without their textures meanwhile, or loaded by the first render of the scene.
+   *
+   * @param async_textures: True to load textures asynchronously.
+   */
+  void setAsyncTextures(const bool async_textures);
+
+  /**
+   * Enables S3TC compression of the textures and their disk cache, when the context supports
+   * GL_EXT_texture_compression_s3tc. The textures of the scene are loaded again on the next render.
+   *
+   * @param compress_textures: True to compress textures.
+   */
+  void setCompressTextures(const bool compress_textures);
+
+  /**
+   * Gets whether S3TC compression of the textures was requested.
+   *
+   * @return True if textures are compressed when supported.
+   */
+  bool compressTextures() const;
+
+  /**
+   * Loads a texture into the shared resources of the scene, for the materials that reference it. The image is loaded by
+   * the texture manager on the calling thread.
+   *
+   * @param filename: path to the texture file to be loaded, relative to the mesh file.
+   *
+   * @return True if the texture was loaded successfully.
+   */
+  bool loadTexture(const QString &filename);
+
+  /**
+   * Gets the texture manager, which decodes and caches the textures of the renderer.
+   *
+   * @return Texture manager of the renderer.
+   */
+  TextureManager &textureManager();
+
+  /**
+   * Makes the renderer decode its textures with the texture manager of another renderer, which renderers sharing scene
+   * resources must do, so the textures they request are taken by either of them.
+   *
+   * @param renderer: renderer whose texture manager is shared.
+   */
+  void shareTextureManager(const SceneRenderer &renderer);
+
+  /**
+   * Gets the profiler of the rendered frames. Every frame updates its counters; sections are measured once it is
+   * enabled.
+   *
+   * @return Profiler of the renderer.
+   */
+  FrameProfiler &profiler();
+
+  /**
+   * Renders the scene into the bound framebuffer, as a profiled frame. The camera looks at the origin from the +z axis.
+   * The OpenGL state of the renderer is set on every frame and the polygon mode is restored to GL_FILL, so other
+   * painters (such as QPainter) may draw into the framebuffer between frames. The camera matrices, the culling and the
+   * uniforms of the shader program are only updated when the view, the scene or the settings changed.
+   *
+   * @param width: width of the viewport, used for the aspect ratio.
+   * @param height: height of the viewport, used for the aspect ratio.
+   * @param rotation: rotation of the scene.
+   * @param camera_zoom: multiplier of the camera distance.
+   */
+  void render(const int width, const int height, const QMatrix4x4 &rotation, const float camera_zoom);
+
+ private:
+  /**
+   * Add veetex and fragment shaders to the shader_program_ (Phong) and to the point_program_ (splats) using source
+   * files. The shaders are cacheable, so the linked program binaries are stored on disk, keyed by the shader sources
+   * and the OpenGL driver and version.
+   *
+   * @return True if shaders were loaded successfully.
+   */
+  bool initShaders();
+
+  /**
+   * Enable GL_DEPTH_TEST and set glDepthFunc to GL_LESS.
+   */
+  void enableGlCapabilities();
+
+  /**
+   * Get location of each attribute of the vertex layout (positions, normals and UV coordinates, or positions and colors
+   * of points), and of the instance matrix, from a shader program.
+   *
+   * @param program: shader program that draws the vertex layout.
+   */
+  void getAttributeLocations(QOpenGLShaderProgram *program);
+
+  /**
+   * Gets the shared resources of the scene, when the scene was changed since they were acquired. The resources of the
+   * previous scene are released first.
+   */
+  void acquireResources();
+
+  /**
+   * Uploads the instance matrices of the scene and records one vertex array object per mesh range, over the shared
+   * vertex and index buffers, and one per slot of the page pool of a streamed scene, or a single one over the points of
+   * a point cloud. Called from render only when the scene was changed.
+   */
+  void uploadBuffers();
+
+  /**
+   * Destroys the instance buffer and vertex array objects of the view.
+   */
+  void destroyBuffers();
+
+  /**
+   * Binds the GPU buffers and sets the attribute pointers of every attribute of the vertex layout, and of the instance
+   * matrices, for a mesh range.
+   *
+   * @param range: mesh range whose vertices are pointed by the attributes.
+   */
+  void bindMeshAttributes(const MeshRange &range);
+
+  /**
+   * Binds the page buffers and sets the attribute pointers of every attribute of the vertex layout for a slot of the
+   * page pool. The instance matrix attribute is disabled, as pages have a single instance whose matrix is set as a
+   * constant attribute value when they are drawn.
+   *
+   * @param slot: slot of the page pool whose vertices are pointed by the attributes.
+   */
+  void bindPageAttributes(const size_t slot);
+
+  /**
+   * Binds the vertex buffer and sets the attribute pointers of every attribute of the point layout, for all the points
+   * of a point cloud.
+   */
+  void bindPointAttributes();
+
+  /**
+   * Sets the attribute pointers of every attribute of the vertex layout into the bound vertex buffer.
+   *
+   * @param offset: offset in bytes of the first vertex in the buffer.
+   */
+  void setVertexAttributes(const size_t offset);
+
+  /**
+   * Finds the visible instances with the bounding volume hierarchy of the scene and, when they changed since the
+   * previous frame, uploads their matrices. The visible instances of each mesh range are packed at the start of its
+   * part of the instance buffer, so the vertex array objects stay valid.
+   *
+   * @param MVP: model/view/projection matrix of the frame.
+   */
+  void cullInstances(const QMatrix4x4 &MVP);
+
+  /**
+   * Selects the level of detail of each mesh range from the size of a pixel at its nearest visible instance. A range
+   * only moves to a coarser level once that level is well below the error threshold, so ranges near the threshold do
+   * not switch levels on every frame.
+   *
+   * @param rotation: rotation of the scene (model matrix).
+   * @param height: height of the viewport, in pixels.
+   */
+  void selectLods(const QMatrix4x4 &rotation, const int height);
+
+  /**
+   * Selects the nodes of the octree of a point cloud to be drawn, under the point budget, and the pixels per unit that
+   * size their splats.
+   *
+   * @param rotation: rotation of the scene (model matrix).
+   * @param height: height of the viewport, in pixels.
+   */
+  void selectPoints(const QMatrix4x4 &rotation, const int height);
+
+  /**
+   * Requests the full pages of a streamed scene for the visible mesh ranges drawn at level 0, those covering the most
+   * pixels first.
+   */
+  void requestPages();
+
+  /**
+   * Enables compression in the texture manager when it was requested and is supported by the context.
+   */
+  void updateTextureCompression();
+
+  /**
+   * Updates the per-frame uniforms of the Frame uniform block with a single buffer update.
+   *
+   * @param MVP: model/view/projection matrix.
+   * @param rotation: rotation of the scene (model matrix).
+   */
+  void setUniformValues(const QMatrix4x4 &MVP, const QMatrix4x4 &rotation);
+
+  /**
+   * Bind the vertex array object and call glDrawElementsInstanced (or glDrawArraysInstanced for de-indexed geometry)
+   * for each mesh range, drawing all of its instances with the indices of its selected level of detail. Texture arrays
+   * are bound to texture units once per frame, and only the layer uniform changes between most draws. Mesh ranges of a
+   * streamed scene at level 0 are drawn from their slot of the page pool when their full page is resident.
+   */
+  void drawMesh();
+
+  /**
+   * Draws the selected nodes of a point cloud with the point program, one glDrawArrays(GL_POINTS) per node. The node
+   * cube, which dequantizes the positions, and the point spacing, which sizes the splats, are set per node.
+   */
+  void drawPoints();
+
+  QColor clear_color_ = Qt::white; /**< Background color */
+
+  QOpenGLShaderProgram shader_program_; /**< Allows OpenGL shader programs to be linked and used */
+  QOpenGLShaderProgram point_program_;  /**< Draws the points of point clouds as splats */
+
+  FrameProfiler profiler_; /**< Measures the sections and counts the work of each frame */
+
+  std::shared_ptr<TextureManager> texture_manager_ = std::make_shared<TextureManager>(); /**< Decodes the textures */
+
+  std::shared_ptr<SceneData> scene_;          /**< Rendered scene */
+  std::shared_ptr<SceneResources> resources_; /**< Buffers and textures of the scene, shared with other renderers */
+
+  bool use_material_ = true;           /**< Enable shading method (Phong) */
+  bool buffers_dirty_ = false;         /**< True if the GPU buffers must be rebuilt from the scene */
+  bool release_cpu_geometry_ = false;  /**< Free the VBOs and IBO after uploading them to the GPU */
+  bool frustum_culling_ = true;        /**< Draw only the instances inside the view frustum */
+  bool use_lods_ = true;               /**< Select a level of detail per mesh range */
+  bool view_dirty_ = true;             /**< True if the camera matrices and the visible instances must be recomputed */
+  bool uniforms_dirty_ = true;         /**< True if the uniforms of the shader program must be sent again */
+  bool async_textures_ = true;         /**< Decode textures on the thread pool of the texture manager */
+  bool compress_textures_ = false;     /**< Compress textures to S3TC when supported */
+  bool compression_supported_ = false; /**< True if the context supports GL_EXT_texture_compression_s3tc */
+
+  GLenum polygon_mode_ = GL_FILL; /**< Rasterization mode of polygons */
+
+  std::vector<int> attribute_locations_; /**< Location in shader of each attribute of the vertex layout */
+  int instance_location_ = -1;           /**< Location of the aInstance attribute (first column) in shader */
+
+  VertexLayoutInfo vertex_layout_ = vertexLayoutInfo<PackedVertex>(); /**< Layout of the uploaded vertices */
+
+  QOpenGLBuffer instance_buffer_; /**< GPU buffer: instance matrices of the view */
+
+  std::vector<uint32_t> visible_instances_; /**< Sorted indices of the instances in the instance buffer */
+  std::vector<size_t> visible_counts_;      /**< Number of visible instances of each mesh range */
+  std::vector<float> instance_data_;        /**< Matrices of the visible instances, as uploaded */
+  std::vector<size_t> range_lods_;          /**< Level of detail of each mesh range, zero for its full indices */
+  std::vector<float> pixel_scales_;         /**< Pixels per unit at the nearest visible instance of each mesh range */
+
+  std::vector<std::unique_ptr<QOpenGLVertexArrayObject>> mesh_vaos_; /**< One vertex array object per mesh range */
+  std::vector<std::unique_ptr<QOpenGLVertexArrayObject>> page_vaos_; /**< One vertex array object per page slot */
+  GLuint frame_buffer_ = 0;                                          /**< Uniform buffer with the Frame block */
+
+  int material_index_location_ = -1; /**< Location of uMaterialIndex uniform in shader */
+  int texture_unit_location_ = -1;   /**< Location of uTextureID uniform (texture unit of the array) in shader */
+  int texture_layer_location_ = -1;  /**< Location of uTextureLayer uniform in shader */
+  int texture_units_ = 16;           /**< Number of texture units available to the fragment shader */
+
+  int node_center_location_ = -1;     /**< Location of uNodeCenter uniform in the point shader */
+  int node_half_size_location_ = -1;  /**< Location of uNodeHalfSize uniform in the point shader */
+  int point_spacing_location_ = -1;   /**< Location of uPointSpacing uniform in the point shader */
+  int pixels_per_unit_location_ = -1; /**< Location of uPixelsPerUnit uniform in the point shader */
+  int max_point_size_location_ = -1;  /**< Location of uMaxPointSize uniform in the point shader */
+
+  size_t point_budget_ = 5000000;                       /**< Maximum number of points drawn per frame */
+  std::vector<SelectedPointNode> selected_points_;      /**< Octree nodes drawn in the last computed view */
+  float pixels_per_unit_ = 1.0f;                        /**< Pixels per unit at unit depth of the last view */
+  std::unique_ptr<QOpenGLVertexArrayObject> point_vao_; /**< Vertex array object over the points of a point cloud */
+
+  int view_width_ = 0;          /**< Width of the viewport of the last computed view */
+  int view_height_ = 0;         /**< Height of the viewport of the last computed view */
+  float view_zoom_ = 0.0f;      /**< Camera zoom of the last computed view */
+  QMatrix4x4 view_rotation_;    /**< Rotation of the scene of the last computed view */
+  QMatrix4x4 mvp_;              /**< Model/view/projection matrix of the last computed view */
+  size_t culled_instances_ = 0; /**< Number of instances culled for the last computed view */
+
+  QVector3D light_pos_;  /**< Light position */
+  QVector3D camera_pos_; /**< Camera position */
+};
+
+#endif  // SCENE_RENDERER_H_
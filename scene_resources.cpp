@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "scene_resources.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+/** Size in bytes of a material in the std140 layout: ambient, diffuse and specular vec4 */
+const size_t kMaterialBlockSize = 3 * 4 * sizeof(float);
+
+/** Size of the decoded textures uploaded per frame, so a burst of ready textures is spread over several frames */
+const size_t kMaxTextureUploadBytes = size_t(64) << 20;
+
+/** Size of the full pages uploaded per frame, so a burst of ready pages is spread over several frames */
+const size_t kMaxPageUploadBytes = size_t(32) << 20;
+
+/** Marks a free slot of the page pool */
+const size_t kFreeSlot = std::numeric_limits<size_t>::max();
+
+/** Internal formats of GL_EXT_texture_compression_s3tc, which is not part of core OpenGL */
+const GLenum kCompressedRgbDxt1 = 0x83F0;
+const GLenum kCompressedRgbaDxt5 = 0x83F3;
+
+/**
+ * Checks whether two decoded textures may be layers of the same texture array.
+ *
+ * @param a: first texture.
+ * @param b: second texture.
+ *
+ * @return True if both textures have the same format, size and mipmap levels.
+ */
+bool sameLayout(const TextureImage& a, const TextureImage& b) {
+  return a.format == b.format && a.levels.front().width == b.levels.front().width &&
+         a.levels.front().height == b.levels.front().height && a.levels.size() == b.levels.size();
+}
+
+}  // namespace
+
+const size_t SceneResources::kMaxBlockMaterials;
+const GLuint SceneResources::kMaterialsBinding;
+
+std::map<std::pair<QOpenGLContextGroup*, const SceneData*>, std::weak_ptr<SceneResources>> SceneResources::registry_;
+
+std::shared_ptr<SceneResources> SceneResources::acquire(const std::shared_ptr<SceneData>& scene,
+                                                        const std::shared_ptr<TextureManager>& texture_manager) {
+  for (auto entry = registry_.begin(); entry != registry_.end();) {
+    entry = entry->second.expired() ? registry_.erase(entry) : std::next(entry);
+  }
+
+  auto key = std::make_pair(QOpenGLContext::currentContext()->shareGroup(), static_cast<const SceneData*>(scene.get()));
+  std::shared_ptr<SceneResources> resources = registry_[key].lock();
+  if (!resources) {
+    resources.reset(new SceneResources(scene, texture_manager));
+    registry_[key] = resources;
+  }
+  return resources;
+}
+
+SceneResources::SceneResources(const std::shared_ptr<SceneData>& scene,
+                               const std::shared_ptr<TextureManager>& texture_manager)
+    : scene_(scene), texture_manager_(texture_manager) {
+  initializeOpenGLFunctions();
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_array_layers_);
+}
+
+SceneResources::~SceneResources() {
+  // Released by the last renderer, whose context may not be the one that created the resources. Textures are plain
+  // names of the share group, deleted through the functions of that context
+  initializeOpenGLFunctions();
+  deleteTextureArrays();
+
+  vertex_buffer_.destroy();
+  index_buffer_.destroy();
+  page_vertex_buffer_.destroy();
+  page_index_buffer_.destroy();
+  if (material_buffer_) {
+    glDeleteBuffers(1, &material_buffer_);
+  }
+}
+
+const std::shared_ptr<SceneData>& SceneResources::scene() const { return scene_; }
+
+bool SceneResources::needsUpdate() const {
+  return !buffers_uploaded_ || !textures_loaded_ || texture_compression_ != texture_manager_->compression() ||
+         texture_manager_->hasReady() || (scene_->streamer && scene_->streamer->hasReady());
+}
+
+void SceneResources::update(const bool async_textures, const bool release_cpu_geometry) {
+  if (!buffers_uploaded_) {
+    uploadBuffers(release_cpu_geometry);
+  }
+  if (!textures_loaded_ || texture_compression_ != texture_manager_->compression()) {
+    loadTextures(async_textures);
+  }
+
+  // The texture manager may be shared with the resources of another scene, whose textures are dropped
+  std::vector<TextureManager::Result> results = texture_manager_->takeReady(kMaxTextureUploadBytes);
+  results.erase(std::remove_if(results.begin(), results.end(),
+                               [this](const TextureManager::Result& result) {
+                                 return requested_textures_.count(result.first) == 0;
+                               }),
+                results.end());
+  if (!results.empty()) {
+    addTextures(results);
+  }
+
+  if (scene_->streamer) {
+    uploadPages(scene_->streamer->takeReady(kMaxPageUploadBytes));
+  }
+}
+
+bool SceneResources::loadTexture(const QString& filename) {
+  if (filename.isEmpty()) {
+    return false;
+  }
+
+  QString path = texturePath(filename);
+  std::shared_ptr<const TextureImage> image = texture_manager_->load(path);
+  if (!image) {
+    qWarning() << "Texture import failed.";
+    return false;
+  }
+
+  addTextures({TextureManager::Result(path, image)});
+  return true;
+}
+
+size_t SceneResources::takeUploadedBytes() { return std::exchange(uploaded_bytes_, 0); }
+
+QOpenGLBuffer& SceneResources::vertexBuffer() { return vertex_buffer_; }
+
+QOpenGLBuffer& SceneResources::indexBuffer() { return index_buffer_; }
+
+void SceneResources::bindMaterialWindow(const size_t window) {
+  const size_t window_size = kMaxBlockMaterials * kMaterialBlockSize;
+  glBindBufferRange(GL_UNIFORM_BUFFER, kMaterialsBinding, material_buffer_, window * window_size, window_size);
+}
+
+SceneResources::TextureLayer SceneResources::meshTexture(const MeshRange& range) const {
+  if (!range.has_texture_coords || range.material_index >= material_textures_.size()) {
+    return TextureLayer();
+  }
+  return material_textures_[range.material_index];
+}
+
+GLuint SceneResources::textureArray(const int array) const { return texture_arrays_[array].texture; }
+
+void SceneResources::requestPages(const std::vector<size_t>& pages) {
+  if (slot_pages_.empty()) {
+    return;
+  }
+  page_requests_++;
+
+  // Resident pages are kept while a request needs them, the others are read in priority order. Pages that were
+  // requested before and are no longer needed are not read
+  std::vector<size_t> missing;
+  for (size_t i = 0; i < std::min(pages.size(), slot_pages_.size()); i++) {
+    if (pages[i] >= page_slots_.size()) {
+      continue;
+    }
+    int slot = page_slots_[pages[i]];
+    if (slot >= 0) {
+      slot_uses_[slot] = page_requests_;
+    } else if (scene_->streamer->isReadable(pages[i])) {
+      missing.push_back(pages[i]);
+    }
+  }
+  scene_->streamer->request(missing);
+  missing_pages_ = missing;
+}
+
+bool SceneResources::pagesMissing() const {
+  // Requested pages may have been dropped by uploadPages for a lack of slots, or have failed to be read
+  if (!scene_->streamer || missing_pages_.empty() || !scene_->streamer->isIdle()) {
+    return false;
+  }
+  return std::any_of(missing_pages_.begin(), missing_pages_.end(), [this](size_t page) {
+    return page_slots_[page] < 0 && scene_->streamer->isReadable(page);
+  });
+}
+
+size_t SceneResources::pageSlotCount() const { return slot_pages_.size(); }
+
+int SceneResources::pageSlot(const size_t range) const {
+  return (range < page_slots_.size()) ? page_slots_[range] : -1;
+}
+
+size_t SceneResources::pageVertexOffset(const size_t slot) const { return slot * slot_vertex_bytes_; }
+
+size_t SceneResources::pageIndexOffset(const size_t slot) const { return slot * slot_index_bytes_; }
+
+QOpenGLBuffer& SceneResources::pageVertexBuffer() { return page_vertex_buffer_; }
+
+QOpenGLBuffer& SceneResources::pageIndexBuffer() { return page_index_buffer_; }
+
+void SceneResources::uploadBuffers(const bool release_cpu_geometry) {
+  buffers_uploaded_ = true;
+
+  // Scenes read from the mesh cache are uploaded straight from the map of the cache file
+  const MappedBuffers& mapped = scene_->mapped_buffers;
+  const bool use_mapped = scene_->vertex_data.empty() && mapped.mapping;
+  const unsigned char* vertex_data = use_mapped ? mapped.vertex_data : scene_->vertex_data.data();
+  const size_t vertex_size = use_mapped ? mapped.vertex_size : scene_->vertex_data.size();
+  const unsigned char* index_data = use_mapped ? mapped.index_data : scene_->index_data.data();
+  const size_t index_size = use_mapped ? mapped.index_size : scene_->index_data.size();
+  if (vertex_size == 0) {
+    return;
+  }
+
+  auto allocate = [](QOpenGLBuffer* buffer, const void* data, size_t size) {
+    buffer->create();
+    buffer->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    buffer->bind();
+    buffer->allocate(data, static_cast<int>(size));
+    buffer->release();
+  };
+
+  allocate(&vertex_buffer_, vertex_data, vertex_size);
+  if (index_size > 0) {
+    allocate(&index_buffer_, index_data, index_size);
+  }
+
+  // The materials are padded to whole windows, so every bound range covers the full Materials block
+  const std::vector<Material>& materials = scene_->materials;
+  size_t window_count = qMax<size_t>(1, (materials.size() + kMaxBlockMaterials - 1) / kMaxBlockMaterials);
+  std::vector<float> material_data(window_count * kMaxBlockMaterials * kMaterialBlockSize / sizeof(float), 0.0f);
+  for (size_t i = 0; i < qMax<size_t>(1, materials.size()); i++) {
+    const Material material = (i < materials.size()) ? materials[i] : Material();
+    float* data = &material_data[i * kMaterialBlockSize / sizeof(float)];
+    for (int k = 0; k < 4; k++) {
+      data[k] = material.ambient[k];
+      data[4 + k] = material.diffuse[k];
+      data[8 + k] = material.specular[k];
+    }
+  }
+
+  glGenBuffers(1, &material_buffer_);
+  glBindBuffer(GL_UNIFORM_BUFFER, material_buffer_);
+  glBufferData(GL_UNIFORM_BUFFER, material_data.size() * sizeof(float), material_data.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  uploaded_bytes_ += vertex_size + index_size + material_data.size() * sizeof(float);
+
+  if (release_cpu_geometry) {
+    std::vector<unsigned char>().swap(scene_->vertex_data);
+    std::vector<unsigned char>().swap(scene_->index_data);
+    scene_->mapped_buffers = MappedBuffers();
+  }
+
+  if (scene_->streamer) {
+    allocatePagePool();
+  }
+}
+
+void SceneResources::allocatePagePool() {
+  const MeshStreamer& streamer = *scene_->streamer;
+  streamer.maxPageSize(&slot_vertex_bytes_, &slot_index_bytes_);
+  if (slot_vertex_bytes_ == 0 || slot_index_bytes_ == 0) {
+    return;
+  }
+
+  // QOpenGLBuffer sizes are ints, so the pool is also limited to 2 GB per buffer
+  const size_t max_buffer_size = static_cast<size_t>(std::numeric_limits<int>::max());
+  size_t slot_count = streamer.memoryBudget() / (slot_vertex_bytes_ + slot_index_bytes_);
+  slot_count = std::min({slot_count, streamer.pageCount(), max_buffer_size / slot_vertex_bytes_,
+                         max_buffer_size / slot_index_bytes_});
+  slot_count = std::max<size_t>(1, slot_count);
+
+  for (QOpenGLBuffer* buffer : {&page_vertex_buffer_, &page_index_buffer_}) {
+    size_t slot_bytes = (buffer == &page_vertex_buffer_) ? slot_vertex_bytes_ : slot_index_bytes_;
+    buffer->create();
+    buffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    buffer->bind();
+    buffer->allocate(static_cast<int>(slot_count * slot_bytes));
+    buffer->release();
+  }
+
+  page_slots_.assign(streamer.pageCount(), -1);
+  slot_pages_.assign(slot_count, kFreeSlot);
+  slot_uses_.assign(slot_count, 0);
+}
+
+void SceneResources::uploadPages(const std::vector<PageData>& pages) {
+  for (const PageData& data : pages) {
+    if (data.page >= page_slots_.size() || page_slots_[data.page] >= 0) {
+      continue;
+    }
+
+    // A free slot, or else the slot least recently needed, as long as the latest request does not need it
+    size_t slot = kFreeSlot;
+    uint64_t oldest_use = std::numeric_limits<uint64_t>::max();
+    for (size_t s = 0; s < slot_pages_.size(); s++) {
+      if (slot_pages_[s] == kFreeSlot) {
+        slot = s;
+        break;
+      }
+      if (slot_uses_[s] < page_requests_ && slot_uses_[s] < oldest_use) {
+        slot = s;
+        oldest_use = slot_uses_[s];
+      }
+    }
+    if (slot == kFreeSlot) {
+      continue;
+    }
+
+    if (slot_pages_[slot] != kFreeSlot) {
+      page_slots_[slot_pages_[slot]] = -1;
+    }
+    page_vertex_buffer_.bind();
+    page_vertex_buffer_.write(static_cast<int>(pageVertexOffset(slot)), data.vertex_data.data(),
+                              static_cast<int>(data.vertex_data.size()));
+    page_vertex_buffer_.release();
+    page_index_buffer_.bind();
+    page_index_buffer_.write(static_cast<int>(pageIndexOffset(slot)), data.index_data.data(),
+                             static_cast<int>(data.index_data.size()));
+    page_index_buffer_.release();
+
+    slot_pages_[slot] = data.page;
+    slot_uses_[slot] = page_requests_;
+    page_slots_[data.page] = static_cast<int>(slot);
+    uploaded_bytes_ += data.vertex_data.size() + data.index_data.size();
+  }
+}
+
+void SceneResources::loadTextures(const bool async_textures) {
+  // Textures requested with the previous compression are not decoded
+  if (!requested_textures_.empty()) {
+    texture_manager_->cancel();
+  }
+  deleteTextureArrays();
+  texture_layers_.clear();
+  material_textures_.clear();
+  loading_images_.clear();
+  requested_textures_.clear();
+  textures_loaded_ = true;
+  texture_compression_ = texture_manager_->compression();
+
+  // Textures decoded for a previous scene are still in the memory cache of the texture manager, so they are ready at
+  // once; the others are drawn once they are decoded
+  std::vector<TextureManager::Result> results;
+  for (const Material& material : scene_->materials) {
+    QString path = material.texture_filename.isEmpty() ? QString() : texturePath(material.texture_filename);
+    if (path.isEmpty() || !requested_textures_.insert(path).second) {
+      continue;
+    }
+    if (async_textures) {
+      texture_manager_->request(path);
+    } else {
+      results.emplace_back(path, texture_manager_->load(path));
+    }
+  }
+
+  if (!async_textures) {
+    requested_textures_.clear();
+    addTextures(results);
+  }
+  updateMaterialTextures();
+}
+
+void SceneResources::addTextures(const std::vector<TextureManager::Result>& results) {
+  std::vector<TextureManager::Result> added;
+  for (const TextureManager::Result& result : results) {
+    requested_textures_.erase(result.first);
+    if (!result.second) {
+      qWarning() << "Texture import failed:" << result.first;
+    } else if (texture_layers_.count(result.first) == 0) {
+      added.push_back(result);
+      loading_images_[result.first] = result.second;
+    }
+  }
+
+  for (size_t i = 0; i < added.size(); i++) {
+    const TextureImage& image = *added[i].second;
+
+    // Arrays grow geometrically, and make room at once for the textures of the batch with the same layout, so the
+    // layers already uploaded are uploaded again only a few times
+    auto same_layout = [&image](const TextureManager::Result& other) { return sameLayout(*other.second, image); };
+    int remaining = static_cast<int>(std::count_if(added.begin() + i, added.end(), same_layout));
+
+    TextureArray* array = NULL;
+    for (TextureArray& candidate : texture_arrays_) {
+      if (candidate.format == image.format && candidate.width == image.levels.front().width &&
+          candidate.height == image.levels.front().height && candidate.levels == image.levels.size() &&
+          static_cast<int>(candidate.paths.size()) < max_array_layers_) {
+        array = &candidate;
+        break;
+      }
+    }
+    if (!array) {
+      texture_arrays_.emplace_back();
+      array = &texture_arrays_.back();
+      array->format = image.format;
+      array->width = image.levels.front().width;
+      array->height = image.levels.front().height;
+      array->levels = image.levels.size();
+    }
+    if (static_cast<int>(array->paths.size()) == array->capacity) {
+      int used = static_cast<int>(array->paths.size());
+      allocateTextureArray(array, std::min(max_array_layers_, std::max(2 * used, used + remaining)));
+    }
+
+    TextureLayer layer;
+    layer.array = static_cast<int>(array - texture_arrays_.data());
+    layer.layer = static_cast<int>(array->paths.size());
+    array->paths.push_back(added[i].first);
+    texture_layers_[added[i].first] = layer;
+    uploadTextureLayer(array, layer.layer, image);
+  }
+
+  // Once every requested texture is uploaded, arrays are shrunk to their used layers and the images are released
+  if (requested_textures_.empty()) {
+    for (TextureArray& array : texture_arrays_) {
+      if (array.capacity > static_cast<int>(array.paths.size())) {
+        allocateTextureArray(&array, static_cast<int>(array.paths.size()));
+      }
+    }
+    loading_images_.clear();
+  }
+
+  for (TextureArray& array : texture_arrays_) {
+    if (array.mipmaps_dirty) {
+      glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+      array.mipmaps_dirty = false;
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  updateMaterialTextures();
+}
+
+void SceneResources::deleteTextureArrays() {
+  for (const TextureArray& array : texture_arrays_) {
+    if (array.texture) {
+      glDeleteTextures(1, &array.texture);
+    }
+  }
+  texture_arrays_.clear();
+}
+
+void SceneResources::allocateTextureArray(TextureArray* array, const int capacity) {
+  if (array->texture) {
+    glDeleteTextures(1, &array->texture);
+  }
+  glGenTextures(1, &array->texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+
+  // Mipmaps of RGBA8 arrays are generated on the GPU once the layers of a batch are uploaded, down to 1x1
+  int levels = static_cast<int>(array->levels);
+  if (array->format == TextureFormat::kRgba8) {
+    levels = 1;
+    while ((std::max(array->width, array->height) >> levels) > 0) {
+      levels++;
+    }
+  }
+
+  for (int level = 0; level < levels; level++) {
+    const int width = std::max(1, array->width >> level);
+    const int height = std::max(1, array->height >> level);
+    if (array->format == TextureFormat::kRgba8) {
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, width, height, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    } else {
+      const bool bc1 = (array->format == TextureFormat::kBc1);
+      const GLsizei size = ((width + 3) / 4) * ((height + 3) / 4) * (bc1 ? 8 : 16) * capacity;
+      glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, bc1 ? kCompressedRgbDxt1 : kCompressedRgbaDxt5, width, height,
+                             capacity, 0, size, NULL);
+    }
+  }
+
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  array->capacity = capacity;
+
+  // The layers of the previous storage are uploaded again from the decoded textures
+  for (size_t layer = 0; layer < array->paths.size(); layer++) {
+    auto loading = loading_images_.find(array->paths[layer]);
+    std::shared_ptr<const TextureImage> image =
+        (loading != loading_images_.end()) ? loading->second : texture_manager_->load(array->paths[layer]);
+    if (image) {
+      uploadTextureLayer(array, static_cast<int>(layer), *image);
+    }
+  }
+}
+
+void SceneResources::uploadTextureLayer(TextureArray* array, const int layer, const TextureImage& image) {
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+  if (image.format == TextureFormat::kRgba8) {
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, array->width, array->height, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                    image.data.data());
+    array->mipmaps_dirty = true;
+  } else {
+    const GLenum format = (image.format == TextureFormat::kBc1) ? kCompressedRgbDxt1 : kCompressedRgbaDxt5;
+    for (size_t i = 0; i < image.levels.size(); i++) {
+      const TextureLevel& level = image.levels[i];
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(i), 0, 0, layer, level.width, level.height, 1,
+                                format, static_cast<GLsizei>(level.size), &image.data[level.offset]);
+    }
+  }
+  uploaded_bytes_ += image.data.size();
+}
+
+void SceneResources::updateMaterialTextures() {
+  material_textures_.assign(scene_->materials.size(), TextureLayer());
+  for (size_t i = 0; i < material_textures_.size(); i++) {
+    const QString& filename = scene_->materials[i].texture_filename;
+    auto layer = filename.isEmpty() ? texture_layers_.end() : texture_layers_.find(texturePath(filename));
+    if (layer != texture_layers_.end()) {
+      material_textures_[i] = layer->second;
+    }
+  }
+}
+
+QString SceneResources::texturePath(const QString& filename) const {
+  return QFileInfo(scene_->filename).absolutePath() + QString(QDir::separator()) + filename;
+}
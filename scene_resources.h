@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef SCENE_RESOURCES_H_
+#define SCENE_RESOURCES_H_
+
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "mesh_streamer.h"
+#include "scene_loader.h"
+#include "texture_manager.h"
+
+/**
+ * @brief GPU resources of a scene that do not depend on the view: the vertex, index and material buffers, the texture
+ * arrays and, for streamed scenes, the page pool. Renderers whose contexts share their objects
+ * (Qt::AA_ShareOpenGLContexts) get the same resources for the same scene from acquire, so a scene shown in several
+ * viewports is uploaded once. The resources are released with the last renderer that references them. They are
+ * created, updated and destroyed with a context of their share group current.
+ */
+class SceneResources : protected QOpenGLExtraFunctions {
+ public:
+  /**
+   * @brief Layer of a texture array that holds a texture of the scene.
+   */
+  struct TextureLayer {
+    int array = -1; /**< Index of the texture array, -1 for no texture */
+    int layer = -1; /**< Layer in the texture array, -1 for no texture */
+  };
+
+  static const size_t kMaxBlockMaterials = 256; /**< Number of materials in the Materials uniform block of phong.frag */
+  static const GLuint kMaterialsBinding = 0;    /**< Uniform buffer binding point of the Materials block */
+
+  /**
+   * Gets the resources of a scene in the share group of the current context, creating them if no renderer of the group
+   * references them.
+   *
+   * @param scene: loaded scene.
+   * @param texture_manager: decodes the textures of the scene, if the resources are created.
+   *
+   * @return Resources of the scene.
+   */
+  static std::shared_ptr<SceneResources> acquire(const std::shared_ptr<SceneData> &scene,
+                                                 const std::shared_ptr<TextureManager> &texture_manager);
+
+  /**
+   * Destructor of the class. Destroys the OpenGL objects, with a context of the share group current.
+   */
+  ~SceneResources();
+
+  /**
+   * Gets the scene of the resources.
+   *
+   * @return The scene.
+   */
+  const std::shared_ptr<SceneData> &scene() const;
+
+  /**
+   * Gets whether update would upload something: the buffers were not uploaded yet, the textures must be loaded, or
+   * decoded textures or full pages are ready.
+   *
+   * @return True if the resources must be updated.
+   */
+  bool needsUpdate() const;
+
+  /**
+   * Uploads the buffers on the first call, loads the textures again when the compression of the texture manager was
+   * changed, adds the textures decoded since the previous call, up to kMaxTextureUploadBytes, and uploads the full
+   * pages read since the previous call, up to kMaxPageUploadBytes.
+   *
+   * @param async_textures: True to decode textures on the thread pool of the texture manager.
+   * @param release_cpu_geometry: True to free the CPU copy of the geometry once it is uploaded.
+   */
+  void update(const bool async_textures, const bool release_cpu_geometry);
+
+  /**
+   * Loads a texture into a layer of the texture array of its size and format, for the materials that reference it. The
+   * image is loaded by the texture manager on the calling thread.
+   *
+   * @param filename: path to the texture file to be loaded, relative to the mesh file.
+   *
+   * @return True if the texture was loaded successfully.
+   */
+  bool loadTexture(const QString &filename);
+
+  /**
+   * Gets the size of the data uploaded since the previous call.
+   *
+   * @return Size in bytes uploaded to buffers and textures.
+   */
+  size_t takeUploadedBytes();
+
+  /**
+   * Gets the GPU buffer with the interleaved vertices.
+   *
+   * @return The vertex buffer, not created until the first update.
+   */
+  QOpenGLBuffer &vertexBuffer();
+
+  /**
+   * Gets the GPU buffer with the indices.
+   *
+   * @return The index buffer, not created for de-indexed geometry.
+   */
+  QOpenGLBuffer &indexBuffer();
+
+  /**
+   * Binds a window of kMaxBlockMaterials materials to the Materials uniform block.
+   *
+   * @param window: index of the window, the material index divided by kMaxBlockMaterials.
+   */
+  void bindMaterialWindow(const size_t window);
+
+  /**
+   * Validates the texture of a mesh: texture file must be valid (and correctly loaded) and the mesh must contain
+   * texture coordinates.
+   *
+   * @param range: mesh range to be drawn.
+   *
+   * @return The texture layer of the mesh, with negative indices if it has no valid texture.
+   */
+  TextureLayer meshTexture(const MeshRange &range) const;
+
+  /**
+   * Gets a texture array.
+   *
+   * @param array: index of the array, from a TextureLayer.
+   *
+   * @return Name of the GL_TEXTURE_2D_ARRAY texture.
+   */
+  GLuint textureArray(const int array) const;
+
+  /**
+   * Marks the full pages of a streamed scene needed by a renderer, so they are not evicted, and requests those that are
+   * not resident from the streamer. Pages beyond the number of slots of the page pool stay coarse.
+   *
+   * @param pages: mesh ranges whose full page is needed, from the highest priority to the lowest.
+   */
+  void requestPages(const std::vector<size_t> &pages);
+
+  /**
+   * Gets whether pages of the last request are still not resident while the streamer is idle, because they were
+   * dropped for a lack of free slots or failed to be read, so they must be requested again.
+   *
+   * @return True if requestPages should be called again.
+   */
+  bool pagesMissing() const;
+
+  /**
+   * Gets the number of slots of the page pool, each one holding the full page of a mesh range of a streamed scene.
+   *
+   * @return Number of slots, zero for scenes in memory or before the first update.
+   */
+  size_t pageSlotCount() const;
+
+  /**
+   * Gets the slot of the page pool that holds the full page of a mesh range.
+   *
+   * @param range: index of the mesh range.
+   *
+   * @return Slot of the page, or -1 if its full page is not resident.
+   */
+  int pageSlot(const size_t range) const;
+
+  /**
+   * Gets the offset of a slot in the page vertex buffer.
+   *
+   * @param slot: slot of the page pool.
+   *
+   * @return Offset in bytes of the first vertex of the slot.
+   */
+  size_t pageVertexOffset(const size_t slot) const;
+
+  /**
+   * Gets the offset of a slot in the page index buffer.
+   *
+   * @param slot: slot of the page pool.
+   *
+   * @return Offset in bytes of the first index of the slot.
+   */
+  size_t pageIndexOffset(const size_t slot) const;
+
+  /**
+   * Gets the GPU buffer with the vertices of the resident full pages.
+   *
+   * @return The page vertex buffer, not created for scenes in memory.
+   */
+  QOpenGLBuffer &pageVertexBuffer();
+
+  /**
+   * Gets the GPU buffer with the 32-bit indices of the resident full pages, relative to the first vertex of their slot.
+   *
+   * @return The page index buffer, not created for scenes in memory.
+   */
+  QOpenGLBuffer &pageIndexBuffer();
+
+ private:
+  /**
+   * @brief GL_TEXTURE_2D_ARRAY holding the textures of the scene that have the same format, size and mipmap levels.
+   */
+  struct TextureArray {
+    GLuint texture = 0;                           /**< Array texture, with capacity layers */
+    TextureFormat format = TextureFormat::kRgba8; /**< Pixel format of the layers */
+    int width = 0;                                /**< Width in pixels of the layers */
+    int height = 0;                               /**< Height in pixels of the layers */
+    size_t levels = 0;                            /**< Number of decoded mipmap levels of each layer */
+    int capacity = 0;                             /**< Number of allocated layers */
+    std::vector<QString> paths;                   /**< Path to the texture file of each used layer */
+    bool mipmaps_dirty = false;                   /**< True if the mipmaps must be generated on the GPU */
+  };
+
+  /**
+   * Class constructor, called by acquire with a context current.
+   *
+   * @param scene: loaded scene.
+   * @param texture_manager: decodes the textures of the scene.
+   */
+  SceneResources(const std::shared_ptr<SceneData> &scene, const std::shared_ptr<TextureManager> &texture_manager);
+
+  /**
+   * Creates the vertex, index and material buffers from the scene.
+   *
+   * @param release_cpu_geometry: True to free the CPU copy of the geometry once it is uploaded.
+   */
+  void uploadBuffers(const bool release_cpu_geometry);
+
+  /**
+   * Allocates the page pool of a streamed scene: as many slots of the size of the largest page as fit in the memory
+   * budget of the streamer.
+   */
+  void allocatePagePool();
+
+  /**
+   * Uploads full pages into free slots of the page pool, or else into the slots least recently needed. Pages for which
+   * every slot is needed by the latest request are dropped, and requested again once they fit.
+   *
+   * @param pages: full pages read by the streamer.
+   */
+  void uploadPages(const std::vector<PageData> &pages);
+
+  /**
+   * Requests the textures of all materials from the texture manager, or loads them when textures are not loaded
+   * asynchronously.
+   *
+   * @param async_textures: True to decode textures on the thread pool of the texture manager.
+   */
+  void loadTextures(const bool async_textures);
+
+  /**
+   * Uploads decoded textures into free layers of the texture arrays of their layout. Arrays without free layers are
+   * reallocated with twice their capacity, up to GL_MAX_ARRAY_TEXTURE_LAYERS, and a new array is created past it. Once
+   * no requested texture is missing, arrays are shrunk to their used layers.
+   *
+   * @param results: decoded textures, NULL for the files that could not be decoded.
+   */
+  void addTextures(const std::vector<TextureManager::Result> &results);
+
+  /**
+   * Deletes the texture arrays. They are plain OpenGL names rather than QOpenGLTexture objects, which keep using the
+   * functions of the context that created them, so they may be deleted from any context of the share group.
+   */
+  void deleteTextureArrays();
+
+  /**
+   * Allocates the storage of a texture array and uploads its used layers again.
+   *
+   * @param array: texture array.
+   * @param capacity: number of layers, at least the number of used layers.
+   */
+  void allocateTextureArray(TextureArray *array, const int capacity);
+
+  /**
+   * Uploads a decoded texture into a layer of a texture array.
+   *
+   * @param array: texture array with the layout of the texture.
+   * @param layer: layer of the array.
+   * @param image: decoded texture.
+   */
+  void uploadTextureLayer(TextureArray *array, const int layer, const TextureImage &image);
+
+  /**
+   * Updates the texture layer of each material from the uploaded textures.
+   */
+  void updateMaterialTextures();
+
+  /**
+   * Gets the path of a texture file of the scene.
+   *
+   * @param filename: path to the texture file, relative to the mesh file.
+   *
+   * @return Path to the texture file.
+   */
+  QString texturePath(const QString &filename) const;
+
+  /**
+   * Resources of the scenes, by share group and scene, while a renderer references them.
+   */
+  static std::map<std::pair<QOpenGLContextGroup *, const SceneData *>, std::weak_ptr<SceneResources>> registry_;
+
+  std::shared_ptr<SceneData> scene_;                /**< Scene of the resources */
+  std::shared_ptr<TextureManager> texture_manager_; /**< Decodes and caches the textures of the scene */
+
+  QOpenGLBuffer vertex_buffer_;                                            /**< GPU buffer: interleaved vertices */
+  QOpenGLBuffer index_buffer_ = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer); /**< GPU buffer: indices */
+  GLuint material_buffer_ = 0; /**< Uniform buffer with the materials, in windows of kMaxBlockMaterials */
+
+  std::vector<TextureArray> texture_arrays_;                              /**< Texture arrays of the scene */
+  std::map<QString, TextureLayer> texture_layers_;                        /**< Layer of each texture, by its path */
+  std::vector<TextureLayer> material_textures_;                           /**< Texture layer of each material */
+  std::map<QString, std::shared_ptr<const TextureImage>> loading_images_; /**< Layers kept until arrays are final */
+  std::set<QString> requested_textures_;                                  /**< Requested textures not added yet */
+
+  QOpenGLBuffer page_vertex_buffer_;                                            /**< GPU buffer: full page vertices */
+  QOpenGLBuffer page_index_buffer_ = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer); /**< GPU buffer: full page indices */
+  size_t slot_vertex_bytes_ = 0;      /**< Size in bytes of the vertices of a slot of the page pool */
+  size_t slot_index_bytes_ = 0;       /**< Size in bytes of the indices of a slot of the page pool */
+  std::vector<int> page_slots_;       /**< Slot of the full page of each mesh range, -1 if it is not resident */
+  std::vector<size_t> slot_pages_;    /**< Mesh range whose full page is in each slot, SIZE_MAX for free slots */
+  std::vector<uint64_t> slot_uses_;   /**< Latest request that needed the page of each slot */
+  std::vector<size_t> missing_pages_; /**< Pages of the last request that were not resident */
+  uint64_t page_requests_ = 0;        /**< Number of calls of requestPages */
+
+  bool buffers_uploaded_ = false;    /**< True once the buffers were created */
+  bool textures_loaded_ = false;     /**< True once the textures were requested or loaded */
+  bool texture_compression_ = false; /**< Compression of the texture manager when the textures were loaded */
+  int max_array_layers_ = 256;       /**< Maximum number of layers of a texture array */
+  size_t uploaded_bytes_ = 0;        /**< Bytes uploaded since the last takeUploadedBytes */
+};
+
+#endif  // SCENE_RESOURCES_H_
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "block_compressor.h"
+
+namespace {
+
+/**
+ * Expands a 5:6:5 color to 8 bits per channel.
+ *
+ * @param packed: 16-bit color.
+ * @param color: receives red, green and blue.
+ */
+void unpackColor(const int packed, int *color) {
+  const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * Decodes a 4x4 block as the GPU does.
+ *
+ * @param format: block format.
+ * @param block: 8 (BC1) or 16 (BC3) bytes.
+ * @param pixels: receives 16 RGBA pixels, in rows.
+ */
+void decodeBlock(const BlockFormat format, const unsigned char *block, unsigned char pixels[16][4]) {
+  int alpha[8] = {255, 255, 255, 255, 255, 255, 255, 255};
+  uint64_t alpha_indices = 0;
+  if (format == BlockFormat::kBc3) {
+    alpha[0] = block[0];
+    alpha[1] = block[1];
+    for (int k = 1; k < 7; k++) {
+      alpha[k + 1] = (alpha[0] > alpha[1]) ? ((7 - k) * alpha[0] + k * alpha[1]) / 7
+                                           : (k < 5 ? ((5 - k) * alpha[0] + k * alpha[1]) / 5 : (k == 5 ? 0 : 255));
+    }
+    for (int k = 0; k < 6; k++) {
+      alpha_indices |= static_cast<uint64_t>(block[2 + k]) << (8 * k);
+    }
+    block += 8;
+  }
+
+  const int color0 = block[0] | (block[1] << 8), color1 = block[2] | (block[3] << 8);
+  int palette[4][4];
+  unpackColor(color0, palette[0]);
+  unpackColor(color1, palette[1]);
+  // BC1 blocks with color0 <= color1 have three colors and transparent black, BC3 blocks always have four colors
+  const bool four_colors = color0 > color1 || format == BlockFormat::kBc3;
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = four_colors ? (2 * palette[0][c] + palette[1][c]) / 3 : (palette[0][c] + palette[1][c]) / 2;
+    palette[3][c] = four_colors ? (palette[0][c] + 2 * palette[1][c]) / 3 : 0;
+  }
+  palette[0][3] = palette[1][3] = palette[2][3] = 255;
+  palette[3][3] = four_colors ? 255 : 0;
+
+  const uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+  for (int i = 0; i < 16; i++) {
+    const int *color = palette[(indices >> (2 * i)) & 3];
+    for (int c = 0; c < 3; c++) {
+      pixels[i][c] = static_cast<unsigned char>(color[c]);
+    }
+    pixels[i][3] = static_cast<unsigned char>(format == BlockFormat::kBc3 ? alpha[(alpha_indices >> (3 * i)) & 7]
+                                                                          : color[3]);
+  }
+}
+
+/**
+ * Compresses a 4x4 block, decodes it and measures the largest error.
+ *
+ * @param format: block format.
+ * @param pixels: 16 RGBA pixels, in rows.
+ * @param channel_errors: receives the largest error of red, green, blue and alpha.
+ */
+void roundTrip(const BlockFormat format, const unsigned char pixels[16][4], int *channel_errors) {
+  unsigned char block[16];
+  BlockCompressor::compress(format, &pixels[0][0], 4, 4, block);
+  unsigned char decoded[16][4];
+  decodeBlock(format, block, decoded);
+
+  std::fill(channel_errors, channel_errors + 4, 0);
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 4; c++) {
+      channel_errors[c] = std::max(channel_errors[c], std::abs(pixels[i][c] - decoded[i][c]));
+    }
+  }
+}
+
+/**
+ * Gets the largest error of the color channels.
+ *
+ * @param channel_errors: errors of red, green, blue and alpha.
+ *
+ * @return The largest error of red, green and blue.
+ */
+int colorError(const int *channel_errors) {
+  return std::max(channel_errors[0], std::max(channel_errors[1], channel_errors[2]));
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of BlockCompressor. Blocks are decoded as the GPU decodes them and compared to the source pixels.
+ */
+class TestBlockCompressor : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * Partial blocks at the borders take a whole block.
+   */
+  void compressedSize() {
+    QCOMPARE(BlockCompressor::compressedSize(BlockFormat::kBc1, 4, 4), size_t(8));
+    QCOMPARE(BlockCompressor::compressedSize(BlockFormat::kBc3, 4, 4), size_t(16));
+    QCOMPARE(BlockCompressor::compressedSize(BlockFormat::kBc1, 5, 3), size_t(16));
+    QCOMPARE(BlockCompressor::compressedSize(BlockFormat::kBc3, 1, 9), size_t(48));
+  }
+
+  /**
+   * A solid block only loses the precision of the 5:6:5 endpoints.
+   */
+  void solid() {
+    unsigned char pixels[16][4];
+    for (int i = 0; i < 16; i++) {
+      pixels[i][0] = 200;
+      pixels[i][1] = 100;
+      pixels[i][2] = 50;
+      pixels[i][3] = 255;
+    }
+    int errors[4];
+    roundTrip(BlockFormat::kBc1, pixels, errors);
+    QVERIFY(errors[0] <= 4 && errors[1] <= 2 && errors[2] <= 4);
+    QCOMPARE(errors[3], 0);
+  }
+
+  /**
+   * A grey ramp fits the four colors of a block along the grey axis. Even the best four colors are 34 steps away from
+   * some of its sixteen values.
+   */
+  void greyRamp() {
+    unsigned char pixels[16][4];
+    for (int i = 0; i < 16; i++) {
+      pixels[i][0] = pixels[i][1] = pixels[i][2] = static_cast<unsigned char>(i * 17);
+      pixels[i][3] = 255;
+    }
+    int errors[4];
+    roundTrip(BlockFormat::kBc1, pixels, errors);
+    QVERIFY(colorError(errors) <= 40);
+  }
+
+  /**
+   * A checker of two colors whose covariance maps the grey axis to zero is still encoded along the red/green axis,
+   * instead of as the solid brown mean of the block.
+   */
+  void redGreenChecker() {
+    unsigned char pixels[16][4];
+    for (int i = 0; i < 16; i++) {
+      const bool red = (i % 4 + i / 4) % 2 == 0;
+      pixels[i][0] = red ? 255 : 0;
+      pixels[i][1] = red ? 0 : 255;
+      pixels[i][2] = 0;
+      pixels[i][3] = 255;
+    }
+    unsigned char block[8];
+    BlockCompressor::compress(BlockFormat::kBc1, &pixels[0][0], 4, 4, block);
+    QVERIFY((block[0] | (block[1] << 8)) != (block[2] | (block[3] << 8)));
+
+    int errors[4];
+    roundTrip(BlockFormat::kBc1, pixels, errors);
+    QVERIFY(colorError(errors) <= 24);
+    QCOMPARE(errors[3], 0);
+  }
+
+  /**
+   * An alpha ramp fits the eight alpha values of a BC3 block, and its colors are kept.
+   */
+  void alphaRamp() {
+    unsigned char pixels[16][4];
+    for (int i = 0; i < 16; i++) {
+      pixels[i][0] = 40;
+      pixels[i][1] = 160;
+      pixels[i][2] = 240;
+      pixels[i][3] = static_cast<unsigned char>(i * 17);
+    }
+    int errors[4];
+    roundTrip(BlockFormat::kBc3, pixels, errors);
+    QVERIFY(colorError(errors) <= 4);
+    QVERIFY(errors[3] <= 19);
+  }
+
+  /**
+   * Blocks are written in rows, and partial blocks repeat the last row and column of the image.
+   */
+  void blockLayout() {
+    const int width = 6, height = 5;
+    std::vector<unsigned char> rgba(width * height * 4);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        unsigned char *pixel = &rgba[(y * width + x) * 4];
+        pixel[0] = x < 4 ? 255 : 0;
+        pixel[1] = y < 4 ? 255 : 0;
+        pixel[2] = 0;
+        pixel[3] = 255;
+      }
+    }
+    std::vector<unsigned char> blocks(BlockCompressor::compressedSize(BlockFormat::kBc1, width, height));
+    BlockCompressor::compress(BlockFormat::kBc1, rgba.data(), width, height, blocks.data());
+    QCOMPARE(blocks.size(), size_t(32));
+
+    const unsigned char expected[4][3] = {{255, 255, 0}, {0, 255, 0}, {255, 0, 0}, {0, 0, 0}};
+    for (int b = 0; b < 4; b++) {
+      unsigned char decoded[16][4];
+      decodeBlock(BlockFormat::kBc1, &blocks[b * 8], decoded);
+      for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+          QCOMPARE(decoded[i][c], expected[b][c]);
+        }
+      }
+    }
+  }
+};
+
+QTEST_APPLESS_MAIN(TestBlockCompressor)
+
+#include "test_block_compressor.moc"
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bounding_box.h"
+
+namespace {
+
+/**
+ * Generates packed positions at random, with a different seed for each count.
+ *
+ * @param count: number of positions.
+ *
+ * @return The packed positions (x, y, z, x, y, z, ...).
+ */
+std::vector<float> randomPositions(const size_t count) {
+  std::mt19937 generator(static_cast<unsigned>(count));
+  std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+  std::vector<float> positions(count * 3);
+  for (float &coordinate : positions) {
+    coordinate = distribution(generator);
+  }
+  return positions;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of extendBoundingBox.
+ */
+class TestBoundingBox : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * The SSE path, which reduces the lanes of three registers into the axes at the end, gives the box of the scalar
+   * path, for counts that leave 1 to 3 positions to the scalar tail.
+   */
+  void matchesScalar() {
+    for (const size_t count : {1, 3, 4, 5, 7, 8, 13, 100}) {
+      const std::vector<float> positions = randomPositions(count);
+      float min[3] = {1.0f, 2.0f, 3.0f}, max[3] = {1.0f, 2.0f, 3.0f};
+      extendBoundingBox(positions.data(), count, min, max);
+
+      float expected_min[3] = {1.0f, 2.0f, 3.0f}, expected_max[3] = {1.0f, 2.0f, 3.0f};
+      for (size_t i = 0; i < positions.size(); i++) {
+        expected_min[i % 3] = std::min(expected_min[i % 3], positions[i]);
+        expected_max[i % 3] = std::max(expected_max[i % 3], positions[i]);
+      }
+      for (int axis = 0; axis < 3; axis++) {
+        QCOMPARE(min[axis], expected_min[axis]);
+        QCOMPARE(max[axis], expected_max[axis]);
+      }
+    }
+  }
+
+  /**
+   * An extreme in any lane of the registers, or in the scalar tail, reaches the axis it belongs to.
+   */
+  void extremeInEachLane() {
+    const size_t count = 7;
+    for (size_t i = 0; i < count * 3; i++) {
+      std::vector<float> positions(count * 3, 0.0f);
+      positions[i] = 5.0f + i;
+      float min[3] = {0.0f, 0.0f, 0.0f}, max[3] = {0.0f, 0.0f, 0.0f};
+      extendBoundingBox(positions.data(), count, min, max);
+      for (int axis = 0; axis < 3; axis++) {
+        QCOMPARE(min[axis], 0.0f);
+        QCOMPARE(max[axis], axis == static_cast<int>(i % 3) ? 5.0f + i : 0.0f);
+      }
+
+      positions[i] = -5.0f - i;
+      extendBoundingBox(positions.data(), count, min, max);
+      QCOMPARE(min[i % 3], -5.0f - i);
+    }
+  }
+
+  /**
+   * No positions leave the box unchanged.
+   */
+  void empty() {
+    float min[3] = {1.0f, 2.0f, 3.0f}, max[3] = {4.0f, 5.0f, 6.0f};
+    extendBoundingBox(NULL, 0, min, max);
+    QCOMPARE(std::vector<float>(min, min + 3), std::vector<float>({1.0f, 2.0f, 3.0f}));
+    QCOMPARE(std::vector<float>(max, max + 3), std::vector<float>({4.0f, 5.0f, 6.0f}));
+  }
+};
+
+QTEST_APPLESS_MAIN(TestBoundingBox)
+
+#include "test_bounding_box.moc"
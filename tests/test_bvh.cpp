@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bvh.h"
+
+namespace {
+
+/** Number of random boxes of the tests */
+const size_t kBoxCount = 5000;
+
+/**
+ * Generates unit boxes at random positions of a cube.
+ *
+ * @param count: number of boxes.
+ * @param extent: half of the edge of the cube.
+ *
+ * @return The boxes.
+ */
+std::vector<BoundingBox> randomBoxes(const size_t count, const float extent) {
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> distribution(-extent, extent);
+  std::vector<BoundingBox> boxes(count);
+  for (BoundingBox &box : boxes) {
+    for (int k = 0; k < 3; k++) {
+      box[k] = distribution(generator);
+      box[3 + k] = box[k] + 1.0f;
+    }
+  }
+  return boxes;
+}
+
+/**
+ * Builds the planes of an axis-aligned box, as the planes of an orthographic frustum.
+ *
+ * @param min: minimum coordinate of the box along every axis.
+ * @param max: maximum coordinate of the box along every axis.
+ *
+ * @return Planes of the box, facing inwards.
+ */
+FrustumPlanes boxPlanes(const float min, const float max) {
+  return {{{1.0f, 0.0f, 0.0f, -min},
+           {-1.0f, 0.0f, 0.0f, max},
+           {0.0f, 1.0f, 0.0f, -min},
+           {0.0f, -1.0f, 0.0f, max},
+           {0.0f, 0.0f, 1.0f, -min},
+           {0.0f, 0.0f, -1.0f, max}}};
+}
+
+/**
+ * Checks whether a box contains another one.
+ *
+ * @param outer: containing box.
+ * @param inner: contained box.
+ *
+ * @return True if inner is inside outer.
+ */
+bool contains(const BoundingBox &outer, const BoundingBox &inner) {
+  for (int k = 0; k < 3; k++) {
+    if (inner[k] < outer[k] || inner[3 + k] > outer[3 + k]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of Bvh and frustumPlanes.
+ */
+class TestBvh : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * A hierarchy without primitives finds nothing.
+   */
+  void empty() {
+    Bvh bvh;
+    bvh.build(std::vector<BoundingBox>());
+    QVERIFY(bvh.empty());
+
+    std::vector<uint32_t> visible = {1};
+    bvh.cullFrustum(boxPlanes(-1.0f, 1.0f), &visible);
+    QVERIFY(visible.empty());
+  }
+
+  /**
+   * Each node bounds its children, leaves hold at most kMaxLeafSize primitives, and the leaves hold every primitive.
+   */
+  void structure() {
+    const std::vector<BoundingBox> boxes = randomBoxes(kBoxCount, 100.0f);
+    Bvh bvh;
+    bvh.build(boxes);
+    QVERIFY(!bvh.empty());
+
+    const std::vector<BvhNode> &nodes = bvh.nodes();
+    size_t primitives = 0;
+    for (const BvhNode &node : nodes) {
+      if (node.count > 0) {
+        QVERIFY(node.count <= Bvh::kMaxLeafSize);
+        primitives += node.count;
+      } else {
+        QVERIFY(node.first + 1 < nodes.size());
+        QVERIFY(contains(node.bounds, nodes[node.first].bounds));
+        QVERIFY(contains(node.bounds, nodes[node.first + 1].bounds));
+      }
+    }
+    QCOMPARE(primitives, kBoxCount);
+    for (const BoundingBox &box : boxes) {
+      QVERIFY(contains(nodes.front().bounds, box));
+    }
+  }
+
+  /**
+   * Against axis-aligned planes the culling is exact, so it finds the same boxes as testing each one.
+   */
+  void cullMatchesBruteForce() {
+    const std::vector<BoundingBox> boxes = randomBoxes(kBoxCount, 100.0f);
+    Bvh bvh;
+    bvh.build(boxes);
+
+    for (float size : {0.5f, 10.0f, 50.0f, 200.0f}) {
+      std::vector<uint32_t> visible;
+      bvh.cullFrustum(boxPlanes(-size, size), &visible);
+      std::sort(visible.begin(), visible.end());
+
+      std::vector<uint32_t> expected;
+      for (uint32_t i = 0; i < boxes.size(); i++) {
+        if (contains(BoundingBox{-size - 1.0f, -size - 1.0f, -size - 1.0f, size + 1.0f, size + 1.0f, size + 1.0f},
+                     boxes[i])) {
+          expected.push_back(i);
+        }
+      }
+      QCOMPARE(visible, expected);
+    }
+  }
+
+  /**
+   * Rebuilding replaces the previous primitives, and clear removes them.
+   */
+  void rebuildAndClear() {
+    Bvh bvh;
+    bvh.build(randomBoxes(kBoxCount, 100.0f));
+    bvh.build(std::vector<BoundingBox>(3, BoundingBox{0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f}));
+
+    std::vector<uint32_t> visible;
+    bvh.cullFrustum(boxPlanes(-200.0f, 200.0f), &visible);
+    std::sort(visible.begin(), visible.end());
+    QCOMPARE(visible, std::vector<uint32_t>({0, 1, 2}));
+
+    bvh.clear();
+    QVERIFY(bvh.empty());
+    bvh.cullFrustum(boxPlanes(-200.0f, 200.0f), &visible);
+    QVERIFY(visible.empty());
+  }
+
+  /**
+   * The planes of the identity matrix bound the clip cube [-1, 1], facing inwards.
+   */
+  void identityPlanes() {
+    const FrustumPlanes planes = frustumPlanes(QMatrix4x4());
+    const float inside[3] = {0.5f, -0.5f, 0.9f};
+    const float outside[3] = {0.0f, 1.5f, 0.0f};
+    bool outside_found = false;
+    for (const std::array<float, 4> &plane : planes) {
+      QVERIFY(plane[0] * inside[0] + plane[1] * inside[1] + plane[2] * inside[2] + plane[3] >= 0.0f);
+      outside_found |= (plane[0] * outside[0] + plane[1] * outside[1] + plane[2] * outside[2] + plane[3] < 0.0f);
+    }
+    QVERIFY(outside_found);
+  }
+};
+
+QTEST_APPLESS_MAIN(TestBvh)
+
+#include "test_bvh.moc"
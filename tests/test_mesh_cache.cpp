@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtTest>
+#include <cstring>
+
+#include "mesh_cache.h"
+
+namespace {
+
+/** Texture of the material of the test scene, searched for in the metadata of its entry */
+const char kTextureFilename[] = "texture.png";
+
+/**
+ * Builds a scene with a single quad, with a level of detail, an instance, a node and a textured material.
+ *
+ * @param filename: path to the mesh file of the scene.
+ *
+ * @return The scene.
+ */
+SceneData quadScene(const QString &filename) {
+  SceneData scene;
+  scene.filename = filename;
+  scene.has_normals = true;
+  scene.scene_min = QVector3D(-1, -1, 0);
+  scene.scene_max = QVector3D(1, 1, 0);
+
+  scene.vertex_data.resize(4 * scene.vertex_layout.stride);
+  for (size_t i = 0; i < scene.vertex_data.size(); i++) {
+    scene.vertex_data[i] = static_cast<unsigned char>(i * 7);
+  }
+  const GLushort indices[] = {0, 1, 2, 0, 2, 3, 0, 1, 2};
+  scene.index_data.resize(sizeof(indices));
+  std::memcpy(scene.index_data.data(), indices, sizeof(indices));
+
+  MeshRange range;
+  range.vertex_count = 4;
+  range.index_count = 6;
+  range.instance_count = 1;
+  range.bounds_min = scene.scene_min;
+  range.bounds_max = scene.scene_max;
+  MeshLod lod;
+  lod.index_offset = 6 * sizeof(GLushort);
+  lod.index_count = 3;
+  lod.error = 0.5f;
+  range.lods.push_back(lod);
+  scene.mesh_ranges.push_back(range);
+  scene.draw_order.push_back(0);
+
+  MeshInstance instance;
+  instance.transform.translate(1, 2, 3);
+  scene.instances.push_back(instance);
+
+  SceneNode node;
+  node.name = "root";
+  node.transform = instance.transform;
+  node.world_transform = instance.transform;
+  node.instances.push_back(0);
+  scene.nodes.push_back(node);
+
+  Material material;
+  material.texture_filename = kTextureFilename;
+  scene.materials.push_back(material);
+  return scene;
+}
+
+/**
+ * Replaces the first occurrence of some bytes of a file.
+ *
+ * @param filename: path to the file.
+ * @param before: bytes to be found.
+ * @param after: bytes written over them, of the same size.
+ *
+ * @return True if the bytes were found and replaced.
+ */
+bool replaceBytes(const QString &filename, const QByteArray &before, const QByteArray &after) {
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadWrite)) {
+    return false;
+  }
+  const int position = file.readAll().indexOf(before);
+  return position >= 0 && file.seek(position) && file.write(after) == after.size();
+}
+
+/**
+ * Encodes a string as QDataStream writes the characters of a QString, in UTF-16 big endian.
+ *
+ * @param text: ASCII string.
+ *
+ * @return The encoded characters, without the length of the string.
+ */
+QByteArray utf16(const QString &text) {
+  QByteArray bytes;
+  for (const QChar &c : text) {
+    bytes.append(static_cast<char>(c.unicode() >> 8));
+    bytes.append(static_cast<char>(c.unicode() & 0xFF));
+  }
+  return bytes;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of MeshCache. Entries are written to the test cache directory of QStandardPaths.
+ */
+class TestMeshCache : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * Moves the cache directory out of the cache of the user.
+   */
+  void initTestCase() {
+    QStandardPaths::setTestModeEnabled(true);
+    QVERIFY(source_dir_.isValid());
+  }
+
+  /**
+   * Removes the entries written by the tests.
+   */
+  void cleanupTestCase() {
+    QThreadPool::globalInstance()->waitForDone();
+    QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).removeRecursively();
+  }
+
+  /**
+   * A saved scene is loaded with the same metadata, and its VBO and IBO are read from the map of the entry.
+   */
+  void roundTrip() {
+    const QString filename = writeSource("round_trip.obj");
+    const SceneData scene = quadScene(filename);
+    QVERIFY(MeshCache::save(scene, SceneLoadOptions()));
+
+    SceneData loaded;
+    QVERIFY(MeshCache::load(filename, SceneLoadOptions(), &loaded));
+    QVERIFY(loaded.vertex_data.empty());
+    QVERIFY(loaded.mapped_buffers.mapping != NULL);
+    QCOMPARE(loaded.mapped_buffers.vertex_size, scene.vertex_data.size());
+    QCOMPARE(loaded.mapped_buffers.index_size, scene.index_data.size());
+    QVERIFY(std::memcmp(loaded.mapped_buffers.vertex_data, scene.vertex_data.data(), scene.vertex_data.size()) == 0);
+    QVERIFY(std::memcmp(loaded.mapped_buffers.index_data, scene.index_data.data(), scene.index_data.size()) == 0);
+
+    QCOMPARE(loaded.vertex_layout.stride, scene.vertex_layout.stride);
+    QCOMPARE(loaded.has_normals, true);
+    QCOMPARE(loaded.scene_min, scene.scene_min);
+    QCOMPARE(loaded.scene_max, scene.scene_max);
+    QCOMPARE(loaded.mesh_ranges.size(), size_t(1));
+    QCOMPARE(loaded.mesh_ranges[0].index_count, size_t(6));
+    QCOMPARE(loaded.mesh_ranges[0].bounds_max, scene.mesh_ranges[0].bounds_max);
+    QCOMPARE(loaded.mesh_ranges[0].lods.size(), size_t(1));
+    QCOMPARE(loaded.mesh_ranges[0].lods[0].index_offset, scene.mesh_ranges[0].lods[0].index_offset);
+    QCOMPARE(loaded.mesh_ranges[0].lods[0].error, 0.5f);
+    QCOMPARE(loaded.instances.size(), size_t(1));
+    QCOMPARE(loaded.instances[0].transform, scene.instances[0].transform);
+    QCOMPARE(loaded.nodes.size(), size_t(1));
+    QCOMPARE(loaded.nodes[0].name, QString("root"));
+    QCOMPARE(loaded.nodes[0].instances, std::vector<size_t>({0}));
+    QCOMPARE(loaded.draw_order, std::vector<size_t>({0}));
+    QCOMPARE(loaded.materials.size(), size_t(1));
+    QCOMPARE(loaded.materials[0].diffuse, scene.materials[0].diffuse);
+    QCOMPARE(loaded.materials[0].texture_filename, QString(kTextureFilename));
+
+    // The data of a valid entry passes its background check
+    loaded = SceneData();
+    QThreadPool::globalInstance()->waitForDone();
+    QVERIFY(QFile::exists(MeshCache::cacheFilename(filename, SceneLoadOptions())));
+  }
+
+  /**
+   * Entries are keyed by the options that change the geometry.
+   */
+  void options() {
+    const QString filename = writeSource("options.obj");
+    SceneLoadOptions options;
+    QVERIFY(MeshCache::save(quadScene(filename), options));
+
+    SceneLoadOptions other = options;
+    other.crease_angle = 30.0f;
+    QVERIFY(MeshCache::cacheFilename(filename, other) != MeshCache::cacheFilename(filename, options));
+    other = options;
+    other.import_profile = ImportProfile::kFast;
+    QVERIFY(MeshCache::cacheFilename(filename, other) != MeshCache::cacheFilename(filename, options));
+
+    SceneData loaded;
+    QVERIFY(!MeshCache::load(filename, other, &loaded));
+    QVERIFY(MeshCache::load(filename, options, &loaded));
+  }
+
+  /**
+   * An entry whose mesh file changed is removed.
+   */
+  void staleSource() {
+    const QString filename = writeSource("stale.obj");
+    QVERIFY(MeshCache::save(quadScene(filename), SceneLoadOptions()));
+    writeSource("stale.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nf 1 2 3\nf 2 4 3\n");
+
+    SceneData loaded;
+    QVERIFY(!MeshCache::load(filename, SceneLoadOptions(), &loaded));
+    QVERIFY(!QFile::exists(MeshCache::cacheFilename(filename, SceneLoadOptions())));
+  }
+
+  /**
+   * Entries with corrupt metadata, or cut short, are rejected and removed.
+   */
+  void corruptMetadata() {
+    const QString filename = writeSource("corrupt_metadata.obj");
+    const QString cache_filename = MeshCache::cacheFilename(filename, SceneLoadOptions());
+    QVERIFY(MeshCache::save(quadScene(filename), SceneLoadOptions()));
+
+    // A changed texture name still parses, so only the checksum catches it
+    QVERIFY(replaceBytes(cache_filename, utf16(kTextureFilename), utf16("tExture.png")));
+    SceneData loaded;
+    QVERIFY(!MeshCache::load(filename, SceneLoadOptions(), &loaded));
+    QVERIFY(!QFile::exists(cache_filename));
+
+    QVERIFY(MeshCache::save(quadScene(filename), SceneLoadOptions()));
+    QFile file(cache_filename);
+    QVERIFY(file.resize(file.size() - 1));
+    QVERIFY(!MeshCache::load(filename, SceneLoadOptions(), &loaded));
+    QVERIFY(!QFile::exists(cache_filename));
+  }
+
+  /**
+   * An entry with a corrupt IBO is rejected and removed before it is drawn, while an entry with a corrupt VBO is
+   * loaded, since its VBO is checked in the background, and then removed.
+   */
+  void corruptData() {
+    const QString filename = writeSource("corrupt_data.obj");
+    const QString cache_filename = MeshCache::cacheFilename(filename, SceneLoadOptions());
+    const SceneData scene = quadScene(filename);
+    QVERIFY(MeshCache::save(scene, SceneLoadOptions()));
+
+    // An index past the vertices of its range would make the draw read outside of the VBO
+    const QByteArray indices(reinterpret_cast<const char *>(scene.index_data.data()),
+                             static_cast<int>(scene.index_data.size()));
+    QByteArray changed = indices;
+    changed[0] = changed[1] = static_cast<char>(0xFF);
+    QVERIFY(replaceBytes(cache_filename, indices, changed));
+    SceneData loaded;
+    QVERIFY(!MeshCache::load(filename, SceneLoadOptions(), &loaded));
+    QVERIFY(loaded.mapped_buffers.mapping == NULL);
+    QVERIFY(!QFile::exists(cache_filename));
+
+    QVERIFY(MeshCache::save(scene, SceneLoadOptions()));
+    const QByteArray vertices(reinterpret_cast<const char *>(scene.vertex_data.data()),
+                              static_cast<int>(scene.vertex_data.size()));
+    changed = vertices;
+    changed[0] = static_cast<char>(changed[0] ^ 0xFF);
+    QVERIFY(replaceBytes(cache_filename, vertices, changed));
+    QVERIFY(MeshCache::load(filename, SceneLoadOptions(), &loaded));
+    loaded = SceneData();
+    QThreadPool::globalInstance()->waitForDone();
+    QVERIFY(!QFile::exists(cache_filename));
+  }
+
+ private:
+  /**
+   * Writes a mesh file into the temporary directory of the tests.
+   *
+   * @param name: name of the file.
+   * @param contents: contents of the file.
+   *
+   * @return Path to the file.
+   */
+  QString writeSource(const QString &name, const QByteArray &contents = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n") {
+    const QString filename = source_dir_.filePath(name);
+    QFile file(filename);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      file.write(contents);
+    }
+    return filename;
+  }
+
+  QTemporaryDir source_dir_; /**< Directory of the mesh files of the entries */
+};
+
+QTEST_GUILESS_MAIN(TestMeshCache)
+
+#include "test_mesh_cache.moc"
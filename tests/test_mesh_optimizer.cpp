@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+#include "mesh_optimizer.h"
+
+namespace {
+
+/** Number of vertices along each side of the test grid */
+const uint32_t kGridSize = 32;
+
+/**
+ * Builds a flat grid of quads, split in two triangles each, with its triangles in random order.
+ *
+ * @param positions: receives the positions (x, y, z) of the vertices.
+ * @param indices: receives the triangle indices.
+ */
+void shuffledGrid(std::vector<float> *positions, std::vector<uint32_t> *indices) {
+  positions->clear();
+  for (uint32_t i = 0; i < kGridSize; i++) {
+    for (uint32_t j = 0; j < kGridSize; j++) {
+      positions->insert(positions->end(), {static_cast<float>(i), static_cast<float>(j), 0.0f});
+    }
+  }
+
+  std::vector<std::array<uint32_t, 3>> triangles;
+  for (uint32_t i = 0; i + 1 < kGridSize; i++) {
+    for (uint32_t j = 0; j + 1 < kGridSize; j++) {
+      const uint32_t a = i * kGridSize + j, b = a + 1, c = a + kGridSize, d = c + 1;
+      triangles.push_back({a, c, d});
+      triangles.push_back({a, d, b});
+    }
+  }
+  std::shuffle(triangles.begin(), triangles.end(), std::mt19937(1));
+
+  indices->clear();
+  for (const std::array<uint32_t, 3> &triangle : triangles) {
+    indices->insert(indices->end(), triangle.begin(), triangle.end());
+  }
+}
+
+/**
+ * Gets the triangles of indices in a canonical order: each triangle is rotated to start at its smallest index, which
+ * keeps its winding, and the triangles are sorted.
+ *
+ * @param indices: triangle indices.
+ *
+ * @return The sorted triangles.
+ */
+std::vector<std::array<uint32_t, 3>> sortedTriangles(const std::vector<uint32_t> &indices) {
+  std::vector<std::array<uint32_t, 3>> triangles;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    std::array<uint32_t, 3> triangle = {indices[i], indices[i + 1], indices[i + 2]};
+    std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+    triangles.push_back(triangle);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of MeshOptimizer.
+ */
+class TestMeshOptimizer : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * The statistics of a strip, of separate triangles and of a strip that revisits vertices already evicted from the
+   * FIFO cache match the counts worked out by hand.
+   */
+  void analyzeVertexCache() {
+    // Each triangle of a strip loads a single new vertex, after the two first ones
+    std::vector<uint32_t> strip;
+    for (uint32_t t = 0; t < 10; t++) {
+      strip.insert(strip.end(), {t, t + 1, t + 2});
+    }
+    VertexCacheStats stats = MeshOptimizer::analyzeVertexCache(strip, 12);
+    QCOMPARE(stats.triangles, size_t(10));
+    QCOMPARE(stats.vertices, size_t(12));
+    QCOMPARE(stats.misses, size_t(12));
+    QCOMPARE(stats.acmr(), 1.2f);
+    QCOMPARE(stats.atvr(), 1.0f);
+
+    // Triangles without shared vertices miss every vertex
+    const std::vector<uint32_t> separate = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+    stats = MeshOptimizer::analyzeVertexCache(separate, 9);
+    QCOMPARE(stats.acmr(), 3.0f);
+    QCOMPARE(stats.atvr(), 1.0f);
+
+    // After 20 strip triangles, 22 vertices were loaded into the 16 entries of the cache, so the first triangle misses
+    // its 3 vertices again: 25 misses for 21 triangles and 22 vertices
+    strip.clear();
+    for (uint32_t t = 0; t < 20; t++) {
+      strip.insert(strip.end(), {t, t + 1, t + 2});
+    }
+    strip.insert(strip.end(), {0, 1, 2});
+    stats = MeshOptimizer::analyzeVertexCache(strip, 22);
+    QCOMPARE(stats.misses, size_t(25));
+    QCOMPARE(stats.acmr(), 25.0f / 21.0f);
+    QCOMPARE(stats.atvr(), 25.0f / 22.0f);
+
+    // Statistics add up, and empty statistics have no ratios
+    VertexCacheStats total;
+    QCOMPARE(total.acmr(), 0.0f);
+    QCOMPARE(total.atvr(), 0.0f);
+    total.add(stats);
+    total.add(stats);
+    QCOMPARE(total.triangles, size_t(42));
+    QCOMPARE(total.acmr(), stats.acmr());
+  }
+
+  /**
+   * Sorting the triangles of a shuffled grid keeps the same triangles, with their winding, and lowers its ACMR close to
+   * the ACMR of a grid drawn in strips.
+   */
+  void optimizeVertexCache() {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    shuffledGrid(&positions, &indices);
+    const size_t vertex_count = positions.size() / 3;
+
+    std::vector<uint32_t> optimized = indices;
+    MeshOptimizer::optimizeVertexCache(&optimized, vertex_count);
+    QCOMPARE(sortedTriangles(optimized), sortedTriangles(indices));
+
+    const float before = MeshOptimizer::analyzeVertexCache(indices, vertex_count).acmr();
+    const float after = MeshOptimizer::analyzeVertexCache(optimized, vertex_count).acmr();
+    QVERIFY(before > 2.0f);
+    QVERIFY(after < 0.8f);
+
+    std::vector<uint32_t> empty;
+    MeshOptimizer::optimizeVertexCache(&empty, vertex_count);
+    QVERIFY(empty.empty());
+  }
+
+  /**
+   * Sorting the clusters of the triangles keeps the same triangles, and about the same ACMR.
+   */
+  void optimizeOverdraw() {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    shuffledGrid(&positions, &indices);
+    const size_t vertex_count = positions.size() / 3;
+    MeshOptimizer::optimizeVertexCache(&indices, vertex_count);
+
+    std::vector<uint32_t> optimized = indices;
+    MeshOptimizer::optimizeOverdraw(positions.data(), vertex_count, &optimized);
+    QCOMPARE(sortedTriangles(optimized), sortedTriangles(indices));
+
+    const float before = MeshOptimizer::analyzeVertexCache(indices, vertex_count).acmr();
+    const float after = MeshOptimizer::analyzeVertexCache(optimized, vertex_count).acmr();
+    QVERIFY(after < before * 1.05f);
+  }
+
+  /**
+   * Vertices are renumbered in the order the indices first reference them, with a bijective remap, and the
+   * unreferenced vertices are moved to the end.
+   */
+  void optimizeVertexFetch() {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    shuffledGrid(&positions, &indices);
+    // The two last vertices are not referenced
+    const size_t vertex_count = positions.size() / 3 + 2;
+
+    std::vector<uint32_t> renumbered = indices;
+    const std::vector<uint32_t> remap = MeshOptimizer::optimizeVertexFetch(&renumbered, vertex_count);
+    QCOMPARE(remap.size(), vertex_count);
+    std::vector<uint32_t> sorted = remap;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t v = 0; v < sorted.size(); v++) {
+      QCOMPARE(sorted[v], static_cast<uint32_t>(v));
+    }
+    QVERIFY(remap[vertex_count - 2] >= vertex_count - 2);
+    QVERIFY(remap[vertex_count - 1] >= vertex_count - 2);
+
+    uint32_t next = 0;
+    QCOMPARE(renumbered.size(), indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+      QCOMPARE(renumbered[i], remap[indices[i]]);
+      QVERIFY(renumbered[i] <= next);
+      if (renumbered[i] == next) {
+        next++;
+      }
+    }
+    QCOMPARE(static_cast<size_t>(next), vertex_count - 2);
+  }
+};
+
+QTEST_APPLESS_MAIN(TestMeshOptimizer)
+
+#include "test_mesh_optimizer.moc"
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <cmath>
+#include <set>
+#include <vector>
+
+#include "mesh_simplifier.h"
+
+namespace {
+
+const float kPi = 3.14159265f;
+
+/**
+ * Builds a closed unit sphere of stacks and slices, with a single vertex at each pole.
+ *
+ * @param stacks: number of stacks from pole to pole.
+ * @param slices: number of slices around the axis.
+ * @param positions: receives the positions (x, y, z) of the vertices.
+ * @param indices: receives the triangle indices, wound counter-clockwise when seen from outside.
+ */
+void sphere(const uint32_t stacks, const uint32_t slices, std::vector<float> *positions,
+            std::vector<uint32_t> *indices) {
+  positions->assign({0.0f, 0.0f, 1.0f});
+  for (uint32_t i = 1; i < stacks; i++) {
+    for (uint32_t j = 0; j < slices; j++) {
+      const float theta = kPi * i / stacks, phi = 2.0f * kPi * j / slices;
+      positions->insert(positions->end(),
+                        {std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)});
+    }
+  }
+  positions->insert(positions->end(), {0.0f, 0.0f, -1.0f});
+
+  const uint32_t south = static_cast<uint32_t>(positions->size() / 3 - 1);
+  auto vertex = [slices](const uint32_t i, const uint32_t j) { return 1 + (i - 1) * slices + j % slices; };
+  indices->clear();
+  for (uint32_t j = 0; j < slices; j++) {
+    indices->insert(indices->end(), {0, vertex(1, j), vertex(1, j + 1)});
+    indices->insert(indices->end(), {vertex(stacks - 1, j), south, vertex(stacks - 1, j + 1)});
+  }
+  for (uint32_t i = 1; i + 1 < stacks; i++) {
+    for (uint32_t j = 0; j < slices; j++) {
+      indices->insert(indices->end(), {vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1)});
+      indices->insert(indices->end(), {vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1)});
+    }
+  }
+}
+
+/**
+ * Checks whether triangle indices are valid: below the number of vertices, and without repeated corners.
+ *
+ * @param indices: triangle indices.
+ * @param vertex_count: number of vertices.
+ *
+ * @return True if every triangle is valid.
+ */
+bool validTriangles(const std::vector<uint32_t> &indices, const size_t vertex_count) {
+  if (indices.size() % 3 != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+    if (a >= vertex_count || b >= vertex_count || c >= vertex_count || a == b || b == c || c == a) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of MeshSimplifier.
+ */
+class TestMeshSimplifier : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * A sphere is reduced to the target number of indices within the target error, and its triangles stay on the
+   * sphere without turning inwards.
+   */
+  void sphereLevels() {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    sphere(64, 128, &positions, &indices);
+    const size_t vertex_count = positions.size() / 3;
+
+    std::vector<uint32_t> level = indices;
+    for (int l = 0; l < 3; l++) {
+      const size_t target = level.size() / 2;
+      float error = -1.0f;
+      std::vector<uint32_t> simplified =
+          MeshSimplifier::simplify(positions.data(), vertex_count, level, target, 0.05f, &error);
+
+      QVERIFY(simplified.size() <= target);
+      QVERIFY(validTriangles(simplified, vertex_count));
+      QVERIFY(error >= 0.0f && error <= 0.05f);
+      for (size_t i = 0; i < simplified.size(); i += 3) {
+        const float *a = &positions[simplified[i] * 3];
+        const float *b = &positions[simplified[i + 1] * 3];
+        const float *c = &positions[simplified[i + 2] * 3];
+        const float center[3] = {(a[0] + b[0] + c[0]) / 3.0f, (a[1] + b[1] + c[1]) / 3.0f,
+                                 (a[2] + b[2] + c[2]) / 3.0f};
+        const float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        const float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        const float normal[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+        const float radius = std::sqrt(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]);
+        const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        QVERIFY(1.0f - radius < 0.1f);
+        QVERIFY(normal[0] * center[0] + normal[1] * center[1] + normal[2] * center[2] > -0.5f * length * radius);
+      }
+      level.swap(simplified);
+    }
+  }
+
+  /**
+   * Without an error budget, a curved mesh keeps all of its triangles.
+   */
+  void zeroError() {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    sphere(16, 32, &positions, &indices);
+
+    float error = -1.0f;
+    std::vector<uint32_t> simplified =
+        MeshSimplifier::simplify(positions.data(), positions.size() / 3, indices, 0, 0.0f, &error);
+    QCOMPARE(simplified.size(), indices.size());
+    QCOMPARE(error, 0.0f);
+  }
+
+  /**
+   * The interior of a flat grid collapses without error, while the vertices of its open border are never moved.
+   */
+  void lockedBorder() {
+    const uint32_t size = 20;
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    for (uint32_t i = 0; i < size; i++) {
+      for (uint32_t j = 0; j < size; j++) {
+        positions.insert(positions.end(), {static_cast<float>(i), static_cast<float>(j), 0.0f});
+      }
+    }
+    for (uint32_t i = 0; i + 1 < size; i++) {
+      for (uint32_t j = 0; j + 1 < size; j++) {
+        const uint32_t a = i * size + j, b = a + 1, c = a + size, d = c + 1;
+        indices.insert(indices.end(), {a, c, d, a, d, b});
+      }
+    }
+
+    float error = -1.0f;
+    std::vector<uint32_t> simplified =
+        MeshSimplifier::simplify(positions.data(), positions.size() / 3, indices, 0, 0.01f, &error);
+    QVERIFY(simplified.size() < indices.size());
+    QVERIFY(validTriangles(simplified, positions.size() / 3));
+    QVERIFY(error < 1e-3f);
+
+    const std::set<uint32_t> used(simplified.begin(), simplified.end());
+    for (uint32_t i = 0; i < size; i++) {
+      for (uint32_t j = 0; j < size; j++) {
+        if (i == 0 || j == 0 || i + 1 == size || j + 1 == size) {
+          QVERIFY(used.count(i * size + j) == 1);
+        }
+      }
+    }
+
+    // The grid keeps its area and no triangle is flipped
+    double area = 0.0;
+    for (size_t t = 0; t < simplified.size(); t += 3) {
+      const float *a = &positions[simplified[t] * 3];
+      const float *b = &positions[simplified[t + 1] * 3];
+      const float *c = &positions[simplified[t + 2] * 3];
+      const float z = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+      QVERIFY(z > 0.0f);
+      area += z * 0.5;
+    }
+    QVERIFY(std::abs(area - (size - 1) * (size - 1)) < 1e-3);
+  }
+};
+
+QTEST_APPLESS_MAIN(TestMeshSimplifier)
+
+#include "test_mesh_simplifier.moc"
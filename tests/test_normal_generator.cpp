@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <cmath>
+#include <vector>
+
+#include "normal_generator.h"
+
+namespace {
+
+/** Largest difference between a generated and an expected normal coordinate */
+const float kTolerance = 1e-4f;
+
+/** Corners (x, y, z) of the unit cube, the vertex x + 2 * y + 4 * z at (x, y, z) */
+const float kCubePositions[] = {0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0, 0, 0, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1};
+
+/** Faces of the unit cube, two per side, wound counter-clockwise when seen from outside */
+const uint32_t kCubeIndices[] = {0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6, 0, 1, 5, 0, 5, 4,
+                                 2, 6, 7, 2, 7, 3, 0, 4, 6, 0, 6, 2, 1, 3, 7, 1, 7, 5};
+
+/**
+ * Builds the unit cube with four vertices per side, as split by a mesh with texture coordinates.
+ *
+ * @param positions: receives the positions (x, y, z) of the vertices.
+ * @param indices: receives the triangle indices.
+ */
+void splitCube(std::vector<float> *positions, std::vector<uint32_t> *indices) {
+  positions->clear();
+  indices->clear();
+  for (size_t side = 0; side < 6; side++) {
+    // Each side is a pair of triangles over the same four corners, its first vertex is on the diagonal
+    const uint32_t *face = kCubeIndices + side * 6;
+    const uint32_t corners[4] = {face[0], face[1], face[2], face[5]};
+    const uint32_t first = static_cast<uint32_t>(positions->size() / 3);
+    for (uint32_t corner : corners) {
+      positions->insert(positions->end(), kCubePositions + corner * 3, kCubePositions + corner * 3 + 3);
+    }
+    indices->insert(indices->end(), {first, first + 1, first + 2, first, first + 2, first + 3});
+  }
+}
+
+/**
+ * Checks whether a normal is a unit vector along the diagonal of the cube from its center to a corner.
+ *
+ * @param normal: normal (x, y, z).
+ * @param corner: position (x, y, z) of the corner.
+ *
+ * @return True if the normal points out of the corner.
+ */
+bool isCornerNormal(const float *normal, const float *corner) {
+  const float component = 1.0f / std::sqrt(3.0f);
+  for (int k = 0; k < 3; k++) {
+    if (std::abs(normal[k] - (corner[k] * 2.0f - 1.0f) * component) > kTolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Computes the normal of a face as the normalized cross product of two of its edges.
+ *
+ * @param positions: positions (x, y, z) of the vertices.
+ * @param face: indices of the three corners of the face.
+ * @param normal: receives the unit normal (x, y, z).
+ */
+void faceNormal(const float *positions, const uint32_t *face, float *normal) {
+  const float *a = positions + face[0] * 3, *b = positions + face[1] * 3, *c = positions + face[2] * 3;
+  const float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  const float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  normal[0] = u[1] * v[2] - u[2] * v[1];
+  normal[1] = u[2] * v[0] - u[0] * v[2];
+  normal[2] = u[0] * v[1] - u[1] * v[0];
+  const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+  for (int k = 0; k < 3; k++) {
+    normal[k] /= length;
+  }
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of NormalGenerator.
+ */
+class TestNormalGenerator : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * Faces of a plane share a single normal and no vertex is split.
+   */
+  void flatQuad() {
+    const float positions[] = {0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0};
+    const uint32_t indices[] = {0, 1, 2, 0, 2, 3};
+    GeneratedNormals result;
+    NormalGenerator::generate(positions, 4, indices, 6, 60.0f, &result);
+
+    QCOMPARE(result.normals.size(), size_t(12));
+    QVERIFY(result.split_sources.empty());
+    for (size_t v = 0; v < 4; v++) {
+      QVERIFY(std::abs(result.normals[v * 3]) < kTolerance);
+      QVERIFY(std::abs(result.normals[v * 3 + 1]) < kTolerance);
+      QVERIFY(std::abs(result.normals[v * 3 + 2] - 1.0f) < kTolerance);
+    }
+  }
+
+  /**
+   * Smooth normals of a cube point out of its corners, whatever the triangulation of each side.
+   */
+  void smoothCube() {
+    GeneratedNormals result;
+    NormalGenerator::generate(kCubePositions, 8, kCubeIndices, 36, NormalGenerator::kSmoothAngle, &result);
+
+    QCOMPARE(result.normals.size(), size_t(24));
+    QVERIFY(result.split_sources.empty());
+    QVERIFY(std::equal(result.indices.begin(), result.indices.end(), kCubeIndices));
+    for (size_t v = 0; v < 8; v++) {
+      QVERIFY(isCornerNormal(&result.normals[v * 3], kCubePositions + v * 3));
+    }
+  }
+
+  /**
+   * The sides of a cube meet at 90 degrees, so with a smaller crease angle each corner is split into one vertex per
+   * side, and every corner gets the normal of its face.
+   */
+  void creasedCube() {
+    GeneratedNormals result;
+    NormalGenerator::generate(kCubePositions, 8, kCubeIndices, 36, 60.0f, &result);
+
+    QCOMPARE(result.split_sources.size(), size_t(16));
+    QCOMPARE(result.normals.size(), size_t(24 * 3));
+    QCOMPARE(result.indices.size(), size_t(36));
+    for (size_t v = 0; v < result.split_sources.size(); v++) {
+      QVERIFY(result.split_sources[v] < 8);
+    }
+
+    // Copies keep the position of their source vertex
+    std::vector<float> positions(kCubePositions, kCubePositions + 24);
+    for (uint32_t source : result.split_sources) {
+      positions.insert(positions.end(), kCubePositions + source * 3, kCubePositions + source * 3 + 3);
+    }
+    for (size_t f = 0; f < 12; f++) {
+      float expected[3];
+      faceNormal(positions.data(), &result.indices[f * 3], expected);
+      for (size_t k = 0; k < 3; k++) {
+        const float *normal = &result.normals[result.indices[f * 3 + k] * 3];
+        QVERIFY(std::abs(normal[0] - expected[0]) < kTolerance);
+        QVERIFY(std::abs(normal[1] - expected[1]) < kTolerance);
+        QVERIFY(std::abs(normal[2] - expected[2]) < kTolerance);
+      }
+    }
+  }
+
+  /**
+   * Vertices split at seams are welded by position, so a cube with four vertices per side is as smooth as one with a
+   * vertex per corner, and is not split further at its creases.
+   */
+  void weldedSeams() {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    splitCube(&positions, &indices);
+
+    GeneratedNormals smooth;
+    NormalGenerator::generate(positions.data(), 24, indices.data(), indices.size(), NormalGenerator::kSmoothAngle,
+                              &smooth);
+    for (size_t v = 0; v < 24; v++) {
+      QVERIFY(isCornerNormal(&smooth.normals[v * 3], &positions[v * 3]));
+    }
+
+    GeneratedNormals creased;
+    NormalGenerator::generate(positions.data(), 24, indices.data(), indices.size(), 60.0f, &creased);
+    QVERIFY(creased.split_sources.empty());
+    for (size_t f = 0; f < 12; f++) {
+      float expected[3];
+      faceNormal(positions.data(), &indices[f * 3], expected);
+      const float *normal = &creased.normals[indices[f * 3] * 3];
+      QVERIFY(std::abs(normal[0] - expected[0]) < kTolerance);
+      QVERIFY(std::abs(normal[1] - expected[1]) < kTolerance);
+      QVERIFY(std::abs(normal[2] - expected[2]) < kTolerance);
+    }
+  }
+
+  /**
+   * Normals accumulated in batches of faces and then normalized are the smooth normals of generate.
+   */
+  void accumulatedBatches() {
+    std::vector<float> sums(24, 0.0f);
+    NormalGenerator::accumulate(kCubePositions, kCubeIndices, 18, sums.data());
+    NormalGenerator::accumulate(kCubePositions, kCubeIndices + 18, 18, sums.data());
+
+    for (size_t v = 0; v < 8; v++) {
+      float *sum = &sums[v * 3];
+      const float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+      QVERIFY(length > 0.0f);
+      for (int k = 0; k < 3; k++) {
+        sum[k] /= length;
+      }
+      QVERIFY(isCornerNormal(sum, kCubePositions + v * 3));
+    }
+  }
+
+  /**
+   * Faces without area neither change the normals of their vertices nor produce invalid ones.
+   */
+  void degenerateFace() {
+    const float positions[] = {0, 0, 0, 1, 0, 0, 1, 1, 0, 2, 0, 0};
+    const uint32_t indices[] = {0, 1, 2, 0, 1, 3};
+    GeneratedNormals result;
+    NormalGenerator::generate(positions, 4, indices, 6, 60.0f, &result);
+
+    for (size_t v = 0; v < 3; v++) {
+      QVERIFY(std::abs(result.normals[v * 3 + 2] - 1.0f) < kTolerance);
+    }
+    for (float coordinate : result.normals) {
+      QVERIFY(std::isfinite(coordinate));
+    }
+  }
+};
+
+QTEST_APPLESS_MAIN(TestNormalGenerator)
+
+#include "test_normal_generator.moc"
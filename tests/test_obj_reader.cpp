@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "obj_reader.h"
+
+namespace {
+
+/**
+ * Parses OBJ data from a string.
+ *
+ * @param data: OBJ file contents.
+ * @param mesh: receives the mesh.
+ *
+ * @return Status of the parse.
+ */
+ObjReader::Status parse(const std::string &data, ObjMesh *mesh) {
+  return ObjReader::parse(data.data(), data.size(), mesh);
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of ObjReader.
+ */
+class TestObjReader : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * Polygons are triangulated as fans, and corners that share their v, vt and vn indices share a vertex.
+   */
+  void indexedQuad() {
+    ObjMesh mesh;
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+                   "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvn 0 0 1\n"
+                   "o quad\ns off\nf 1/1/1 2/2/1 3/3/1 4/4/1 # comment\n",
+                   &mesh),
+             ObjReader::kSuccess);
+
+    QVERIFY(mesh.has_normals);
+    QVERIFY(mesh.has_texture_coords);
+    QVERIFY(!mesh.has_colors);
+    QVERIFY(mesh.missing_normals.empty());
+    QCOMPARE(mesh.vertices.size(), size_t(12));
+    QCOMPARE(mesh.indices, std::vector<uint32_t>({0, 1, 2, 0, 2, 3}));
+    QCOMPARE(mesh.texture_coords, std::vector<float>({0, 0, 1, 0, 1, 1, 0, 1}));
+    for (size_t v = 0; v < 4; v++) {
+      QCOMPARE(mesh.normals[v * 3 + 2], 1.0f);
+    }
+  }
+
+  /**
+   * Negative indices refer to the records read before the face, also across the chunks parsed in parallel.
+   */
+  void relativeIndices() {
+    // Large enough to be split in several chunks
+    std::string data;
+    const size_t triangles = 100000;
+    for (size_t t = 0; t < triangles; t++) {
+      const std::string x = std::to_string(t);
+      data += "v " + x + " 0 0\nv " + x + " 1 0\nv " + x + " 0 1\nf -3 -2 -1\n";
+    }
+
+    ObjMesh mesh;
+    QCOMPARE(parse(data, &mesh), ObjReader::kSuccess);
+    QCOMPARE(mesh.indices.size(), triangles * 3);
+    QCOMPARE(mesh.vertices.size(), triangles * 9);
+    for (size_t i = 0; i < mesh.indices.size(); i++) {
+      QCOMPARE(mesh.indices[i], static_cast<uint32_t>(i));
+      QCOMPARE(mesh.vertices[mesh.indices[i] * 3], static_cast<float>(i / 3));
+    }
+  }
+
+  /**
+   * Vertices of faces without normals, in a file where other faces have them, are marked as missing their normals.
+   */
+  void partialNormals() {
+    ObjMesh mesh;
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nvn 0 0 1\nf 1//1 2//1 3//1\nf 2 4 3\n", &mesh),
+             ObjReader::kSuccess);
+    QVERIFY(mesh.has_normals);
+    QCOMPARE(mesh.vertices.size(), size_t(18));
+    QCOMPARE(mesh.missing_normals, std::vector<uint8_t>({0, 0, 0, 1, 1, 1}));
+    QCOMPARE(mesh.normals[2], 1.0f);
+    QCOMPARE(mesh.normals[3 * 3 + 2], 0.0f);
+
+    // Files whose vn records follow their v records keep the vertices of the file
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nvn 0 0 1\nvn 0 0 1\nvn 0 0 1\n"
+                   "f 1//1 2//2 3//3\nf 2 4 3\n",
+                   &mesh),
+             ObjReader::kSuccess);
+    QCOMPARE(mesh.vertices.size(), size_t(12));
+    QCOMPARE(mesh.missing_normals, std::vector<uint8_t>({0, 0, 0, 1}));
+
+    // Without any normal, none is missing: they are all generated
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n", &mesh), ObjReader::kSuccess);
+    QVERIFY(!mesh.has_normals);
+    QVERIFY(mesh.missing_normals.empty());
+  }
+
+  /**
+   * Files with only v records are point clouds, whose colors (v x y z r g b or v x y z w r g b) are scaled to [0, 1].
+   */
+  void pointColors() {
+    ObjMesh mesh;
+    QCOMPARE(parse("v 0 0 0 255 0 0\nv 1 0 0 1 0 255 0\nv 0 1 0\np 1 2 3\n", &mesh), ObjReader::kSuccess);
+    QVERIFY(mesh.indices.empty());
+    QVERIFY(mesh.has_colors);
+    QCOMPARE(mesh.vertices, std::vector<float>({0, 0, 0, 1, 0, 0, 0, 1, 0}));
+    QCOMPARE(mesh.colors.size(), size_t(9));
+    QCOMPARE(mesh.colors[0], 1.0f);
+    QCOMPARE(mesh.colors[1], 0.0f);
+    QCOMPARE(mesh.colors[3], 0.0f);
+    QCOMPARE(mesh.colors[4], 1.0f);
+
+    // Points without a color get the default gray, and colors already in [0, 1] are kept
+    QVERIFY(mesh.colors[6] > 0.0f && mesh.colors[6] < 1.0f);
+    QCOMPARE(parse("v 0 0 0 0.5 0.25 1\n", &mesh), ObjReader::kSuccess);
+    QCOMPARE(mesh.colors, std::vector<float>({0.5f, 0.25f, 1.0f}));
+  }
+
+  /**
+   * Features the reader does not handle are reported as unsupported, so they are left to assimp.
+   */
+  void unsupported() {
+    ObjMesh mesh;
+    const std::string triangle = "v 0 0 0\nv 1 0 0\nv 0 1 0\n";
+    QCOMPARE(parse("mtllib scene.mtl\n" + triangle + "usemtl red\nf 1 2 3\n", &mesh), ObjReader::kUnsupported);
+    QCOMPARE(parse(triangle + "l 1 2\n", &mesh), ObjReader::kUnsupported);
+    QCOMPARE(parse(triangle + "f 1 2\n", &mesh), ObjReader::kUnsupported);
+    QCOMPARE(parse(triangle + "p 1\nf 1 2 3\n", &mesh), ObjReader::kUnsupported);
+    QCOMPARE(parse(triangle + "f 1 2 \\\n3\n", &mesh), ObjReader::kUnsupported);
+  }
+
+  /**
+   * Malformed records and indices of missing records fail the read.
+   */
+  void malformed() {
+    ObjMesh mesh;
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n", &mesh), ObjReader::kFailed);
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1/1 2/1 3/1\n", &mesh), ObjReader::kFailed);
+    QCOMPARE(parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nf -1 -2 -4\n", &mesh), ObjReader::kFailed);
+    QCOMPARE(parse("v 0 zero 0\n", &mesh), ObjReader::kFailed);
+    QCOMPARE(parse("vn 0 0\n", &mesh), ObjReader::kFailed);
+  }
+
+  /**
+   * The progress callback cancels the parse.
+   */
+  void cancelled() {
+    ObjMesh mesh;
+    const std::string data = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+    QCOMPARE(ObjReader::parse(data.data(), data.size(), &mesh, [](float) { return false; }), ObjReader::kCancelled);
+
+    float last = 0.0f;
+    QCOMPARE(ObjReader::parse(data.data(), data.size(), &mesh,
+                              [&last](float progress) {
+                                last = progress;
+                                return true;
+                              }),
+             ObjReader::kSuccess);
+    QCOMPARE(last, 1.0f);
+  }
+
+  /**
+   * Records parsed one at a time, as by the streaming reader, give the same positions and fan triangles.
+   */
+  void streamedRecords() {
+    const char position_line[] = " 1.5 -2e1 .25 # comment";
+    float position[3];
+    QVERIFY(ObjReader::parsePosition(position_line, position_line + std::strlen(position_line), position));
+    QCOMPARE(position[0], 1.5f);
+    QCOMPARE(position[1], -20.0f);
+    QCOMPARE(position[2], 0.25f);
+
+    const char face_line[] = " 1/2/3 -1 2//4 5";
+    std::vector<uint32_t> indices;
+    QCOMPARE(ObjReader::parseFacePositions(face_line, face_line + std::strlen(face_line), 5, &indices), 4);
+    QCOMPARE(indices, std::vector<uint32_t>({0, 4, 1, 0, 1, 4}));
+
+    const char missing_line[] = " 1 2 6";
+    QCOMPARE(ObjReader::parseFacePositions(missing_line, missing_line + std::strlen(missing_line), 5, &indices), -1);
+  }
+};
+
+QTEST_APPLESS_MAIN(TestObjReader)
+
+#include "test_obj_reader.moc"
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "point_octree.h"
+
+namespace {
+
+/** Number of points of the random clouds, enough for a few levels of nodes */
+const size_t kPointCount = 300000;
+
+/** Edge of the cube of the random clouds */
+const float kExtent = 10.0f;
+
+/**
+ * Generates points at random positions of the cube [0, kExtent].
+ *
+ * @param positions: receives the positions (x, y, z) of the points.
+ * @param bounds: receives the bounding box of the points.
+ */
+void randomCloud(std::vector<float> *positions, BoundingBox *bounds) {
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> distribution(0.0f, kExtent);
+  positions->resize(kPointCount * 3);
+  for (float &coordinate : *positions) {
+    coordinate = distribution(generator);
+  }
+
+  *bounds = {kExtent, kExtent, kExtent, 0.0f, 0.0f, 0.0f};
+  for (size_t i = 0; i < positions->size(); i++) {
+    (*bounds)[i % 3] = std::min((*bounds)[i % 3], (*positions)[i]);
+    (*bounds)[i % 3 + 3] = std::max((*bounds)[i % 3 + 3], (*positions)[i]);
+  }
+}
+
+/**
+ * Checks whether the cube of a node is on the inside of a plane, at least in part.
+ *
+ * @param node: node of the octree.
+ * @param plane: plane (a, b, c, d).
+ *
+ * @return True if the cube is not fully outside of the plane.
+ */
+bool insidePlane(const PointOctreeNode &node, const std::array<float, 4> &plane) {
+  const float distance = plane[0] * node.center[0] + plane[1] * node.center[1] + plane[2] * node.center[2] + plane[3];
+  return distance + node.half_size * (std::abs(plane[0]) + std::abs(plane[1]) + std::abs(plane[2])) >= 0.0f;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of PointOctree.
+ */
+class TestPointOctree : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * An empty cloud has no nodes and selects nothing.
+   */
+  void empty() {
+    PointOctree octree;
+    std::vector<uint32_t> order;
+    octree.build(std::vector<float>(), BoundingBox{0, 0, 0, 1, 1, 1}, &order);
+    QVERIFY(octree.empty());
+    QVERIFY(order.empty());
+
+    std::vector<SelectedPointNode> selected;
+    QCOMPARE(octree.select(FrustumPlanes(), QVector3D(0, 0, 0), 1000.0f, 1000000, &selected), size_t(0));
+    QVERIFY(selected.empty());
+  }
+
+  /**
+   * The order is a permutation of the points, and each node holds its own points (a full sample for inner nodes),
+   * inside its cube, followed by the points of its children.
+   */
+  void structure() {
+    std::vector<float> positions;
+    BoundingBox bounds;
+    randomCloud(&positions, &bounds);
+
+    PointOctree octree;
+    std::vector<uint32_t> order;
+    octree.build(positions, bounds, &order);
+    const std::vector<PointOctreeNode> &nodes = octree.nodes();
+    QVERIFY(nodes.size() > 9);
+
+    std::vector<uint32_t> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<uint32_t> expected(kPointCount);
+    std::iota(expected.begin(), expected.end(), 0);
+    QCOMPARE(sorted, expected);
+
+    size_t total = 0;
+    for (const PointOctreeNode &node : nodes) {
+      total += node.count;
+      QVERIFY(node.spacing > 0.0f);
+      if (node.child_count > 0) {
+        QCOMPARE(node.count, uint32_t(PointOctree::kNodePoints));
+        QCOMPARE(nodes[node.first_child].first, node.first + node.count);
+        for (uint32_t child = node.first_child; child < node.first_child + node.child_count; child++) {
+          QCOMPARE(nodes[child].half_size, node.half_size / 2.0f);
+        }
+      } else {
+        QVERIFY(node.count <= 2 * PointOctree::kNodePoints);
+      }
+
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        const float *position = &positions[order[i] * 3];
+        for (int k = 0; k < 3; k++) {
+          QVERIFY(std::abs(position[k] - node.center[k]) <= node.half_size * 1.0001f);
+        }
+      }
+    }
+    QCOMPARE(total, kPointCount);
+
+    // Builds are reproducible
+    std::vector<uint32_t> again;
+    octree.build(positions, bounds, &again);
+    QCOMPARE(again, order);
+  }
+
+  /**
+   * Nodes are refined while their points are more than a pixel apart and the budget allows it, and the root is always
+   * selected.
+   */
+  void budget() {
+    std::vector<float> positions;
+    BoundingBox bounds;
+    randomCloud(&positions, &bounds);
+    PointOctree octree;
+    std::vector<uint32_t> order;
+    octree.build(positions, bounds, &order);
+
+    // Zero planes disable culling, and a near camera with many pixels per unit refines every node
+    const QVector3D camera(kExtent / 2.0f, kExtent / 2.0f, kExtent * 3.0f);
+    std::vector<SelectedPointNode> selected;
+    QCOMPARE(octree.select(FrustumPlanes(), camera, 1e6f, kPointCount, &selected), kPointCount);
+    QCOMPARE(selected.size(), octree.nodes().size());
+    QCOMPARE(selected.front().node, 0u);
+
+    // Parents come before their children, whose spacing is at most the spacing of the node
+    std::vector<bool> seen(octree.nodes().size(), false);
+    for (const SelectedPointNode &entry : selected) {
+      const PointOctreeNode &node = octree.nodes()[entry.node];
+      seen[entry.node] = true;
+      for (uint32_t child = node.first_child; child < node.first_child + node.child_count; child++) {
+        QVERIFY(!seen[child]);
+      }
+      QVERIFY(entry.spacing > 0.0f && entry.spacing <= node.spacing);
+    }
+
+    const size_t budget = PointOctree::kNodePoints * 3;
+    QVERIFY(octree.select(FrustumPlanes(), camera, 1e6f, budget, &selected) <= budget);
+    QVERIFY(selected.size() > 1);
+
+    // The root is drawn even over the budget, and a far view does not refine it
+    QCOMPARE(octree.select(FrustumPlanes(), camera, 1e6f, 0, &selected), size_t(PointOctree::kNodePoints));
+    QCOMPARE(selected.size(), size_t(1));
+    QCOMPARE(octree.select(FrustumPlanes(), QVector3D(0, 0, 1e6f), 1.0f, kPointCount, &selected),
+             size_t(PointOctree::kNodePoints));
+    QCOMPARE(selected.size(), size_t(1));
+  }
+
+  /**
+   * Nodes outside the view frustum are not selected.
+   */
+  void culling() {
+    std::vector<float> positions;
+    BoundingBox bounds;
+    randomCloud(&positions, &bounds);
+    PointOctree octree;
+    std::vector<uint32_t> order;
+    octree.build(positions, bounds, &order);
+
+    // Only the points with x below kExtent / 4 are visible, the other planes accept everything
+    FrustumPlanes planes = FrustumPlanes();
+    planes[0] = {-1.0f, 0.0f, 0.0f, kExtent / 4.0f};
+    const QVector3D camera(kExtent / 2.0f, kExtent / 2.0f, kExtent * 3.0f);
+    std::vector<SelectedPointNode> selected;
+    octree.select(planes, camera, 1e6f, kPointCount, &selected);
+
+    QVERIFY(selected.size() > 1);
+    QVERIFY(selected.size() < octree.nodes().size());
+    for (const SelectedPointNode &entry : selected) {
+      QVERIFY(insidePlane(octree.nodes()[entry.node], planes[0]));
+    }
+
+    // A frustum that misses the root selects nothing
+    planes[0] = {-1.0f, 0.0f, 0.0f, -2.0f * kExtent};
+    QCOMPARE(octree.select(planes, camera, 1e6f, kPointCount, &selected), size_t(0));
+    QVERIFY(selected.empty());
+  }
+};
+
+QTEST_APPLESS_MAIN(TestPointOctree)
+
+#include "test_point_octree.moc"
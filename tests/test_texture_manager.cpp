@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QColor>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <algorithm>
+#include <atomic>
+
+#include "texture_manager.h"
+
+namespace {
+
+/** Edge of the test images, in pixels */
+const int kImageSize = 16;
+
+/** Size in bytes of a decoded test image */
+const size_t kImageBytes = kImageSize * kImageSize * 4;
+
+/** Number of mipmap levels of the test images, from 16x16 down to 1x1 */
+const size_t kLevelCount = 5;
+
+/**
+ * Inverts the last byte of a file.
+ *
+ * @param filename: path to the file.
+ *
+ * @return True if the byte was changed.
+ */
+bool invertLastByte(const QString &filename) {
+  QFile file(filename);
+  char byte;
+  return file.open(QIODevice::ReadWrite) && file.size() > 0 && file.seek(file.size() - 1) && file.getChar(&byte) &&
+         file.seek(file.size() - 1) && file.putChar(static_cast<char>(~byte));
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of TextureManager: its memory cache, and the mipmaps of compressed textures with their disk cache, which
+ * is written to the test cache directory of QStandardPaths.
+ */
+class TestTextureManager : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * Writes the test images and moves the cache directory out of the cache of the user.
+   */
+  void initTestCase() {
+    QStandardPaths::setTestModeEnabled(true);
+    QVERIFY(dir_.isValid());
+    for (const QString &name : {"a", "b", "c"}) {
+      QImage image(kImageSize, kImageSize, QImage::Format_RGBA8888);
+      image.fill(QColor(name == "a" ? 255 : 0, name == "b" ? 255 : 0, name == "c" ? 255 : 0));
+      QVERIFY(image.save(path(name)));
+    }
+    for (const QString &name : {"opaque", "touched"}) {
+      QImage image(kImageSize, kImageSize, QImage::Format_RGB32);
+      image.fill(QColor(255, 0, 0));
+      QVERIFY(image.save(path(name)));
+    }
+    QImage translucent(kImageSize, kImageSize, QImage::Format_ARGB32);
+    translucent.fill(QColor(0, 0, 255, 128));
+    QVERIFY(translucent.save(path("translucent")));
+  }
+
+  /**
+   * Removes the entries written by the tests.
+   */
+  void cleanupTestCase() { QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).removeRecursively(); }
+
+  /**
+   * A texture loaded again is taken from memory.
+   */
+  void cached() {
+    TextureManager manager;
+    std::shared_ptr<const TextureImage> image = manager.load(path("a"));
+    QVERIFY(image != NULL);
+    QVERIFY(image->format == TextureFormat::kRgba8);
+    QCOMPARE(image->data.size(), kImageBytes);
+    QCOMPARE(manager.memoryUsage(), kImageBytes);
+    QCOMPARE(manager.load(path("a")), image);
+    QCOMPARE(manager.memoryUsage(), kImageBytes);
+  }
+
+  /**
+   * Over the budget, the least recently used textures are evicted first, and loading a texture marks it as used.
+   */
+  void leastRecentlyUsed() {
+    TextureManager manager;
+    manager.setMemoryBudget(kImageBytes * 2);
+    std::shared_ptr<const TextureImage> a = manager.load(path("a"));
+    std::shared_ptr<const TextureImage> b = manager.load(path("b"));
+    QCOMPARE(manager.load(path("a")), a);
+
+    std::shared_ptr<const TextureImage> c = manager.load(path("c"));
+    QCOMPARE(manager.memoryUsage(), kImageBytes * 2);
+    QCOMPARE(manager.load(path("a")), a);
+    QCOMPARE(manager.load(path("c")), c);
+
+    // b was evicted, so it is decoded again, which evicts a
+    std::shared_ptr<const TextureImage> decoded = manager.load(path("b"));
+    QVERIFY(decoded != NULL && decoded != b);
+    QCOMPARE(manager.load(path("c")), c);
+    QVERIFY(manager.load(path("a")) != a);
+  }
+
+  /**
+   * The most recently used texture is kept even over the budget, and a smaller budget evicts at once.
+   */
+  void budget() {
+    TextureManager manager;
+    manager.setMemoryBudget(kImageBytes / 2);
+    std::shared_ptr<const TextureImage> a = manager.load(path("a"));
+    QCOMPARE(manager.memoryUsage(), kImageBytes);
+    QCOMPARE(manager.load(path("a")), a);
+
+    manager.load(path("b"));
+    QCOMPARE(manager.memoryUsage(), kImageBytes);
+    QVERIFY(manager.load(path("a")) != a);
+
+    manager.setMemoryBudget(kImageBytes * 3);
+    manager.load(path("b"));
+    manager.load(path("c"));
+    QCOMPARE(manager.memoryUsage(), kImageBytes * 3);
+    manager.setMemoryBudget(kImageBytes);
+    QCOMPARE(manager.memoryUsage(), kImageBytes);
+
+    // Enabling compression discards the textures in memory
+    manager.setCompression(true);
+    QCOMPARE(manager.memoryUsage(), size_t(0));
+  }
+
+  /**
+   * Files that cannot be decoded give no texture and are not kept.
+   */
+  void missingFile() {
+    TextureManager manager;
+    QVERIFY(manager.load(path("missing")) == NULL);
+    QCOMPARE(manager.memoryUsage(), size_t(0));
+  }
+
+  /**
+   * Requested textures are decoded on the thread pool and taken once, and textures in memory are ready at once.
+   */
+  void requests() {
+    TextureManager manager;
+    std::atomic<int> callbacks(0);
+    manager.setReadyCallback([&callbacks]() { callbacks++; });
+
+    manager.request(path("a"));
+    manager.request(path("a"));
+    QTRY_VERIFY(manager.hasReady());
+    std::vector<TextureManager::Result> ready = manager.takeReady(0);
+    QCOMPARE(ready.size(), size_t(1));
+    QCOMPARE(ready[0].first, path("a"));
+    QVERIFY(ready[0].second != NULL);
+    QTRY_COMPARE(callbacks.load(), 1);
+    QVERIFY(!manager.hasReady());
+
+    manager.request(path("a"));
+    QVERIFY(manager.hasReady());
+    QCOMPARE(manager.takeReady(0).front().second, ready[0].second);
+  }
+
+  /**
+   * Compressed textures have every mipmap level down to 1x1, in BC1 without alpha and in BC3 with it, and each level
+   * is downsampled from the image.
+   */
+  void mipmaps() {
+    TextureManager manager;
+    manager.setCompression(true);
+    std::shared_ptr<const TextureImage> opaque = manager.load(path("opaque"));
+    QVERIFY(opaque != NULL);
+    QVERIFY(opaque->format == TextureFormat::kBc1);
+    QCOMPARE(opaque->levels.size(), kLevelCount);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < opaque->levels.size(); i++) {
+      const TextureLevel &level = opaque->levels[i];
+      QCOMPARE(level.width, kImageSize >> i);
+      QCOMPARE(level.height, kImageSize >> i);
+      QCOMPARE(level.offset, offset);
+      QCOMPARE(level.size, static_cast<size_t>(std::max(1, level.width / 4) * std::max(1, level.height / 4) * 8));
+      offset += level.size;
+
+      // Every block of the red image has the 5:6:5 red endpoints
+      for (size_t block = level.offset; block < level.offset + level.size; block += 8) {
+        QCOMPARE(opaque->data[block], static_cast<unsigned char>(0x00));
+        QCOMPARE(opaque->data[block + 1], static_cast<unsigned char>(0xF8));
+      }
+    }
+    QCOMPARE(opaque->data.size(), offset);
+    QCOMPARE(manager.memoryUsage(), offset);
+
+    std::shared_ptr<const TextureImage> translucent = manager.load(path("translucent"));
+    QVERIFY(translucent != NULL);
+    QVERIFY(translucent->format == TextureFormat::kBc3);
+    QCOMPARE(translucent->levels.size(), kLevelCount);
+    QCOMPARE(translucent->data.size(), offset * 2);
+    for (const TextureLevel &level : translucent->levels) {
+      QCOMPARE(static_cast<int>(translucent->data[level.offset]), 128);
+    }
+  }
+
+  /**
+   * Compressed textures are written to the disk cache, and later loads read the entry instead of the image file.
+   */
+  void diskCache() {
+    const QString cache_filename = TextureManager::cacheFilename(path("opaque"));
+    QFile::remove(cache_filename);
+    TextureManager manager;
+    manager.setCompression(true);
+    std::shared_ptr<const TextureImage> written = manager.load(path("opaque"));
+    QVERIFY(written != NULL);
+    QVERIFY(QFile::exists(cache_filename));
+
+    // A changed block of the entry shows that it was read instead of the image
+    QVERIFY(invertLastByte(cache_filename));
+    TextureManager other;
+    other.setCompression(true);
+    std::shared_ptr<const TextureImage> read = other.load(path("opaque"));
+    QVERIFY(read != NULL);
+    QVERIFY(read->format == written->format);
+    QCOMPARE(read->levels.size(), kLevelCount);
+    QCOMPARE(read->data.size(), written->data.size());
+    QVERIFY(std::equal(read->data.begin(), read->data.end() - 1, written->data.begin()));
+    QVERIFY(read->data.back() != written->data.back());
+
+    // Uncompressed textures do not use the disk cache
+    TextureManager uncompressed;
+    QVERIFY(uncompressed.load(path("opaque"))->format == TextureFormat::kRgba8);
+  }
+
+  /**
+   * Touching the image file invalidates its entry, which is replaced by the texture decoded again.
+   */
+  void touchedSource() {
+    const QString cache_filename = TextureManager::cacheFilename(path("touched"));
+    TextureManager manager;
+    manager.setCompression(true);
+    std::shared_ptr<const TextureImage> written = manager.load(path("touched"));
+    QVERIFY(written != NULL);
+    QVERIFY(invertLastByte(cache_filename));
+
+    QFile source(path("touched"));
+    QVERIFY(source.open(QIODevice::ReadWrite));
+    const QDateTime modified = QFileInfo(source).lastModified().addSecs(60);
+    QVERIFY(source.setFileTime(modified, QFileDevice::FileModificationTime));
+    source.close();
+
+    TextureManager other;
+    other.setCompression(true);
+    std::shared_ptr<const TextureImage> decoded = other.load(path("touched"));
+    QVERIFY(decoded != NULL);
+    QVERIFY(decoded->data == written->data);
+
+    // The entry was written again for the new modification time
+    TextureManager again;
+    again.setCompression(true);
+    QVERIFY(again.load(path("touched"))->data == written->data);
+    QVERIFY(QFile::exists(cache_filename));
+  }
+
+ private:
+  /**
+   * Gets the path of a test image.
+   *
+   * @param name: name of the image, without its suffix.
+   *
+   * @return Path to the PNG file.
+   */
+  QString path(const QString &name) const { return dir_.filePath(name + ".png"); }
+
+  QTemporaryDir dir_; /**< Directory of the test images */
+};
+
+QTEST_GUILESS_MAIN(TestTextureManager)
+
+#include "test_texture_manager.moc"
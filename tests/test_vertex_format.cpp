@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QtTest>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "vertex_format.h"
+
+namespace {
+
+/**
+ * Generates packed positions whose coordinates are multiples of 1/4, so every sum and product of the tests is exact and
+ * the results of the SSE and scalar paths can be compared for equality.
+ *
+ * @param count: number of positions.
+ *
+ * @return The packed positions (x, y, z, x, y, z, ...).
+ */
+std::vector<float> randomPositions(const size_t count) {
+  std::mt19937 generator(static_cast<unsigned>(count));
+  std::uniform_int_distribution<int> distribution(-64, 64);
+  std::vector<float> positions(count * 3);
+  for (float &coordinate : positions) {
+    coordinate = distribution(generator) * 0.25f;
+  }
+  return positions;
+}
+
+}  // namespace
+
+/**
+ * @brief Tests of the helpers of vertex_format.h.
+ */
+class TestVertexFormat : public QObject {
+  Q_OBJECT
+
+ private slots:
+  /**
+   * The SSE path, which rotates the per-axis constants over the lanes of three registers, gives the results of the
+   * scalar path position by position, for counts that leave 1 to 3 positions to the scalar tail, and in place.
+   */
+  void transformMatchesScalar() {
+    // Each axis has its own offset and scale, some negative, so a constant in the wrong lane changes the result
+    const float add[3] = {1.5f, -3.0f, 0.75f};
+    const float mul[3] = {2.0f, -0.5f, 0.125f};
+    const float low = -20.0f, high = 12.0f;
+
+    for (const size_t count : {1, 3, 4, 5, 7, 8, 13}) {
+      const std::vector<float> positions = randomPositions(count);
+      std::vector<float> result(positions.size());
+      transformPositions(positions.data(), count, add, mul, low, high, result.data());
+
+      for (size_t i = 0; i < positions.size(); i++) {
+        const int axis = static_cast<int>(i % 3);
+        QCOMPARE(result[i], std::max(low, std::min(high, (positions[i] + add[axis]) * mul[axis])));
+      }
+
+      std::vector<float> in_place = positions;
+      transformPositions(in_place.data(), count, add, mul, low, high, in_place.data());
+      QCOMPARE(in_place, result);
+    }
+
+    // Results are clamped on both sides
+    const float far[6] = {100.0f, -100.0f, 0.0f, -100.0f, 100.0f, 0.0f};
+    float clamped[6];
+    transformPositions(far, 2, add, mul, low, high, clamped);
+    QCOMPARE(clamped[0], high);
+    QCOMPARE(clamped[1], high);
+    QCOMPARE(clamped[3], low);
+    QCOMPARE(clamped[4], low);
+  }
+};
+
+QTEST_APPLESS_MAIN(TestVertexFormat)
+
+#include "test_vertex_format.moc"
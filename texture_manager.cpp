@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include "texture_manager.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <cstring>
+
+#include "block_compressor.h"
+
+namespace {
+
+/** Default size of the decoded textures kept in memory */
+const size_t kDefaultMemoryBudget = size_t(512) << 20;
+
+/** Identifies texture cache files */
+const char kMagic[8] = {'Q', 'T', 'G', 'L', 'T', 'E', 'X', 'R'};
+
+/** Must be incremented whenever the compression or the layout of the cache file changes */
+const uint32_t kVersion = 1;
+
+/**
+ * @brief Fixed-size header of a texture cache file. It is followed by the blocks of every mipmap level, the levels
+ * being derived from the size and format of the texture.
+ */
+struct CacheHeader {
+  char magic[8];        /**< Must be kMagic */
+  uint32_t version;     /**< Must be kVersion */
+  uint32_t format;      /**< TextureFormat of the blocks */
+  int32_t width;        /**< Width in pixels of level 0 */
+  int32_t height;       /**< Height in pixels of level 0 */
+  uint64_t source_size; /**< Size of the image file when the entry was written */
+  int64_t source_mtime; /**< Modification time of the image file, in milliseconds since epoch */
+  uint64_t data_size;   /**< Size in bytes of the blocks */
+};
+
+/**
+ * @brief Runs a function on a QThreadPool.
+ */
+class Task : public QRunnable {
+ public:
+  /**
+   * Class constructor.
+   *
+   * @param function: function to be run.
+   */
+  explicit Task(const std::function<void()>& function) : function_(function) {}
+
+  /**
+   * Runs the function on a thread of the pool.
+   */
+  void run() override { function_(); }
+
+ private:
+  std::function<void()> function_; /**< Function to be run */
+};
+
+/**
+ * Computes the mipmap levels of a texture, down to 1x1.
+ *
+ * @param format: pixel format of the levels.
+ * @param width: width in pixels of level 0.
+ * @param height: height in pixels of level 0.
+ * @param mipmaps: True for every level, false for level 0 only.
+ *
+ * @return The levels, with their offsets in a single buffer.
+ */
+std::vector<TextureLevel> textureLevels(const TextureFormat format, const int width, const int height,
+                                        const bool mipmaps) {
+  std::vector<TextureLevel> levels;
+  size_t offset = 0;
+  for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+    TextureLevel level;
+    level.width = w;
+    level.height = h;
+    level.offset = offset;
+    if (format == TextureFormat::kRgba8) {
+      level.size = static_cast<size_t>(w) * h * 4;
+    } else {
+      BlockFormat block_format = (format == TextureFormat::kBc1) ? BlockFormat::kBc1 : BlockFormat::kBc3;
+      level.size = BlockCompressor::compressedSize(block_format, w, h);
+    }
+    offset += level.size;
+    levels.push_back(level);
+
+    if (!mipmaps || (w == 1 && h == 1)) {
+      break;
+    }
+  }
+  return levels;
+}
+
+/**
+ * Halves an RGBA8 image with a box filter. Odd rows and columns are folded into the last output pixel.
+ *
+ * @param source: pixels of the image.
+ * @param width: width of the image.
+ * @param height: height of the image.
+ * @param target: receives max(1, width / 2) x max(1, height / 2) pixels.
+ */
+void downsample(const unsigned char* source, const int width, const int height, unsigned char* target) {
+  const int target_width = std::max(1, width / 2);
+  const int target_height = std::max(1, height / 2);
+  for (int y = 0; y < target_height; y++) {
+    const int y0 = std::min(y * 2, height - 1);
+    const int y1 = std::min(y * 2 + 1, height - 1);
+    for (int x = 0; x < target_width; x++) {
+      const int x0 = std::min(x * 2, width - 1);
+      const int x1 = std::min(x * 2 + 1, width - 1);
+      for (int c = 0; c < 4; c++) {
+        int sum = source[(static_cast<size_t>(y0) * width + x0) * 4 + c] +
+                  source[(static_cast<size_t>(y0) * width + x1) * 4 + c] +
+                  source[(static_cast<size_t>(y1) * width + x0) * 4 + c] +
+                  source[(static_cast<size_t>(y1) * width + x1) * 4 + c];
+        target[(static_cast<size_t>(y) * target_width + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+/**
+ * Reads a compressed texture from the disk cache. Stale or corrupt entries are removed.
+ *
+ * @param path: path to the image file.
+ *
+ * @return The cached texture, or NULL if no valid entry was found.
+ */
+std::shared_ptr<TextureImage> readCache(const QString& path) {
+  QFileInfo source(path);
+  QString cache_filename = TextureManager::cacheFilename(path);
+  QFile file(cache_filename);
+  if (!source.exists() || !file.open(QIODevice::ReadOnly)) {
+    return NULL;
+  }
+
+  CacheHeader header;
+  std::shared_ptr<TextureImage> image = std::make_shared<TextureImage>();
+  bool valid = file.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) &&
+               std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.version == kVersion &&
+               (header.format == static_cast<uint32_t>(TextureFormat::kBc1) ||
+                header.format == static_cast<uint32_t>(TextureFormat::kBc3)) &&
+               header.width > 0 && header.height > 0 && header.source_size == static_cast<uint64_t>(source.size()) &&
+               header.source_mtime == source.lastModified().toMSecsSinceEpoch() &&
+               sizeof(header) + header.data_size == static_cast<uint64_t>(file.size());
+  if (valid) {
+    image->format = static_cast<TextureFormat>(header.format);
+    image->levels = textureLevels(image->format, header.width, header.height, true);
+    valid = image->levels.back().offset + image->levels.back().size == header.data_size;
+  }
+  if (valid) {
+    image->data.resize(header.data_size);
+    valid = file.read(reinterpret_cast<char*>(image->data.data()), header.data_size) ==
+            static_cast<qint64>(header.data_size);
+  }
+  file.close();
+
+  if (!valid) {
+    qDebug() << "Removing stale texture cache" << cache_filename;
+    QFile::remove(cache_filename);
+    return NULL;
+  }
+  return image;
+}
+
+/**
+ * Writes a compressed texture to the disk cache, replacing any previous entry.
+ *
+ * @param path: path to the image file.
+ * @param image: compressed texture.
+ */
+void writeCache(const QString& path, const TextureImage& image) {
+  QFileInfo source(path);
+  QString cache_filename = TextureManager::cacheFilename(path);
+  if (!QDir().mkpath(QFileInfo(cache_filename).absolutePath())) {
+    return;
+  }
+
+  CacheHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.format = static_cast<uint32_t>(image.format);
+  header.width = image.levels.front().width;
+  header.height = image.levels.front().height;
+  header.source_size = source.size();
+  header.source_mtime = source.lastModified().toMSecsSinceEpoch();
+  header.data_size = image.data.size();
+
+  // The entry is written to a temporary file and renamed, so readers never see a partial entry
+  QSaveFile file(cache_filename);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return;
+  }
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(image.data.data()), image.data.size());
+  if (!file.commit()) {
+    qWarning() << "Could not write texture cache" << cache_filename;
+  }
+}
+
+}  // namespace
+
+TextureManager::TextureManager() : memory_budget_(kDefaultMemoryBudget) {}
+
+TextureManager::~TextureManager() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation_++;
+    ready_callback_ = ReadyCallback();
+  }
+  thread_pool_.clear();
+  thread_pool_.waitForDone();
+}
+
+void TextureManager::setMemoryBudget(const size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  memory_budget_ = bytes;
+  evict();
+}
+
+size_t TextureManager::memoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+void TextureManager::setCompression(const bool compression) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (compression_ != compression) {
+    compression_ = compression;
+    cache_.clear();
+    lru_.clear();
+    memory_usage_ = 0;
+  }
+}
+
+bool TextureManager::compression() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return compression_;
+}
+
+void TextureManager::setReadyCallback(const ReadyCallback& callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ready_callback_ = callback;
+}
+
+void TextureManager::request(const QString& path) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto cached = cache_.find(path);
+  if (cached != cache_.end()) {
+    lru_.splice(lru_.begin(), lru_, cached->second.lru);
+    ready_.emplace_back(path, cached->second.image);
+    return;
+  }
+
+  if (!requested_.insert(path).second) {
+    return;
+  }
+
+  const uint64_t generation = generation_;
+  const bool compression = compression_;
+  lock.unlock();
+
+  thread_pool_.start(new Task([this, path, generation, compression]() {
+    std::shared_ptr<const TextureImage> image = decode(path, compression);
+
+    ReadyCallback callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (image && compression == compression_) {
+        insert(path, image);
+      }
+      if (generation == generation_) {
+        requested_.erase(path);
+        ready_.emplace_back(path, image);
+        callback = ready_callback_;
+      }
+    }
+
+    if (callback) {
+      callback();
+    }
+  }));
+}
+
+std::vector<TextureManager::Result> TextureManager::takeReady(const size_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  size_t count = 0;
+  size_t bytes = 0;
+  while (count < ready_.size() && (count == 0 || bytes < max_bytes)) {
+    bytes += ready_[count].second ? ready_[count].second->data.size() : 0;
+    count++;
+  }
+
+  std::vector<Result> results(std::make_move_iterator(ready_.begin()), std::make_move_iterator(ready_.begin() + count));
+  ready_.erase(ready_.begin(), ready_.begin() + count);
+  return results;
+}
+
+bool TextureManager::hasReady() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !ready_.empty();
+}
+
+std::shared_ptr<const TextureImage> TextureManager::load(const QString& path) {
+  bool compression;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto cached = cache_.find(path);
+    if (cached != cache_.end()) {
+      lru_.splice(lru_.begin(), lru_, cached->second.lru);
+      return cached->second.image;
+    }
+    compression = compression_;
+  }
+
+  std::shared_ptr<const TextureImage> image = decode(path, compression);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (image && compression == compression_) {
+    insert(path, image);
+  }
+  return image;
+}
+
+void TextureManager::cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation_++;
+  requested_.clear();
+  ready_.clear();
+  thread_pool_.clear();
+}
+
+QString TextureManager::cacheFilename(const QString& path) {
+  QString key = QFileInfo(path).absoluteFilePath();
+  QString hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/textures/" + hash + ".tex";
+}
+
+std::shared_ptr<const TextureImage> TextureManager::decode(const QString& path, const bool compression) {
+  if (compression) {
+    if (std::shared_ptr<TextureImage> cached = readCache(path)) {
+      return cached;
+    }
+  }
+
+  QImageReader reader(path);
+  QImage image = reader.read();
+  if (image.isNull()) {
+    qWarning() << "Could not decode texture" << path << reader.errorString();
+    return NULL;
+  }
+
+  // Rows of RGBA8888 images are never padded, and the conversion is skipped when the image is already RGBA
+  bool has_alpha = image.hasAlphaChannel();
+  image = image.convertToFormat(QImage::Format_RGBA8888);
+
+  std::shared_ptr<TextureImage> texture = std::make_shared<TextureImage>();
+  if (!compression) {
+    texture->format = TextureFormat::kRgba8;
+    texture->levels = textureLevels(texture->format, image.width(), image.height(), false);
+    texture->data.assign(image.constBits(), image.constBits() + texture->levels.front().size);
+    return texture;
+  }
+
+  // Compressed textures cannot be mipmapped on the GPU, so each level is downsampled from the previous one here
+  texture->format = has_alpha ? TextureFormat::kBc3 : TextureFormat::kBc1;
+  texture->levels = textureLevels(texture->format, image.width(), image.height(), true);
+  texture->data.resize(texture->levels.back().offset + texture->levels.back().size);
+
+  const BlockFormat block_format = has_alpha ? BlockFormat::kBc3 : BlockFormat::kBc1;
+  const size_t image_size = static_cast<size_t>(image.width()) * image.height() * 4;
+  std::vector<unsigned char> pixels(image.constBits(), image.constBits() + image_size);
+  std::vector<unsigned char> next_pixels;
+  for (size_t i = 0; i < texture->levels.size(); i++) {
+    const TextureLevel& level = texture->levels[i];
+    if (i > 0) {
+      const TextureLevel& previous = texture->levels[i - 1];
+      next_pixels.resize(static_cast<size_t>(level.width) * level.height * 4);
+      downsample(pixels.data(), previous.width, previous.height, next_pixels.data());
+      pixels.swap(next_pixels);
+    }
+    BlockCompressor::compress(block_format, pixels.data(), level.width, level.height, &texture->data[level.offset]);
+  }
+
+  writeCache(path, *texture);
+  return texture;
+}
+
+void TextureManager::insert(const QString& path, const std::shared_ptr<const TextureImage>& image) {
+  auto cached = cache_.find(path);
+  if (cached != cache_.end()) {
+    memory_usage_ -= cached->second.image->data.size();
+    lru_.erase(cached->second.lru);
+    cache_.erase(cached);
+  }
+
+  lru_.push_front(path);
+  cache_[path] = CacheEntry{image, lru_.begin()};
+  memory_usage_ += image->data.size();
+  evict();
+}
+
+void TextureManager::evict() {
+  while (memory_usage_ > memory_budget_ && lru_.size() > 1) {
+    auto evicted = cache_.find(lru_.back());
+    memory_usage_ -= evicted->second.image->data.size();
+    cache_.erase(evicted);
+    lru_.pop_back();
+  }
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef TEXTURE_MANAGER_H_
+#define TEXTURE_MANAGER_H_
+
+#include <QString>
+#include <QThreadPool>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Pixel formats of decoded textures.
+ */
+enum class TextureFormat {
+  kRgba8, /**< 4 bytes per pixel, mipmaps are generated on the GPU */
+  kBc1,   /**< S3TC DXT1 blocks, with every mipmap */
+  kBc3    /**< S3TC DXT5 blocks, with every mipmap */
+};
+
+/**
+ * @brief Mipmap level of a decoded texture.
+ */
+struct TextureLevel {
+  int width = 0;     /**< Width in pixels */
+  int height = 0;    /**< Height in pixels */
+  size_t offset = 0; /**< Offset in bytes of the level in TextureImage::data */
+  size_t size = 0;   /**< Size in bytes of the level */
+};
+
+/**
+ * @brief Texture decoded for upload. Rows are stored top row first, as in the image file; the shaders flip the v
+ * texture coordinate instead of the images being flipped.
+ */
+struct TextureImage {
+  TextureFormat format = TextureFormat::kRgba8; /**< Pixel format of every level */
+  std::vector<TextureLevel> levels;             /**< Mipmap levels, level 0 has the size of the image */
+  std::vector<unsigned char> data;              /**< Pixels or blocks of all levels */
+};
+
+/**
+ * @brief Decodes texture files on a thread pool and keeps the decoded textures in memory, evicting the least recently
+ * used ones once their size exceeds a budget. When compression is enabled, textures are mipmapped and compressed to
+ * S3TC on the CPU, and the result is stored in a disk cache (validated against the size and modification time of the
+ * image file), so later loads read the blocks directly. All methods are thread safe.
+ */
+class TextureManager {
+ public:
+  /**
+   * Callback called from a decoding thread when a requested texture is ready.
+   */
+  using ReadyCallback = std::function<void()>;
+
+  /**
+   * Decoded texture (NULL if the file could not be decoded) and the path of its image file.
+   */
+  using Result = std::pair<QString, std::shared_ptr<const TextureImage>>;
+
+  /**
+   * Class constructor.
+   */
+  TextureManager();
+
+  /**
+   * Destructor of the class. Waits for the textures being decoded.
+   */
+  ~TextureManager();
+
+  /**
+   * Sets the size of the decoded textures kept in memory. The most recently used texture is kept even if it is larger.
+   *
+   * @param bytes: memory budget, in bytes.
+   */
+  void setMemoryBudget(const size_t bytes);
+
+  /**
+   * Gets the size of the decoded textures kept in memory.
+   *
+   * @return Size in bytes of the cached textures.
+   */
+  size_t memoryUsage() const;
+
+  /**
+   * Enables S3TC compression of the decoded textures and the disk cache. Textures already in memory are discarded.
+   *
+   * @param compression: True to compress textures.
+   */
+  void setCompression(const bool compression);
+
+  /**
+   * Gets whether textures are compressed.
+   *
+   * @return True if textures are compressed.
+   */
+  bool compression() const;
+
+  /**
+   * Sets the callback called when a requested texture is ready.
+   *
+   * @param callback: function called from the decoding thread.
+   */
+  void setReadyCallback(const ReadyCallback &callback);
+
+  /**
+   * Requests a texture. Textures in memory are ready at once, others are decoded on the thread pool; takeReady returns
+   * the texture once it is ready. A texture already requested is not decoded twice.
+   *
+   * @param path: path to the image file.
+   */
+  void request(const QString &path);
+
+  /**
+   * Takes the requested textures that are ready, in the order they became ready.
+   *
+   * @param max_bytes: size in bytes after which no more textures are taken. At least one texture is taken.
+   *
+   * @return The ready textures.
+   */
+  std::vector<Result> takeReady(const size_t max_bytes);
+
+  /**
+   * Gets whether requested textures are ready to be taken.
+   *
+   * @return True if takeReady would return textures.
+   */
+  bool hasReady() const;
+
+  /**
+   * Loads a texture on the calling thread, from memory, the disk cache or the image file.
+   *
+   * @param path: path to the image file.
+   *
+   * @return The decoded texture, or NULL if the file could not be decoded.
+   */
+  std::shared_ptr<const TextureImage> load(const QString &path);
+
+  /**
+   * Drops the requested textures that are not ready or not taken yet. Textures being decoded are still kept in memory.
+   */
+  void cancel();
+
+  /**
+   * Gets the disk cache file of an image file.
+   *
+   * @param path: path to the image file.
+   *
+   * @return Path to the cache file, inside the application cache directory.
+   */
+  static QString cacheFilename(const QString &path);
+
+ private:
+  /**
+   * Decodes an image file, or reads it from the disk cache when compression is enabled. Compressed textures that were
+   * decoded are written to the disk cache.
+   *
+   * @param path: path to the image file.
+   * @param compression: True to compress the texture.
+   *
+   * @return The decoded texture, or NULL if the file could not be decoded.
+   */
+  static std::shared_ptr<const TextureImage> decode(const QString &path, const bool compression);
+
+  /**
+   * Adds a decoded texture to the memory cache and evicts the least recently used textures over the budget. Requires
+   * mutex_ to be locked.
+   *
+   * @param path: path to the image file.
+   * @param image: decoded texture.
+   */
+  void insert(const QString &path, const std::shared_ptr<const TextureImage> &image);
+
+  /**
+   * Evicts the least recently used textures until the memory cache fits the budget. Requires mutex_ to be locked.
+   */
+  void evict();
+
+  /**
+   * @brief Texture kept in memory.
+   */
+  struct CacheEntry {
+    std::shared_ptr<const TextureImage> image; /**< Decoded texture */
+    std::list<QString>::iterator lru;          /**< Position of the texture in lru_ */
+  };
+
+  mutable std::mutex mutex_; /**< Guards every member below */
+
+  std::map<QString, CacheEntry> cache_; /**< Textures kept in memory, by path */
+  std::list<QString> lru_;              /**< Paths of the cached textures, most recently used first */
+  size_t memory_usage_ = 0;             /**< Size in bytes of the cached textures */
+  size_t memory_budget_;                /**< Size in bytes of the textures that may be kept in memory */
+
+  std::set<QString> requested_; /**< Requested textures being decoded */
+  std::vector<Result> ready_;   /**< Requested textures ready to be taken */
+  uint64_t generation_ = 0;     /**< Incremented by cancel, so textures requested before are not made ready */
+
+  bool compression_ = false;     /**< Compress textures and use the disk cache */
+  ReadyCallback ready_callback_; /**< Called when a requested texture is ready */
+
+  QThreadPool thread_pool_; /**< Decodes the requested textures */
+};
+
+#endif  // TEXTURE_MANAGER_H_
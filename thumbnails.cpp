@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImage>
+#include <QMap>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QPainter>
+#include <QRunnable>
+#include <QSet>
+#include <QSurfaceFormat>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "scene_loader.h"
+#include "scene_renderer.h"
+
+namespace {
+
+/** Rotation of every view around the horizontal axis, in degrees, so the top of the mesh is visible */
+const float kTilt = 20.0f;
+
+/** Rotation of the first view around the vertical axis, in degrees */
+const float kFirstYaw = 30.0f;
+
+/**
+ * @brief How every mesh is rendered.
+ */
+struct ThumbnailSettings {
+  QSize size;               /**< Size of each view */
+  int views = 1;            /**< Number of views around the vertical axis, side by side in the image */
+  float camera_zoom = 1.0f; /**< Multiplier of the camera distance, below 1 to zoom into the scene */
+};
+
+/**
+ * @brief Mesh file going through the pipeline: loaded on a worker thread, rendered on the OpenGL thread and encoded on
+ * another worker thread.
+ */
+struct ThumbnailJob {
+  QString filename;                 /**< Path to the mesh file */
+  QString output;                   /**< Path to the PNG file */
+  std::shared_ptr<SceneData> scene; /**< Loaded scene, NULL if the load failed */
+  double load_ms = 0.0;             /**< Time spent loading the scene and decoding its textures */
+};
+
+/**
+ * @brief Time spent in each stage of the pipeline, summed over every mesh.
+ */
+struct StageTimes {
+  double load_ms = 0.0;   /**< Loading scenes and decoding textures, on the loading threads */
+  double render_ms = 0.0; /**< Uploading, drawing and reading back the views, on the OpenGL thread */
+  double encode_ms = 0.0; /**< Composing the views and writing the PNG files, on the encoding threads */
+};
+
+/**
+ * @brief Runs a function on a QThreadPool.
+ */
+class Task : public QRunnable {
+ public:
+  /**
+   * Class constructor.
+   *
+   * @param function: function to be run.
+   */
+  explicit Task(const std::function<void()>& function) : function_(function) {}
+
+  /**
+   * Runs the function on a thread of the pool.
+   */
+  void run() override { function_(); }
+
+ private:
+  std::function<void()> function_; /**< Function to be run */
+};
+
+/**
+ * Expands the inputs into mesh files: directories are searched recursively, and names with wildcards are matched
+ * against the files of their directory, so lists too long for the command line can be given as a pattern.
+ *
+ * @param inputs: mesh files, directories or wildcard patterns.
+ *
+ * @return Mesh files, each listed once, in the order of the inputs.
+ */
+QStringList expandInputs(const QStringList& inputs) {
+  QStringList files;
+  for (const QString& input : inputs) {
+    QFileInfo info(input);
+    if (info.isDir()) {
+      QStringList found;
+      QDirIterator iterator(input, {"*.obj"}, QDir::Files, QDirIterator::Subdirectories);
+      while (iterator.hasNext()) {
+        found << iterator.next();
+      }
+      found.sort();
+      files << found;
+    } else if (input.contains('*') || input.contains('?') || input.contains('[')) {
+      for (const QFileInfo& match : QDir(info.path()).entryInfoList({info.fileName()}, QDir::Files, QDir::Name)) {
+        files << match.filePath();
+      }
+    } else {
+      files << input;
+    }
+  }
+
+  QStringList meshes;
+  QSet<QString> seen;
+  for (const QString& file : files) {
+    QString path = QFileInfo(file).absoluteFilePath();
+    if (!SceneLoader::isValidMeshFile(file)) {
+      qWarning() << file << "is not a valid mesh file.";
+    } else if (!seen.contains(path)) {
+      seen.insert(path);
+      meshes << file;
+    }
+  }
+  return meshes;
+}
+
+/**
+ * Loads a scene and decodes its textures into the memory cache of the texture manager, so the OpenGL thread only
+ * uploads them. Texture paths are relative to the mesh file, as in SceneResources.
+ *
+ * @param options: options used to build the geometry.
+ * @param texture_manager: texture manager of the renderer.
+ * @param job: job whose file is loaded, receives the scene and the load time.
+ */
+void loadScene(const SceneLoadOptions& options, TextureManager* texture_manager, ThumbnailJob* job) {
+  QElapsedTimer timer;
+  timer.start();
+
+  std::shared_ptr<SceneData> scene = std::make_shared<SceneData>();
+  SceneLoader loader(options);
+  if (loader.load(job->filename, scene.get())) {
+    QSet<QString> decoded;
+    for (const Material& material : scene->materials) {
+      QString path = QFileInfo(scene->filename).absolutePath() + QString(QDir::separator()) + material.texture_filename;
+      if (!material.texture_filename.isEmpty() && !decoded.contains(path)) {
+        decoded.insert(path);
+        texture_manager->load(path);
+      }
+    }
+    job->scene = scene;
+  }
+
+  job->load_ms = timer.nsecsElapsed() / 1e6;
+}
+
+/**
+ * Renders the views of a scene around the vertical axis into the bound framebuffer, and reads each of them back.
+ *
+ * @param renderer: renderer of the scene.
+ * @param framebuffer: bound framebuffer, of the size of a view.
+ * @param settings: how the scene is rendered.
+ *
+ * @return The views, from the first one.
+ */
+std::vector<QImage> renderViews(SceneRenderer* renderer, QOpenGLFramebufferObject* framebuffer,
+                                const ThumbnailSettings& settings) {
+  std::vector<QImage> views;
+  for (int i = 0; i < settings.views; i++) {
+    // Reading back a multisampled framebuffer goes through a temporary one, so this one is bound again
+    framebuffer->bind();
+    QMatrix4x4 rotation;
+    rotation.rotate(kTilt, 1.0, 0.0, 0.0);
+    rotation.rotate(kFirstYaw + 360.0f * i / settings.views, 0.0, 1.0, 0.0);
+    renderer->render(settings.size.width(), settings.size.height(), rotation, settings.camera_zoom);
+    views.push_back(framebuffer->toImage());
+  }
+  return views;
+}
+
+/**
+ * Places the views side by side and writes them as a PNG file.
+ *
+ * @param views: views of a scene, all of the same size.
+ * @param filename: path to the PNG file.
+ *
+ * @return True if the file was written successfully.
+ */
+bool writeImage(const std::vector<QImage>& views, const QString& filename) {
+  if (views.size() == 1) {
+    return views.front().save(filename, "PNG");
+  }
+
+  QImage image(views.front().width() * static_cast<int>(views.size()), views.front().height(),
+               QImage::Format_ARGB32_Premultiplied);
+  image.fill(Qt::transparent);
+  QPainter painter(&image);
+  painter.setCompositionMode(QPainter::CompositionMode_Source);
+  for (size_t i = 0; i < views.size(); i++) {
+    painter.drawImage(views.front().width() * static_cast<int>(i), 0, views[i]);
+  }
+  painter.end();
+  return image.save(filename, "PNG");
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // Same context as the viewer: uniform blocks and GLSL 3.30 shaders require OpenGL 3.3
+  QSurfaceFormat format;
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CoreProfile);
+  format.setDepthBufferSize(24);
+  QSurfaceFormat::setDefaultFormat(format);
+
+  QGuiApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Renders mesh files offscreen into PNG thumbnails or turntables.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("inputs", "Mesh files, directories or wildcard patterns (\"assets/*.obj\").",
+                               "[inputs...]");
+
+  QCommandLineOption list_option("list", "Text file with one mesh file per line.", "file");
+  QCommandLineOption output_option("output", "Directory of the PNG files.", "directory", "thumbnails");
+  QCommandLineOption size_option("size", "Size of each view.", "WxH", "256x256");
+  QCommandLineOption views_option("turntable", "Render <views> views around the mesh, side by side in its image.",
+                                  "views", "1");
+  QCommandLineOption samples_option("samples", "Multisampling samples per pixel.", "samples", "4");
+  QCommandLineOption zoom_option("zoom", "Multiplier of the camera distance, below 1 to zoom in.", "factor", "1");
+  QCommandLineOption background_option("background", "Background color (e.g. white, #202020 or transparent).",
+                                       "color");
+  QCommandLineOption jobs_option("jobs", "Meshes loaded in parallel (the number of cores by default).", "count");
+  QCommandLineOption no_cache_option("no-cache", "Do not load or store meshes in the mesh cache.");
+  parser.addOptions({list_option, output_option, size_option, views_option, samples_option, zoom_option,
+                     background_option, jobs_option, no_cache_option});
+  parser.process(app);
+
+  ThumbnailSettings settings;
+  QStringList size_values = parser.value(size_option).toLower().split('x');
+  settings.size = size_values.size() == 2 ? QSize(size_values[0].toInt(), size_values[1].toInt()) : QSize();
+  if (settings.size.isEmpty()) {
+    qCritical() << "Invalid image size:" << parser.value(size_option);
+    return 1;
+  }
+
+  bool valid_views = true;
+  settings.views = parser.value(views_option).toInt(&valid_views);
+  if (!valid_views || settings.views < 1) {
+    qCritical() << "Invalid number of views:" << parser.value(views_option);
+    return 1;
+  }
+
+  bool valid_samples = true;
+  int samples = parser.value(samples_option).toInt(&valid_samples);
+  if (!valid_samples || samples < 0) {
+    qCritical() << "Invalid number of samples:" << parser.value(samples_option);
+    return 1;
+  }
+
+  bool valid_zoom = true;
+  settings.camera_zoom = parser.value(zoom_option).toFloat(&valid_zoom);
+  if (!valid_zoom || settings.camera_zoom <= 0.0f) {
+    qCritical() << "Invalid camera zoom:" << parser.value(zoom_option);
+    return 1;
+  }
+
+  QColor background(parser.value(background_option));
+  if (parser.isSet(background_option) && !background.isValid()) {
+    qCritical() << "Invalid background color:" << parser.value(background_option);
+    return 1;
+  }
+
+  bool valid_jobs = true;
+  int jobs = parser.isSet(jobs_option) ? parser.value(jobs_option).toInt(&valid_jobs) : QThread::idealThreadCount();
+  if (!valid_jobs || jobs < 1) {
+    qCritical() << "Invalid number of jobs:" << parser.value(jobs_option);
+    return 1;
+  }
+
+  QStringList inputs = parser.positionalArguments();
+  if (parser.isSet(list_option)) {
+    QFile list(parser.value(list_option));
+    if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+      qCritical() << "Could not read the list" << parser.value(list_option);
+      return 1;
+    }
+    QTextStream stream(&list);
+    while (!stream.atEnd()) {
+      QString line = stream.readLine().trimmed();
+      if (!line.isEmpty()) {
+        inputs << line;
+      }
+    }
+  }
+
+  QStringList files = expandInputs(inputs);
+  if (files.isEmpty()) {
+    parser.showHelp(1);
+  }
+
+  QDir output_dir(parser.value(output_option));
+  if (!output_dir.mkpath(".")) {
+    qCritical() << "Could not create the output directory" << output_dir.path();
+    return 1;
+  }
+
+  // Images are named after their mesh files, meshes with the same name get a numbered suffix
+  std::vector<ThumbnailJob> thumbnail_jobs(files.size());
+  QMap<QString, int> name_counts;
+  for (int i = 0; i < files.size(); i++) {
+    QString name = QFileInfo(files[i]).completeBaseName();
+    int count = ++name_counts[name];
+    thumbnail_jobs[i].filename = files[i];
+    thumbnail_jobs[i].output =
+        output_dir.filePath((count > 1) ? QString("%1_%2.png").arg(name).arg(count) : name + ".png");
+  }
+
+  // A few frames do not repay optimizing the meshes or simplifying their levels of detail. The cores are shared by the
+  // parallel loads, so the steps of each load do not start a thread per core from every job
+  SceneLoadOptions options;
+  options.use_mesh_cache = !parser.isSet(no_cache_option);
+  options.generate_lods = false;
+  options.optimize_meshes = false;
+  options.max_threads = static_cast<size_t>(qMax(1, QThread::idealThreadCount() / jobs));
+
+  QOffscreenSurface surface;
+  surface.setFormat(format);
+  surface.create();
+
+  QOpenGLContext context;
+  context.setFormat(format);
+  if (!context.create() || !context.makeCurrent(&surface)) {
+    qCritical() << "Could not create an OpenGL context.";
+    return 1;
+  }
+
+  QOpenGLFramebufferObjectFormat framebuffer_format;
+  framebuffer_format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+  framebuffer_format.setSamples(samples);
+  QOpenGLFramebufferObject framebuffer(settings.size, framebuffer_format);
+  framebuffer.bind();
+  context.functions()->glViewport(0, 0, settings.size.width(), settings.size.height());
+
+  // A single renderer draws every scene, so the shaders are compiled once and the buffers of each scene replace the
+  // buffers of the previous one. Textures are decoded by the loading threads and uploaded by the first frame
+  SceneRenderer renderer;
+  if (!renderer.initialize()) {
+    qCritical() << "Could not initialize the renderer.";
+    return 1;
+  }
+  renderer.setAsyncTextures(false);
+  if (background.isValid()) {
+    renderer.setClearColor(background);
+  }
+
+  // Loads run ahead of the OpenGL thread on their own pool, bounded so loaded scenes do not pile up in memory, and the
+  // images are written on another pool while the next scenes are rendered
+  QThreadPool load_pool;
+  load_pool.setMaxThreadCount(jobs);
+  QThreadPool encode_pool;
+  encode_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 4));
+  const size_t max_loaded = static_cast<size_t>(jobs) + 2;
+  const size_t max_encoding = static_cast<size_t>(encode_pool.maxThreadCount()) * 2;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<size_t> loaded;
+  size_t encoding = 0;
+  size_t written = 0;
+  size_t rendered_meshes = 0;
+  StageTimes times;
+
+  QElapsedTimer total_timer;
+  total_timer.start();
+
+  size_t next_load = 0;
+  for (size_t rendered = 0; rendered < thumbnail_jobs.size(); rendered++) {
+    for (; next_load < thumbnail_jobs.size() && next_load < rendered + max_loaded; next_load++) {
+      load_pool.start(new Task([&, next_load]() {
+        loadScene(options, &renderer.textureManager(), &thumbnail_jobs[next_load]);
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded.push_back(next_load);
+        condition.notify_all();
+      }));
+    }
+
+    size_t index;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&loaded]() { return !loaded.empty(); });
+      index = loaded.front();
+      loaded.pop_front();
+    }
+
+    ThumbnailJob& job = thumbnail_jobs[index];
+    times.load_ms += job.load_ms;
+    if (!job.scene) {
+      qWarning() << "Could not load" << job.filename;
+      continue;
+    }
+
+    QElapsedTimer render_timer;
+    render_timer.start();
+    renderer.setScene(job.scene);
+    job.scene.reset();
+    std::vector<QImage> views = renderViews(&renderer, &framebuffer, settings);
+    times.render_ms += render_timer.nsecsElapsed() / 1e6;
+    rendered_meshes++;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&]() { return encoding < max_encoding; });
+      encoding++;
+    }
+    encode_pool.start(new Task([&, index, views]() {
+      QElapsedTimer encode_timer;
+      encode_timer.start();
+      bool success = writeImage(views, thumbnail_jobs[index].output);
+      if (!success) {
+        qWarning() << "Could not write" << thumbnail_jobs[index].output;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      times.encode_ms += encode_timer.nsecsElapsed() / 1e6;
+      written += success ? 1 : 0;
+      encoding--;
+      condition.notify_all();
+    }));
+  }
+
+  encode_pool.waitForDone();
+  load_pool.waitForDone();
+  const double total_s = total_timer.nsecsElapsed() / 1e9;
+
+  renderer.destroy();
+  framebuffer.release();
+  context.doneCurrent();
+
+  QTextStream(stdout) << QString("%1 of %2 meshes in %3 s: %4 meshes/s (%5 per hour)\n")
+                             .arg(written)
+                             .arg(thumbnail_jobs.size())
+                             .arg(total_s, 0, 'f', 2)
+                             .arg(written / qMax(total_s, 1e-9), 0, 'f', 2)
+                             .arg(qRound(written * 3600.0 / qMax(total_s, 1e-9)))
+                      << QString("  load %1 ms, render %2 ms, encode %3 ms per mesh\n")
+                             .arg(times.load_ms / thumbnail_jobs.size(), 0, 'f', 2)
+                             .arg(times.render_ms / qMax<size_t>(rendered_meshes, 1), 0, 'f', 2)
+                             .arg(times.encode_ms / qMax<size_t>(rendered_meshes, 1), 0, 'f', 2);
+
+  return (written == thumbnail_jobs.size()) ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2021, Eberty Alves
+ */
+
+#ifndef VERTEX_FORMAT_H_
+#define VERTEX_FORMAT_H_
+
+#include <qopengl.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define VERTEX_FORMAT_SSE 1
+#endif
+
+/**
+ * @brief Description of a single vertex attribute inside an interleaved vertex, as expected by glVertexAttribPointer.
+ */
+struct VertexAttribute {
+  const char *name;     /**< Name of the attribute in the vertex shader */
+  GLint size;           /**< Number of components */
+  GLenum type;          /**< Data type of each component */
+  GLboolean normalized; /**< True if integer data is mapped to [-1, 1] or [0, 1] */
+  size_t offset;        /**< Offset in bytes from the start of the vertex */
+};
+
+/**
+ * @brief Interleaved vertex with float positions, 10_10_10_2 packed normals and half-float UVs (20 bytes).
+ */
+struct PackedVertex {
+  float position[3];          /**< Position (x, y, z) */
+  uint32_t normal;            /**< Normal packed as GL_INT_2_10_10_10_REV */
+  uint16_t texture_coords[2]; /**< Texture coordinates as half floats */
+};
+
+/**
+ * @brief Interleaved vertex with 16-bit positions quantized against the scene bounding box, 10_10_10_2 packed normals
+ * and half-float UVs (16 bytes).
+ */
+struct QuantizedVertex {
+  int16_t position[4];        /**< Normalized position (x, y, z) in the bounding box, w is padding */
+  uint32_t normal;            /**< Normal packed as GL_INT_2_10_10_10_REV */
+  uint16_t texture_coords[2]; /**< Texture coordinates as half floats */
+};
+
+/**
+ * @brief Point of a point cloud, with a 16-bit position quantized against the cube of its octree node and an RGBA8
+ * color (12 bytes).
+ */
+struct PointVertex {
+  int16_t position[4]; /**< Normalized position (x, y, z) in the cube of the node, w is padding */
+  uint8_t color[4];    /**< Color (r, g, b, a) */
+};
+
+/**
+ * @brief Compile-time attribute layout of a vertex type. Each specialization lists the attributes of the vertex in the
+ * same order used by the vertex shader.
+ */
+template <typename Vertex>
+struct VertexLayout;
+
+template <>
+struct VertexLayout<PackedVertex> {
+  static constexpr std::array<VertexAttribute, 3> attributes = {{
+      {"aPosition", 3, GL_FLOAT, GL_FALSE, offsetof(PackedVertex, position)},
+      {"aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertex, normal)},
+      {"aCoords", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texture_coords)},
+  }};
+};
+
+template <>
+struct VertexLayout<QuantizedVertex> {
+  static constexpr std::array<VertexAttribute, 3> attributes = {{
+      {"aPosition", 4, GL_SHORT, GL_TRUE, offsetof(QuantizedVertex, position)},
+      {"aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(QuantizedVertex, normal)},
+      {"aCoords", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(QuantizedVertex, texture_coords)},
+  }};
+};
+
+template <>
+struct VertexLayout<PointVertex> {
+  static constexpr std::array<VertexAttribute, 2> attributes = {{
+      {"aPosition", 4, GL_SHORT, GL_TRUE, offsetof(PointVertex, position)},
+      {"aColor", 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(PointVertex, color)},
+  }};
+};
+
+/**
+ * @brief Type-erased view of a VertexLayout, so the vertex format can be selected at runtime.
+ */
+struct VertexLayoutInfo {
+  size_t stride;                     /**< Size in bytes of a vertex */
+  const VertexAttribute *attributes; /**< Attributes of the vertex */
+  size_t attribute_count;            /**< Number of attributes */
+  bool quantized;                    /**< True if positions must be dequantized with the bounding box */
+};
+
+/**
+ * Gets the runtime description of a vertex type.
+ *
+ * @return Stride and attributes of the vertex type.
+ */
+template <typename Vertex>
+constexpr VertexLayoutInfo vertexLayoutInfo() {
+  return {sizeof(Vertex), VertexLayout<Vertex>::attributes.data(), VertexLayout<Vertex>::attributes.size(),
+          std::is_same<Vertex, QuantizedVertex>::value};
+}
+
+/**
+ * Converts a float to an IEEE 754 half float, rounding to nearest.
+ *
+ * @param value: float value to be converted.
+ *
+ * @return Bits of the half float.
+ */
+inline uint16_t toHalfFloat(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t mantissa = bits & 0x7FFFFF;
+  int32_t float_exponent = (bits >> 23) & 0xFF;
+  int32_t exponent = float_exponent - 127 + 15;
+
+  if (float_exponent == 0xFF) {
+    return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+  }
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7C00);
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    mantissa |= 0x800000;
+    uint32_t shift = 14 - exponent;
+    uint32_t half = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1);
+    return static_cast<uint16_t>(sign | half);
+  }
+
+  // A rounding carry out of the mantissa correctly increments the exponent
+  uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+  return static_cast<uint16_t>(half + ((mantissa >> 12) & 1));
+}
+
+/**
+ * Packs a unit normal as GL_INT_2_10_10_10_REV (signed normalized 10 bits per component).
+ *
+ * @param x: x component of the normal.
+ * @param y: y component of the normal.
+ * @param z: z component of the normal.
+ *
+ * @return The packed normal.
+ */
+inline uint32_t packNormal(const float x, const float y, const float z) {
+  auto pack = [](float v) {
+    return static_cast<uint32_t>(static_cast<int32_t>(std::lround(std::max(-1.0f, std::min(1.0f, v)) * 511.0f))) &
+           0x3FF;
+  };
+  return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+}
+
+/**
+ * Quantizes a coordinate to a signed normalized 16-bit value.
+ *
+ * @param value: coordinate to be quantized.
+ * @param offset: center of the bounding box along the axis.
+ * @param scale: half extent of the bounding box along the axis.
+ *
+ * @return The quantized coordinate, so that value ~= offset + (quantized / 32767) * scale.
+ */
+inline int16_t quantizeCoordinate(const float value, const float offset, const float scale) {
+  float normalized = (scale > 0.0f) ? (value - offset) / scale : 0.0f;
+  return static_cast<int16_t>(std::lround(std::max(-1.0f, std::min(1.0f, normalized)) * 32767.0f));
+}
+
+/**
+ * Moves, scales and clamps packed positions (x, y, z, x, y, z, ...), so result = clamp((position + add) * mul, low,
+ * high) on each axis. Four positions are processed per step with SSE: they span three registers whose lanes hold
+ * (x y z x), (y z x y) and (z x y z), so the per-axis constants are rotated the same way instead of shuffling the
+ * positions.
+ *
+ * @param positions: packed positions.
+ * @param count: number of positions.
+ * @param add: value (x, y, z) added to the positions.
+ * @param mul: factor (x, y, z) of the moved positions.
+ * @param low: lowest result of each axis.
+ * @param high: highest result of each axis.
+ * @param result: packed results, which may be the positions themselves.
+ */
+inline void transformPositions(const float *positions, const size_t count, const float *add, const float *mul,
+                               const float low, const float high, float *result) {
+  size_t i = 0;
+
+#ifdef VERTEX_FORMAT_SSE
+  const __m128 add_a = _mm_setr_ps(add[0], add[1], add[2], add[0]);
+  const __m128 add_b = _mm_setr_ps(add[1], add[2], add[0], add[1]);
+  const __m128 add_c = _mm_setr_ps(add[2], add[0], add[1], add[2]);
+  const __m128 mul_a = _mm_setr_ps(mul[0], mul[1], mul[2], mul[0]);
+  const __m128 mul_b = _mm_setr_ps(mul[1], mul[2], mul[0], mul[1]);
+  const __m128 mul_c = _mm_setr_ps(mul[2], mul[0], mul[1], mul[2]);
+  const __m128 low_v = _mm_set1_ps(low);
+  const __m128 high_v = _mm_set1_ps(high);
+
+  for (; i + 4 <= count; i += 4) {
+    const float *p = positions + i * 3;
+    __m128 a = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(p), add_a), mul_a);
+    __m128 b = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(p + 4), add_b), mul_b);
+    __m128 c = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(p + 8), add_c), mul_c);
+
+    float *r = result + i * 3;
+    _mm_storeu_ps(r, _mm_min_ps(_mm_max_ps(a, low_v), high_v));
+    _mm_storeu_ps(r + 4, _mm_min_ps(_mm_max_ps(b, low_v), high_v));
+    _mm_storeu_ps(r + 8, _mm_min_ps(_mm_max_ps(c, low_v), high_v));
+  }
+#endif
+
+  for (; i < count; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      result[i * 3 + axis] = std::max(low, std::min(high, (positions[i * 3 + axis] + add[axis]) * mul[axis]));
+    }
+  }
+}
+
+#endif  // VERTEX_FORMAT_H_